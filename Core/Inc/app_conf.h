@@ -83,22 +83,38 @@
                    Flash size/8 * (number of element by page in byte)
    ZIGBEE_DB_START_ADDR: beginning of zigbee NVM
 
-   CFG_EE_AUTO_CLEAN : Clean the flash automatically when needed
+   CFG_EE_AUTO_CLEAN : Clean the flash automatically when needed, inside EE_Write.
+   Kept to 0 : cleanups are done by the NVM maintenance task (APP_ZIGBEE_NVM_Gc)
+   while no image transfer is running
+
+   CFG_PERSIST_STORE_NB_PAGES : Number of pages taken at the end of the NVM area
+   for the Zigbee persistent data, appended there as snapshot and delta records
+   and restored in a single pass (the EE emulation keeps the other pages for the
+   OTA context). Pages are used in turn, a new page starts with a snapshot.
+   The EE emulation used to span the 16 pages : a device updated from such a
+   version fails EE_Init and formats the EE pages at its first startup, losing
+   the OTA resume context (a transfer in progress restarts from offset 0) and
+   the Zigbee persistent data. There is no migration of the previous layout.
 */ 
     
-#define CFG_NB_OF_PAGE                          (16u)
+#define CFG_PERSIST_STORE_NB_PAGES              (4u)
+#define CFG_NB_OF_PAGE                          (16u - CFG_PERSIST_STORE_NB_PAGES)
 #define CFG_EE_BANK0_SIZE                       (CFG_NB_OF_PAGE * HW_FLASH_PAGE_SIZE) 
 #define CFG_NVM_BASE_ADDRESS                    ( 0x20000u )
 #define ZIGBEE_DB_START_ADDR                    (100u)
 #define USER_DB_START_ADDR                      (0u)
 
-#define CFG_EE_AUTO_CLEAN                       (1u)
+#define CFG_EE_AUTO_CLEAN                       (0u)
 
 #define CFG_EE_BANK0_MAX_NB                     (1000u)                         /* Max persistent data words */
 #define ST_PERSIST_MAX_ALLOC_SZ                 (4u * CFG_EE_BANK0_MAX_NB)      /* Max persistent data in bytes */
 #define ST_PERSIST_FLASH_DATA_OFFSET            (8u)                            /* Other Persistent Data : Len + Tag */
 #define ST_PERSIST_MAX_ALLOC_BUFFER_SZ          (ST_PERSIST_MAX_ALLOC_SZ + ST_PERSIST_FLASH_DATA_OFFSET)   /* Max persistent Buffer in bytes */
 #define ST_PERSIST_TAG                          0xCAFEDECAu                     /* TAG for verifu if persistent info are good. */
+#define ST_PERSIST_TAG_PACKED                   0xCAFEDECBu                     /* TAG of persistent info stored packed : size and CRC follow */
+#define CFG_PERSIST_STORE_SECTOR_INDEX          ((CFG_NVM_BASE_ADDRESS / 0x1000u) + CFG_NB_OF_PAGE)
+#define ST_PERSIST_RECORD_MAGIC                 0x53524550u                     /* 'PERS' : persistent data snapshot record header */
+#define ST_PERSIST_DELTA_MAGIC                  0x41544C44u                     /* 'DLTA' : persistent data delta record header */
 
    
 /******************************************************************************
@@ -293,6 +309,18 @@ typedef enum
 #define DBG_TRACE_MSG_QUEUE_SIZE 4096
 #define MAX_DBG_TRACE_MSG_SIZE 1024
 
+/**
+ * When set, the sequencer tasks run time and latency are measured with the
+ * DWT cycle counter (app_seq_prof.c). The "PROF" UART command traces them,
+ * "PROF_CLR" clears them.
+ */
+#define CFG_SEQ_PROF_ENABLE    1
+
+#if ( CFG_DEBUG_TRACE == 0 )
+#undef CFG_SEQ_PROF_ENABLE
+#define CFG_SEQ_PROF_ENABLE    0
+#endif
+
 /******************************************************************************
  * Configure Log level for Application
  ******************************************************************************/
@@ -325,6 +353,7 @@ typedef enum
 typedef enum {
   CFG_TASK_NOTIFY_FROM_M0_TO_M4,
   CFG_TASK_REQUEST_FROM_M0_TO_M4,
+  CFG_TASK_ZIGBEE_CMD,
   CFG_TASK_SYSTEM_HCI_ASYNCH_EVT,
   CFG_TASK_ZIGBEE_NETWORK_FORM,
   CFG_TASK_ZIGBEE_APP_START,
@@ -332,11 +361,22 @@ typedef enum {
   CFG_TASK_ZIGBEE_OTA_START_DOWNLOAD,
   CFG_TASK_ZIGBEE_OTA_RESUME_DOWNLOAD,
   CFG_TASK_ZIGBEE_OTA_SERVER_DISCOVERY,
+  CFG_TASK_ZIGBEE_OTA_MCAST_NACK,
+  CFG_TASK_ZIGBEE_OTA_MCAST_PREPARE,
+  CFG_TASK_ZIGBEE_OTA_SCHEDULE,
   CFG_TASK_ZIGBEE_WRITE_FLASH,
+  CFG_TASK_ZIGBEE_PERSIST_SAVE,
+  CFG_TASK_ZIGBEE_PERSIST_GC,
   CFG_TASK_FUOTA_RESET,
   CFG_TASK_BUTTON_SW1,
   CFG_TASK_BUTTON_SW2,
   CFG_TASK_BUTTON_SW3,
+#if (CFG_SEQ_PROF_ENABLE != 0)
+  CFG_TASK_SEQ_PROF_DUMP,
+#endif /* CFG_SEQ_PROF_ENABLE */
+#if (CFG_DEBUG_TRACE != 0)
+  CFG_TASK_POOL_DUMP,
+#endif /* CFG_DEBUG_TRACE */
 #if (CFG_USB_INTERFACE_ENABLE != 0)
   CFG_TASK_VCP_SEND_DATA,
 #endif /* (CFG_USB_INTERFACE_ENABLE != 0) */
@@ -358,9 +398,23 @@ typedef enum
 {
     CFG_SCH_PRIO_0,
     CFG_SCH_PRIO_1,
+    CFG_SCH_PRIO_2,
+    CFG_SCH_PRIO_3,
     CFG_PRIO_NBR,
 } CFG_SCH_Prio_Id_t;
 
+/**
+ * Latency classes : a task is always set with the class of its CFG_TASK_xxx id.
+ * After each task, the sequencer runs a pending task of the most urgent class,
+ * so a class waits at most for the longest task of the other classes : the
+ * background tasks do their flash work in steps (one cleanup, erase or record
+ * per run) and set themselves again for the next step.
+ */
+#define CFG_SCH_CLASS_IPCC          CFG_SCH_PRIO_0  /* M0 notifications, requests and posted commands */
+#define CFG_SCH_CLASS_OTA           CFG_SCH_PRIO_1  /* OTA data path, network start */
+#define CFG_SCH_CLASS_UI            CFG_SCH_PRIO_2  /* buttons, console */
+#define CFG_SCH_CLASS_BACKGROUND    CFG_SCH_PRIO_3  /* persistence, NVM maintenance, profiling dump */
+
 /**
  * This is a bit mapping over 32bits listing all events id supported in the application
  */
@@ -368,14 +422,10 @@ typedef enum {
     CFG_EVT_SYSTEM_HCI_CMD_EVT_RESP,
     CFG_EVT_ACK_FROM_M0_EVT,
     CFG_EVT_SYNCHRO_BYPASS_IDLE,
-    CFG_EVT_ZIGBEE_STARTUP_ENDED,
-    CFG_EVT_ZIGBEE_OTA_SERVER_FOUND,
 } CFG_IdleEvt_Id_t;
 
 #define EVENT_ACK_FROM_M0_EVT           (1U << CFG_EVT_ACK_FROM_M0_EVT)
 #define EVENT_SYNCHRO_BYPASS_IDLE       (1U << CFG_EVT_SYNCHRO_BYPASS_IDLE)
-#define EVENT_ZIGBEE_STARTUP_ENDED      (1U << CFG_EVT_ZIGBEE_STARTUP_ENDED)
-#define EVENT_ZIGBEE_OTA_SERVER_FOUND   (1U << CFG_EVT_ZIGBEE_OTA_SERVER_FOUND)
 
 /******************************************************************************
  * Configure Log level for Application
@@ -410,12 +460,40 @@ typedef enum {
  */
 #define CFG_APP_START_SECTOR_INDEX      (0x30)
 
+/**
+ * Sector where a delta image is rebuilt before being copied at CFG_APP_START_SECTOR_INDEX
+ * The running application shall fit below this sector
+ */
+#define CFG_APP_DELTA_STAGING_SECTOR_INDEX   (0x70)
+
 /**
  * Define list of reboot reason
  */
 #define CFG_REBOOT_ON_DOWNLOADED_FW     (0x00)    /* Rebbot on Downloaded FW */
 #define CFG_REBOOT_ON_OTA_FW            (0x01)    /* Rebbot on OTA FW */
 #define CFG_REBOOT_ON_CPU2_UPGRADE      (0x02)    /* Reboot on OTA FW to download CPU2 */
+#define CFG_REBOOT_ON_TRIAL_FW          (0x03)    /* Reboot on a new FW Application not confirmed yet */
+
+/**
+ * A/B slots : when set to 1, a M4 application is downloaded in slot B (the delta staging area)
+ * and swapped page by page with slot A (CFG_APP_START_SECTOR_INDEX) through a scratch page, so
+ * that the previous application is kept in slot B. The new application is started once with
+ * the IWDG set to CFG_APP_TRIAL_DEADLINE_S : if it does not append a CFG_APP_SLOT_CONFIRMED record
+ * to the slot state page before the next reset, the OTA loader swaps the slots back. The record
+ * format and what the application shall do are in app_slot.h, which the application includes.
+ */
+#define CFG_APP_AB_SLOTS                     (0u)
+#define CFG_APP_SLOT_NB_SECTORS              (CFG_APP_DELTA_STAGING_SECTOR_INDEX - CFG_APP_START_SECTOR_INDEX)
+#define CFG_APP_SWAP_SCRATCH_SECTOR_INDEX    (CFG_APP_DELTA_STAGING_SECTOR_INDEX + CFG_APP_SLOT_NB_SECTORS)
+#define CFG_APP_SLOT_STATE_SECTOR_INDEX      (CFG_APP_SWAP_SCRATCH_SECTOR_INDEX + 1)
+/**
+ * The slots, scratch and state pages shall stay below the secure flash (SFSA option byte) of
+ * every wireless stack the device may run : set the lowest SFSA expected. The OTA loader also
+ * checks the SFSA at startup and refuses the M4 images when the slot state page is secure.
+ */
+#define CFG_APP_SLOT_LIMIT_SECTOR_INDEX      (0xC0u)
+#define CFG_APP_TRIAL_DEADLINE_S             (30u)     /* IWDG period, 32 s max */
+#define CFG_APP_SLOT_SWAP_STEPS              (3u)      /* recorded copies per swapped page, progress fits 8 bits */
 
 #endif /*APP_CONF_H */
 
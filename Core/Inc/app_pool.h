@@ -0,0 +1,66 @@
+/**
+  ******************************************************************************
+  * File Name          : app_pool.h
+  * Description        : Header for the fixed-block pool allocator.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef APP_POOL_H
+#define APP_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+
+/* Exported defines ----------------------------------------------------------*/
+/* The free blocks of a pool are tracked in a 32 bits bitmap */
+#define APP_POOL_BLOCK_NB_MAX                  32u
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct APP_POOL
+{
+  const char       *name;
+  uint32_t         *p_mem;
+  uint32_t          block_size;   /**< words */
+  uint32_t          block_nb;
+  uint32_t          free_bm;      /**< bit n set when block n is free */
+  uint32_t          used;
+  uint32_t          high_water;
+  uint32_t          alloc_fail;
+  struct APP_POOL  *p_next;       /**< pools initialized, for APP_POOL_Dump */
+} APP_POOL_t;
+
+/* Exported macros -----------------------------------------------------------*/
+/**
+ * Define a pool of nb blocks of type, the storage is a static array sized at
+ * compile time. APP_POOL_Init() must be called before the first allocation.
+ */
+#define APP_POOL_DEFINE( pool, type, nb )                                                       \
+  static uint32_t pool##_mem[( nb ) * ( ( sizeof(type) + 3u ) / 4u )];                           \
+  static APP_POOL_t pool = { #pool, pool##_mem, ( sizeof(type) + 3u ) / 4u, ( nb ), 0, 0, 0, 0, NULL }
+
+/* Exported functions ------------------------------------------------------- */
+void  APP_POOL_Init(APP_POOL_t *p_pool);
+void *APP_POOL_Alloc(APP_POOL_t *p_pool);
+void  APP_POOL_Free(APP_POOL_t *p_pool, void *p_block);
+void  APP_POOL_Dump(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* APP_POOL_H */
@@ -0,0 +1,76 @@
+/**
+  ******************************************************************************
+  * File Name          : app_seq_prof.h
+  * Description        : Header for the sequencer task profiling.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef APP_SEQ_PROF_H
+#define APP_SEQ_PROF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "app_conf.h"
+#include "stm32_seq.h"
+
+/* Exported defines ----------------------------------------------------------*/
+/**
+ * Latency buckets : [0] < 16us, then x4 per bucket, the last one counts
+ * everything above 64ms.
+ */
+#define SEQ_PROF_LATENCY_BUCKETS               8u
+#define SEQ_PROF_LATENCY_FIRST_US              16u
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t runs;          /**< invocations since the last reset */
+  uint32_t run_min;       /**< run time (cycles) */
+  uint32_t run_max;
+  uint64_t run_total;
+  uint32_t latency_max;   /**< SetTask to dispatch (cycles) */
+  uint32_t latency[SEQ_PROF_LATENCY_BUCKETS];
+} APP_SEQ_PROF_Task_t;
+
+/* Exported macros -----------------------------------------------------------*/
+/**
+ * The application registers and sets its tasks through these macros so that
+ * the dispatch is measured when CFG_SEQ_PROF_ENABLE is set.
+ */
+#if (CFG_SEQ_PROF_ENABLE != 0)
+#define APP_SEQ_RegTask( TaskId_bm, Flags, Task )   APP_SEQ_PROF_RegTask( (TaskId_bm), (Flags), (Task) )
+#define APP_SEQ_SetTask( TaskId_bm, Task_Prio )     APP_SEQ_PROF_SetTask( (TaskId_bm), (Task_Prio) )
+#else
+#define APP_SEQ_RegTask( TaskId_bm, Flags, Task )   UTIL_SEQ_RegTask( (TaskId_bm), (Flags), (Task) )
+#define APP_SEQ_SetTask( TaskId_bm, Task_Prio )     UTIL_SEQ_SetTask( (TaskId_bm), (Task_Prio) )
+#endif /* CFG_SEQ_PROF_ENABLE */
+
+/* Exported functions ------------------------------------------------------- */
+#if (CFG_SEQ_PROF_ENABLE != 0)
+void APP_SEQ_PROF_Init(void);
+void APP_SEQ_PROF_RegTask(UTIL_SEQ_bm_t TaskId_bm, uint32_t Flags, void (*Task)(void));
+void APP_SEQ_PROF_SetTask(UTIL_SEQ_bm_t TaskId_bm, uint32_t Task_Prio);
+void APP_SEQ_PROF_Get(uint32_t task_id, APP_SEQ_PROF_Task_t *p_stats);
+void APP_SEQ_PROF_Reset(void);
+void APP_SEQ_PROF_Dump(void);
+#endif /* CFG_SEQ_PROF_ENABLE */
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* APP_SEQ_PROF_H */
@@ -0,0 +1,160 @@
+/**
+  ******************************************************************************
+  * File Name          : app_slot.h
+  * Description        : A/B slots contract between the OTA loader and the
+  *                      application it starts on trial.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef APP_SLOT_H
+#define APP_SLOT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * With CFG_APP_AB_SLOTS, the OTA loader starts a new application once with the
+ * IWDG running (CFG_APP_TRIAL_DEADLINE_S). The application is a separate binary
+ * built in its own project : it includes this header, and only this header, to
+ * take its part of the contract :
+ *  - refresh the IWDG (APP_SLOT_RefreshWatchdog) more often than the deadline,
+ *    from the start of main() and for as long as it runs : the IWDG cannot be
+ *    stopped ;
+ *  - once it knows it works (e.g. joined the network), call APP_SLOT_Confirm()
+ *    once. It appends the double word
+ *      { CFG_APP_SLOT_RECORD(CFG_APP_SLOT_CONFIRMED, 0, pages), file version }
+ *    at the first erased double word of the slot state page, pages and file
+ *    version being copied from the CFG_APP_SLOT_TRIAL record before it.
+ * On any reset before the confirmation, the OTA loader swaps the slots back.
+ * The page is never erased by the application : the loader keeps room for the
+ * confirmation record before the swap.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+#include "stm32wbxx_hal.h"
+#include "stm32wbxx_ll_hsem.h"
+#include "stm32wbxx_ll_system.h"
+
+/* Exported defines ----------------------------------------------------------*/
+/* Slot state page, checked against CFG_APP_SLOT_STATE_SECTOR_INDEX by the OTA loader */
+#define APP_SLOT_STATE_SECTOR_INDEX          (0xB1u)
+#define APP_SLOT_STATE_ADDRESS               (FLASH_BASE + (APP_SLOT_STATE_SECTOR_INDEX * FLASH_PAGE_SIZE))
+
+#ifndef CFG_HW_FLASH_SEMID
+#define CFG_HW_FLASH_SEMID                   (2U)      /* Flash semaphore shared with the CPU2 */
+#endif
+
+/**
+ * Slot state records : double words appended to the slot state page, the last one is the
+ * current state. First word : 0xA5, pages swapped, swap progress, state. Second word : file version.
+ */
+#define CFG_APP_SLOT_EMPTY                   (0u)      /* nothing to install */
+#define CFG_APP_SLOT_DOWNLOADING             (1u)      /* slot B being written */
+#define CFG_APP_SLOT_PENDING                 (2u)      /* slot B validated, to be installed */
+#define CFG_APP_SLOT_INSTALLING              (3u)      /* slots being swapped */
+#define CFG_APP_SLOT_TRIAL                   (4u)      /* new application started once, not confirmed */
+#define CFG_APP_SLOT_CONFIRMED               (5u)      /* new application confirmed, previous one in slot B */
+#define CFG_APP_SLOT_REVERTING               (6u)      /* slots being swapped back */
+#define CFG_APP_SLOT_ROLLED_BACK             (7u)      /* previous application restored, file version rejected */
+#define CFG_APP_SLOT_RECORD(state, progress, pages) (0xA5000000u | ((uint32_t)(pages) << 16) | ((uint32_t)(progress) << 8) | (uint32_t)(state))
+#define CFG_APP_SLOT_RECORD_STATE(record)    ((record) & 0xFFu)
+#define CFG_APP_SLOT_RECORD_PROGRESS(record) (((record) >> 8) & 0xFFu)
+#define CFG_APP_SLOT_RECORD_PAGES(record)    (((record) >> 16) & 0xFFu)
+
+/* Exported functions ------------------------------------------------------- */
+/**
+ * @brief  Reading the last record of the slot state page
+ * @param  p_file_version: file version of the record, may be NULL
+ * @retval record first word, CFG_APP_SLOT_EMPTY record if the page is erased
+ */
+static inline uint32_t APP_SLOT_GetState(uint32_t *p_file_version)
+{
+  const uint32_t *p_record = (const uint32_t *)APP_SLOT_STATE_ADDRESS;
+  uint32_t record = CFG_APP_SLOT_RECORD(CFG_APP_SLOT_EMPTY, 0u, 0u);
+  uint32_t file_version = 0;
+  uint32_t index;
+
+  for(index = 0; (index < (FLASH_PAGE_SIZE / 4u)) && (p_record[index] != 0xFFFFFFFFu); index += 2u)
+  {
+    record = p_record[index];
+    file_version = p_record[index + 1u];
+  }
+  if(p_file_version != NULL)
+  {
+    *p_file_version = file_version;
+  }
+
+  return record;
+}
+
+/**
+ * @brief  Refreshing the IWDG started by the OTA loader for the trial
+ * @param  None
+ * @retval None
+ */
+static inline void APP_SLOT_RefreshWatchdog(void)
+{
+  IWDG->KR = 0x0000AAAAU;
+}
+
+/**
+ * @brief  Confirming the application started on trial, see the contract above
+ *         Nothing is written when no application is on trial.
+ * @param  None
+ * @retval 0 when confirmed or not on trial, -1 if the record could not be written
+ */
+static inline int APP_SLOT_Confirm(void)
+{
+  const uint32_t *p_record = (const uint32_t *)APP_SLOT_STATE_ADDRESS;
+  uint32_t file_version;
+  uint32_t record = APP_SLOT_GetState(&file_version);
+  uint32_t index = 0;
+  uint64_t data;
+  int status = 0;
+
+  if(CFG_APP_SLOT_RECORD_STATE(record) != CFG_APP_SLOT_TRIAL)
+  {
+    return 0;
+  }
+  while((index < (FLASH_PAGE_SIZE / 4u)) && (p_record[index] != 0xFFFFFFFFu))
+  {
+    index += 2u;
+  }
+  if(index == (FLASH_PAGE_SIZE / 4u))
+  {
+    return -1;
+  }
+  data = ((uint64_t)file_version << 32) | CFG_APP_SLOT_RECORD(CFG_APP_SLOT_CONFIRMED, 0u, CFG_APP_SLOT_RECORD_PAGES(record));
+
+  while( LL_HSEM_1StepLock( HSEM, CFG_HW_FLASH_SEMID ) );
+  HAL_FLASH_Unlock();
+  while(LL_FLASH_IsActiveFlag_OperationSuspended());
+  if((HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, APP_SLOT_STATE_ADDRESS + (4u * index), data) != HAL_OK)
+     || (*(const uint64_t *)(APP_SLOT_STATE_ADDRESS + (4u * index)) != data))
+  {
+    status = -1;
+  }
+  HAL_FLASH_Lock();
+  LL_HSEM_ReleaseLock( HSEM, CFG_HW_FLASH_SEMID, 0 );
+
+  return status;
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* APP_SLOT_H */
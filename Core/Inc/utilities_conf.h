@@ -55,7 +55,7 @@ extern "C" {
 #define UTIL_SEQ_ENTER_CRITICAL_SECTION( )      UTILS_ENTER_CRITICAL_SECTION( )
 #define UTIL_SEQ_EXIT_CRITICAL_SECTION( )       UTILS_EXIT_CRITICAL_SECTION( )
 #define UTIL_SEQ_CONF_TASK_NBR                  (32)
-#define UTIL_SEQ_CONF_PRIO_NBR                  (2)
+#define UTIL_SEQ_CONF_PRIO_NBR                  (4)     /* CFG_PRIO_NBR */
 #define UTIL_SEQ_MEMSET8( dest, value, size )   UTILS_MEMSET8( dest, value, size )
   
 #ifdef __cplusplus
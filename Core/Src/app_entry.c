@@ -23,6 +23,8 @@
 #include "app_conf.h"
 #include "hw_conf.h"
 #include "stm32_seq.h"
+#include "app_seq_prof.h"
+#include "app_pool.h"
 #include "stm_logging.h"
 #include "shci_tl.h"
 #include "stm32_lpm.h"
@@ -98,6 +100,12 @@ void APPE_Init( void )
   Led_Init();
   Button_Init();
   RxUART_Init();
+#if (CFG_SEQ_PROF_ENABLE != 0)
+  APP_SEQ_RegTask(1U << CFG_TASK_SEQ_PROF_DUMP, UTIL_SEQ_RFU, APP_SEQ_PROF_Dump);
+#endif
+#if (CFG_DEBUG_TRACE != 0)
+  APP_SEQ_RegTask(1U << CFG_TASK_POOL_DUMP, UTIL_SEQ_RFU, APP_POOL_Dump);
+#endif
 
   /* Initialize all transport layers */
   APPE_Tl_Init();	
@@ -158,6 +166,11 @@ static void Init_Debug( void )
   DbgTraceInit();
 #endif
 
+#if (CFG_SEQ_PROF_ENABLE != 0)
+  /* Before the first task is registered */
+  APP_SEQ_PROF_Init();
+#endif
+
   return;
 }
 
@@ -201,7 +214,7 @@ static void APPE_Tl_Init( void )
   TL_Init();
 
   /**< System channel initialization */
-  UTIL_SEQ_RegTask( 1<< CFG_TASK_SYSTEM_HCI_ASYNCH_EVT, UTIL_SEQ_RFU, shci_user_evt_proc );
+  APP_SEQ_RegTask( 1<< CFG_TASK_SYSTEM_HCI_ASYNCH_EVT, UTIL_SEQ_RFU, shci_user_evt_proc );
   SHci_Tl_Init_Conf.p_cmdbuffer = (uint8_t*)&SystemCmdBuffer;
   SHci_Tl_Init_Conf.StatusNotCallBack = APPE_SysStatusNot;
   shci_init(APPE_SysUserEvtRx, (void*) &SHci_Tl_Init_Conf);
@@ -500,7 +513,7 @@ void UTIL_SEQ_EvtIdle( UTIL_SEQ_bm_t task_id_bm, UTIL_SEQ_bm_t evt_waited_bm )
 void shci_notify_asynch_evt(void* pdata)
 {
   UNUSED(pdata);
-  UTIL_SEQ_SetTask(1U << CFG_TASK_SYSTEM_HCI_ASYNCH_EVT, CFG_SCH_PRIO_0);
+  APP_SEQ_SetTask(1U << CFG_TASK_SYSTEM_HCI_ASYNCH_EVT, CFG_SCH_CLASS_IPCC);
   return;
 }
 
@@ -575,15 +588,15 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
   switch (GPIO_Pin) 
   {
     case BUTTON_SW1_PIN:
-        UTIL_SEQ_SetTask(1U << CFG_TASK_BUTTON_SW1,CFG_SCH_PRIO_1);
+        APP_SEQ_SetTask(1U << CFG_TASK_BUTTON_SW1,CFG_SCH_CLASS_UI);
         break;
 
     case BUTTON_SW2_PIN:
-        UTIL_SEQ_SetTask(1U << CFG_TASK_BUTTON_SW2,CFG_SCH_PRIO_1);
+        APP_SEQ_SetTask(1U << CFG_TASK_BUTTON_SW2,CFG_SCH_CLASS_UI);
         break;
 
     case BUTTON_SW3_PIN:
-        UTIL_SEQ_SetTask(1U << CFG_TASK_BUTTON_SW3,CFG_SCH_PRIO_1);
+        APP_SEQ_SetTask(1U << CFG_TASK_BUTTON_SW3,CFG_SCH_CLASS_UI);
         break;
 
     default:
@@ -645,6 +658,23 @@ static void UartCmdExecute(void)
     exti_handle.Line = EXTI_LINE_1;
     HAL_EXTI_GenerateSWI(&exti_handle);
   }
+#if (CFG_SEQ_PROF_ENABLE != 0)
+  else if (strcmp((char const*)CommandString, "PROF") == 0)
+  {
+    APP_SEQ_SetTask(1U << CFG_TASK_SEQ_PROF_DUMP, CFG_SCH_CLASS_BACKGROUND);
+  }
+  else if (strcmp((char const*)CommandString, "PROF_CLR") == 0)
+  {
+    APP_DBG("PROF_CLR OK");
+    APP_SEQ_PROF_Reset();
+  }
+#endif /* CFG_SEQ_PROF_ENABLE */
+#if (CFG_DEBUG_TRACE != 0)
+  else if (strcmp((char const*)CommandString, "POOL") == 0)
+  {
+    APP_SEQ_SetTask(1U << CFG_TASK_POOL_DUMP, CFG_SCH_CLASS_BACKGROUND);
+  }
+#endif /* CFG_DEBUG_TRACE */
   else
   {
     APP_DBG("NOT RECOGNIZED COMMAND : %s", CommandString);
@@ -0,0 +1,151 @@
+/**
+  ******************************************************************************
+  * File Name          : app_pool.c
+  * Description        : Fixed-block pool allocator.
+  *                      Each pool is a static array of blocks of one size,
+  *                      allocated and freed in constant time from a bitmap.
+  *                      Allocation and free may be called under interrupt.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "app_common.h"
+#include "app_pool.h"
+#include "stm_logging.h"
+#include "utilities_conf.h"
+
+/* Private variables ---------------------------------------------------------*/
+static APP_POOL_t *APP_POOL_List = NULL;
+
+/* Functions Definition ------------------------------------------------------*/
+
+/**
+ * @brief  Mark all the blocks of a pool free
+ *         The pool is added to the ones traced by APP_POOL_Dump on the first call.
+ * @param  p_pool: pool defined with APP_POOL_DEFINE
+ * @retval None
+ */
+void APP_POOL_Init(APP_POOL_t *p_pool)
+{
+  APP_POOL_t *p_entry;
+
+  if ( p_pool->block_nb > APP_POOL_BLOCK_NB_MAX )
+  {
+    APP_DBG("Pool %s : %d blocks, only %d used", p_pool->name, p_pool->block_nb, APP_POOL_BLOCK_NB_MAX);
+    p_pool->block_nb = APP_POOL_BLOCK_NB_MAX;
+  }
+
+  UTILS_ENTER_CRITICAL_SECTION();
+  p_pool->free_bm = ( p_pool->block_nb == 32u ) ? UINT32_MAX : ( ( 1u << p_pool->block_nb ) - 1u );
+  p_pool->used = 0;
+  p_pool->high_water = 0;
+  p_pool->alloc_fail = 0;
+
+  for ( p_entry = APP_POOL_List; ( p_entry != NULL ) && ( p_entry != p_pool ); p_entry = p_entry->p_next )
+  {
+  }
+  if ( p_entry == NULL )
+  {
+    p_pool->p_next = APP_POOL_List;
+    APP_POOL_List = p_pool;
+  }
+  UTILS_EXIT_CRITICAL_SECTION();
+} /* APP_POOL_Init */
+
+/**
+ * @brief  Allocate a block
+ * @param  p_pool: pool
+ * @retval block, NULL when the pool is exhausted
+ */
+void *APP_POOL_Alloc(APP_POOL_t *p_pool)
+{
+  uint32_t index;
+  void *p_block = NULL;
+
+  UTILS_ENTER_CRITICAL_SECTION();
+  if ( p_pool->free_bm == 0u )
+  {
+    p_pool->alloc_fail++;
+  }
+  else
+  {
+    index = POSITION_VAL(p_pool->free_bm);
+    p_pool->free_bm &= ~( 1u << index );
+    p_pool->used++;
+    if ( p_pool->used > p_pool->high_water )
+    {
+      p_pool->high_water = p_pool->used;
+    }
+    p_block = &p_pool->p_mem[index * p_pool->block_size];
+  }
+  UTILS_EXIT_CRITICAL_SECTION();
+
+  return p_block;
+} /* APP_POOL_Alloc */
+
+/**
+ * @brief  Give a block back to its pool
+ *         A pointer outside of the pool or a block already free is traced and ignored.
+ * @param  p_pool: pool the block was allocated from
+ * @param  p_block: block, may be NULL
+ * @retval None
+ */
+void APP_POOL_Free(APP_POOL_t *p_pool, void *p_block)
+{
+  uint32_t offset, index;
+
+  if ( p_block == NULL )
+  {
+    return;
+  }
+
+  offset = (uint32_t)( (uint32_t *)p_block - p_pool->p_mem );
+  index = offset / p_pool->block_size;
+  if ( ( (uint32_t *)p_block < p_pool->p_mem ) || ( index >= p_pool->block_nb )
+       || ( ( offset % p_pool->block_size ) != 0u ) )
+  {
+    APP_DBG("Pool %s : free of a foreign block %p", p_pool->name, p_block);
+    return;
+  }
+
+  UTILS_ENTER_CRITICAL_SECTION();
+  if ( ( p_pool->free_bm & ( 1u << index ) ) == 0u )
+  {
+    p_pool->free_bm |= ( 1u << index );
+    p_pool->used--;
+    p_block = NULL;
+  }
+  UTILS_EXIT_CRITICAL_SECTION();
+
+  if ( p_block != NULL )
+  {
+    APP_DBG("Pool %s : double free of block %d", p_pool->name, index);
+  }
+} /* APP_POOL_Free */
+
+/**
+ * @brief  Trace the usage of the pools initialized
+ * @param  None
+ * @retval None
+ */
+void APP_POOL_Dump(void)
+{
+  const APP_POOL_t *p_pool;
+
+  APP_DBG("Pool blocks x bytes used high-water alloc failures");
+  for ( p_pool = APP_POOL_List; p_pool != NULL; p_pool = p_pool->p_next )
+  {
+    APP_DBG("%s %d x %d %d %d %d", p_pool->name, p_pool->block_nb, p_pool->block_size * 4u,
+            p_pool->used, p_pool->high_water, p_pool->alloc_fail);
+  }
+} /* APP_POOL_Dump */
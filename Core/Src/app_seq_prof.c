@@ -0,0 +1,246 @@
+/**
+  ******************************************************************************
+  * File Name          : app_seq_prof.c
+  * Description        : Sequencer task profiling.
+  *                      Each registered task is dispatched through a wrapper
+  *                      measuring its run time, and UTIL_SEQ_SetTask is
+  *                      wrapped to time stamp the first request of a pending
+  *                      task, giving the latency until the dispatch. Times
+  *                      are read from the DWT cycle counter, which does not
+  *                      count in Stop mode : a latency spanning a low power
+  *                      period is underestimated.
+  *                      The run time of a task waiting for an event
+  *                      (UTIL_SEQ_WaitEvt) excludes the tasks run meanwhile,
+  *                      each charged to itself, but includes the idle time
+  *                      and the interrupts.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "app_common.h"
+#include "app_seq_prof.h"
+#include "stm_logging.h"
+#include "utilities_conf.h"
+
+#if (CFG_SEQ_PROF_ENABLE != 0)
+/* Private defines -----------------------------------------------------------*/
+#define SEQ_PROF_TASK_NBR                      32u
+#define SEQ_PROF_CYCLES_PER_US                 ( SystemCoreClock / 1000000u )
+
+/* Private macros ------------------------------------------------------------*/
+/* One dispatch function per task id, the sequencer does not tell which task it runs */
+#define SEQ_PROF_TASK( id )  static void APP_SEQ_PROF_Task##id( void ) { APP_SEQ_PROF_Run( id##u ); }
+
+/* Private function prototypes -----------------------------------------------*/
+static void APP_SEQ_PROF_Run(uint32_t task_id);
+
+/* Private variables ---------------------------------------------------------*/
+static void (*APP_SEQ_PROF_TaskFunc[SEQ_PROF_TASK_NBR])(void);
+/* CYCCNT of the first SetTask since the last dispatch, 0 when not pending */
+static volatile uint32_t APP_SEQ_PROF_Enqueued[SEQ_PROF_TASK_NBR];
+static APP_SEQ_PROF_Task_t APP_SEQ_PROF_Stats[SEQ_PROF_TASK_NBR];
+/* Cycles of the tasks run nested in the current one, from UTIL_SEQ_WaitEvt */
+static uint32_t APP_SEQ_PROF_NestedCycles;
+
+SEQ_PROF_TASK(0)  SEQ_PROF_TASK(1)  SEQ_PROF_TASK(2)  SEQ_PROF_TASK(3)
+SEQ_PROF_TASK(4)  SEQ_PROF_TASK(5)  SEQ_PROF_TASK(6)  SEQ_PROF_TASK(7)
+SEQ_PROF_TASK(8)  SEQ_PROF_TASK(9)  SEQ_PROF_TASK(10) SEQ_PROF_TASK(11)
+SEQ_PROF_TASK(12) SEQ_PROF_TASK(13) SEQ_PROF_TASK(14) SEQ_PROF_TASK(15)
+SEQ_PROF_TASK(16) SEQ_PROF_TASK(17) SEQ_PROF_TASK(18) SEQ_PROF_TASK(19)
+SEQ_PROF_TASK(20) SEQ_PROF_TASK(21) SEQ_PROF_TASK(22) SEQ_PROF_TASK(23)
+SEQ_PROF_TASK(24) SEQ_PROF_TASK(25) SEQ_PROF_TASK(26) SEQ_PROF_TASK(27)
+SEQ_PROF_TASK(28) SEQ_PROF_TASK(29) SEQ_PROF_TASK(30) SEQ_PROF_TASK(31)
+
+static void (* const APP_SEQ_PROF_Dispatch[SEQ_PROF_TASK_NBR])(void) =
+{
+  APP_SEQ_PROF_Task0,  APP_SEQ_PROF_Task1,  APP_SEQ_PROF_Task2,  APP_SEQ_PROF_Task3,
+  APP_SEQ_PROF_Task4,  APP_SEQ_PROF_Task5,  APP_SEQ_PROF_Task6,  APP_SEQ_PROF_Task7,
+  APP_SEQ_PROF_Task8,  APP_SEQ_PROF_Task9,  APP_SEQ_PROF_Task10, APP_SEQ_PROF_Task11,
+  APP_SEQ_PROF_Task12, APP_SEQ_PROF_Task13, APP_SEQ_PROF_Task14, APP_SEQ_PROF_Task15,
+  APP_SEQ_PROF_Task16, APP_SEQ_PROF_Task17, APP_SEQ_PROF_Task18, APP_SEQ_PROF_Task19,
+  APP_SEQ_PROF_Task20, APP_SEQ_PROF_Task21, APP_SEQ_PROF_Task22, APP_SEQ_PROF_Task23,
+  APP_SEQ_PROF_Task24, APP_SEQ_PROF_Task25, APP_SEQ_PROF_Task26, APP_SEQ_PROF_Task27,
+  APP_SEQ_PROF_Task28, APP_SEQ_PROF_Task29, APP_SEQ_PROF_Task30, APP_SEQ_PROF_Task31,
+};
+
+/* Functions Definition ------------------------------------------------------*/
+
+/**
+ * @brief  Start the DWT cycle counter and clear the statistics
+ * @param  None
+ * @retval None
+ */
+void APP_SEQ_PROF_Init(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  APP_SEQ_PROF_Reset();
+} /* APP_SEQ_PROF_Init */
+
+/**
+ * @brief  Register a task, dispatched through its profiling wrapper
+ * @param  TaskId_bm: task id bitmap, one bit
+ * @param  Flags: UTIL_SEQ_RegTask flags
+ * @param  Task: task function
+ * @retval None
+ */
+void APP_SEQ_PROF_RegTask(UTIL_SEQ_bm_t TaskId_bm, uint32_t Flags, void (*Task)(void))
+{
+  uint32_t task_id = POSITION_VAL(TaskId_bm);
+
+  APP_SEQ_PROF_TaskFunc[task_id] = Task;
+  UTIL_SEQ_RegTask(TaskId_bm, Flags, APP_SEQ_PROF_Dispatch[task_id]);
+} /* APP_SEQ_PROF_RegTask */
+
+/**
+ * @brief  Request tasks to run, time stamping the ones not already pending
+ *         May be called under interrupt.
+ * @param  TaskId_bm: task id bitmap
+ * @param  Task_Prio: sequencer priority
+ * @retval None
+ */
+void APP_SEQ_PROF_SetTask(UTIL_SEQ_bm_t TaskId_bm, uint32_t Task_Prio)
+{
+  uint32_t now = DWT->CYCCNT | 1u;
+  uint32_t bm = TaskId_bm;
+  uint32_t task_id;
+
+  UTILS_ENTER_CRITICAL_SECTION();
+  while ( bm != 0u )
+  {
+    task_id = POSITION_VAL(bm);
+    bm &= ~( 1u << task_id );
+    if ( APP_SEQ_PROF_Enqueued[task_id] == 0u )
+    {
+      APP_SEQ_PROF_Enqueued[task_id] = now;
+    }
+  }
+  UTILS_EXIT_CRITICAL_SECTION();
+
+  UTIL_SEQ_SetTask(TaskId_bm, Task_Prio);
+} /* APP_SEQ_PROF_SetTask */
+
+/**
+ * @brief  Run a task and update its statistics
+ *         The tasks it runs while waiting for an event are dispatched through
+ *         this function too : their time is subtracted from its run time.
+ * @param  task_id: task id
+ * @retval None
+ */
+static void APP_SEQ_PROF_Run(uint32_t task_id)
+{
+  APP_SEQ_PROF_Task_t *p_stats = &APP_SEQ_PROF_Stats[task_id];
+  uint32_t enqueued, start, cycles, limit, total, outer_nested;
+  uint32_t bucket = 0;
+
+  UTILS_ENTER_CRITICAL_SECTION();
+  enqueued = APP_SEQ_PROF_Enqueued[task_id];
+  APP_SEQ_PROF_Enqueued[task_id] = 0;
+  UTILS_EXIT_CRITICAL_SECTION();
+
+  start = DWT->CYCCNT;
+  if ( enqueued != 0u )
+  {
+    cycles = start - enqueued;
+    if ( cycles > p_stats->latency_max )
+    {
+      p_stats->latency_max = cycles;
+    }
+    limit = SEQ_PROF_LATENCY_FIRST_US * SEQ_PROF_CYCLES_PER_US;
+    while ( ( bucket < ( SEQ_PROF_LATENCY_BUCKETS - 1u ) ) && ( cycles >= limit ) )
+    {
+      bucket++;
+      limit *= 4u;
+    }
+    p_stats->latency[bucket]++;
+  }
+
+  outer_nested = APP_SEQ_PROF_NestedCycles;
+  APP_SEQ_PROF_NestedCycles = 0;
+
+  APP_SEQ_PROF_TaskFunc[task_id]();
+
+  total = DWT->CYCCNT - start;
+  cycles = total - APP_SEQ_PROF_NestedCycles;
+  /* Excluded from the run time of the task this one is nested in, if any */
+  APP_SEQ_PROF_NestedCycles = outer_nested + total;
+  p_stats->runs++;
+  p_stats->run_total += cycles;
+  if ( cycles < p_stats->run_min )
+  {
+    p_stats->run_min = cycles;
+  }
+  if ( cycles > p_stats->run_max )
+  {
+    p_stats->run_max = cycles;
+  }
+} /* APP_SEQ_PROF_Run */
+
+/**
+ * @brief  Get the statistics of a task
+ * @param  task_id: task id
+ * @param  p_stats: statistics
+ * @retval None
+ */
+void APP_SEQ_PROF_Get(uint32_t task_id, APP_SEQ_PROF_Task_t *p_stats)
+{
+  *p_stats = APP_SEQ_PROF_Stats[task_id % SEQ_PROF_TASK_NBR];
+} /* APP_SEQ_PROF_Get */
+
+/**
+ * @brief  Clear the statistics of all the tasks
+ * @param  None
+ * @retval None
+ */
+void APP_SEQ_PROF_Reset(void)
+{
+  uint32_t task_id;
+
+  memset(APP_SEQ_PROF_Stats, 0, sizeof(APP_SEQ_PROF_Stats));
+  for ( task_id = 0; task_id < SEQ_PROF_TASK_NBR; task_id++ )
+  {
+    APP_SEQ_PROF_Stats[task_id].run_min = UINT32_MAX;
+  }
+} /* APP_SEQ_PROF_Reset */
+
+/**
+ * @brief  Trace the statistics of the tasks run since the last reset (us)
+ * @param  None
+ * @retval None
+ */
+void APP_SEQ_PROF_Dump(void)
+{
+  const APP_SEQ_PROF_Task_t *p_stats;
+  uint32_t cycles_per_us = SEQ_PROF_CYCLES_PER_US;
+  uint32_t task_id;
+
+  APP_DBG("Task runs min/avg/max(us) latency max(us) <16us <64us <256us <1ms <4ms <16ms <64ms >=64ms");
+  for ( task_id = 0; task_id < SEQ_PROF_TASK_NBR; task_id++ )
+  {
+    p_stats = &APP_SEQ_PROF_Stats[task_id];
+    if ( p_stats->runs == 0u )
+    {
+      continue;
+    }
+    APP_DBG("%2d %6d %d/%d/%d %d %d %d %d %d %d %d %d %d", task_id, p_stats->runs,
+            p_stats->run_min / cycles_per_us,
+            (uint32_t)( p_stats->run_total / p_stats->runs ) / cycles_per_us,
+            p_stats->run_max / cycles_per_us,
+            p_stats->latency_max / cycles_per_us,
+            p_stats->latency[0], p_stats->latency[1], p_stats->latency[2], p_stats->latency[3],
+            p_stats->latency[4], p_stats->latency[5], p_stats->latency[6], p_stats->latency[7]);
+  }
+} /* APP_SEQ_PROF_Dump */
+#endif /* CFG_SEQ_PROF_ENABLE */
@@ -83,6 +83,7 @@
   */
 
 #include "app_common.h"
+#include "app_slot.h"
 
 #if !defined  (HSE_VALUE)
   #define HSE_VALUE    (32000000UL) /*!< Value of the External oscillator in Hz */
@@ -186,6 +187,10 @@ static void JumpFwApp( void );
 static void BootModeCheck( void );
 static void JumpSelectionOnPowerUp( void );
 static uint8_t  CheckFwAppValidity( void );
+#if (CFG_APP_AB_SLOTS)
+static uint8_t  SlotStateCheck( void );
+static void StartTrialWatchdog( void );
+#endif
 
 /**
  * Check the Boot mode request
@@ -194,6 +199,16 @@ static uint8_t  CheckFwAppValidity( void );
  */
 static void BootModeCheck( void )
 {
+#if (CFG_APP_AB_SLOTS)
+  if ( SlotStateCheck( ) != 0 )
+  {
+    /**
+     * Return to the startup file and run the Thread_Ota application to complete or revert the slots swap
+     */
+    return;
+  }
+#endif
+
   if ( LL_RCC_IsActiveFlag_SFTRST( ) || LL_RCC_IsActiveFlag_OBLRST( ) )
   {
     /**
@@ -315,6 +330,67 @@ static void JumpSelectionOnPowerUp( void )
   return;
 }
 
+#if (CFG_APP_AB_SLOTS)
+/**
+ * Check the A/B slots state written by the Thread_Ota application
+ * A new application is started once, on request of the Thread_Ota application, with the IWDG running.
+ * Any other reset before it is confirmed, or an unfinished swap, keeps the Thread_Ota application running
+ */
+static uint8_t SlotStateCheck( void )
+{
+  uint32_t state;
+
+  if ( ( READ_BIT( FLASH->SFR, FLASH_SFR_SFSA ) >> FLASH_SFR_SFSA_Pos ) <= CFG_APP_SLOT_STATE_SECTOR_INDEX )
+  {
+    /**
+     * The slot state page is in the secure flash, the slots are not used
+     */
+    return 0;
+  }
+
+  state = CFG_APP_SLOT_RECORD_STATE( APP_SLOT_GetState( NULL ) );
+
+  if ( state == CFG_APP_SLOT_TRIAL )
+  {
+    if ( LL_RCC_IsActiveFlag_SFTRST( ) && ( ( *(uint8_t*)SRAM1_BASE ) == CFG_REBOOT_ON_TRIAL_FW ) )
+    {
+      /**
+       * First start of the new application, it has CFG_APP_TRIAL_DEADLINE_S to confirm or refresh the IWDG
+       */
+      *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_DOWNLOADED_FW;
+      StartTrialWatchdog( );
+      JumpFwApp( );
+    }
+  }
+  else if ( ( state != CFG_APP_SLOT_PENDING ) && ( state != CFG_APP_SLOT_INSTALLING ) && ( state != CFG_APP_SLOT_REVERTING ) )
+  {
+    return 0;
+  }
+
+  *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_OTA_FW;
+  *((uint8_t*)SRAM1_BASE+1) = CFG_APP_START_SECTOR_INDEX;
+  *((uint8_t*)SRAM1_BASE+2) = 0xFF;
+
+  return 1;
+}
+
+/**
+ * Start the IWDG (LSI / 256) with a CFG_APP_TRIAL_DEADLINE_S period
+ * It cannot be stopped, the application shall keep refreshing it
+ */
+static void StartTrialWatchdog( void )
+{
+  IWDG->KR = 0x0000CCCCU;
+  IWDG->KR = 0x00005555U;
+  IWDG->PR = IWDG_PR_PR_2 | IWDG_PR_PR_1;
+  IWDG->RLR = ( CFG_APP_TRIAL_DEADLINE_S * 32000U ) / 256U;
+  while ( IWDG->SR != 0U );
+  IWDG->KR = 0x0000AAAAU;
+
+  return;
+}
+#endif
+
 /**
  * Jump to existing FW App in flash
  * It never returns
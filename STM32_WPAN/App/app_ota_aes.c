@@ -0,0 +1,259 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_aes.c
+  * Description        : AES-128 CTR decryption of encrypted OTA images.
+  *                      Chunks are decrypted as received, at any byte offset,
+  *                      straight into the RAM staging buffer. The stream
+  *                      position is the only state : a transfer is resumed
+  *                      by seeking to the offset already written to flash.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "app_ota_aes.h"
+#if defined(USE_HAL_DRIVER)
+#include "stm32wbxx_hal.h"
+#endif
+
+#if defined(HAL_CRYP_MODULE_ENABLED)
+/* Private defines -----------------------------------------------------------*/
+#define AES_CRYP_TIMEOUT                       10u  /* ms */
+
+/* Private variables ---------------------------------------------------------*/
+static CRYP_HandleTypeDef APP_OTA_AES_hcryp;
+static uint32_t APP_OTA_AES_key[OTA_AES_KEY_SIZE / 4u];
+
+/* Functions Definition ------------------------------------------------------*/
+
+/**
+ * @brief  Load the key in the AES1 peripheral, ECB mode
+ * @param  p_ctr: CTR context
+ * @param  p_key: OTA_AES_KEY_SIZE bytes
+ * @retval None
+ */
+static void APP_OTA_AES_SetKey(APP_OTA_AES_Ctr_t *p_ctr, const uint8_t *p_key)
+{
+  uint32_t index;
+
+  (void)p_ctr;
+  for (index = 0; index < (OTA_AES_KEY_SIZE / 4u); index++)
+  {
+    APP_OTA_AES_key[index] = ((uint32_t)p_key[4u * index] << 24) | ((uint32_t)p_key[4u * index + 1u] << 16)
+                             | ((uint32_t)p_key[4u * index + 2u] << 8) | (uint32_t)p_key[4u * index + 3u];
+  }
+
+  __HAL_RCC_AES1_CLK_ENABLE();
+  (void)HAL_CRYP_DeInit(&APP_OTA_AES_hcryp);
+  APP_OTA_AES_hcryp.Instance = AES1;
+  APP_OTA_AES_hcryp.Init.DataType = CRYP_DATATYPE_8B;
+  APP_OTA_AES_hcryp.Init.KeySize = CRYP_KEYSIZE_128B;
+  APP_OTA_AES_hcryp.Init.pKey = APP_OTA_AES_key;
+  APP_OTA_AES_hcryp.Init.Algorithm = CRYP_AES_ECB;
+  APP_OTA_AES_hcryp.Init.DataWidthUnit = CRYP_DATAWIDTHUNIT_BYTE;
+  (void)HAL_CRYP_Init(&APP_OTA_AES_hcryp);
+}
+
+/**
+ * @brief  Encrypt one block with the AES1 peripheral
+ * @param  p_ctr: CTR context
+ * @param  p_in: plain block
+ * @param  p_out: encrypted block
+ * @retval None
+ */
+static void APP_OTA_AES_EncryptBlock(const APP_OTA_AES_Ctr_t *p_ctr, const uint8_t *p_in, uint8_t *p_out)
+{
+  uint32_t in[OTA_AES_BLOCK_SIZE / 4u];
+  uint32_t out[OTA_AES_BLOCK_SIZE / 4u];
+
+  (void)p_ctr;
+  memcpy(in, p_in, sizeof(in));
+  (void)HAL_CRYP_Encrypt(&APP_OTA_AES_hcryp, in, OTA_AES_BLOCK_SIZE, out, AES_CRYP_TIMEOUT);
+  memcpy(p_out, out, sizeof(out));
+}
+
+#else /* HAL_CRYP_MODULE_ENABLED */
+
+/* Private macros ------------------------------------------------------------*/
+#define XTIME(x)                               ((uint8_t)(((x) << 1) ^ ((((x) >> 7) & 1u) * 0x1Bu)))
+
+/* Private variables ---------------------------------------------------------*/
+static const uint8_t APP_OTA_AES_Sbox[256] =
+{
+  0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+  0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+  0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+  0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+  0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+  0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+  0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+  0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+  0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+  0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+  0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+  0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+  0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+  0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+  0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+  0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
+};
+
+/* Functions Definition ------------------------------------------------------*/
+
+/**
+ * @brief  Expand the key
+ * @param  p_ctr: CTR context
+ * @param  p_key: OTA_AES_KEY_SIZE bytes
+ * @retval None
+ */
+static void APP_OTA_AES_SetKey(APP_OTA_AES_Ctr_t *p_ctr, const uint8_t *p_key)
+{
+  uint8_t *rk = p_ctr->round_keys;
+  uint8_t rcon = 0x01u;
+  uint8_t temp[4];
+  uint32_t index;
+
+  memcpy(rk, p_key, OTA_AES_KEY_SIZE);
+  for (index = OTA_AES_KEY_SIZE; index < sizeof(p_ctr->round_keys); index += 4u)
+  {
+    memcpy(temp, &rk[index - 4u], 4u);
+    if ((index % OTA_AES_KEY_SIZE) == 0u)
+    {
+      /* RotWord, SubWord, Rcon */
+      uint8_t first = temp[0];
+      temp[0] = APP_OTA_AES_Sbox[temp[1]] ^ rcon;
+      temp[1] = APP_OTA_AES_Sbox[temp[2]];
+      temp[2] = APP_OTA_AES_Sbox[temp[3]];
+      temp[3] = APP_OTA_AES_Sbox[first];
+      rcon = XTIME(rcon);
+    }
+    rk[index]      = rk[index - OTA_AES_KEY_SIZE] ^ temp[0];
+    rk[index + 1u] = rk[index + 1u - OTA_AES_KEY_SIZE] ^ temp[1];
+    rk[index + 2u] = rk[index + 2u - OTA_AES_KEY_SIZE] ^ temp[2];
+    rk[index + 3u] = rk[index + 3u - OTA_AES_KEY_SIZE] ^ temp[3];
+  }
+}
+
+/**
+ * @brief  Encrypt one block (FIPS 197)
+ * @param  p_ctr: CTR context
+ * @param  p_in: plain block
+ * @param  p_out: encrypted block
+ * @retval None
+ */
+static void APP_OTA_AES_EncryptBlock(const APP_OTA_AES_Ctr_t *p_ctr, const uint8_t *p_in, uint8_t *p_out)
+{
+  uint8_t s[OTA_AES_BLOCK_SIZE];
+  uint8_t t[OTA_AES_BLOCK_SIZE];
+  uint8_t a0, a1, a2, a3, all;
+  uint32_t round, index, column;
+
+  for (index = 0; index < OTA_AES_BLOCK_SIZE; index++)
+  {
+    s[index] = p_in[index] ^ p_ctr->round_keys[index];
+  }
+  for (round = 1; round <= 10u; round++)
+  {
+    /* SubBytes and ShiftRows, state stored column by column */
+    for (index = 0; index < OTA_AES_BLOCK_SIZE; index++)
+    {
+      t[index] = APP_OTA_AES_Sbox[s[(index + 4u * (index % 4u)) % OTA_AES_BLOCK_SIZE]];
+    }
+    if (round != 10u)
+    {
+      /* MixColumns */
+      for (column = 0; column < 4u; column++)
+      {
+        a0 = t[4u * column]; a1 = t[4u * column + 1u]; a2 = t[4u * column + 2u]; a3 = t[4u * column + 3u];
+        all = a0 ^ a1 ^ a2 ^ a3;
+        t[4u * column]      = a0 ^ all ^ XTIME(a0 ^ a1);
+        t[4u * column + 1u] = a1 ^ all ^ XTIME(a1 ^ a2);
+        t[4u * column + 2u] = a2 ^ all ^ XTIME(a2 ^ a3);
+        t[4u * column + 3u] = a3 ^ all ^ XTIME(a3 ^ a0);
+      }
+    }
+    for (index = 0; index < OTA_AES_BLOCK_SIZE; index++)
+    {
+      s[index] = t[index] ^ p_ctr->round_keys[round * OTA_AES_BLOCK_SIZE + index];
+    }
+  }
+  memcpy(p_out, s, OTA_AES_BLOCK_SIZE);
+}
+
+#endif /* HAL_CRYP_MODULE_ENABLED */
+
+/**
+ * @brief  Compute the keystream of the block holding the current offset
+ * @param  p_ctr: CTR context
+ * @retval None
+ */
+static void APP_OTA_AES_NextKeystream(APP_OTA_AES_Ctr_t *p_ctr)
+{
+  uint8_t counter[OTA_AES_BLOCK_SIZE];
+  uint32_t carry = p_ctr->offset / OTA_AES_BLOCK_SIZE;
+  uint32_t index = OTA_AES_BLOCK_SIZE;
+
+  /* counter = IV + block number, 128 bits big endian */
+  while (index-- > 0u)
+  {
+    carry += p_ctr->iv[index];
+    counter[index] = (uint8_t)carry;
+    carry >>= 8;
+  }
+  APP_OTA_AES_EncryptBlock(p_ctr, counter, p_ctr->keystream);
+}
+
+/**
+ * @brief  Start (or resume) a CTR stream
+ * @param  p_ctr: CTR context
+ * @param  p_key: OTA_AES_KEY_SIZE bytes
+ * @param  p_iv: initial counter block
+ * @param  offset: stream position to resume from, 0 for a new stream
+ * @retval None
+ */
+void APP_OTA_AES_CtrInit(APP_OTA_AES_Ctr_t *p_ctr, const uint8_t *p_key, const uint8_t *p_iv, uint32_t offset)
+{
+  memset(p_ctr, 0, sizeof(*p_ctr));
+  APP_OTA_AES_SetKey(p_ctr, p_key);
+  memcpy(p_ctr->iv, p_iv, OTA_AES_BLOCK_SIZE);
+  p_ctr->offset = offset;
+  if ((offset % OTA_AES_BLOCK_SIZE) != 0u)
+  {
+    APP_OTA_AES_NextKeystream(p_ctr);
+  }
+}
+
+/**
+ * @brief  Decrypt (or encrypt) a chunk, input and output may be the same buffer
+ * @param  p_ctr: CTR context
+ * @param  p_in: input data
+ * @param  p_out: output data
+ * @param  size: data length
+ * @retval None
+ */
+void APP_OTA_AES_CtrProcess(APP_OTA_AES_Ctr_t *p_ctr, const uint8_t *p_in, uint8_t *p_out, uint32_t size)
+{
+  uint32_t index;
+  uint32_t position;
+
+  for (index = 0; index < size; index++)
+  {
+    position = p_ctr->offset % OTA_AES_BLOCK_SIZE;
+    if (position == 0u)
+    {
+      APP_OTA_AES_NextKeystream(p_ctr);
+    }
+    p_out[index] = p_in[index] ^ p_ctr->keystream[position];
+    p_ctr->offset++;
+  }
+}
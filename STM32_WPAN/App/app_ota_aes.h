@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_aes.h
+  * Description        : Header for the AES-128 CTR decryption of encrypted
+  *                      OTA images.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef APP_OTA_AES_H
+#define APP_OTA_AES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported defines ----------------------------------------------------------*/
+/**
+ * Counter mode as in NIST SP 800-38A (must match Tools/ota_aes.py) : the
+ * counter block of the n-th 16 bytes block is IV + n, big endian. The
+ * keystream is computed by the AES1 peripheral when HAL_CRYP_MODULE_ENABLED
+ * is defined in stm32wbxx_hal_conf.h, in software otherwise.
+ */
+#define OTA_AES_KEY_SIZE                       16u
+#define OTA_AES_BLOCK_SIZE                     16u
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint8_t  round_keys[11u * OTA_AES_BLOCK_SIZE]; /**< expanded key (software implementation) */
+  uint8_t  iv[OTA_AES_BLOCK_SIZE];               /**< initial counter block */
+  uint8_t  keystream[OTA_AES_BLOCK_SIZE];        /**< keystream of the current block */
+  uint32_t offset;                               /**< bytes processed since the IV */
+} APP_OTA_AES_Ctr_t;
+
+/* Exported functions ------------------------------------------------------- */
+void APP_OTA_AES_CtrInit(APP_OTA_AES_Ctr_t *p_ctr, const uint8_t *p_key, const uint8_t *p_iv, uint32_t offset);
+void APP_OTA_AES_CtrProcess(APP_OTA_AES_Ctr_t *p_ctr, const uint8_t *p_in, uint8_t *p_out, uint32_t size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* APP_OTA_AES_H */
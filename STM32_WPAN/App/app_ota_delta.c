@@ -0,0 +1,200 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_delta.c
+  * Description        : Streaming patch applier for delta OTA images.
+  *                      The new image is rebuilt from copy operations taken
+  *                      from the image currently installed in flash and from
+  *                      insert operations carried by the patch itself.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "app_ota_delta.h"
+
+/* Private defines -----------------------------------------------------------*/
+#define DELTA_STATE_OP                         0u  /* waiting for an operation code */
+#define DELTA_STATE_ARGS                       1u  /* receiving operation arguments */
+#define DELTA_STATE_COPY                       2u  /* copying from the installed image */
+#define DELTA_STATE_INSERT                     3u  /* copying bytes from the patch */
+
+#define DELTA_MIN(a, b)                        (((a) < (b)) ? (a) : (b))
+
+/* Functions Definition ------------------------------------------------------*/
+
+/**
+ * @brief  Initialize the patcher for a new patch
+ * @param  p_patch: patcher
+ * @param  p_source: installed image
+ * @param  source_size: installed image size
+ * @retval None
+ */
+void APP_OTA_DELTA_Init(APP_OTA_DELTA_Patcher_t *p_patch, const uint8_t *p_source, uint32_t source_size)
+{
+  memset(p_patch, 0, sizeof(*p_patch));
+  p_patch->p_source = p_source;
+  p_patch->source_size = source_size;
+  p_patch->state = DELTA_STATE_OP;
+}
+
+/**
+ * @brief  Decode the arguments of the current operation once all received
+ * @param  p_patch: patcher
+ * @retval APP_OTA_DELTA_ERROR on an out of range or empty operation
+ */
+static APP_OTA_DELTA_StatusTypeDef APP_OTA_DELTA_StartOp(APP_OTA_DELTA_Patcher_t *p_patch)
+{
+  const uint8_t *args = p_patch->args;
+
+  if (p_patch->op == OTA_DELTA_OP_COPY)
+  {
+    p_patch->src_pos = (uint32_t)args[0] | ((uint32_t)args[1] << 8) | ((uint32_t)args[2] << 16) | ((uint32_t)args[3] << 24);
+    p_patch->remaining = (uint32_t)args[4] | ((uint32_t)args[5] << 8);
+    if ((p_patch->src_pos > p_patch->source_size) || (p_patch->remaining > (p_patch->source_size - p_patch->src_pos)))
+    {
+      return APP_OTA_DELTA_ERROR;
+    }
+    p_patch->state = DELTA_STATE_COPY;
+  }
+  else
+  {
+    p_patch->remaining = (uint32_t)args[0] | ((uint32_t)args[1] << 8);
+    p_patch->state = DELTA_STATE_INSERT;
+  }
+
+  return (p_patch->remaining == 0u) ? APP_OTA_DELTA_ERROR : APP_OTA_DELTA_OK;
+}
+
+/**
+ * @brief  Apply a chunk of patch data
+ *         Processing stops either when all the input is consumed (and no copy
+ *         from the installed image is pending) or when the output buffer is full.
+ * @param  p_patch: patcher
+ * @param  p_in: patch data
+ * @param  in_len: patch data length
+ * @param  p_consumed: number of patch bytes consumed
+ * @param  p_out: output buffer
+ * @param  out_size: space available in output buffer
+ * @param  p_produced: number of bytes of the new image written in output buffer
+ * @retval APP_OTA_DELTA_ERROR on a malformed patch
+ */
+APP_OTA_DELTA_StatusTypeDef APP_OTA_DELTA_Apply(APP_OTA_DELTA_Patcher_t *p_patch,
+                                                const uint8_t *p_in, uint32_t in_len, uint32_t *p_consumed,
+                                                uint8_t *p_out, uint32_t out_size, uint32_t *p_produced)
+{
+  APP_OTA_DELTA_StatusTypeDef status = APP_OTA_DELTA_OK;
+  uint32_t in_index = 0;
+  uint32_t out_index = 0;
+  uint32_t size;
+  uint8_t  args_size;
+
+  while ((out_index < out_size) && (status == APP_OTA_DELTA_OK))
+  {
+    if (p_patch->state == DELTA_STATE_COPY)
+    {
+      size = DELTA_MIN(p_patch->remaining, out_size - out_index);
+      memcpy(&p_out[out_index], &p_patch->p_source[p_patch->src_pos], size);
+      p_patch->src_pos += size;
+      p_patch->remaining -= size;
+      out_index += size;
+      if (p_patch->remaining == 0u)
+      {
+        p_patch->state = DELTA_STATE_OP;
+      }
+      continue;
+    }
+
+    if (in_index == in_len)
+    {
+      break;
+    }
+
+    if (p_patch->state == DELTA_STATE_INSERT)
+    {
+      size = DELTA_MIN(DELTA_MIN(p_patch->remaining, out_size - out_index), in_len - in_index);
+      memcpy(&p_out[out_index], &p_in[in_index], size);
+      in_index += size;
+      p_patch->remaining -= size;
+      out_index += size;
+      if (p_patch->remaining == 0u)
+      {
+        p_patch->state = DELTA_STATE_OP;
+      }
+    }
+    else if (p_patch->state == DELTA_STATE_OP)
+    {
+      p_patch->op = p_in[in_index++];
+      p_patch->args_len = 0;
+      p_patch->state = DELTA_STATE_ARGS;
+      if ((p_patch->op != OTA_DELTA_OP_COPY) && (p_patch->op != OTA_DELTA_OP_INSERT))
+      {
+        status = APP_OTA_DELTA_ERROR;
+      }
+    }
+    else
+    {
+      args_size = (p_patch->op == OTA_DELTA_OP_COPY) ? OTA_DELTA_COPY_ARGS_SIZE : OTA_DELTA_INSERT_ARGS_SIZE;
+      p_patch->args[p_patch->args_len++] = p_in[in_index++];
+      if (p_patch->args_len == args_size)
+      {
+        status = APP_OTA_DELTA_StartOp(p_patch);
+      }
+    }
+  }
+
+  *p_consumed = in_index;
+  *p_produced = out_index;
+  return status;
+}
+
+/**
+ * @brief  Check if output is still pending without further input
+ * @param  p_patch: patcher
+ * @retval true if a copy from the installed image is in progress
+ */
+bool APP_OTA_DELTA_IsPending(const APP_OTA_DELTA_Patcher_t *p_patch)
+{
+  return (p_patch->state == DELTA_STATE_COPY);
+}
+
+/**
+ * @brief  Serialize the patcher state to be checkpointed with the OTA context.
+ *         Only called once the output buffer is full, i.e. never in the middle
+ *         of operation arguments.
+ * @param  p_patch: patcher
+ * @param  p_ctx: OTA_DELTA_CTX_WORDS words to fill
+ * @retval None
+ */
+void APP_OTA_DELTA_Save(const APP_OTA_DELTA_Patcher_t *p_patch, uint32_t *p_ctx)
+{
+  p_ctx[0] = (uint32_t)p_patch->state | ((uint32_t)p_patch->op << 8);
+  p_ctx[1] = p_patch->src_pos;
+  p_ctx[2] = p_patch->remaining;
+  p_ctx[3] = p_patch->source_size;
+}
+
+/**
+ * @brief  Restore a patcher checkpointed with APP_OTA_DELTA_Save
+ * @param  p_patch: patcher
+ * @param  p_ctx: OTA_DELTA_CTX_WORDS words saved
+ * @param  p_source: installed image
+ * @retval None
+ */
+void APP_OTA_DELTA_Restore(APP_OTA_DELTA_Patcher_t *p_patch, const uint32_t *p_ctx, const uint8_t *p_source)
+{
+  APP_OTA_DELTA_Init(p_patch, p_source, p_ctx[3]);
+  p_patch->state = (uint8_t)(p_ctx[0] & 0xFFu);
+  p_patch->op = (uint8_t)((p_ctx[0] >> 8) & 0xFFu);
+  p_patch->src_pos = p_ctx[1];
+  p_patch->remaining = p_ctx[2];
+}
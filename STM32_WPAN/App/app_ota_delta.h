@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_delta.h
+  * Description        : Header for the streaming patch applier used by the OTA
+  *                      client to rebuild an application from a delta image.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef APP_OTA_DELTA_H
+#define APP_OTA_DELTA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "stdbool.h"
+
+/* Exported defines ----------------------------------------------------------*/
+/**
+ * Patch format (must match Tools/ota_delta.py), all fields little endian :
+ *  - OTA_DELTA_OP_COPY   : source offset (uint32) + length (uint16),
+ *                          bytes copied from the installed image
+ *  - OTA_DELTA_OP_INSERT : length (uint16) followed by the new bytes
+ */
+#define OTA_DELTA_OP_COPY                      0x01u
+#define OTA_DELTA_OP_INSERT                    0x02u
+#define OTA_DELTA_COPY_ARGS_SIZE               6u
+#define OTA_DELTA_INSERT_ARGS_SIZE             2u
+
+/* Number of 32 bits words needed to checkpoint the patcher state in NVM */
+#define OTA_DELTA_CTX_WORDS                    4u
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  APP_OTA_DELTA_OK    = 0x00,
+  APP_OTA_DELTA_ERROR = 0x01,
+} APP_OTA_DELTA_StatusTypeDef;
+
+typedef struct
+{
+  const uint8_t *p_source;                      /**< installed image (read from flash) */
+  uint32_t source_size;                         /**< installed image size */
+  uint32_t src_pos;                             /**< source offset of the copy in progress */
+  uint32_t remaining;                           /**< bytes left in the current copy/insert */
+  uint8_t  state;                               /**< parser state */
+  uint8_t  op;                                  /**< current operation */
+  uint8_t  args_len;                            /**< operation argument bytes received */
+  uint8_t  args[OTA_DELTA_COPY_ARGS_SIZE];      /**< operation arguments */
+} APP_OTA_DELTA_Patcher_t;
+
+/* Exported functions ------------------------------------------------------- */
+void APP_OTA_DELTA_Init(APP_OTA_DELTA_Patcher_t *p_patch, const uint8_t *p_source, uint32_t source_size);
+APP_OTA_DELTA_StatusTypeDef APP_OTA_DELTA_Apply(APP_OTA_DELTA_Patcher_t *p_patch,
+                                                const uint8_t *p_in, uint32_t in_len, uint32_t *p_consumed,
+                                                uint8_t *p_out, uint32_t out_size, uint32_t *p_produced);
+bool APP_OTA_DELTA_IsPending(const APP_OTA_DELTA_Patcher_t *p_patch);
+void APP_OTA_DELTA_Save(const APP_OTA_DELTA_Patcher_t *p_patch, uint32_t *p_ctx);
+void APP_OTA_DELTA_Restore(APP_OTA_DELTA_Patcher_t *p_patch, const uint32_t *p_ctx, const uint8_t *p_source);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* APP_OTA_DELTA_H */
@@ -0,0 +1,530 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_ecdsa.c
+  * Description        : ECDSA P-256 signature verification of OTA images.
+  *                      The PKA computes the verification when its HAL driver
+  *                      is enabled. Otherwise a portable implementation is
+  *                      used (Montgomery arithmetic on 32 bits words, Jacobian
+  *                      coordinates), it only handles public data so it is
+  *                      not written to run in constant time.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "app_ota_ecdsa.h"
+#if defined(USE_HAL_DRIVER)
+#include "stm32wbxx_hal.h"
+#endif
+
+#if defined(HAL_PKA_MODULE_ENABLED)
+#include "stm32wbxx_ll_hsem.h"
+#include "hw_conf.h"
+
+/* Private defines -----------------------------------------------------------*/
+#define ECDSA_PKA_TIMEOUT                      5000u  /* ms */
+
+/* Private variables ---------------------------------------------------------*/
+static const uint8_t APP_OTA_ECDSA_P256_p[32] =
+{
+  0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+static const uint8_t APP_OTA_ECDSA_P256_n[32] =
+{
+  0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xBC, 0xE6, 0xFA, 0xAD, 0xA7, 0x17, 0x9E, 0x84, 0xF3, 0xB9, 0xCA, 0xC2, 0xFC, 0x63, 0x25, 0x51,
+};
+static const uint8_t APP_OTA_ECDSA_P256_gx[32] =
+{
+  0x6B, 0x17, 0xD1, 0xF2, 0xE1, 0x2C, 0x42, 0x47, 0xF8, 0xBC, 0xE6, 0xE5, 0x63, 0xA4, 0x40, 0xF2,
+  0x77, 0x03, 0x7D, 0x81, 0x2D, 0xEB, 0x33, 0xA0, 0xF4, 0xA1, 0x39, 0x45, 0xD8, 0x98, 0xC2, 0x96,
+};
+static const uint8_t APP_OTA_ECDSA_P256_gy[32] =
+{
+  0x4F, 0xE3, 0x42, 0xE2, 0xFE, 0x1A, 0x7F, 0x9B, 0x8E, 0xE7, 0xEB, 0x4A, 0x7C, 0x0F, 0x9E, 0x16,
+  0x2B, 0xCE, 0x33, 0x57, 0x6B, 0x31, 0x5E, 0xCE, 0xCB, 0xB6, 0x40, 0x68, 0x37, 0xBF, 0x51, 0xF5,
+};
+/* |a|, a = -3 */
+static const uint8_t APP_OTA_ECDSA_P256_abs_a[32] =
+{
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03,
+};
+
+/* Functions Definition ------------------------------------------------------*/
+
+/**
+ * @brief  Verify an ECDSA P-256 signature with the PKA
+ *         The PKA is shared with the CPU2, its access is protected by CFG_HW_PKA_SEMID.
+ * @param  p_public_key: X || Y
+ * @param  p_hash: SHA-256 digest of the signed data
+ * @param  p_signature: r || s
+ * @retval true if the signature is valid
+ */
+bool APP_OTA_ECDSA_Verify(const uint8_t *p_public_key, const uint8_t *p_hash, const uint8_t *p_signature)
+{
+  PKA_HandleTypeDef hpka = {0};
+  PKA_ECDSAVerifInTypeDef in = {0};
+  bool valid = false;
+
+  while (LL_HSEM_1StepLock(HSEM, CFG_HW_PKA_SEMID));
+  __HAL_RCC_PKA_CLK_ENABLE();
+  hpka.Instance = PKA;
+  if (HAL_PKA_Init(&hpka) == HAL_OK)
+  {
+    in.primeOrderSize = sizeof(APP_OTA_ECDSA_P256_n);
+    in.modulusSize = sizeof(APP_OTA_ECDSA_P256_p);
+    in.coefSign = 1u;
+    in.coef = APP_OTA_ECDSA_P256_abs_a;
+    in.modulus = APP_OTA_ECDSA_P256_p;
+    in.basePointX = APP_OTA_ECDSA_P256_gx;
+    in.basePointY = APP_OTA_ECDSA_P256_gy;
+    in.pPubKeyCurvePtX = &p_public_key[0];
+    in.pPubKeyCurvePtY = &p_public_key[32];
+    in.RSign = &p_signature[0];
+    in.SSign = &p_signature[32];
+    in.hash = p_hash;
+    in.primeOrder = APP_OTA_ECDSA_P256_n;
+
+    if (HAL_PKA_ECDSAVerif(&hpka, &in, ECDSA_PKA_TIMEOUT) == HAL_OK)
+    {
+      valid = (HAL_PKA_ECDSAVerif_IsValidSignature(&hpka) != 0u);
+    }
+    HAL_PKA_DeInit(&hpka);
+  }
+  __HAL_RCC_PKA_CLK_DISABLE();
+  LL_HSEM_ReleaseLock(HSEM, CFG_HW_PKA_SEMID, 0);
+
+  return valid;
+}
+
+#else /* HAL_PKA_MODULE_ENABLED */
+
+/* Private defines -----------------------------------------------------------*/
+#define ECDSA_WORDS                            8u    /* 256 bits numbers, least significant word first */
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  const uint32_t *m;                       /**< modulus */
+  const uint32_t *r2;                      /**< 2^512 mod m */
+  uint32_t m0_inv;                         /**< -m^-1 mod 2^32 */
+} APP_OTA_ECDSA_Modulus_t;
+
+typedef struct
+{
+  uint32_t x[ECDSA_WORDS];
+  uint32_t y[ECDSA_WORDS];
+  uint32_t z[ECDSA_WORDS];                 /**< 0 for the point at infinity */
+} APP_OTA_ECDSA_Point_t;
+
+/* Private variables ---------------------------------------------------------*/
+static const uint32_t APP_OTA_ECDSA_P256_p[ECDSA_WORDS] =
+  { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0x00000000, 0x00000000, 0x00000001, 0xFFFFFFFF };
+static const uint32_t APP_OTA_ECDSA_P256_p_r2[ECDSA_WORDS] =
+  { 0x00000003, 0x00000000, 0xFFFFFFFF, 0xFFFFFFFB, 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFD, 0x00000004 };
+static const uint32_t APP_OTA_ECDSA_P256_n[ECDSA_WORDS] =
+  { 0xFC632551, 0xF3B9CAC2, 0xA7179E84, 0xBCE6FAAD, 0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0xFFFFFFFF };
+static const uint32_t APP_OTA_ECDSA_P256_n_r2[ECDSA_WORDS] =
+  { 0xBE79EEA2, 0x83244C95, 0x49BD6FA6, 0x4699799C, 0x2B6BEC59, 0x2845B239, 0xF3D95620, 0x66E12D94 };
+static const uint32_t APP_OTA_ECDSA_P256_b[ECDSA_WORDS] =
+  { 0x27D2604B, 0x3BCE3C3E, 0xCC53B0F6, 0x651D06B0, 0x769886BC, 0xB3EBBD55, 0xAA3A93E7, 0x5AC635D8 };
+static const uint32_t APP_OTA_ECDSA_P256_gx[ECDSA_WORDS] =
+  { 0xD898C296, 0xF4A13945, 0x2DEB33A0, 0x77037D81, 0x63A440F2, 0xF8BCE6E5, 0xE12C4247, 0x6B17D1F2 };
+static const uint32_t APP_OTA_ECDSA_P256_gy[ECDSA_WORDS] =
+  { 0x37BF51F5, 0xCBB64068, 0x6B315ECE, 0x2BCE3357, 0x7C0F9E16, 0x8EE7EB4A, 0xFE1A7F9B, 0x4FE342E2 };
+static const uint32_t APP_OTA_ECDSA_One[ECDSA_WORDS] = { 1 };
+
+static const APP_OTA_ECDSA_Modulus_t APP_OTA_ECDSA_ModP = { APP_OTA_ECDSA_P256_p, APP_OTA_ECDSA_P256_p_r2, 0x00000001 };
+static const APP_OTA_ECDSA_Modulus_t APP_OTA_ECDSA_ModN = { APP_OTA_ECDSA_P256_n, APP_OTA_ECDSA_P256_n_r2, 0xEE00BC4F };
+
+/* Functions Definition ------------------------------------------------------*/
+
+/**
+ * @brief  Load a big endian 256 bits number
+ * @param  p_r: result
+ * @param  p_bytes: 32 bytes
+ * @retval None
+ */
+static void APP_OTA_ECDSA_FromBytes(uint32_t *p_r, const uint8_t *p_bytes)
+{
+  uint32_t index;
+
+  for (index = 0; index < ECDSA_WORDS; index++)
+  {
+    p_r[ECDSA_WORDS - 1u - index] = ((uint32_t)p_bytes[4u * index] << 24) | ((uint32_t)p_bytes[4u * index + 1u] << 16)
+                                    | ((uint32_t)p_bytes[4u * index + 2u] << 8) | (uint32_t)p_bytes[4u * index + 3u];
+  }
+}
+
+/**
+ * @brief  Compare two numbers
+ * @retval -1, 0 or 1 as a is lower, equal or greater than b
+ */
+static int APP_OTA_ECDSA_Cmp(const uint32_t *p_a, const uint32_t *p_b)
+{
+  uint32_t index = ECDSA_WORDS;
+
+  while (index-- > 0u)
+  {
+    if (p_a[index] != p_b[index])
+    {
+      return (p_a[index] > p_b[index]) ? 1 : -1;
+    }
+  }
+  return 0;
+}
+
+static bool APP_OTA_ECDSA_IsZero(const uint32_t *p_a)
+{
+  uint32_t acc = 0;
+  uint32_t index;
+
+  for (index = 0; index < ECDSA_WORDS; index++)
+  {
+    acc |= p_a[index];
+  }
+  return (acc == 0u);
+}
+
+/**
+ * @brief  r = a + b
+ * @retval carry
+ */
+static uint32_t APP_OTA_ECDSA_Add(uint32_t *p_r, const uint32_t *p_a, const uint32_t *p_b)
+{
+  uint64_t acc = 0;
+  uint32_t index;
+
+  for (index = 0; index < ECDSA_WORDS; index++)
+  {
+    acc += (uint64_t)p_a[index] + p_b[index];
+    p_r[index] = (uint32_t)acc;
+    acc >>= 32;
+  }
+  return (uint32_t)acc;
+}
+
+/**
+ * @brief  r = a - b
+ * @retval borrow
+ */
+static uint32_t APP_OTA_ECDSA_Sub(uint32_t *p_r, const uint32_t *p_a, const uint32_t *p_b)
+{
+  uint64_t acc = 0;
+  uint32_t index;
+
+  for (index = 0; index < ECDSA_WORDS; index++)
+  {
+    acc = (uint64_t)p_a[index] - p_b[index] - (uint32_t)(acc >> 63);
+    p_r[index] = (uint32_t)acc;
+  }
+  return (uint32_t)(acc >> 63);
+}
+
+/**
+ * @brief  r = a + b mod m, with a, b < m
+ */
+static void APP_OTA_ECDSA_ModAdd(uint32_t *p_r, const uint32_t *p_a, const uint32_t *p_b, const APP_OTA_ECDSA_Modulus_t *p_mod)
+{
+  if ((APP_OTA_ECDSA_Add(p_r, p_a, p_b) != 0u) || (APP_OTA_ECDSA_Cmp(p_r, p_mod->m) >= 0))
+  {
+    (void)APP_OTA_ECDSA_Sub(p_r, p_r, p_mod->m);
+  }
+}
+
+/**
+ * @brief  r = a - b mod m, with a, b < m
+ */
+static void APP_OTA_ECDSA_ModSub(uint32_t *p_r, const uint32_t *p_a, const uint32_t *p_b, const APP_OTA_ECDSA_Modulus_t *p_mod)
+{
+  if (APP_OTA_ECDSA_Sub(p_r, p_a, p_b) != 0u)
+  {
+    (void)APP_OTA_ECDSA_Add(p_r, p_r, p_mod->m);
+  }
+}
+
+/**
+ * @brief  Montgomery product r = a * b * 2^-256 mod m, with a, b < m (CIOS method)
+ *         r may be one of the operands.
+ */
+static void APP_OTA_ECDSA_MontMul(uint32_t *p_r, const uint32_t *p_a, const uint32_t *p_b, const APP_OTA_ECDSA_Modulus_t *p_mod)
+{
+  uint32_t t[ECDSA_WORDS + 2u] = {0};
+  uint64_t acc;
+  uint32_t q, i, j;
+
+  for (i = 0; i < ECDSA_WORDS; i++)
+  {
+    acc = 0;
+    for (j = 0; j < ECDSA_WORDS; j++)
+    {
+      acc = (uint64_t)t[j] + (uint64_t)p_a[j] * p_b[i] + (acc >> 32);
+      t[j] = (uint32_t)acc;
+    }
+    acc = (uint64_t)t[ECDSA_WORDS] + (acc >> 32);
+    t[ECDSA_WORDS] = (uint32_t)acc;
+    t[ECDSA_WORDS + 1u] = (uint32_t)(acc >> 32);
+
+    q = t[0] * p_mod->m0_inv;
+    acc = (uint64_t)t[0] + (uint64_t)q * p_mod->m[0];
+    for (j = 1; j < ECDSA_WORDS; j++)
+    {
+      acc = (uint64_t)t[j] + (uint64_t)q * p_mod->m[j] + (acc >> 32);
+      t[j - 1u] = (uint32_t)acc;
+    }
+    acc = (uint64_t)t[ECDSA_WORDS] + (acc >> 32);
+    t[ECDSA_WORDS - 1u] = (uint32_t)acc;
+    t[ECDSA_WORDS] = t[ECDSA_WORDS + 1u] + (uint32_t)(acc >> 32);
+  }
+
+  if ((t[ECDSA_WORDS] != 0u) || (APP_OTA_ECDSA_Cmp(t, p_mod->m) >= 0))
+  {
+    (void)APP_OTA_ECDSA_Sub(t, t, p_mod->m);
+  }
+  memcpy(p_r, t, ECDSA_WORDS * sizeof(uint32_t));
+}
+
+/**
+ * @brief  Montgomery inverse r = (a * 2^-256)^-1 * 2^256 mod m, m prime (a^(m-2))
+ */
+static void APP_OTA_ECDSA_MontInv(uint32_t *p_r, const uint32_t *p_a, const APP_OTA_ECDSA_Modulus_t *p_mod)
+{
+  static const uint32_t two[ECDSA_WORDS] = { 2 };
+  uint32_t exponent[ECDSA_WORDS];
+  uint32_t result[ECDSA_WORDS];
+  int bit;
+
+  (void)APP_OTA_ECDSA_Sub(exponent, p_mod->m, two);
+  /* 1 in Montgomery form */
+  APP_OTA_ECDSA_MontMul(result, APP_OTA_ECDSA_One, p_mod->r2, p_mod);
+  for (bit = 255; bit >= 0; bit--)
+  {
+    APP_OTA_ECDSA_MontMul(result, result, result, p_mod);
+    if ((exponent[bit / 32] >> (bit % 32)) & 1u)
+    {
+      APP_OTA_ECDSA_MontMul(result, result, p_a, p_mod);
+    }
+  }
+  memcpy(p_r, result, sizeof(result));
+}
+
+/**
+ * @brief  Point doubling, Jacobian coordinates in Montgomery form, a = -3
+ */
+static void APP_OTA_ECDSA_PointDouble(APP_OTA_ECDSA_Point_t *p_r, const APP_OTA_ECDSA_Point_t *p_p)
+{
+  const APP_OTA_ECDSA_Modulus_t *mod = &APP_OTA_ECDSA_ModP;
+  uint32_t delta[ECDSA_WORDS], gamma[ECDSA_WORDS], beta[ECDSA_WORDS], alpha[ECDSA_WORDS], t[ECDSA_WORDS];
+
+  if (APP_OTA_ECDSA_IsZero(p_p->z))
+  {
+    *p_r = *p_p;
+    return;
+  }
+  APP_OTA_ECDSA_MontMul(delta, p_p->z, p_p->z, mod);
+  APP_OTA_ECDSA_MontMul(gamma, p_p->y, p_p->y, mod);
+  APP_OTA_ECDSA_MontMul(beta, p_p->x, gamma, mod);
+  /* alpha = 3 * (x - delta) * (x + delta) */
+  APP_OTA_ECDSA_ModSub(t, p_p->x, delta, mod);
+  APP_OTA_ECDSA_ModAdd(alpha, p_p->x, delta, mod);
+  APP_OTA_ECDSA_MontMul(alpha, alpha, t, mod);
+  APP_OTA_ECDSA_ModAdd(t, alpha, alpha, mod);
+  APP_OTA_ECDSA_ModAdd(alpha, alpha, t, mod);
+  /* z3 = (y + z)^2 - gamma - delta */
+  APP_OTA_ECDSA_ModAdd(t, p_p->y, p_p->z, mod);
+  APP_OTA_ECDSA_MontMul(t, t, t, mod);
+  APP_OTA_ECDSA_ModSub(t, t, gamma, mod);
+  APP_OTA_ECDSA_ModSub(p_r->z, t, delta, mod);
+  /* x3 = alpha^2 - 8 * beta */
+  APP_OTA_ECDSA_ModAdd(beta, beta, beta, mod);
+  APP_OTA_ECDSA_ModAdd(beta, beta, beta, mod);
+  APP_OTA_ECDSA_MontMul(t, alpha, alpha, mod);
+  APP_OTA_ECDSA_ModSub(t, t, beta, mod);
+  APP_OTA_ECDSA_ModSub(p_r->x, t, beta, mod);
+  /* y3 = alpha * (4 * beta - x3) - 8 * gamma^2 */
+  APP_OTA_ECDSA_ModSub(t, beta, p_r->x, mod);
+  APP_OTA_ECDSA_MontMul(t, alpha, t, mod);
+  APP_OTA_ECDSA_MontMul(gamma, gamma, gamma, mod);
+  APP_OTA_ECDSA_ModAdd(gamma, gamma, gamma, mod);
+  APP_OTA_ECDSA_ModAdd(gamma, gamma, gamma, mod);
+  APP_OTA_ECDSA_ModAdd(gamma, gamma, gamma, mod);
+  APP_OTA_ECDSA_ModSub(p_r->y, t, gamma, mod);
+}
+
+/**
+ * @brief  Point addition, Jacobian coordinates in Montgomery form
+ */
+static void APP_OTA_ECDSA_PointAdd(APP_OTA_ECDSA_Point_t *p_r, const APP_OTA_ECDSA_Point_t *p_p, const APP_OTA_ECDSA_Point_t *p_q)
+{
+  const APP_OTA_ECDSA_Modulus_t *mod = &APP_OTA_ECDSA_ModP;
+  uint32_t u1[ECDSA_WORDS], u2[ECDSA_WORDS], s1[ECDSA_WORDS], s2[ECDSA_WORDS], h[ECDSA_WORDS], t[ECDSA_WORDS];
+
+  if (APP_OTA_ECDSA_IsZero(p_p->z))
+  {
+    *p_r = *p_q;
+    return;
+  }
+  if (APP_OTA_ECDSA_IsZero(p_q->z))
+  {
+    *p_r = *p_p;
+    return;
+  }
+  APP_OTA_ECDSA_MontMul(t, p_q->z, p_q->z, mod);
+  APP_OTA_ECDSA_MontMul(u1, p_p->x, t, mod);
+  APP_OTA_ECDSA_MontMul(t, t, p_q->z, mod);
+  APP_OTA_ECDSA_MontMul(s1, p_p->y, t, mod);
+  APP_OTA_ECDSA_MontMul(t, p_p->z, p_p->z, mod);
+  APP_OTA_ECDSA_MontMul(u2, p_q->x, t, mod);
+  APP_OTA_ECDSA_MontMul(t, t, p_p->z, mod);
+  APP_OTA_ECDSA_MontMul(s2, p_q->y, t, mod);
+  APP_OTA_ECDSA_ModSub(h, u2, u1, mod);
+  APP_OTA_ECDSA_ModSub(s2, s2, s1, mod);
+  if (APP_OTA_ECDSA_IsZero(h))
+  {
+    if (APP_OTA_ECDSA_IsZero(s2))
+    {
+      APP_OTA_ECDSA_PointDouble(p_r, p_p);
+    }
+    else
+    {
+      memset(p_r, 0, sizeof(*p_r));
+    }
+    return;
+  }
+  /* z3 = z1 * z2 * h */
+  APP_OTA_ECDSA_MontMul(t, p_p->z, p_q->z, mod);
+  APP_OTA_ECDSA_MontMul(p_r->z, t, h, mod);
+  /* u2 = h^2, h = h^3, u1 = u1 * h^2 */
+  APP_OTA_ECDSA_MontMul(u2, h, h, mod);
+  APP_OTA_ECDSA_MontMul(h, h, u2, mod);
+  APP_OTA_ECDSA_MontMul(u1, u1, u2, mod);
+  /* x3 = r^2 - h^3 - 2 * u1 * h^2 */
+  APP_OTA_ECDSA_MontMul(t, s2, s2, mod);
+  APP_OTA_ECDSA_ModSub(t, t, h, mod);
+  APP_OTA_ECDSA_ModSub(t, t, u1, mod);
+  APP_OTA_ECDSA_ModSub(p_r->x, t, u1, mod);
+  /* y3 = r * (u1 * h^2 - x3) - s1 * h^3 */
+  APP_OTA_ECDSA_ModSub(t, u1, p_r->x, mod);
+  APP_OTA_ECDSA_MontMul(t, s2, t, mod);
+  APP_OTA_ECDSA_MontMul(s1, s1, h, mod);
+  APP_OTA_ECDSA_ModSub(p_r->y, t, s1, mod);
+}
+
+/**
+ * @brief  Loading an affine point in Montgomery form, checking it is on the curve
+ * @retval true if the point is valid
+ */
+static bool APP_OTA_ECDSA_PointLoad(APP_OTA_ECDSA_Point_t *p_r, const uint32_t *p_x, const uint32_t *p_y)
+{
+  const APP_OTA_ECDSA_Modulus_t *mod = &APP_OTA_ECDSA_ModP;
+  uint32_t lhs[ECDSA_WORDS], rhs[ECDSA_WORDS], t[ECDSA_WORDS];
+
+  if ((APP_OTA_ECDSA_Cmp(p_x, mod->m) >= 0) || (APP_OTA_ECDSA_Cmp(p_y, mod->m) >= 0))
+  {
+    return false;
+  }
+  APP_OTA_ECDSA_MontMul(p_r->x, p_x, mod->r2, mod);
+  APP_OTA_ECDSA_MontMul(p_r->y, p_y, mod->r2, mod);
+  APP_OTA_ECDSA_MontMul(p_r->z, APP_OTA_ECDSA_One, mod->r2, mod);
+
+  /* y^2 = x^3 - 3x + b */
+  APP_OTA_ECDSA_MontMul(lhs, p_r->y, p_r->y, mod);
+  APP_OTA_ECDSA_MontMul(rhs, p_r->x, p_r->x, mod);
+  APP_OTA_ECDSA_MontMul(rhs, rhs, p_r->x, mod);
+  APP_OTA_ECDSA_ModAdd(t, p_r->x, p_r->x, mod);
+  APP_OTA_ECDSA_ModAdd(t, t, p_r->x, mod);
+  APP_OTA_ECDSA_ModSub(rhs, rhs, t, mod);
+  APP_OTA_ECDSA_MontMul(t, APP_OTA_ECDSA_P256_b, mod->r2, mod);
+  APP_OTA_ECDSA_ModAdd(rhs, rhs, t, mod);
+
+  return (APP_OTA_ECDSA_Cmp(lhs, rhs) == 0);
+}
+
+/**
+ * @brief  Verify an ECDSA P-256 signature
+ * @param  p_public_key: X || Y
+ * @param  p_hash: SHA-256 digest of the signed data
+ * @param  p_signature: r || s
+ * @retval true if the signature is valid
+ */
+bool APP_OTA_ECDSA_Verify(const uint8_t *p_public_key, const uint8_t *p_hash, const uint8_t *p_signature)
+{
+  const APP_OTA_ECDSA_Modulus_t *mod_n = &APP_OTA_ECDSA_ModN;
+  APP_OTA_ECDSA_Point_t table[4];
+  APP_OTA_ECDSA_Point_t result;
+  uint32_t r[ECDSA_WORDS], s[ECDSA_WORDS], e[ECDSA_WORDS], u1[ECDSA_WORDS], u2[ECDSA_WORDS], t[ECDSA_WORDS];
+  uint32_t select;
+  int bit;
+
+  APP_OTA_ECDSA_FromBytes(r, &p_signature[0]);
+  APP_OTA_ECDSA_FromBytes(s, &p_signature[32]);
+  if (APP_OTA_ECDSA_IsZero(r) || APP_OTA_ECDSA_IsZero(s)
+      || (APP_OTA_ECDSA_Cmp(r, mod_n->m) >= 0) || (APP_OTA_ECDSA_Cmp(s, mod_n->m) >= 0))
+  {
+    return false;
+  }
+
+  /* table = { infinity, G, Q, G + Q } */
+  memset(&table[0], 0, sizeof(table[0]));
+  (void)APP_OTA_ECDSA_PointLoad(&table[1], APP_OTA_ECDSA_P256_gx, APP_OTA_ECDSA_P256_gy);
+  APP_OTA_ECDSA_FromBytes(t, &p_public_key[0]);
+  APP_OTA_ECDSA_FromBytes(u1, &p_public_key[32]);
+  if (!APP_OTA_ECDSA_PointLoad(&table[2], t, u1))
+  {
+    return false;
+  }
+  APP_OTA_ECDSA_PointAdd(&table[3], &table[1], &table[2]);
+
+  /* w = s^-1 in Montgomery form, so that u1 = e * w and u2 = r * w with a plain Montgomery product */
+  APP_OTA_ECDSA_FromBytes(e, p_hash);
+  if (APP_OTA_ECDSA_Cmp(e, mod_n->m) >= 0)
+  {
+    (void)APP_OTA_ECDSA_Sub(e, e, mod_n->m);
+  }
+  APP_OTA_ECDSA_MontMul(t, s, mod_n->r2, mod_n);
+  APP_OTA_ECDSA_MontInv(t, t, mod_n);
+  APP_OTA_ECDSA_MontMul(u1, e, t, mod_n);
+  APP_OTA_ECDSA_MontMul(u2, r, t, mod_n);
+
+  /* u1 * G + u2 * Q, both scalars at once */
+  memset(&result, 0, sizeof(result));
+  for (bit = 255; bit >= 0; bit--)
+  {
+    APP_OTA_ECDSA_PointDouble(&result, &result);
+    select = ((u1[bit / 32] >> (bit % 32)) & 1u) | (((u2[bit / 32] >> (bit % 32)) & 1u) << 1);
+    if (select != 0u)
+    {
+      APP_OTA_ECDSA_PointAdd(&result, &result, &table[select]);
+    }
+  }
+  if (APP_OTA_ECDSA_IsZero(result.z))
+  {
+    return false;
+  }
+
+  /* Affine x mod n must be r */
+  APP_OTA_ECDSA_MontInv(t, result.z, &APP_OTA_ECDSA_ModP);
+  APP_OTA_ECDSA_MontMul(t, t, t, &APP_OTA_ECDSA_ModP);
+  APP_OTA_ECDSA_MontMul(t, result.x, t, &APP_OTA_ECDSA_ModP);
+  APP_OTA_ECDSA_MontMul(t, t, APP_OTA_ECDSA_One, &APP_OTA_ECDSA_ModP);
+  if (APP_OTA_ECDSA_Cmp(t, mod_n->m) >= 0)
+  {
+    (void)APP_OTA_ECDSA_Sub(t, t, mod_n->m);
+  }
+
+  return (APP_OTA_ECDSA_Cmp(t, r) == 0);
+}
+
+#endif /* HAL_PKA_MODULE_ENABLED */
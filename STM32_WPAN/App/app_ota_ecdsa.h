@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_ecdsa.h
+  * Description        : Header for the ECDSA P-256 signature verification of
+  *                      OTA images.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef APP_OTA_ECDSA_H
+#define APP_OTA_ECDSA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "stdbool.h"
+
+/* Exported defines ----------------------------------------------------------*/
+/**
+ * Formats (must match Tools/ota_sign.py), all values big endian :
+ *  - public key : X || Y, 32 bytes each
+ *  - signature  : r || s, 32 bytes each
+ *  - hash       : SHA-256 digest of the image
+ * The PKA is used when HAL_PKA_MODULE_ENABLED is defined in stm32wbxx_hal_conf.h,
+ * a software implementation otherwise.
+ */
+#define OTA_ECDSA_KEY_SIZE                     64u
+#define OTA_ECDSA_SIGNATURE_SIZE               64u
+#define OTA_ECDSA_HASH_SIZE                    32u
+
+/* Exported functions ------------------------------------------------------- */
+bool APP_OTA_ECDSA_Verify(const uint8_t *p_public_key, const uint8_t *p_hash, const uint8_t *p_signature);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* APP_OTA_ECDSA_H */
@@ -0,0 +1,212 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_lzss.c
+  * Description        : Streaming LZSS decoder for compressed OTA images.
+  *                      The decoder is fed with the chunks received in the
+  *                      OTA block responses and writes directly into the
+  *                      caller RAM staging buffer, stopping when it is full.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "app_ota_lzss.h"
+
+/* Private defines -----------------------------------------------------------*/
+#define LZSS_STATE_FLAGS                       0u  /* waiting for a flag byte */
+#define LZSS_STATE_ITEM                        1u  /* waiting for a literal or a token low byte */
+#define LZSS_STATE_TOKEN_HI                    2u  /* waiting for a token high byte */
+#define LZSS_STATE_COPY                        3u  /* copying a match from the window */
+
+/* Functions Definition ------------------------------------------------------*/
+
+/**
+ * @brief  Store one decoded byte in output and history window
+ * @param  p_dec: decoder
+ * @param  p_out: output buffer
+ * @param  value: decoded byte
+ * @retval None
+ */
+static inline void APP_OTA_LZSS_Emit(APP_OTA_LZSS_Decoder_t *p_dec, uint8_t *p_out, uint8_t value)
+{
+  *p_out = value;
+  p_dec->window[p_dec->out_count & OTA_LZSS_WINDOW_MASK] = value;
+  p_dec->out_count++;
+}
+
+/**
+ * @brief  Move to the next item announced by the current flag byte
+ * @param  p_dec: decoder
+ * @retval None
+ */
+static inline void APP_OTA_LZSS_NextItem(APP_OTA_LZSS_Decoder_t *p_dec)
+{
+  p_dec->flags >>= 1;
+  p_dec->flag_bits--;
+  p_dec->state = (p_dec->flag_bits == 0u) ? LZSS_STATE_FLAGS : LZSS_STATE_ITEM;
+}
+
+/**
+ * @brief  Initialize the decoder for a new stream
+ * @param  p_dec: decoder
+ * @retval None
+ */
+void APP_OTA_LZSS_Init(APP_OTA_LZSS_Decoder_t *p_dec)
+{
+  memset(p_dec, 0, sizeof(*p_dec));
+  p_dec->state = LZSS_STATE_FLAGS;
+}
+
+/**
+ * @brief  Decode a chunk of compressed data
+ *         Decoding stops either when all the input is consumed (and no match
+ *         copy is pending) or when the output buffer is full.
+ * @param  p_dec: decoder
+ * @param  p_in: compressed data
+ * @param  in_len: compressed data length
+ * @param  p_consumed: number of compressed bytes consumed
+ * @param  p_out: output buffer
+ * @param  out_size: space available in output buffer
+ * @param  p_produced: number of decoded bytes written in output buffer
+ * @retval APP_OTA_LZSS_ERROR if the stream references data before its start
+ */
+APP_OTA_LZSS_StatusTypeDef APP_OTA_LZSS_Decode(APP_OTA_LZSS_Decoder_t *p_dec,
+                                               const uint8_t *p_in, uint32_t in_len, uint32_t *p_consumed,
+                                               uint8_t *p_out, uint32_t out_size, uint32_t *p_produced)
+{
+  uint32_t in_index = 0;
+  uint32_t out_index = 0;
+  uint16_t token;
+  uint8_t  value;
+
+  while (out_index < out_size)
+  {
+    if (p_dec->state == LZSS_STATE_COPY)
+    {
+      value = p_dec->window[(p_dec->out_count - p_dec->match_distance) & OTA_LZSS_WINDOW_MASK];
+      APP_OTA_LZSS_Emit(p_dec, &p_out[out_index++], value);
+      if (--p_dec->match_length == 0u)
+      {
+        p_dec->state = (p_dec->flag_bits == 0u) ? LZSS_STATE_FLAGS : LZSS_STATE_ITEM;
+      }
+      continue;
+    }
+
+    if (in_index == in_len)
+    {
+      break;
+    }
+    value = p_in[in_index++];
+
+    switch (p_dec->state)
+    {
+      case LZSS_STATE_FLAGS:
+        p_dec->flags = value;
+        p_dec->flag_bits = 8u;
+        p_dec->state = LZSS_STATE_ITEM;
+        break;
+
+      case LZSS_STATE_ITEM:
+        if ((p_dec->flags & 0x01u) != 0u)
+        {
+          APP_OTA_LZSS_Emit(p_dec, &p_out[out_index++], value);
+          APP_OTA_LZSS_NextItem(p_dec);
+        }
+        else
+        {
+          p_dec->token_lo = value;
+          p_dec->state = LZSS_STATE_TOKEN_HI;
+        }
+        break;
+
+      case LZSS_STATE_TOKEN_HI:
+      default:
+        token = (uint16_t)p_dec->token_lo | ((uint16_t)value << 8);
+        p_dec->match_distance = (token & OTA_LZSS_WINDOW_MASK) + 1u;
+        p_dec->match_length = (token >> OTA_LZSS_WINDOW_BITS) + OTA_LZSS_MIN_MATCH;
+        if (p_dec->match_distance > p_dec->out_count)
+        {
+          *p_consumed = in_index;
+          *p_produced = out_index;
+          return APP_OTA_LZSS_ERROR;
+        }
+        /* Account for the match item now, the copy state only drains it */
+        p_dec->flags >>= 1;
+        p_dec->flag_bits--;
+        p_dec->state = LZSS_STATE_COPY;
+        break;
+    }
+  }
+
+  *p_consumed = in_index;
+  *p_produced = out_index;
+  return APP_OTA_LZSS_OK;
+}
+
+/**
+ * @brief  Check if decoded data is still pending without further input
+ * @param  p_dec: decoder
+ * @retval true if a match copy is in progress
+ */
+bool APP_OTA_LZSS_IsPending(const APP_OTA_LZSS_Decoder_t *p_dec)
+{
+  return (p_dec->state == LZSS_STATE_COPY);
+}
+
+/**
+ * @brief  Serialize the parser state to be checkpointed with the OTA context.
+ *         The history window is not saved, it is rebuilt from flash on restore.
+ * @param  p_dec: decoder
+ * @param  p_ctx: OTA_LZSS_CTX_WORDS words to fill
+ * @retval None
+ */
+void APP_OTA_LZSS_Save(const APP_OTA_LZSS_Decoder_t *p_dec, uint32_t *p_ctx)
+{
+  p_ctx[0] = (uint32_t)p_dec->state | ((uint32_t)p_dec->flags << 8)
+             | ((uint32_t)p_dec->flag_bits << 16) | ((uint32_t)p_dec->token_lo << 24);
+  p_ctx[1] = (uint32_t)p_dec->match_distance | ((uint32_t)p_dec->match_length << 16);
+}
+
+/**
+ * @brief  Restore a decoder checkpointed with APP_OTA_LZSS_Save
+ * @param  p_dec: decoder
+ * @param  p_ctx: OTA_LZSS_CTX_WORDS words saved
+ * @param  out_count: decoded bytes already written when the checkpoint was taken
+ * @param  p_history: last decoded bytes (usually read back from flash)
+ * @param  history_len: number of history bytes, at most OTA_LZSS_WINDOW_SIZE
+ * @retval None
+ */
+void APP_OTA_LZSS_Restore(APP_OTA_LZSS_Decoder_t *p_dec, const uint32_t *p_ctx, uint32_t out_count,
+                          const uint8_t *p_history, uint32_t history_len)
+{
+  uint32_t index;
+
+  APP_OTA_LZSS_Init(p_dec);
+  p_dec->state = (uint8_t)(p_ctx[0] & 0xFFu);
+  p_dec->flags = (uint8_t)((p_ctx[0] >> 8) & 0xFFu);
+  p_dec->flag_bits = (uint8_t)((p_ctx[0] >> 16) & 0xFFu);
+  p_dec->token_lo = (uint8_t)(p_ctx[0] >> 24);
+  p_dec->match_distance = (uint16_t)(p_ctx[1] & 0xFFFFu);
+  p_dec->match_length = (uint16_t)(p_ctx[1] >> 16);
+
+  if (history_len > OTA_LZSS_WINDOW_SIZE)
+  {
+    p_history += history_len - OTA_LZSS_WINDOW_SIZE;
+    history_len = OTA_LZSS_WINDOW_SIZE;
+  }
+  for (index = 0; index < history_len; index++)
+  {
+    p_dec->window[(out_count - history_len + index) & OTA_LZSS_WINDOW_MASK] = p_history[index];
+  }
+  p_dec->out_count = out_count;
+}
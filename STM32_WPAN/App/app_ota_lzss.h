@@ -0,0 +1,81 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_lzss.h
+  * Description        : Header for the streaming LZSS decoder used by the OTA
+  *                      client to expand compressed upgrade images.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef APP_OTA_LZSS_H
+#define APP_OTA_LZSS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "stdbool.h"
+
+/* Exported defines ----------------------------------------------------------*/
+/**
+ * Stream format (must match Tools/ota_lzss.py) :
+ *  - one flag byte announces the next 8 items, LSB first, 1 = literal, 0 = match
+ *  - a literal is one raw byte
+ *  - a match is a 16 bits little endian token : bits 0..10 = distance - 1,
+ *    bits 11..15 = length - OTA_LZSS_MIN_MATCH
+ */
+#define OTA_LZSS_WINDOW_BITS                   11u
+#define OTA_LZSS_LENGTH_BITS                   5u
+#define OTA_LZSS_WINDOW_SIZE                   (1u << OTA_LZSS_WINDOW_BITS)    /* 2 KB history */
+#define OTA_LZSS_WINDOW_MASK                   (OTA_LZSS_WINDOW_SIZE - 1u)
+#define OTA_LZSS_MIN_MATCH                     3u
+#define OTA_LZSS_MAX_MATCH                     (OTA_LZSS_MIN_MATCH + (1u << OTA_LZSS_LENGTH_BITS) - 1u)
+
+/* Number of 32 bits words needed to checkpoint the decoder state in NVM */
+#define OTA_LZSS_CTX_WORDS                     2u
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+  APP_OTA_LZSS_OK    = 0x00,
+  APP_OTA_LZSS_ERROR = 0x01,
+} APP_OTA_LZSS_StatusTypeDef;
+
+typedef struct
+{
+  uint8_t  window[OTA_LZSS_WINDOW_SIZE];  /**< last decoded bytes (match source) */
+  uint32_t out_count;                     /**< decoded bytes produced since start of stream */
+  uint8_t  state;                         /**< parser state */
+  uint8_t  flags;                         /**< current flag byte (already shifted) */
+  uint8_t  flag_bits;                     /**< items left in current flag byte */
+  uint8_t  token_lo;                      /**< low byte of a match token being received */
+  uint16_t match_distance;                /**< distance of the match being copied */
+  uint16_t match_length;                  /**< bytes of the match still to copy */
+} APP_OTA_LZSS_Decoder_t;
+
+/* Exported functions ------------------------------------------------------- */
+void APP_OTA_LZSS_Init(APP_OTA_LZSS_Decoder_t *p_dec);
+APP_OTA_LZSS_StatusTypeDef APP_OTA_LZSS_Decode(APP_OTA_LZSS_Decoder_t *p_dec,
+                                               const uint8_t *p_in, uint32_t in_len, uint32_t *p_consumed,
+                                               uint8_t *p_out, uint32_t out_size, uint32_t *p_produced);
+bool APP_OTA_LZSS_IsPending(const APP_OTA_LZSS_Decoder_t *p_dec);
+void APP_OTA_LZSS_Save(const APP_OTA_LZSS_Decoder_t *p_dec, uint32_t *p_ctx);
+void APP_OTA_LZSS_Restore(APP_OTA_LZSS_Decoder_t *p_dec, const uint32_t *p_ctx, uint32_t out_count,
+                          const uint8_t *p_history, uint32_t history_len);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* APP_OTA_LZSS_H */
@@ -0,0 +1,165 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_sha256.c
+  * Description        : Streaming SHA-256 (FIPS 180-4). The OTA client feeds
+  *                      it with each RAM staging buffer as it is programmed,
+  *                      so the digest is ready when the download ends.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <string.h>
+#include "app_ota_sha256.h"
+
+/* Private macros ------------------------------------------------------------*/
+#define ROTR(x, n)                             (((x) >> (n)) | ((x) << (32u - (n))))
+
+/* Private variables ---------------------------------------------------------*/
+static const uint32_t APP_OTA_SHA256_K[64] =
+{
+  0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+  0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+  0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+  0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+  0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+  0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+  0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+  0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+/* Functions Definition ------------------------------------------------------*/
+
+/**
+ * @brief  Process one 64 bytes block
+ * @param  p_state: intermediate hash value
+ * @param  p_block: message block
+ * @retval None
+ */
+static void APP_OTA_SHA256_Transform(uint32_t *p_state, const uint8_t *p_block)
+{
+  uint32_t w[64];
+  uint32_t a, b, c, d, e, f, g, h, t1, t2;
+  uint32_t index;
+
+  for (index = 0; index < 16u; index++)
+  {
+    w[index] = ((uint32_t)p_block[4u * index] << 24) | ((uint32_t)p_block[4u * index + 1u] << 16)
+               | ((uint32_t)p_block[4u * index + 2u] << 8) | (uint32_t)p_block[4u * index + 3u];
+  }
+  for (index = 16; index < 64u; index++)
+  {
+    t1 = ROTR(w[index - 2u], 17u) ^ ROTR(w[index - 2u], 19u) ^ (w[index - 2u] >> 10);
+    t2 = ROTR(w[index - 15u], 7u) ^ ROTR(w[index - 15u], 18u) ^ (w[index - 15u] >> 3);
+    w[index] = t1 + w[index - 7u] + t2 + w[index - 16u];
+  }
+
+  a = p_state[0]; b = p_state[1]; c = p_state[2]; d = p_state[3];
+  e = p_state[4]; f = p_state[5]; g = p_state[6]; h = p_state[7];
+  for (index = 0; index < 64u; index++)
+  {
+    t1 = h + (ROTR(e, 6u) ^ ROTR(e, 11u) ^ ROTR(e, 25u)) + ((e & f) ^ (~e & g)) + APP_OTA_SHA256_K[index] + w[index];
+    t2 = (ROTR(a, 2u) ^ ROTR(a, 13u) ^ ROTR(a, 22u)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  p_state[0] += a; p_state[1] += b; p_state[2] += c; p_state[3] += d;
+  p_state[4] += e; p_state[5] += f; p_state[6] += g; p_state[7] += h;
+}
+
+/**
+ * @brief  Start a new digest
+ * @param  p_ctx: hash context
+ * @retval None
+ */
+void APP_OTA_SHA256_Init(APP_OTA_SHA256_Ctx_t *p_ctx)
+{
+  memset(p_ctx, 0, sizeof(*p_ctx));
+  p_ctx->state[0] = 0x6A09E667;
+  p_ctx->state[1] = 0xBB67AE85;
+  p_ctx->state[2] = 0x3C6EF372;
+  p_ctx->state[3] = 0xA54FF53A;
+  p_ctx->state[4] = 0x510E527F;
+  p_ctx->state[5] = 0x9B05688C;
+  p_ctx->state[6] = 0x1F83D9AB;
+  p_ctx->state[7] = 0x5BE0CD19;
+}
+
+/**
+ * @brief  Hash a chunk of data
+ * @param  p_ctx: hash context
+ * @param  p_data: data, RAM or flash
+ * @param  size: data length
+ * @retval None
+ */
+void APP_OTA_SHA256_Update(APP_OTA_SHA256_Ctx_t *p_ctx, const uint8_t *p_data, uint32_t size)
+{
+  uint32_t used = p_ctx->length % OTA_SHA256_BLOCK_SIZE;
+  uint32_t chunk;
+
+  p_ctx->length += size;
+  if (used != 0u)
+  {
+    chunk = ((OTA_SHA256_BLOCK_SIZE - used) < size) ? (OTA_SHA256_BLOCK_SIZE - used) : size;
+    memcpy(&p_ctx->block[used], p_data, chunk);
+    p_data += chunk;
+    size -= chunk;
+    if ((used + chunk) < OTA_SHA256_BLOCK_SIZE)
+    {
+      return;
+    }
+    APP_OTA_SHA256_Transform(p_ctx->state, p_ctx->block);
+  }
+  while (size >= OTA_SHA256_BLOCK_SIZE)
+  {
+    APP_OTA_SHA256_Transform(p_ctx->state, p_data);
+    p_data += OTA_SHA256_BLOCK_SIZE;
+    size -= OTA_SHA256_BLOCK_SIZE;
+  }
+  memcpy(p_ctx->block, p_data, size);
+}
+
+/**
+ * @brief  Pad the message and output the digest
+ * @param  p_ctx: hash context, to be initialized again before reuse
+ * @param  p_digest: OTA_SHA256_DIGEST_SIZE bytes, big endian
+ * @retval None
+ */
+void APP_OTA_SHA256_Final(APP_OTA_SHA256_Ctx_t *p_ctx, uint8_t *p_digest)
+{
+  uint32_t used = p_ctx->length % OTA_SHA256_BLOCK_SIZE;
+  uint32_t index;
+
+  p_ctx->block[used++] = 0x80u;
+  if (used > (OTA_SHA256_BLOCK_SIZE - 8u))
+  {
+    memset(&p_ctx->block[used], 0, OTA_SHA256_BLOCK_SIZE - used);
+    APP_OTA_SHA256_Transform(p_ctx->state, p_ctx->block);
+    used = 0;
+  }
+  memset(&p_ctx->block[used], 0, OTA_SHA256_BLOCK_SIZE - used);
+  /* Message length in bits, images are below 512 MB */
+  p_ctx->block[59] = (uint8_t)(p_ctx->length >> 29);
+  p_ctx->block[60] = (uint8_t)(p_ctx->length >> 21);
+  p_ctx->block[61] = (uint8_t)(p_ctx->length >> 13);
+  p_ctx->block[62] = (uint8_t)(p_ctx->length >> 5);
+  p_ctx->block[63] = (uint8_t)(p_ctx->length << 3);
+  APP_OTA_SHA256_Transform(p_ctx->state, p_ctx->block);
+
+  for (index = 0; index < 8u; index++)
+  {
+    p_digest[4u * index]      = (uint8_t)(p_ctx->state[index] >> 24);
+    p_digest[4u * index + 1u] = (uint8_t)(p_ctx->state[index] >> 16);
+    p_digest[4u * index + 2u] = (uint8_t)(p_ctx->state[index] >> 8);
+    p_digest[4u * index + 3u] = (uint8_t)p_ctx->state[index];
+  }
+}
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * File Name          : App/app_ota_sha256.h
+  * Description        : Header for the streaming SHA-256 used to digest OTA
+  *                      images while they are written to flash.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  */
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef APP_OTA_SHA256_H
+#define APP_OTA_SHA256_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+
+/* Exported defines ----------------------------------------------------------*/
+#define OTA_SHA256_BLOCK_SIZE                  64u
+#define OTA_SHA256_DIGEST_SIZE                 32u
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t state[8];                       /**< intermediate hash value */
+  uint32_t length;                         /**< bytes hashed so far */
+  uint8_t  block[OTA_SHA256_BLOCK_SIZE];   /**< pending partial block */
+} APP_OTA_SHA256_Ctx_t;
+
+/* Exported functions ------------------------------------------------------- */
+void APP_OTA_SHA256_Init(APP_OTA_SHA256_Ctx_t *p_ctx);
+void APP_OTA_SHA256_Update(APP_OTA_SHA256_Ctx_t *p_ctx, const uint8_t *p_data, uint32_t size);
+void APP_OTA_SHA256_Final(APP_OTA_SHA256_Ctx_t *p_ctx, uint8_t *p_digest);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* APP_OTA_SHA256_H */
@@ -27,8 +27,12 @@
 #include "stm32wbxx_core_interface_def.h"
 #include "zigbee_types.h"
 #include "stm32_seq.h"
+#include "app_seq_prof.h"
+#include "app_pool.h"
+#include "app_slot.h"
 
 #include <assert.h>
+#include <stddef.h>
 #include "zcl/zcl.h"
 #include "zcl/general/zcl.ota.h"
 
@@ -36,22 +40,113 @@
 #include "hw_flash.h"
 
 /* Private defines -----------------------------------------------------------*/
-#define APP_ZIGBEE_STARTUP_FAIL_DELAY          500U
+#define APP_ZIGBEE_STARTUP_FAIL_DELAY          500U     /**< ms, first join retry delay, doubled after each failure */
+#define APP_ZIGBEE_STARTUP_FAIL_DELAY_MAX      32000U   /**< ms, join retry delay ceiling */
+#define APP_ZIGBEE_STARTUP_FAIL_BACKOFF_MAX    6U       /**< 500ms << 6 = 32s */
+#define APP_ZIGBEE_CHANNELMASK_2400MHZ         0x07FFF800U  /**< channels 11 to 26 */
+#define STARTUP_JOIN_TIMEOUT                   (60*1000*1000/CFG_TS_TICK_VAL)   /**< 60s without ZbStartup callback */
+#define STARTUP_DISCOVERY_TIMEOUT              (30*1000*1000/CFG_TS_TICK_VAL)   /**< 30s without discovery callback */
 #define SW1_ENDPOINT                           17
 #define CHANNEL                                19
 
 #define HW_TS_SERVER_1S_NB_TICKS               (1*1000*1000/CFG_TS_TICK_VAL)
 #define LED_TOGGLE_TIMING                      (0.1*1000*1000/CFG_TS_TICK_VAL)  /**< 0.5s */
 #define OTA_DOWNLOAD_RETRY_DELAY               (0.1*1000*1000/CFG_TS_TICK_VAL)  /**< 0.5s */
+#define PERSIST_SAVE_DELAY                     (0.5*1000*1000/CFG_TS_TICK_VAL)  /**< 0.5s without notification before saving */
+#define PERSIST_SAVE_MAX_LATENCY               5000u  /**< ms, saving is not delayed further after the first notification */
 #define CFG_NVM                                1u         /* use FLASH */
+#define PERSIST_STORE_ADDRESS                  (FLASH_BASE + CFG_PERSIST_STORE_SECTOR_INDEX*0x1000)
+#define PERSIST_STORE_PAGE(address)            (((address) - PERSIST_STORE_ADDRESS) / FLASH_PAGE_SIZE)
+#define PERSIST_STORE_PAGE_END(address)        (PERSIST_STORE_ADDRESS + (PERSIST_STORE_PAGE(address) + 1u) * FLASH_PAGE_SIZE)
+#define PERSIST_STORE_MAX_DELTAS               16u   /* Delta records after a snapshot before a new snapshot is written */
+#define NVM_GC_RETRY_DELAY                     (10*1000*1000/CFG_TS_TICK_VAL)   /**< 10s, maintenance postponed by a transfer */
+#define PERSIST_RAM_SEAL_MAGIC                 0x4C414553u   /* 'SEAL' : RAM cache matching the NVM */
+#define NVM_EE_CLEAN_FILL                      50u   /* EE bank written since the last cleanup (%) above which it is cleaned while idle */
+#define CMD_POOL_SIZE                          8u    /* Commands posted to the M0 and not run yet */
+#define OTA_MCAST_REPORT_POOL_SIZE             2u    /* Multicast reports waiting for their APS confirm */
 //#define OTA_DISPLAY_TIMING                   1u         /* Display all times (load transaction & NVM or Eeprom save )  */
 #define OTA_PREVENT_DOWNGRADE                  TRUE  /* For security reason firmware downgrade should be prenvented */
 #define OTA_ABORT_RETRY_ENABLE                 TRUE  /* Enable download resume retries after abort */
-#define USE_TAG_WRITE_CB                       False /* Set to TRUE to handle multiple tags in single OTA image  */
+#define USE_TAG_WRITE_CB                       TRUE  /* Set to FALSE to only handle single tag (raw image) OTA files */
+#define OTA_TAG_HANDLERS_MAX                   8u    /* Size of the sub-element handlers table */
+#define OTA_BUNDLE_ENABLE                      TRUE  /* Fetch the M0 image, if any, right after an M4 image and apply both with one reboot */
+#define OTA_MCAST_ENABLE                       TRUE  /* Accept images distributed to the OTA multicast group */
+#define OTA_MCAST_NACK_DELAY                   (2*1000*1000/CFG_TS_TICK_VAL)    /**< 2s without block before asking for repair */
+#define OTA_MCAST_NACK_RETRY_DELAY             (10*1000*1000/CFG_TS_TICK_VAL)   /**< 10s between two NACKs of a client */
+#define OTA_MCAST_NACK_SLOT                    (0.05*1000*1000/CFG_TS_TICK_VAL) /**< 50ms */
+#define OTA_MCAST_NACK_SLOTS                   32u   /* NACKs after session end are spread over 32 slots */
+#define OTA_MCAST_BITMAP_EE_ADDR               (USER_DB_START_ADDR + 0x200u)  /* EE words of the blocks received with the erased value */
+#define OTA_MCAST_BITMAP_EE_WORDS              (OTA_MCAST_MAX_BLOCKS / 32u)
+#define OTA_MCAST_ERASE_PAGES_PER_RUN          4u    /* Download area pages erased per run of the background task */
+#define OTA_MCAST_CLEAR_WORDS_PER_RUN          32u   /* EE bitmap words cleared per run of the background task */
+#define OTA_SCHEDULE_ENABLE                    FALSE /* Set to TRUE to download only during the window below */
+#define OTA_SCHEDULE_PERIOD                    (24u*3600u)  /**< local clock period (s) */
+#define OTA_SCHEDULE_WINDOW_START              (1u*3600u)   /**< window start in the period (s), 01:00 */
+#define OTA_SCHEDULE_WINDOW_LENGTH             (4u*3600u)   /**< window length (s) */
+#define OTA_SCHEDULE_SPREAD                    (1800u)      /**< device start offsets spread over the first 30 minutes */
+#define OTA_SCHEDULE_TIME_AT_BOOT              (0u)         /**< local time at startup, until set with APP_ZIGBEE_OTA_SetLocalTime() */
+#define OTA_SIGNATURE_ENABLE                   TRUE  /* Check the image signature sub-element, if any */
+#define OTA_SIGNATURE_REQUIRED                 FALSE /* Set to TRUE to reject images without signature or signed manifest */
+#define OTA_MANIFEST_REQUIRED                  FALSE /* Set to TRUE to reject images not starting with a signed manifest */
+#define OTA_ENCRYPTION_ENABLE                  TRUE  /* Accept AES-128 CTR encrypted images */
+
+#if (OTA_SIGNATURE_REQUIRED) && !(OTA_SIGNATURE_ENABLE)
+#error "OTA_SIGNATURE_REQUIRED needs OTA_SIGNATURE_ENABLE"
+#endif
+#if (CFG_APP_AB_SLOTS) && ((CFG_APP_SLOT_SWAP_STEPS * CFG_APP_SLOT_NB_SECTORS) > 0xFFu)
+#error "The swap progress of CFG_APP_SLOT_NB_SECTORS pages does not fit a slot state record"
+#endif
+#if (CFG_APP_AB_SLOTS) && ((CFG_APP_SLOT_STATE_SECTOR_INDEX + 1) > CFG_APP_SLOT_LIMIT_SECTOR_INDEX)
+#error "The A/B slots layout reaches CFG_APP_SLOT_LIMIT_SECTOR_INDEX : reduce CFG_APP_SLOT_NB_SECTORS"
+#endif
+#if (CFG_APP_AB_SLOTS) && (CFG_APP_SLOT_STATE_SECTOR_INDEX != APP_SLOT_STATE_SECTOR_INDEX)
+#error "The slot state page moved : update APP_SLOT_STATE_SECTOR_INDEX in app_slot.h, shared with the applications"
+#endif
+#if (OTA_SIGNATURE_ENABLE) || (OTA_ENCRYPTION_ENABLE)
+/* Keys, generated with Tools/ota_keys.py before the first build (not part of the sources) */
+#if defined(__has_include)
+#if !__has_include("app_ota_keys.h")
+#error "app_ota_keys.h missing, run: python Tools/ota_keys.py Tools/ota_sign.key Tools/ota_aes.key STM32_WPAN/App/app_ota_keys.h"
+#endif
+#endif
+#include "app_ota_keys.h"
+#endif
+
 
+/* Private typedef -----------------------------------------------------------*/
+/* OTA file sub-element handler, called with each received chunk of the sub-element */
+typedef enum ZclStatusCodeT (*APP_ZIGBEE_OtaTagHandler_t)(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                          uint8_t length, uint8_t * data, void *arg);
+
+struct APP_ZIGBEE_OtaTagHandlerEntry_t{
+  uint16_t tag_id;
+  APP_ZIGBEE_OtaTagHandler_t handler;
+};
+
+/* Persistence store record header, followed by the stored image or delta (see APP_ZIGBEE_NVM_Write) */
+typedef struct
+{
+  uint32_t magic;       /**< ST_PERSIST_RECORD_MAGIC (snapshot) or ST_PERSIST_DELTA_MAGIC */
+  uint32_t size;        /**< record data size in bytes, double word aligned */
+  uint32_t sequence;    /**< incremented at each record, the highest valid one is restored */
+  uint32_t crc;         /**< CRC-32 of the record data */
+} APP_ZIGBEE_PersistRecord_t;
+
+/* Seal of the persistent data RAM cache, kept across warm resets (see APP_ZIGBEE_NVM_SealCheck) */
+typedef struct
+{
+  uint32_t magic;       /**< PERSIST_RAM_SEAL_MAGIC */
+  uint32_t sequence;    /**< generation : sequence number of the last record in NVM */
+  uint32_t snapshot;    /**< persistence store index matching this generation */
+  uint32_t record;
+  uint32_t deltas;
+  uint32_t free;
+  uint32_t num_words;   /**< cache size in words */
+  uint32_t data_crc;    /**< CRC-32 of the cache */
+  uint32_t crc;         /**< CRC-32 of the fields above */
+} APP_ZIGBEE_PersistSeal_t;
 
 /* external definition */
-enum ZbStatusCodeT ZbStartupWait(struct ZigBeeT *zb, struct ZbStartupT *config);
 
 /* Private function prototypes -----------------------------------------------*/
 
@@ -59,7 +154,13 @@ enum ZbStatusCodeT ZbStartupWait(struct ZigBeeT *zb, struct ZbStartupT *config);
 static void APP_ZIGBEE_StackLayersInit(void);
 static void APP_ZIGBEE_ConfigEndpoints(void);
 static void APP_ZIGBEE_NwkForm(void);
+static void APP_ZIGBEE_Join_cb(enum ZbStatusCodeT status, void *cb_arg);
+static void APP_ZIGBEE_JoinRetrySchedule(void);
+static void APP_ZIGBEE_JoinRetry_Timer_cb(void);
+static uint32_t APP_ZIGBEE_JoinChannelMask(void);
 static void APP_ZIGBEE_App_Init(void);
+static void APP_ZIGBEE_Startup_SetState(enum APP_ZIGBEE_StartupState_t state);
+static void APP_ZIGBEE_Startup_Timer_cb(void);
 static void APP_ZIGBEE_SW1_Process(void);
 static void APP_ZIGBEE_SW2_Process(void);
 static void APP_ZIGBEE_SW3_Process(void);
@@ -70,12 +171,15 @@ static void APP_ZIGBEE_CheckWirelessFirmwareInfo(void);
 static void Wait_Getting_Ack_From_M0(void);
 static void Receive_Ack_From_M0(void);
 static void Receive_Notification_From_M0(void);
+static void APP_ZIGBEE_CmdProcess(void);
 
 /* ZCL OTA cluster related functions */
 static void APP_ZIGBEE_OTA_Client_Init(void);
+static void APP_ZIGBEE_OTA_Client_Start(void);
 static void APP_ZIGBEE_OTA_Client_ServerDiscovery( void );
 
 static void APP_ZIGBEE_OTA_Client_DiscoverComplete_cb(struct ZbZclClusterT *clusterPtr, enum ZclStatusCodeT status,void *arg);
+static uint32_t APP_ZIGBEE_OTA_Client_ReadServerId(void *arg);
 static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_ImageNotify_cb(struct ZbZclClusterT *clusterPtr, uint8_t payload_type,
                                                                 uint8_t jitter, struct ZbZclOtaImageDefinition *image_definition,
                                                                 struct ZbApsdeDataIndT *data_ind, struct ZbZclHeaderT *zcl_header);
@@ -83,28 +187,112 @@ static void APP_ZIGBEE_OTA_Client_QueryNextImage_cb(struct ZbZclClusterT *cluste
                                                     struct ZbZclOtaImageDefinition *image_definition, uint32_t image_size, void *arg);
 static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteImage_cb(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
                                                                uint8_t length, uint8_t *data, void *arg);
-#ifdef USE_TAG_WRITE_CB
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteCompressedImage(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                      uint8_t length, uint8_t * data, void *arg);
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteDeltaImage(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                 uint8_t length, uint8_t * data, void *arg);
+#if (OTA_ENCRYPTION_ENABLE)
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteEncryptedImage(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                     uint8_t length, uint8_t * data, void *arg);
+#endif
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_DecodeChunk(struct Zigbee_OTA_client_info* client_info, uint8_t length, uint8_t * data, uint32_t index);
+static bool APP_ZIGBEE_OTA_Client_ParseSubHeader(struct Zigbee_OTA_client_info* client_info, uint8_t length, uint8_t * data,
+                                                 uint32_t *p_index, uint32_t header_size);
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_ResumeTransfer(struct Zigbee_OTA_client_info* client_info, struct ZbZclOtaHeader *header);
+#if (USE_TAG_WRITE_CB)
 static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteTag_cb(struct ZbZclClusterT * clusterPtr, struct ZbZclOtaHeader * header,
                                                             uint16_t tag_id, uint32_t tag_length, uint8_t data_length,
                                                             uint8_t * data, void * arg);
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteIntegrityCode(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                    uint8_t length, uint8_t * data, void *arg);
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_RegisterTagHandler(uint16_t tag_id, APP_ZIGBEE_OtaTagHandler_t handler);
+#if (OTA_SIGNATURE_ENABLE)
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteSignature(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                uint8_t length, uint8_t * data, void *arg);
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteManifest(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                               uint8_t length, uint8_t * data, void *arg);
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_CheckManifest(struct Zigbee_OTA_client_info* client_info);
+#endif
 #endif
 static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_ImageValidate_cb(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header, void *arg);
+#if (OTA_SIGNATURE_ENABLE)
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_CheckSignature(struct Zigbee_OTA_client_info* client_info);
+#endif
 static void APP_ZIGBEE_OTA_Client_Reboot_cb(struct ZbZclClusterT *clusterPtr, void *arg);
+#if (OTA_BUNDLE_ENABLE)
+static bool APP_ZIGBEE_OTA_Client_BundleNext(struct Zigbee_OTA_client_info* client_info);
+#endif
 static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_AbortDownload_cb(struct ZbZclClusterT *clusterPtr, enum ZbZclOtaCommandId commandId, void *arg);
 
 /* OTA application related functions */
 static bool APP_ZIGBEE_OTA_Client_CheckPriviousDownload(struct ZbZclOtaImageDefinition *image_definition);
 static inline int APP_ZIGBEE_FindImageType(unsigned int fileType);
+static void APP_ZIGBEE_OTA_VersionRegistry_Init(void);
+static inline uint32_t APP_ZIGBEE_GetLE32(const uint8_t *p_data);
+static bool APP_ZIGBEE_OTA_Client_SetImageType(struct Zigbee_OTA_client_info* client_info, uint16_t image_type);
 static inline void APP_ZIGBEE_OTA_Client_Request_Upgrade(void);
 static inline void APP_ZIGBEE_OTA_Client_StartDownload(void);
 static inline APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_WriteFirmwareData(struct Zigbee_OTA_client_info* client_info);
-static inline APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_CheckDeviceCapabilities(void);
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_FlushBuffer(struct Zigbee_OTA_client_info* client_info);
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_FlashProgram(uint32_t address, const uint8_t *p_data, uint32_t size);
+static void APP_ZIGBEE_OTA_Client_ErasePages(uint32_t first_page, uint32_t nb_pages);
+static void APP_ZIGBEE_OTA_Client_PrepareFlash(struct Zigbee_OTA_client_info* client_info);
+#if !(CFG_APP_AB_SLOTS)
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_CommitImage(struct Zigbee_OTA_client_info* client_info);
+#endif
+static uint32_t APP_ZIGBEE_OTA_Client_Crc_Calc(uint32_t address, uint32_t size);
+static inline APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_CheckDeviceCapabilities(uint32_t required_size);
 static void APP_ZIGBEE_PerformReset(void);
 static void APP_ZIGBEE_LEDToggle(void);
 
 static inline uint32_t GetFirstSecureSector(void);
 static inline void Delete_Sectors(void);
 
+#if (CFG_APP_AB_SLOTS)
+/* A/B slots */
+static void APP_ZIGBEE_OTA_Slot_SetState(uint32_t record, uint32_t file_version);
+static void APP_ZIGBEE_OTA_Slot_Reserve(uint32_t nb_records);
+static uint32_t APP_ZIGBEE_OTA_Slot_ImagePages(uint32_t slot_address);
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Slot_Swap(uint32_t state, uint32_t pages, uint32_t progress, uint32_t file_version);
+static void APP_ZIGBEE_OTA_Slot_Install(uint32_t file_version);
+static void APP_ZIGBEE_OTA_Slot_Init(void);
+#endif
+
+#if (OTA_MCAST_ENABLE)
+/* OTA multicast distribution */
+static inline uint16_t APP_ZIGBEE_GetLE16(const uint8_t *p_data);
+static void APP_ZIGBEE_OTA_Mcast_Init(void);
+static int APP_ZIGBEE_OTA_Mcast_Filter_cb(struct ZbApsdeDataIndT *data_ind, void *arg);
+static void APP_ZIGBEE_OTA_Mcast_SessionStart(struct Zigbee_OTA_client_info* client_info, struct ZbApsdeDataIndT *data_ind);
+static void APP_ZIGBEE_OTA_Mcast_Block(struct Zigbee_OTA_client_info* client_info, struct ZbApsdeDataIndT *data_ind);
+static void APP_ZIGBEE_OTA_Mcast_Complete(struct Zigbee_OTA_client_info* client_info);
+#if (OTA_SIGNATURE_ENABLE)
+static void APP_ZIGBEE_OTA_Mcast_Signature(struct Zigbee_OTA_client_info* client_info, struct ZbApsdeDataIndT *data_ind);
+#endif
+static void APP_ZIGBEE_OTA_Mcast_SaveBitmapWord(uint16_t index);
+static void APP_ZIGBEE_OTA_Mcast_ClearSavedBitmap(uint16_t first, uint16_t count);
+static void APP_ZIGBEE_OTA_Mcast_Prepare(void);
+static bool APP_ZIGBEE_OTA_Mcast_IsErased(const uint8_t *p_data, uint32_t size);
+static void APP_ZIGBEE_OTA_Mcast_ArmNack(uint32_t delay);
+static void APP_ZIGBEE_OTA_Mcast_NackTimer_cb(void);
+static void APP_ZIGBEE_OTA_Mcast_SendNack(void);
+static void APP_ZIGBEE_OTA_Mcast_SendReport(struct Zigbee_OTA_client_info* client_info, uint8_t status);
+static uint32_t APP_ZIGBEE_OTA_Mcast_ReportCmd(void *arg);
+static void APP_ZIGBEE_OTA_Mcast_ReportDone(uint32_t status, void *arg);
+static uint32_t APP_ZIGBEE_OTA_Mcast_ArmRepairCmd(void *arg);
+static void APP_ZIGBEE_OTA_Mcast_ReportConf_cb(struct ZbApsdeDataConfT *conf, void *arg);
+static void APP_ZIGBEE_OTA_Mcast_ReportSent(struct Zigbee_OTA_client_info* client_info);
+#endif /* OTA_MCAST_ENABLE */
+
+#if (OTA_SCHEDULE_ENABLE)
+/* OTA download window */
+static void APP_ZIGBEE_OTA_Schedule_Init(void);
+static bool APP_ZIGBEE_OTA_Schedule_IsInWindow(void);
+static void APP_ZIGBEE_OTA_Schedule_Tick_cb(void);
+static void APP_ZIGBEE_OTA_Schedule_Download(void);
+static void APP_ZIGBEE_OTA_Schedule_Process(void);
+#endif /* OTA_SCHEDULE_ENABLE */
+
 /* NVM related function */
 static bool APP_ZIGBEE_OTA_ctx_save_nvm(struct Zigbee_OTA_client_info* client_info);
 static bool APP_ZIGBEE_OTA_ctx_load_nvm(void);
@@ -112,6 +300,8 @@ static bool APP_ZIGBEE_persist_load(void);
 static bool APP_ZIGBEE_persist_save(void);
 static void APP_ZIGBEE_persist_delete(void);
 static void APP_ZIGBEE_persist_notify_cb(struct ZigBeeT *zb, void *cbarg);
+static void APP_ZIGBEE_persist_timer_cb(void);
+static void APP_ZIGBEE_persist_flush(void);
 static enum ZbStatusCodeT APP_ZIGBEE_ZbStartupPersist(struct ZigBeeT *zb);
 static void APP_ZIGBEE_PersistCompleted_callback(void);
 #ifdef CFG_NVM
@@ -119,13 +309,47 @@ static void APP_ZIGBEE_NVM_Init(void);
 static bool APP_ZIGBEE_NVM_Read(void);
 static bool APP_ZIGBEE_NVM_Write(void);
 static void APP_ZIGBEE_NVM_Erase(void);
+static void APP_ZIGBEE_NVM_Scan(void);
+static void APP_ZIGBEE_NVM_Gc(void);
+static void APP_ZIGBEE_NVM_GcTimer_cb(void);
+static int APP_ZIGBEE_NVM_EeWrite(uint16_t address, uint32_t data);
+static uint32_t APP_ZIGBEE_NVM_RecordSize(uint32_t address, uint32_t end);
+static uint32_t APP_ZIGBEE_NVM_NextDelta(uint32_t address, uint32_t end, uint32_t sequence);
+static bool APP_ZIGBEE_NVM_ApplyDelta(uint32_t address, uint32_t *p_num_words);
+static uint32_t APP_ZIGBEE_NVM_Delta(uint32_t num_words, uint32_t address, uint32_t *p_crc);
+static bool APP_ZIGBEE_NVM_WriteSnapshot(uint32_t num_words);
+static bool APP_ZIGBEE_NVM_WriteDelta(uint32_t num_words, uint32_t size, uint32_t crc);
+static bool APP_ZIGBEE_NVM_PageErased(uint32_t page);
+static bool APP_ZIGBEE_NVM_DwChanged(uint32_t index);
+static void APP_ZIGBEE_NVM_Seal(uint32_t num_words);
+static void APP_ZIGBEE_NVM_Unseal(void);
+static bool APP_ZIGBEE_NVM_SealCheck(void);
+static uint32_t APP_ZIGBEE_NVM_Pack(const uint8_t *p_in, uint32_t size, uint8_t *p_out, uint32_t max_size);
+static uint32_t APP_ZIGBEE_NVM_Unpack(const uint8_t *p_in, uint32_t size, uint8_t *p_out, uint32_t max_size);
+static uint32_t APP_ZIGBEE_NVM_Crc32(uint32_t crc, const uint8_t *p_data, uint32_t size);
 #endif /* CFG_NVM */
 
 /* Private variables -----------------------------------------------*/
 static TL_CmdPacket_t *p_ZIGBEE_otcmdbuffer;
 static TL_EvtPacket_t *p_ZIGBEE_notif_M0_to_M4;
 static TL_EvtPacket_t *p_ZIGBEE_request_M0_to_M4;
+/* M0 notification : the IPCC channel stays masked until it is acknowledged, one at a time */
 static __IO uint32_t CptReceiveNotifyFromM0 = 0;
+static __IO uint32_t NotifyOverflowPending = 0;
+static APP_ZIGBEE_NotifyStats_t notifyStats;
+/* Commands posted to the M0, allocated from CmdPool and executed back to back by CFG_TASK_ZIGBEE_CMD */
+APP_POOL_DEFINE(CmdPool, APP_ZIGBEE_Cmd_t, CMD_POOL_SIZE);
+static APP_ZIGBEE_Cmd_t *CmdQueueHead = NULL;
+static APP_ZIGBEE_Cmd_t *CmdQueueTail = NULL;
+
+#if (OTA_MCAST_ENABLE)
+/* Multicast report, kept until the APS confirm : the frame is sent from it */
+struct APP_ZIGBEE_OtaMcastReport_t {
+  struct Zigbee_OTA_client_info *client_info;
+  uint8_t frame[4u + (OTA_MCAST_MAX_NACK_RANGES * 4u)];
+};
+APP_POOL_DEFINE(McastReportPool, struct APP_ZIGBEE_OtaMcastReport_t, OTA_MCAST_REPORT_POOL_SIZE);
+#endif /* OTA_MCAST_ENABLE */
 static __IO uint32_t CptReceiveRequestFromM0 = 0;
 
 PLACE_IN_SECTION("MB_MEM1") ALIGN(4) static TL_ZIGBEE_Config_t ZigbeeConfigBuffer;
@@ -134,12 +358,21 @@ PLACE_IN_SECTION("MB_MEM2") ALIGN(4) static uint8_t ZigbeeNotifRspEvtBuffer[size
 PLACE_IN_SECTION("MB_MEM2") ALIGN(4) static uint8_t ZigbeeNotifRequestBuffer[sizeof(TL_PacketHeader_t) + TL_EVT_HDR_SIZE + 255U];
 
 /* OTA app variables */
-const struct OTA_currentFileVersion OTA_currentFileVersionTab[] = {
-  {fileType_COPRO_WIRELESS, CURRENT_FW_COPRO_WIRELESS_FILE_VERSION},
-  {fileType_APP, CURRENT_FW_APP_FILE_VERSION},
+/* Versions of the installed images, indexed by image type, updated at startup by APP_ZIGBEE_OTA_VersionRegistry_Init() */
+static struct OTA_currentFileVersion OTA_currentFileVersionTab[IMAGE_TYPE_MAX + 1] = {
+  [fileType_COPRO_WIRELESS] = {fileType_COPRO_WIRELESS, CURRENT_FW_COPRO_WIRELESS_FILE_VERSION},
+  [fileType_APP] = {fileType_APP, CURRENT_FW_APP_FILE_VERSION},
 };
 
 static struct Zigbee_OTA_client_info OTA_client_info;
+#if (OTA_SIGNATURE_ENABLE)
+/* Public key (X || Y) of the image signer */
+static const uint8_t OTA_signature_public_key[OTA_ECDSA_KEY_SIZE] = OTA_KEYS_SIGNATURE_PUBLIC_KEY;
+#endif
+#if (OTA_ENCRYPTION_ENABLE)
+/* Key of the encrypted images */
+static const uint8_t OTA_image_key[OTA_AES_KEY_SIZE] = OTA_KEYS_IMAGE_KEY;
+#endif
 static struct ZbZclOtaClientConfig client_config = {
   .profile_id = ZCL_PROFILE_HOME_AUTOMATION,
   .endpoint = SW1_ENDPOINT,
@@ -147,6 +380,12 @@ static struct ZbZclOtaClientConfig client_config = {
   .timeout_policy = ZCL_OTA_TIMEOUT_POLICY_APPLY_UPGRADE,
 };
 
+#if (USE_TAG_WRITE_CB)
+/* OTA file sub-element handlers, called with each chunk of their sub-element */
+static struct APP_ZIGBEE_OtaTagHandlerEntry_t OTA_tag_handlers[OTA_TAG_HANDLERS_MAX];
+static uint8_t OTA_tag_handlers_nb;
+#endif /* USE_TAG_WRITE_CB */
+
 
 
 
@@ -154,17 +393,37 @@ struct zigbee_app_info {
   bool has_init;
   struct ZigBeeT *zb;
   enum ZbStatusCodeT join_status;
-  uint32_t join_delay;
+  uint32_t join_retry_nb;     /**< failed attempts since the last success, backoff exponent and channel rotation */
+  uint32_t join_rand;         /**< jitter generator state, seeded with the EUI64 */
+  bool join_retry_pending;    /**< TS_JOIN_RETRY running */
+  bool join_in_progress;      /**< ZbStartup called, callback not received yet */
+  bool join_done;             /**< callback received, join_status not processed yet */
+  uint32_t join_attempt;      /**< callback argument, tells a late callback from the current one */
+  enum APP_ZIGBEE_StartupState_t startup_state;
+  uint32_t startup_state_tick;                  /**< HAL tick of the state entry */
+  uint32_t startup_time[STARTUP_STATE_NB];      /**< ms spent in each state */
+  bool startup_timeout;
   uint32_t persistNumWrites;
   bool fresh_startup;
 
   struct ZbZclClusterT *ota_client;
+  struct ZbApsFilterT *ota_mcast_filter;
 };
 
 static struct zigbee_app_info zigbee_app_info;
 
 static uint8_t      TS_ID_LED;
 static uint8_t      TS_DOWNLOAD_RESUME;
+static uint8_t      TS_STARTUP;
+static uint8_t      TS_JOIN_RETRY;
+static uint8_t      TS_MCAST_NACK;
+#if (CFG_APP_AB_SLOTS)
+static bool         slotLayoutValid;      /* slots below the secure flash, checked by APP_ZIGBEE_OTA_Slot_Init */
+#endif
+#if (OTA_SCHEDULE_ENABLE)
+static uint8_t      TS_OTA_SCHEDULE;
+static struct APP_ZIGBEE_OtaSchedule_t OTA_schedule = { .local_time = OTA_SCHEDULE_TIME_AT_BOOT };
+#endif
 /* NVM variables */
 /* cache in uninit RAM to store/retrieve persistent data */
 union cache
@@ -174,7 +433,29 @@ union cache
 };
 
 __attribute__ ((section(".noinit"))) union cache cache_persistent_data;
+/* shadow of the persistent data in NVM, the reference of the delta records */
 __attribute__ ((section(".noinit"))) union cache cache_diag_reference;
+/* persistent data snapshot as stored in NVM, packed when it saves words */
+__attribute__ ((section(".noinit"))) union cache cache_nvm_image;
+static uint16_t     persistShadowWords;   /* words of the shadow, 0 if unknown */
+/* seal of cache_persistent_data : a warm reset restores from RAM */
+__attribute__ ((section(".noinit"))) APP_ZIGBEE_PersistSeal_t persistRamSeal;
+static bool         persistRamSealed;     /* seal checked at startup, cache not verified yet */
+/* persistence store index, built by APP_ZIGBEE_NVM_Scan */
+static uint32_t     persistStoreSnapshot; /* address of the last valid snapshot record, 0 if none */
+static uint32_t     persistStoreRecord;   /* address of the last record of its chain */
+static uint32_t     persistStoreDeltas;   /* delta records in the chain */
+static uint32_t     persistStoreFree;     /* address the next record is appended at, 0 to go to the next page */
+static uint32_t     persistStoreSequence; /* sequence number of the last record */
+/* NVM maintenance, see APP_ZIGBEE_NVM_Gc */
+static uint8_t      TS_PERSIST_GC;
+static bool         eeCleanPending;       /* EE_Write asked for a cleanup */
+static uint32_t     eeWritesSinceClean;
+static APP_ZIGBEE_NvmStats_t nvmStats;
+/* persistence notifications are coalesced, see APP_ZIGBEE_persist_notify_cb */
+static uint8_t      TS_PERSIST_SAVE;
+static bool         persistDirty;
+static uint32_t     persistDirtyTime;     /* HAL tick of the first notification not saved yet */
 
 /* timer to delay reading attribute back from persistence */
 static uint8_t  TS_ID1;
@@ -183,6 +464,26 @@ static uint8_t  bPersistDataUsed;
 
 /* Functions Definition ------------------------------------------------------*/
 
+/**
+ * @brief  Reading the OTA server address found by the discovery (posted command)
+ * @param  arg: unused
+ * @retval ZCL status
+ */
+static uint32_t APP_ZIGBEE_OTA_Client_ReadServerId(void *arg)
+{
+  enum ZclStatusCodeT internal_status = ZCL_STATUS_SUCCESS;
+  uint64_t requested_server_ext;
+  UNUSED(arg);
+
+  /* The OTA server extended address in stored in ZCL_OTA_ATTR_UPGRADE_SERVER_ID attribute */
+  requested_server_ext = ZbZclAttrIntegerRead(zigbee_app_info.ota_client, ZCL_OTA_ATTR_UPGRADE_SERVER_ID, NULL, &internal_status);
+  UNUSED (requested_server_ext);
+  if(internal_status != ZCL_STATUS_SUCCESS){
+    APP_DBG("ZbZclAttrIntegerRead failed.\n");
+  }
+  return (uint32_t)internal_status;
+}
+
 /**
  * @brief  OTA client Discover callback
  * @param  clusterPtr: ZCL Cluster pointer
@@ -190,26 +491,20 @@ static uint8_t  bPersistDataUsed;
  * @retval None
  */
 static void APP_ZIGBEE_OTA_Client_DiscoverComplete_cb(struct ZbZclClusterT *clusterPtr, enum ZclStatusCodeT status,void *arg){
-  enum ZclStatusCodeT internal_status = ZCL_STATUS_SUCCESS;
-  uint64_t requested_server_ext = 0;
   //UNUSED (status);
 
   if (status == ZCL_STATUS_SUCCESS )
   {
-    /* The OTA server extended address in stored in ZCL_OTA_ATTR_UPGRADE_SERVER_ID attribute */
-    requested_server_ext = ZbZclAttrIntegerRead(zigbee_app_info.ota_client, ZCL_OTA_ATTR_UPGRADE_SERVER_ID, NULL, &internal_status);
-    UNUSED (requested_server_ext);
-    if(internal_status != ZCL_STATUS_SUCCESS){
-      APP_DBG("ZbZclAttrIntegerRead failed.\n");
-    }
+    /* Read once the M0 notification is acknowledged */
+    (void)APP_ZIGBEE_CmdPost(APP_ZIGBEE_OTA_Client_ReadServerId, NULL, NULL);
 
     APP_DBG("OTA Server located ...");
-    UTIL_SEQ_SetEvt(EVENT_ZIGBEE_OTA_SERVER_FOUND);
+    APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_APP_START, CFG_SCH_CLASS_OTA);
   }
   else
   {
     APP_DBG("OTA Server not found after TimeOut. Retry a discovery");
-    UTIL_SEQ_SetTask( 1U << CFG_TASK_ZIGBEE_OTA_SERVER_DISCOVERY, CFG_SCH_PRIO_0 );
+    APP_SEQ_SetTask( 1U << CFG_TASK_ZIGBEE_OTA_SERVER_DISCOVERY, CFG_SCH_CLASS_OTA );
   }
 }
 
@@ -284,7 +579,7 @@ static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_ImageNotify_cb(struct ZbZclClus
    * => re-send an Query Next Image request  back to the upgrade server */
   OTA_client_info.image_type = image_definition->image_type;
   OTA_client_info.current_file_version = OTA_currentFileVersionTab[pos].fileVersion;
-  UTIL_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_REQUEST_UPGRADE, CFG_SCH_PRIO_0);
+  APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_REQUEST_UPGRADE, CFG_SCH_CLASS_OTA);
 
   return ZCL_STATUS_SUCCESS;
 }
@@ -302,36 +597,53 @@ static void APP_ZIGBEE_OTA_Client_QueryNextImage_cb(struct ZbZclClusterT *cluste
                                                     struct ZbZclOtaImageDefinition *image_definition, uint32_t image_size, void *arg){
   struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
   bool ota_resume_status = false;
+#if (CFG_APP_AB_SLOTS)
+  uint32_t rejected_version;
+#endif
   APP_DBG("[OTA] Client Query Next Image request response received.");
   if(status != ZCL_STATUS_SUCCESS){
     APP_DBG("[OTA] A such image is not available.\n");
+#if (OTA_BUNDLE_ENABLE)
+    if((client_info->ctx.bundle_offset != 0u) && (client_info->image_type == fileType_COPRO_WIRELESS)){
+      /* No wireless stack to go with the application : apply the application alone */
+      APP_DBG("[OTA] No M0 image to bundle, rebooting on the M4 application.");
+      client_info->image_type = fileType_APP;
+      client_info->ctx.bundle_offset = 0;
+      APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_FUOTA_RESET, CFG_SCH_CLASS_OTA);
+    }
+#endif
     return;
   } else {
     APP_DBG("[OTA] A such image is available.");
   }
 
-  switch(image_definition->image_type){
-    case fileType_COPRO_WIRELESS:
-      client_info->ctx.base_address = FUOTA_COPRO_FW_BINARY_ADDRESS;
-      client_info->ctx.magic_keyword = FUOTA_MAGIC_KEYWORD_COPRO_WIRELESS;
-      client_info->ctx.file_type = fileType_COPRO_WIRELESS;
-      break;
-
-    case fileType_APP:
-      client_info->ctx.base_address = FUOTA_APP_FW_BINARY_ADDRESS;
-      client_info->ctx.magic_keyword = FUOTA_MAGIC_KEYWORD_APP;
-      client_info->ctx.file_type = fileType_APP;
-      break;
+  if(client_info->mcast.active){
+    APP_DBG("[OTA] Multicast session in progress, no unicast download.\n");
+    return;
+  }
 
-    default:
-      APP_DBG("[OTA] Error, unknown image type.\n");
-      return;
+  if(!APP_ZIGBEE_OTA_Client_SetImageType(client_info, image_definition->image_type)){
+    return;
+  }
+#if (CFG_APP_AB_SLOTS)
+  if((image_definition->image_type == fileType_APP)
+     && (CFG_APP_SLOT_RECORD_STATE(APP_SLOT_GetState(&rejected_version)) == CFG_APP_SLOT_ROLLED_BACK)
+     && (rejected_version == image_definition->file_version)){
+    APP_DBG("[OTA] File version 0x%08x was rolled back. No download.\n", rejected_version);
+    return;
   }
+#endif
   client_info->requested_image_size = image_size;
   client_info->ctx.binary_srv_crc = 0;
   client_info->ctx.binary_calc_crc = 0;
+  client_info->flags &= ~(OTA_CLIENT_CRC_RECEIVED_FLAG | OTA_CLIENT_SIGNATURE_RECEIVED_FLAG | OTA_CLIENT_MANIFEST_VALID_FLAG
+                          | OTA_CLIENT_IMAGE_VERIFIED_FLAG);
   client_info->ctx.file_version = image_definition->file_version;
-  if(APP_ZIGBEE_CheckDeviceCapabilities() != APP_ZIGBEE_OK){
+  client_info->ctx.image_encoding = OTA_IMAGE_ENCODING_RAW;
+  client_info->ctx.tag_offset = 0;
+  memset(&client_info->tag, 0, sizeof(client_info->tag));
+  /* In a bundle the M0 image is written after the M4 one */
+  if(APP_ZIGBEE_CheckDeviceCapabilities(client_info->ctx.bundle_offset + image_size) != APP_ZIGBEE_OK){
     APP_DBG("[OTA] Not enough space. No download.\n");
     return;
   }
@@ -342,18 +654,41 @@ if(client_info->flags & OTA_CLIENT_CTX_FOUND_FLAG)
   /* Check and validate previous OTA data in flash (in case we resume a transfer) */
   /* Validate date against received header */
   ota_resume_status = APP_ZIGBEE_OTA_Client_CheckPriviousDownload(image_definition);
+#if (OTA_SIGNATURE_ENABLE)
+  if(ota_resume_status && (client_info->zigbee_ota_ctx_nvm.OtaCurrentState == VERIFYING_IMAGE))
+  {
+    if(client_info->zigbee_ota_ctx_nvm.image_verified != 0u)
+    {
+      /* The signature and/or manifest already matched this image before the reset */
+      client_info->flags |= OTA_CLIENT_IMAGE_VERIFIED_FLAG;
+    }
+    else
+    {
+      /* Reset before the signature was checked : it was only held in RAM, the image is downloaded again */
+      APP_DBG("[OTA] Image not verified before the reset.");
+      ota_resume_status = false;
+    }
+  }
+#endif
   if(ota_resume_status)
   {
     /* Checks are ok , we can resume download */
     client_info->flags |= OTA_CLIENT_RESUME_DOWNLOAD_FLAG;
+    client_info->ctx.image_encoding = (enum APP_ZIGBEE_OtaImageEncoding_t)client_info->zigbee_ota_ctx_nvm.image_encoding;
+    if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_DELTA)
+    {
+      /* A delta image is rebuilt in the staging area, the installed image is left untouched */
+      client_info->ctx.base_address = FUOTA_APP_DELTA_STAGING_ADDRESS;
+    }
     APP_DBG("[OTA] Resuming download for this image type.\n");
   }
   else
   {
     /* Image type header mismatch previous data in NVM , clean up to start a fresh download */
     client_info->flags &= ~OTA_CLIENT_CTX_FOUND_FLAG;
-    APP_DBG("Delete_Sectors");
-    Delete_Sectors();
+    /* Erase is done on first block, once the image encoding is known */
+    client_info->flags |= OTA_CLIENT_ERASE_PENDING_FLAG;
+    client_info->write_info.flash_current_offset = 0;
     APP_DBG("[OTA] checks failled , starting a fresh download.\n");
     
   }
@@ -371,46 +706,55 @@ if(client_info->flags & OTA_CLIENT_RESUME_DOWNLOAD_FLAG){
     ret_val = APP_ZIGBEE_OTA_Client_ImageValidate_cb(NULL,NULL,client_info);
     if(ret_val == ZCL_STATUS_SUCCESS)
     {
+#if (OTA_BUNDLE_ENABLE)
+      if(APP_ZIGBEE_OTA_Client_BundleNext(client_info))
+      {
+        return;
+      }
+#endif
       /* Schedule reboot if validation is ok */
       APP_DBG("**************************************************************");
       APP_DBG("[OTA] Rebooting.");
       HAL_Delay(100);
-      UTIL_SEQ_SetTask(1U << (uint32_t)CFG_TASK_FUOTA_RESET, CFG_SCH_PRIO_0);
+      APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_FUOTA_RESET, CFG_SCH_CLASS_OTA);
       return;
     }
   }
 }
   client_info->OTA_state = DOWNLOADING_IMAGE;
   APP_DBG("[OTA] For image type 0x%04x, %d byte(s) will be downloaded.", image_definition->image_type, image_size);
-  UTIL_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_START_DOWNLOAD, CFG_SCH_PRIO_0);
+#if (OTA_SCHEDULE_ENABLE)
+  APP_ZIGBEE_OTA_Schedule_Download();
+#else
+  APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_START_DOWNLOAD, CFG_SCH_CLASS_OTA);
   APP_DBG("[OTA] Starting download.\n");
+#endif
 }
 
 
 /**
- * @brief  OTA client Calc CRC for a payload
- * @param  data: payload to calc
- * @param  size: length of payload
+ * @brief  OTA client Calc CRC (XOR of 32 bits words) of an image written in flash
+ *         Computed from flash so that it also covers data written before a resume.
+ * @param  address: image start address
+ * @param  size: image length, a last incomplete word is padded with 0
+ * @retval CRC value
  */
-static void APP_ZIGBEE_OTA_Client_Crc_Calc( struct Zigbee_OTA_client_info * client_info ) {
-  uint8_t     modulo;
-  uint16_t    index, size;
-  uint32_t *  crc_data;
+static uint32_t APP_ZIGBEE_OTA_Client_Crc_Calc(uint32_t address, uint32_t size) {
+  uint32_t crc = 0;
+  uint32_t last_word = 0;
+  uint32_t index;
 
-  // -- Prepare pointer & size --
-  size = client_info->write_info.firmware_buffer_current_offset;
-  crc_data = (uint32_t *)client_info->write_info.firmware_buffer;
-  modulo = size % 4u;
-  if ( modulo != 0u )
+  for ( index = 0; ( index + 4u ) <= size; index += 4u )
   {
-      memset( &crc_data[size], 0, ( 4u - modulo ) );
-      size  += ( 4u - modulo );
+    crc ^= *(uint32_t *)( address + index );
   }
-
-  for ( index = 0; index < ( size / 4u ); index++ )
+  if ( index < size )
   {
-    client_info->ctx.binary_calc_crc ^= crc_data[index];
+    memcpy( &last_word, (void const *)( address + index ), size - index );
+    crc ^= last_word;
   }
+
+  return crc;
 }
 
 
@@ -442,18 +786,10 @@ static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteImage_cb(struct ZbZclClust
   {
     /* Resume OTA process from a previsouly downloaded file */
     current_offset+= client_info->zigbee_ota_ctx_nvm.flash_offset;
-    /* reset flag */
-    client_info->flags &= ~OTA_CLIENT_RESUME_DOWNLOAD_FLAG;
-    /* Update ota cluster ZCL_OTA_ATTR_FILE_OFFSET attribute, need to skip header length (which is sent with every block response ) + TAG length */
-    if(ZbZclAttrIntegerWrite(zigbee_app_info.ota_client,ZCL_OTA_ATTR_FILE_OFFSET,client_info->zigbee_ota_ctx_nvm.flash_offset+header->header_length+OTA_HEADER_TAG_SIZE  ) != ZCL_STATUS_SUCCESS)
-    {
-      APP_DBG("[OTA] FUOTA failed to update ota cluster attr with value offset= 0x%04X)", current_offset);
-      return ZCL_STATUS_FAILURE;
-    }
-
-    APP_DBG("[OTA] FUOTA Transfer resuming from NVM ( offset= 0x%04X)", current_offset);
-    return status;
+    return APP_ZIGBEE_OTA_Client_ResumeTransfer(client_info, header);
   }
+  APP_ZIGBEE_OTA_Client_PrepareFlash(client_info);
+  client_info->ctx.tag_offset += length;
   if(client_info->write_info.firmware_buffer_current_offset + size > RAM_FIRMWARE_BUFFER_SIZE)
   {
     size = RAM_FIRMWARE_BUFFER_SIZE - client_info->write_info.firmware_buffer_current_offset;
@@ -485,9 +821,6 @@ static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteImage_cb(struct ZbZclClust
     APP_DBG("[OTA] FUOTA Transfer (current_offset = 0x%04X)", current_offset);
 #endif // OTA_DISPLAY_TIMING
 
-    // -- Calc CRC --
-    APP_ZIGBEE_OTA_Client_Crc_Calc( client_info );
-
     memset(client_info->write_info.firmware_buffer, 0, RAM_FIRMWARE_BUFFER_SIZE);
     memcpy(client_info->write_info.firmware_buffer, data+size, remaining_size);
     client_info->write_info.firmware_buffer_current_offset = remaining_size;
@@ -511,961 +844,3779 @@ static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteImage_cb(struct ZbZclClust
 }
 
 
-#ifdef USE_TAG_WRITE_CB
 /**
-* @brief  OTA client WriteTag callback
-* @param  clusterPtr: ZCL Cluster pointer
-* @param  header: ZCL OTA file format image header
-* @param  tag_id: Tag identifier
-* @param  tag_length : length of Tag
-* @param  data_length  : length of Tag data
-* @param  data  : Tag data
-* @param  arg: Passed arg
-* @retval ZCL status code
-*/
-static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteTag_cb(struct ZbZclClusterT * clusterPtr, struct ZbZclOtaHeader * header,
-                                                            uint16_t tag_id, uint32_t tag_length, uint8_t data_length,
-                                                            uint8_t * data, void * arg)
-{
-   struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
-   enum ZclStatusCodeT status = ZCL_STATUS_SUCCESS;
-   UNUSED(tag_length);
+ * @brief  OTA client accumulating the encoding specific header of the image sub-element
+ * @param  client_info: OTA client internal structure
+ * @param  length: received chunk length
+ * @param  data: received chunk payload
+ * @param  p_index: chunk read index, updated
+ * @param  header_size: header length
+ * @retval true when the header has just been completed
+ */
+static bool APP_ZIGBEE_OTA_Client_ParseSubHeader(struct Zigbee_OTA_client_info* client_info, uint8_t length, uint8_t * data,
+                                                 uint32_t *p_index, uint32_t header_size){
+  bool complete = false;
 
-   switch (tag_id)
-   {
-       case ZCL_OTA_SUB_TAG_UPGRADE_IMAGE:
-           /* APP_DBG("[OTA] Writing blocks. \n"); */
-           status = APP_ZIGBEE_OTA_Client_WriteImage_cb(clusterPtr, header, data_length, data, arg);
-           break;
-
-       case ZCL_OTA_SUB_TAG_IMAGE_INTEGRITY_CODE:
-           APP_DBG("[OTA] Get check crc. \n");
-           client_info->ctx.binary_srv_crc = (uint32_t)data[0] | ( (uint16_t)data[1] << 8 );
-           if ( data_length == 4u )
-           {
-             client_info->ctx.binary_srv_crc |= ( (uint32_t)data[2] << 16u ) | ( (uint32_t)data[3] << 24u );
-           }
-           break;
-
-       default:
-           status = ZCL_STATUS_INVALID_FIELD;
-           break;
-   }
-   return status;
+  /* Header may be split over two blocks */
+  while((client_info->ctx.tag_offset < header_size) && (*p_index < length))
+  {
+    client_info->ctx.sub_header[client_info->ctx.tag_offset++] = data[(*p_index)++];
+    complete = (client_info->ctx.tag_offset == header_size);
+  }
+
+  return complete;
 }
-#endif
 
 /**
- * @brief  OTA client Image Validate callback
+ * @brief  OTA client decoding a chunk of an encoded image sub-element
+ *         Data is expanded on the fly into the RAM staging buffer which is
+ *         flushed to flash each time it is full, as for a raw image.
+ * @param  client_info: OTA client internal structure
+ * @param  length: received chunk length
+ * @param  data: received chunk payload
+ * @param  index: first byte of the chunk to decode
+ * @retval ZCL status code
+ */
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_DecodeChunk(struct Zigbee_OTA_client_info* client_info, uint8_t length, uint8_t * data, uint32_t index){
+  struct APP_ZIGBEE_OtaWriteInfo_t *write_info = &client_info->write_info;
+  uint32_t consumed, produced;
+  bool lzss = (client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_LZSS);
+  bool delta = (client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_DELTA);
+  bool error;
+
+  /* Keep draining while a copy is pending, even without new input */
+  while((index < length)
+        || (lzss && APP_OTA_LZSS_IsPending(&client_info->decoder.lzss))
+        || (delta && APP_OTA_DELTA_IsPending(&client_info->decoder.delta)))
+  {
+    if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_ENCRYPTED)
+    {
+      /* Decrypted straight into the staging buffer, one byte out for one byte in */
+      consumed = MIN(length - index, RAM_FIRMWARE_BUFFER_SIZE - write_info->firmware_buffer_current_offset);
+      APP_OTA_AES_CtrProcess(&client_info->decoder.aes, &data[index],
+                             &write_info->firmware_buffer[write_info->firmware_buffer_current_offset], consumed);
+      produced = consumed;
+      error = false;
+    }
+    else if(lzss)
+    {
+      error = (APP_OTA_LZSS_Decode(&client_info->decoder.lzss, &data[index], length - index, &consumed,
+                                   &write_info->firmware_buffer[write_info->firmware_buffer_current_offset],
+                                   RAM_FIRMWARE_BUFFER_SIZE - write_info->firmware_buffer_current_offset,
+                                   &produced) != APP_OTA_LZSS_OK);
+    }
+    else
+    {
+      error = (APP_OTA_DELTA_Apply(&client_info->decoder.delta, &data[index], length - index, &consumed,
+                                   &write_info->firmware_buffer[write_info->firmware_buffer_current_offset],
+                                   RAM_FIRMWARE_BUFFER_SIZE - write_info->firmware_buffer_current_offset,
+                                   &produced) != APP_OTA_DELTA_OK);
+    }
+    if(error)
+    {
+      APP_DBG("[OTA] Corrupted image sub-element (offset = 0x%04X).", client_info->ctx.tag_offset + consumed);
+      return ZCL_STATUS_INVALID_IMAGE;
+    }
+    index += consumed;
+    client_info->ctx.tag_offset += consumed;
+    write_info->firmware_buffer_current_offset += produced;
+
+    if(write_info->firmware_buffer_current_offset == RAM_FIRMWARE_BUFFER_SIZE){
+      if(APP_ZIGBEE_OTA_Client_FlushBuffer(client_info) != APP_ZIGBEE_OK){
+        return ZCL_STATUS_FAILURE;
+      }
+    }
+  }
+
+  /* Handling donwload pause request */
+  if(client_info->flags & OTA_CLIENT_PAUSE_DOWNLOAD_FLAG )
+  {
+    client_info->flags &= ~OTA_CLIENT_PAUSE_DOWNLOAD_FLAG;
+    return ZCL_STATUS_WAIT_FOR_DATA;
+  }
+
+  return ZCL_STATUS_SUCCESS;
+}
+
+/**
+ * @brief  OTA client write of a LZSS compressed image sub-element
  * @param  clusterPtr: ZCL Cluster pointer
  * @param  header: ZCL OTA file format image header
+ * @param  length: received chunk length
+ * @param  data: received chunk payload
  * @param  arg: Passed arg
  * @retval ZCL status code
  */
-static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_ImageValidate_cb(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header, void *arg){
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteCompressedImage(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                      uint8_t length, uint8_t * data, void *arg){
   struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
-  enum ZclStatusCodeT status = ZCL_STATUS_SUCCESS;
-  uint64_t last_double_word = 0;
-  double l_transfer_throughput = 0;
-  uint32_t lTransfertThroughputInt, lTransfertThroughputDec;
+  uint32_t index = 0;
 
-  /* Download finished => stop Toggling of the LED */
-  HW_TS_Stop(TS_ID_LED);
-  BSP_LED_Off(LED_GREEN);
-  APP_DBG("LED_GREEN OFF");
-  client_info->OTA_state=VERIFYING_IMAGE;
-  /* Write the last RAM buffer to Flash */
-  if(client_info->write_info.firmware_buffer_current_offset != 0){
-    /* Write to Flash Memory */
-    APP_ZIGBEE_OTA_Client_WriteFirmwareData(client_info);
-    client_info->write_info.firmware_buffer_current_offset = 0;
+  if(client_info->flags & OTA_CLIENT_RESUME_DOWNLOAD_FLAG)
+  {
+    return APP_ZIGBEE_OTA_Client_ResumeTransfer(client_info, header);
   }
 
-  APP_DBG("**************************************************************\n");
-  APP_DBG("[OTA] Validating the image.");
-  
-  /* Finding the magic number */
+  if(client_info->ctx.image_encoding != OTA_IMAGE_ENCODING_LZSS)
+  {
+    /* First block of the sub-element : fresh decoder */
+    APP_OTA_LZSS_Init(&client_info->decoder.lzss);
+    client_info->ctx.image_encoding = OTA_IMAGE_ENCODING_LZSS;
+  }
 
-  /* Last double word in Flash
-   * => the magic if the firmware is valid
-   */
-  client_info->write_info.flash_current_offset -= 8;
-  memcpy(&last_double_word, (void const*)(client_info->ctx.base_address + client_info->write_info.flash_current_offset), 8);
-  if(((last_double_word & 0x00000000FFFFFFFF) != client_info->ctx.magic_keyword)
-     && (((last_double_word & 0xFFFFFFFF00000000) >> 32) != client_info->ctx.magic_keyword)){
-    APP_DBG("[OTA] Wrong magic keyword: invalid firmware.\n");
-    status = ZCL_STATUS_INVALID_IMAGE;
-    return status;
+  if(APP_ZIGBEE_OTA_Client_ParseSubHeader(client_info, length, data, &index, OTA_LZSS_HEADER_SIZE))
+  {
+    client_info->ctx.binary_size = APP_ZIGBEE_GetLE32(&client_info->ctx.sub_header[0]);
+    APP_DBG("[OTA] Compressed image, %d bytes once expanded.", client_info->ctx.binary_size);
+    if(APP_ZIGBEE_CheckDeviceCapabilities(client_info->ctx.binary_size) != APP_ZIGBEE_OK){
+      return ZCL_STATUS_INSUFFICIENT_SPACE;
+    }
+    APP_ZIGBEE_OTA_Client_PrepareFlash(client_info);
   }
 
-  APP_DBG("[OTA] The downloaded firmware is valid.\n");
-  client_info->download_time = (HAL_GetTick()- client_info->download_time)/1000;
-  l_transfer_throughput = (((double)client_info->requested_image_size/client_info->download_time) / 1000) * 8;
-  lTransfertThroughputInt = (uint32_t)l_transfer_throughput;
-  lTransfertThroughputDec = (uint32_t)( ( l_transfer_throughput - lTransfertThroughputInt ) * 100 );
+  return APP_ZIGBEE_OTA_Client_DecodeChunk(client_info, length, data, index);
+}
 
-  APP_DBG("**************************************************************");
-  APP_DBG(" FUOTA : END OF TRANSFER COMPLETED");
+/**
+ * @brief  OTA client write of a delta image sub-element
+ *         The new application is rebuilt in the staging area from the image
+ *         installed at FUOTA_APP_FW_BINARY_ADDRESS (slot A), which must match
+ *         the patch source (size and CRC). This is not always the running
+ *         application : after a bundle or an A/B slots swap, slot A holds the
+ *         last image installed, which only runs after the next reset. The
+ *         server shall build the delta against that image.
+ * @param  clusterPtr: ZCL Cluster pointer
+ * @param  header: ZCL OTA file format image header
+ * @param  length: received chunk length
+ * @param  data: received chunk payload
+ * @param  arg: Passed arg
+ * @retval ZCL status code
+ */
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteDeltaImage(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                 uint8_t length, uint8_t * data, void *arg){
+  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+  uint32_t index = 0;
+  uint32_t source_size, source_crc;
+  uint32_t max_size = (CFG_APP_DELTA_STAGING_SECTOR_INDEX - CFG_APP_START_SECTOR_INDEX) * FLASH_PAGE_SIZE;
 
-  if(client_info->image_type == IMAGE_TYPE_FW_COPRO_WIRELESS){
-    APP_DBG("  - M0 wireless coprocessor firmware.");
-  } else {
-    APP_DBG("  - M4 application firmware.");
+  if(client_info->flags & OTA_CLIENT_RESUME_DOWNLOAD_FLAG)
+  {
+    return APP_ZIGBEE_OTA_Client_ResumeTransfer(client_info, header);
   }
 
-  APP_DBG("  - %d bytes downloaded in %d seconds.",  client_info->requested_image_size, client_info->download_time);
-  APP_DBG("  - Average throughput = %d.%d kbit/s.", lTransfertThroughputInt, lTransfertThroughputDec );
-  APP_DBG("**************************************************************");
+  if(client_info->ctx.file_type != fileType_APP)
+  {
+    APP_DBG("[OTA] Delta image only supported for M4 application.");
+    return ZCL_STATUS_INVALID_IMAGE;
+  }
 
-  BSP_LED_On(LED_GREEN);
-  APP_DBG("LED_GREEN ON");
+  if(client_info->ctx.image_encoding != OTA_IMAGE_ENCODING_DELTA)
+  {
+    /* First block of the sub-element */
+    client_info->ctx.image_encoding = OTA_IMAGE_ENCODING_DELTA;
+    client_info->ctx.base_address = FUOTA_APP_DELTA_STAGING_ADDRESS;
+  }
 
-  return status;
+  if(APP_ZIGBEE_OTA_Client_ParseSubHeader(client_info, length, data, &index, OTA_DELTA_HEADER_SIZE))
+  {
+    source_size = APP_ZIGBEE_GetLE32(&client_info->ctx.sub_header[0]);
+    source_crc = APP_ZIGBEE_GetLE32(&client_info->ctx.sub_header[4]);
+    client_info->ctx.binary_size = APP_ZIGBEE_GetLE32(&client_info->ctx.sub_header[8]);
+    APP_DBG("[OTA] Delta image, %d bytes rebuilt from %d bytes of installed image.", client_info->ctx.binary_size, source_size);
+
+    if((source_size > max_size)
+       || (APP_ZIGBEE_OTA_Client_Crc_Calc(FUOTA_APP_FW_BINARY_ADDRESS, source_size) != source_crc))
+    {
+      APP_DBG("[OTA] Installed image does not match the delta image source.");
+      return ZCL_STATUS_INVALID_IMAGE;
+    }
+    if((client_info->ctx.binary_size > max_size)
+       || ((CFG_APP_DELTA_STAGING_SECTOR_INDEX * FLASH_PAGE_SIZE + client_info->ctx.binary_size) > (GetFirstSecureSector() * FLASH_PAGE_SIZE)))
+    {
+      APP_DBG("[OTA] Not enough space to rebuild the delta image.");
+      return ZCL_STATUS_INSUFFICIENT_SPACE;
+    }
+
+    APP_OTA_DELTA_Init(&client_info->decoder.delta, (const uint8_t *)FUOTA_APP_FW_BINARY_ADDRESS, source_size);
+    APP_ZIGBEE_OTA_Client_PrepareFlash(client_info);
+  }
+
+  return APP_ZIGBEE_OTA_Client_DecodeChunk(client_info, length, data, index);
 }
 
+#if (OTA_ENCRYPTION_ENABLE)
 /**
- * @brief  OTA client Reboot callback
+ * @brief  OTA client write of an encrypted image sub-element
+ *         The image is decrypted as received, in the RAM staging buffer.
  * @param  clusterPtr: ZCL Cluster pointer
+ * @param  header: ZCL OTA file format image header
+ * @param  length: received chunk length
+ * @param  data: received chunk payload
  * @param  arg: Passed arg
- * @retval None
+ * @retval ZCL status code
  */
-static void APP_ZIGBEE_OTA_Client_Reboot_cb(struct ZbZclClusterT *clusterPtr, void *arg){
-  UNUSED(arg);
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteEncryptedImage(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                     uint8_t length, uint8_t * data, void *arg){
+  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+  uint32_t index = 0;
 
-  APP_DBG("**************************************************************");
-  APP_DBG("[OTA] Rebooting.");
+  if(client_info->flags & OTA_CLIENT_RESUME_DOWNLOAD_FLAG)
+  {
+    return APP_ZIGBEE_OTA_Client_ResumeTransfer(client_info, header);
+  }
 
-  APP_DBG("LED_BLUE OFF");
-  BSP_LED_Off(LED_BLUE);
-  APP_DBG("LED_GREEN OFF");
-  BSP_LED_Off(LED_GREEN);
-  APP_DBG("**************************************************************\n");
-  
-  HAL_Delay(100);
-  UTIL_SEQ_SetTask(1U << (uint32_t)CFG_TASK_FUOTA_RESET, CFG_SCH_PRIO_0);
+  if(client_info->tag.length <= OTA_AES_HEADER_SIZE)
+  {
+    APP_DBG("[OTA] Wrong encrypted image sub-element length (%d bytes).", client_info->tag.length);
+    return ZCL_STATUS_INVALID_IMAGE;
+  }
+
+  client_info->ctx.image_encoding = OTA_IMAGE_ENCODING_ENCRYPTED;
+  if(APP_ZIGBEE_OTA_Client_ParseSubHeader(client_info, length, data, &index, OTA_AES_HEADER_SIZE))
+  {
+    client_info->ctx.binary_size = client_info->tag.length - OTA_AES_HEADER_SIZE;
+    APP_DBG("[OTA] Encrypted image, %d bytes.", client_info->ctx.binary_size);
+    APP_OTA_AES_CtrInit(&client_info->decoder.aes, OTA_image_key, client_info->ctx.sub_header, 0);
+    APP_ZIGBEE_OTA_Client_PrepareFlash(client_info);
+  }
+
+  return APP_ZIGBEE_OTA_Client_DecodeChunk(client_info, length, data, index);
 }
+#endif /* OTA_ENCRYPTION_ENABLE */
 
 /**
- * @brief  OTA client Abort callback
- * @param  clusterPtr: ZCL Cluster pointer
- * @param  commandId: ZCL OTA command ID associated to the block transfer abortion
- * @param  arg: Passed arg
+ * @brief  OTA client resume of a transfer from the context saved in NVM
+ *         The first block received is dropped, the server is then asked to
+ *         continue from the sub-element offset matching the last flash write.
+ * @param  client_info: OTA client internal structure
+ * @param  header: ZCL OTA file format image header
  * @retval ZCL status code
  */
-static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_AbortDownload_cb(struct ZbZclClusterT *clusterPtr, enum ZbZclOtaCommandId commandId, void *arg){
- 
-  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
-  APP_DBG("[OTA] Server aborted download.");
-  HW_TS_Stop(TS_ID_LED);
-  BSP_LED_Off(LED_GREEN);
-  BSP_LED_On(LED_RED);
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_ResumeTransfer(struct Zigbee_OTA_client_info* client_info, struct ZbZclOtaHeader *header){
+  uint32_t flash_offset = client_info->zigbee_ota_ctx_nvm.flash_offset;
+  uint32_t history_len;
 
-//  if(commandId == ZCL_OTA_COMMAND_IMAGE_BLOCK_RESPONSE)
-//  {
-  #ifdef OTA_ABORT_RETRY_ENABLE
-    client_info->OTA_abort_retries++;
-    if(client_info->OTA_abort_retries < OTA_CLIENT_ABORT_MAX_RETRIES )
-    {
-      APP_DBG("[OTA] retrying resume download in 500ms");
-      HW_TS_Start(TS_DOWNLOAD_RESUME, (uint32_t)OTA_DOWNLOAD_RETRY_DELAY);
-    }
-    else
-    {
-      
-      APP_DBG("[OTA] FATAL ERROR :resuming download failled after %d attempts",client_info->OTA_abort_retries);
-      client_info->OTA_abort_retries=0;
-      return ZCL_STATUS_SUCCESS;
-    }
-  #endif
- //}
+  /* reset flag */
+  client_info->flags &= ~OTA_CLIENT_RESUME_DOWNLOAD_FLAG;
 
-  return ZCL_STATUS_ABORT;
+  client_info->ctx.image_encoding = (enum APP_ZIGBEE_OtaImageEncoding_t)client_info->zigbee_ota_ctx_nvm.image_encoding;
+  client_info->ctx.tag_offset = client_info->zigbee_ota_ctx_nvm.tag_offset;
+  if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_LZSS)
+  {
+    /* Rebuild the decoder history from what is already in flash */
+    history_len = (flash_offset < OTA_LZSS_WINDOW_SIZE) ? flash_offset : OTA_LZSS_WINDOW_SIZE;
+    APP_OTA_LZSS_Restore(&client_info->decoder.lzss, client_info->zigbee_ota_ctx_nvm.decoder_ctx, flash_offset,
+                         (const uint8_t *)(client_info->ctx.base_address + flash_offset - history_len), history_len);
+  }
+  else if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_DELTA)
+  {
+    APP_OTA_DELTA_Restore(&client_info->decoder.delta, client_info->zigbee_ota_ctx_nvm.decoder_ctx,
+                          (const uint8_t *)FUOTA_APP_FW_BINARY_ADDRESS);
+  }
+#if (OTA_ENCRYPTION_ENABLE)
+  else if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_ENCRYPTED)
+  {
+    /* Counter mode : seek to the first byte not yet in flash */
+    memcpy(client_info->ctx.sub_header, client_info->zigbee_ota_ctx_nvm.decoder_ctx, OTA_AES_HEADER_SIZE);
+    APP_OTA_AES_CtrInit(&client_info->decoder.aes, OTA_image_key, client_info->ctx.sub_header, flash_offset);
+  }
+#endif
+#if (OTA_SIGNATURE_ENABLE)
+  /* Digest of what is already in flash, the rest is hashed as it is written */
+  APP_OTA_SHA256_Init(&client_info->image_hash);
+  APP_OTA_SHA256_Update(&client_info->image_hash, (const uint8_t *)client_info->ctx.base_address, flash_offset);
+#endif
+
+#if (USE_TAG_WRITE_CB)
+  /* Update ota cluster ZCL_OTA_ATTR_FILE_OFFSET attribute, relative to the image sub-element data (a manifest may come first) */
+  if(ZbZclAttrIntegerWrite(zigbee_app_info.ota_client,ZCL_OTA_ATTR_FILE_OFFSET,client_info->tag.data_offset+client_info->ctx.tag_offset) != ZCL_STATUS_SUCCESS)
+#else
+  /* Update ota cluster ZCL_OTA_ATTR_FILE_OFFSET attribute, need to skip header length (which is sent with every block response ) + TAG length */
+  if(ZbZclAttrIntegerWrite(zigbee_app_info.ota_client,ZCL_OTA_ATTR_FILE_OFFSET,client_info->ctx.tag_offset+header->header_length+OTA_HEADER_TAG_SIZE  ) != ZCL_STATUS_SUCCESS)
+#endif
+  {
+    APP_DBG("[OTA] FUOTA failed to update ota cluster attr with value offset= 0x%04X)", client_info->ctx.tag_offset);
+    return ZCL_STATUS_FAILURE;
+  }
+
+  APP_DBG("[OTA] FUOTA Transfer resuming from NVM ( offset= 0x%04X, flash offset= 0x%04X)", client_info->ctx.tag_offset, flash_offset);
+  return ZCL_STATUS_SUCCESS;
 }
 
+#if (USE_TAG_WRITE_CB)
 /**
- * @brief  OTA client request upgrade
- * @param  None
- * @retval None
- */
-static inline void APP_ZIGBEE_OTA_Client_Request_Upgrade(void){
-  enum ZclStatusCodeT status;
-  struct ZbZclOtaImageDefinition image_definition;
+* @brief  OTA client WriteTag callback
+*         The handler of a sub-element is looked up once, on its first chunk, and
+*         then called with the chunks as received. Sub-elements without handler
+*         are skipped, so that new metadata can be added to OTA files.
+* @param  clusterPtr: ZCL Cluster pointer
+* @param  header: ZCL OTA file format image header
+* @param  tag_id: Tag identifier
+* @param  tag_length : length of Tag
+* @param  data_length  : length of Tag data
+* @param  data  : Tag data
+* @param  arg: Passed arg
+* @retval ZCL status code
+*/
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteTag_cb(struct ZbZclClusterT * clusterPtr, struct ZbZclOtaHeader * header,
+                                                            uint16_t tag_id, uint32_t tag_length, uint8_t data_length,
+                                                            uint8_t * data, void * arg)
+{
+   struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+   enum ZclStatusCodeT status = ZCL_STATUS_SUCCESS;
+   uint8_t index;
 
-  APP_DBG("[OTA] Requesting an update.");
-  APP_DBG("[OTA] Image type: 0x%04x.", OTA_client_info.image_type);
-  APP_DBG("[OTA] Current file version: 0x%08x.\n", OTA_client_info.current_file_version);
+   if((tag_id != client_info->tag.id) || (client_info->tag.offset >= client_info->tag.length))
+   {
+     /* First chunk of a sub-element */
+     if(client_info->tag.next_offset == 0u)
+     {
+       client_info->tag.next_offset = header->header_length;
+     }
+#if (OTA_SIGNATURE_ENABLE) && (OTA_MANIFEST_REQUIRED)
+     if((client_info->tag.next_offset == header->header_length) && (tag_id != OTA_SUB_TAG_MANIFEST))
+     {
+       APP_DBG("[OTA] No manifest: image rejected.\n");
+       return ZCL_STATUS_INVALID_IMAGE;
+     }
+#endif
+     client_info->tag.id = tag_id;
+     client_info->tag.length = tag_length;
+     client_info->tag.offset = 0;
+     client_info->tag.data_offset = client_info->tag.next_offset + OTA_HEADER_TAG_SIZE;
+     client_info->tag.next_offset = client_info->tag.data_offset + tag_length;
+     client_info->tag.handler_index = OTA_TAG_HANDLER_NONE;
+     for(index = 0; index < OTA_tag_handlers_nb; index++)
+     {
+       if(OTA_tag_handlers[index].tag_id == tag_id)
+       {
+         client_info->tag.handler_index = index;
+         break;
+       }
+     }
+     if(client_info->tag.handler_index == OTA_TAG_HANDLER_NONE)
+     {
+       APP_DBG("[OTA] Skipping sub-element 0x%04x (%d bytes).", tag_id, tag_length);
+     }
+   }
 
-  /* Image definition configuration */
-  memset(&image_definition, 0, sizeof(image_definition));
-  image_definition.manufacturer_code = ST_ZIGBEE_MANUFACTURER_CODE;
-  image_definition.image_type = OTA_client_info.image_type;
-  image_definition.file_version = OTA_client_info.current_file_version;
+   if(client_info->tag.handler_index != OTA_TAG_HANDLER_NONE)
+   {
+     status = OTA_tag_handlers[client_info->tag.handler_index].handler(clusterPtr, header, data_length, data, arg);
+   }
+   client_info->tag.offset += data_length;
 
-  OTA_client_info.OTA_state = QUERYING_NEXT_IMAGE;
-  /* Sending Discovery request to server */
-  APP_DBG("[OTA] Sending Query Next Image request.");
-  /* HW version is provided as additional info in Query Next Image request */
-  status = ZbZclOtaClientQueryNextImageReq(zigbee_app_info.ota_client, &image_definition,
-                                           ZCL_OTA_QUERY_FIELD_CONTROL_HW_VERSION, CURRENT_HARDWARE_VERSION);
-  if(status != ZCL_STATUS_SUCCESS){
-    APP_DBG("ZbZclOtaClientDiscover failed.\n");
-  }
+   return status;
 }
 
 /**
- * @brief  OTA client start download
- * @param  None
- * @retval None
+ * @brief  Registering (or replacing) the handler of an OTA file sub-element
+ * @param  tag_id: sub-element tag identifier
+ * @param  handler: called with each chunk of the sub-element, see client_info->tag for its position
+ * @retval Application status code
  */
-static inline void APP_ZIGBEE_OTA_Client_StartDownload(void){
-  HW_TS_Start(TS_ID_LED, (uint32_t)LED_TOGGLE_TIMING);
-  OTA_client_info.download_time = HAL_GetTick();
-  ZbZclOtaClientImageTransferStart(zigbee_app_info.ota_client);
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_RegisterTagHandler(uint16_t tag_id, APP_ZIGBEE_OtaTagHandler_t handler)
+{
+  uint8_t index;
+
+  for(index = 0; index < OTA_tag_handlers_nb; index++)
+  {
+    if(OTA_tag_handlers[index].tag_id == tag_id)
+    {
+      OTA_tag_handlers[index].handler = handler;
+      return APP_ZIGBEE_OK;
+    }
+  }
+  if(OTA_tag_handlers_nb == OTA_TAG_HANDLERS_MAX)
+  {
+    return APP_ZIGBEE_ERROR;
+  }
+  OTA_tag_handlers[OTA_tag_handlers_nb].tag_id = tag_id;
+  OTA_tag_handlers[OTA_tag_handlers_nb].handler = handler;
+  OTA_tag_handlers_nb++;
+
+  return APP_ZIGBEE_OK;
 }
 
 /**
- * @brief  OTA client pause download
- * @param  None
- * @retval None
+ * @brief  OTA client write of the image integrity code sub-element (CRC, little endian)
+ * @param  clusterPtr: ZCL Cluster pointer
+ * @param  header: ZCL OTA file format image header
+ * @param  length: received chunk length
+ * @param  data: received chunk payload
+ * @param  arg: Passed arg
+ * @retval ZCL status code
  */
-static inline void APP_ZIGBEE_OTA_Client_PauseDownload(void){
-  /* Request download pause */
-  OTA_client_info.flags |= OTA_CLIENT_PAUSE_DOWNLOAD_FLAG ;
-}
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteIntegrityCode(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                    uint8_t length, uint8_t * data, void *arg){
+  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+  uint32_t index;
+
+  if(client_info->tag.offset == 0u)
+  {
+    client_info->ctx.binary_srv_crc = 0;
+  }
+  /* The code may be split over two blocks */
+  for(index = 0; (index < length) && ((client_info->tag.offset + index) < sizeof(uint32_t)); index++)
+  {
+    client_info->ctx.binary_srv_crc |= (uint32_t)data[index] << (8u * (client_info->tag.offset + index));
+  }
+  if((client_info->tag.offset + length) >= client_info->tag.length)
+  {
+    APP_DBG("[OTA] Get check crc. \n");
+    client_info->flags |= OTA_CLIENT_CRC_RECEIVED_FLAG;
+  }
 
+  return ZCL_STATUS_SUCCESS;
+}
 
+#if (OTA_SIGNATURE_ENABLE)
 /**
- * @brief  OTA client resume download
- * @param  None
- * @retval None
+ * @brief  OTA client write of the image signature sub-element (r || s)
+ * @param  clusterPtr: ZCL Cluster pointer
+ * @param  header: ZCL OTA file format image header
+ * @param  length: received chunk length
+ * @param  data: received chunk payload
+ * @param  arg: Passed arg
+ * @retval ZCL status code
  */
-static inline void APP_ZIGBEE_OTA_Client_ResumeDownload(void){
-  /* Resume download */
-  ZbZclOtaClientImageTransferResume(zigbee_app_info.ota_client);
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteSignature(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                                uint8_t length, uint8_t * data, void *arg){
+  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+
+  if((client_info->tag.length != OTA_ECDSA_SIGNATURE_SIZE) || ((client_info->tag.offset + length) > OTA_ECDSA_SIGNATURE_SIZE))
+  {
+    APP_DBG("[OTA] Wrong signature sub-element length (%d bytes).", client_info->tag.length);
+    return ZCL_STATUS_INVALID_IMAGE;
+  }
+  memcpy(&client_info->signature[client_info->tag.offset], data, length);
+  if((client_info->tag.offset + length) == OTA_ECDSA_SIGNATURE_SIZE)
+  {
+    APP_DBG("[OTA] Get image signature.");
+    client_info->flags |= OTA_CLIENT_SIGNATURE_RECEIVED_FLAG;
+  }
+
+  return ZCL_STATUS_SUCCESS;
 }
 
 /**
- * @brief  OTA client check for previous ota data vs server image_definition
- * @param  struct ZbZclOtaImageDefinition *image_definition : image type header received 
- * @retval bool : True : Resume download, False : erase sectors and start a new download
+ * @brief  OTA client manifest sub-element handler
+ *         The manifest is the first sub-element : it is checked as soon as it is
+ *         received, before the download area is erased.
+ * @param  clusterPtr: ZCL Cluster pointer
+ * @param  header: ZCL OTA file format image header
+ * @param  length: chunk length
+ * @param  data: chunk of the sub-element
+ * @param  arg: Passed arg
+ * @retval ZCL status code
  */
-static bool APP_ZIGBEE_OTA_Client_CheckPriviousDownload(struct ZbZclOtaImageDefinition *image_definition){
-  /* Check previous downloaded image type & version */
-  bool status = true;
-  if(image_definition->file_version != OTA_client_info.zigbee_ota_ctx_nvm.file_version)
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_WriteManifest(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header,
+                                                               uint8_t length, uint8_t * data, void *arg){
+  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+
+  if((client_info->tag.length != OTA_MANIFEST_SIZE) || ((client_info->tag.offset + length) > OTA_MANIFEST_SIZE))
   {
-    status = false;
+    APP_DBG("[OTA] Wrong manifest sub-element length (%d bytes).", client_info->tag.length);
+    return ZCL_STATUS_INVALID_IMAGE;
   }
-
-  if(image_definition->image_type != OTA_client_info.zigbee_ota_ctx_nvm.previous_image_type)
+  memcpy(&client_info->manifest[client_info->tag.offset], data, length);
+  if((client_info->tag.offset + length) < OTA_MANIFEST_SIZE)
   {
-    status = false;
+    return ZCL_STATUS_SUCCESS;
   }
 
-  return status;
+  return APP_ZIGBEE_OTA_Client_CheckManifest(client_info);
 }
 
-
 /**
- * @brief  OTA Server find image type helper
- * @param  fileType: requested file type
- * @retval index value
+ * @brief  Checking the received manifest against the device and the image offered
+ * @param  client_info: OTA client internal structure
+ * @retval ZCL status code
  */
-static inline int APP_ZIGBEE_FindImageType(unsigned int fileType)
-{
-    for(unsigned int i=0; i<(sizeof(OTA_currentFileVersionTab)/sizeof(*OTA_currentFileVersionTab)); i++)
-    {
-        if(OTA_currentFileVersionTab[i].fileType == fileType){ return i; }
-    }
-    return -1;
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_CheckManifest(struct Zigbee_OTA_client_info* client_info){
+  const uint8_t *p_manifest = client_info->manifest;
+  APP_OTA_SHA256_Ctx_t hash;
+  uint8_t digest[OTA_SHA256_DIGEST_SIZE];
+  uint32_t start_time = HAL_GetTick();
+  uint16_t hw_min = APP_ZIGBEE_GetLE16(&p_manifest[12]);
+  uint16_t hw_max = APP_ZIGBEE_GetLE16(&p_manifest[14]);
+  uint32_t image_size = APP_ZIGBEE_GetLE32(&p_manifest[16]);
+
+  if((APP_ZIGBEE_GetLE32(&p_manifest[0]) != OTA_MANIFEST_MAGIC) || (APP_ZIGBEE_GetLE16(&p_manifest[4]) != OTA_MANIFEST_VERSION))
+  {
+    APP_DBG("[OTA] Unknown manifest format: image rejected.\n");
+    return ZCL_STATUS_INVALID_IMAGE;
+  }
+  if((APP_ZIGBEE_GetLE16(&p_manifest[6]) != client_info->image_type)
+     || (APP_ZIGBEE_GetLE32(&p_manifest[8]) != client_info->ctx.file_version))
+  {
+    APP_DBG("[OTA] Manifest does not match the image offered: image rejected.\n");
+    return ZCL_STATUS_INVALID_IMAGE;
+  }
+  if((CURRENT_HARDWARE_VERSION < hw_min) || (CURRENT_HARDWARE_VERSION > hw_max))
+  {
+    APP_DBG("[OTA] Image for hardware versions 0x%04X..0x%04X: image rejected.\n", hw_min, hw_max);
+    return ZCL_STATUS_INVALID_IMAGE;
+  }
+  if(APP_ZIGBEE_CheckDeviceCapabilities(client_info->ctx.bundle_offset + image_size) != APP_ZIGBEE_OK)
+  {
+    APP_DBG("[OTA] Not enough space for a %d bytes image: image rejected.\n", image_size);
+    return ZCL_STATUS_INVALID_IMAGE;
+  }
+
+  APP_OTA_SHA256_Init(&hash);
+  APP_OTA_SHA256_Update(&hash, p_manifest, OTA_MANIFEST_BODY_SIZE);
+  APP_OTA_SHA256_Final(&hash, digest);
+  if(!APP_OTA_ECDSA_Verify(OTA_signature_public_key, digest, &p_manifest[OTA_MANIFEST_BODY_SIZE]))
+  {
+    APP_DBG("[OTA] Wrong manifest signature: image rejected.\n");
+    return ZCL_STATUS_INVALID_IMAGE;
+  }
+
+  client_info->flags |= OTA_CLIENT_MANIFEST_VALID_FLAG;
+  APP_DBG("[OTA] Manifest verified in %d ms (image size = %d bytes).", HAL_GetTick() - start_time, image_size);
+
+  return ZCL_STATUS_SUCCESS;
 }
+#endif /* OTA_SIGNATURE_ENABLE */
+#endif /* USE_TAG_WRITE_CB */
 
+#if (OTA_SIGNATURE_ENABLE)
 /**
- * @brief  OTA client writing firmware data from internal RAM cache to flash
+ * @brief  Checking the image signature and/or the manifest against the digest computed while the image was written
+ *         Multicast images are hashed once complete, their signature comes in OTA_MCAST_CMD_SIGNATURE.
  * @param  client_info: OTA client internal structure
- * @retval Application status code
+ * @retval ZCL status code
  */
-static inline APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_WriteFirmwareData(struct Zigbee_OTA_client_info* client_info){
-  uint64_t l_read64 = 0;
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_CheckSignature(struct Zigbee_OTA_client_info* client_info){
+  uint8_t digest[OTA_SHA256_DIGEST_SIZE];
+  uint8_t message[OTA_SIGNED_MESSAGE_SIZE];
+  APP_OTA_SHA256_Ctx_t hash;
 
-  /* Write to Flash Memory */
-  for(unsigned int flash_index = 0; flash_index < client_info->write_info.firmware_buffer_current_offset; flash_index+=8){
-    while( LL_HSEM_1StepLock( HSEM, CFG_HW_FLASH_SEMID ) );
-    HAL_FLASH_Unlock();
-    while(LL_FLASH_IsActiveFlag_OperationSuspended());
+  if(client_info->flags & OTA_CLIENT_IMAGE_VERIFIED_FLAG)
+  {
+    APP_DBG("[OTA] Image verified before the reset.");
+    return ZCL_STATUS_SUCCESS;
+  }
+  if((client_info->flags & (OTA_CLIENT_SIGNATURE_RECEIVED_FLAG | OTA_CLIENT_MANIFEST_VALID_FLAG)) == 0)
+  {
+#if (OTA_SIGNATURE_REQUIRED)
+    APP_DBG("[OTA] No signature: image rejected.\n");
+    return ZCL_STATUS_INVALID_IMAGE;
+#else
+    return ZCL_STATUS_SUCCESS;
+#endif
+  }
 
-    memcpy(&l_read64, &(client_info->write_info.firmware_buffer[flash_index]), 8);
-    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD,
-        client_info->ctx.base_address + client_info->write_info.flash_current_offset,
-        l_read64) == HAL_OK)
+  APP_OTA_SHA256_Final(&client_info->image_hash, digest);
+  if(client_info->flags & OTA_CLIENT_SIGNATURE_RECEIVED_FLAG)
+  {
+    /* The signature also covers the header fields the image was accepted on, so that a signed
+     * image can not be offered again under a higher file version (OTA_PREVENT_DOWNGRADE) */
+    message[0] = (uint8_t)(ST_ZIGBEE_MANUFACTURER_CODE & 0xFFu);
+    message[1] = (uint8_t)(ST_ZIGBEE_MANUFACTURER_CODE >> 8);
+    message[2] = (uint8_t)(client_info->image_type & 0xFFu);
+    message[3] = (uint8_t)(client_info->image_type >> 8);
+    message[4] = (uint8_t)(client_info->ctx.file_version & 0xFFu);
+    message[5] = (uint8_t)(client_info->ctx.file_version >> 8);
+    message[6] = (uint8_t)(client_info->ctx.file_version >> 16);
+    message[7] = (uint8_t)(client_info->ctx.file_version >> 24);
+    memcpy(&message[8], digest, OTA_SHA256_DIGEST_SIZE);
+    APP_OTA_SHA256_Init(&hash);
+    APP_OTA_SHA256_Update(&hash, message, OTA_SIGNED_MESSAGE_SIZE);
+    APP_OTA_SHA256_Final(&hash, message);
+    if(!APP_OTA_ECDSA_Verify(OTA_signature_public_key, message, client_info->signature))
     {
-      /* Read back value for verification */
-      l_read64 = 0;
-      l_read64 = *(uint64_t*)(client_info->ctx.base_address + client_info->write_info.flash_current_offset);
-      if(l_read64 != (*(uint64_t*)(client_info->write_info.firmware_buffer+flash_index)))
-      {
-        APP_DBG("FLASH: Comparison failed l_read64 = 0x%jx / ram_array = 0x%jx",
-                l_read64, client_info->write_info.firmware_buffer[flash_index]);
-        return APP_ZIGBEE_ERROR;
-      }
+      APP_DBG("[OTA] Wrong signature: invalid firmware.\n");
+      return ZCL_STATUS_INVALID_IMAGE;
     }
-    else
+    APP_DBG("[OTA] Image signature verified.");
+  }
+  if(client_info->flags & OTA_CLIENT_MANIFEST_VALID_FLAG)
+  {
+    /* The manifest signature covers the image size and digest */
+    if((client_info->image_hash.length != APP_ZIGBEE_GetLE32(&client_info->manifest[16]))
+       || (memcmp(digest, &client_info->manifest[20], OTA_SHA256_DIGEST_SIZE) != 0))
     {
-      APP_DBG("HAL_FLASH_Program FAILED at flash_index = %d ,  flash offset = 0x%04X", flash_index, client_info->write_info.flash_current_offset);
-      return APP_ZIGBEE_ERROR;
+      APP_DBG("[OTA] Image does not match its manifest: invalid firmware.\n");
+      return ZCL_STATUS_INVALID_IMAGE;
     }
+    APP_DBG("[OTA] Image matches its manifest.");
+  }
 
+  return ZCL_STATUS_SUCCESS;
+}
+#endif /* OTA_SIGNATURE_ENABLE */
 
-    client_info->write_info.flash_current_offset += sizeof(uint64_t);
-
- 
-  }
+/**
+ * @brief  OTA client Image Validate callback
+ * @param  clusterPtr: ZCL Cluster pointer
+ * @param  header: ZCL OTA file format image header
+ * @param  arg: Passed arg
+ * @retval ZCL status code
+ */
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_ImageValidate_cb(struct ZbZclClusterT *clusterPtr, struct ZbZclOtaHeader *header, void *arg){
+  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+  enum ZclStatusCodeT status = ZCL_STATUS_SUCCESS;
+  uint64_t last_double_word = 0;
+  double l_transfer_throughput = 0;
+  uint32_t lTransfertThroughputInt, lTransfertThroughputDec;
 
-  /* Save client.info ctx to NVM */
-  if(APP_ZIGBEE_OTA_ctx_save_nvm(client_info))
-  {
-    APP_DBG("[OTA] ctx save : flash offset =0x%04X pushed to NVM",client_info->write_info.flash_current_offset);
+  /* Download finished => stop Toggling of the LED */
+  HW_TS_Stop(TS_ID_LED);
+  BSP_LED_Off(LED_GREEN);
+  APP_DBG("LED_GREEN OFF");
+  client_info->OTA_state=VERIFYING_IMAGE;
+  /* Write the last RAM buffer to Flash */
+  if(client_info->write_info.firmware_buffer_current_offset != 0){
+    /* Write to Flash Memory */
+    if(APP_ZIGBEE_OTA_Client_WriteFirmwareData(client_info) != APP_ZIGBEE_OK){
+      return ZCL_STATUS_FAILURE;
+    }
+    client_info->write_info.firmware_buffer_current_offset = 0;
   }
-   HAL_FLASH_Lock();
-   LL_HSEM_ReleaseLock( HSEM, CFG_HW_FLASH_SEMID, 0 );
 
+  APP_DBG("**************************************************************\n");
+  APP_DBG("[OTA] Validating the image.");
+  
+  /* Finding the magic number */
 
+  /* Last double word in Flash
+   * => the magic if the firmware is valid
+   */
+  memcpy(&last_double_word, (void const*)(client_info->ctx.base_address + client_info->write_info.flash_current_offset - 8), 8);
+  if(((last_double_word & 0x00000000FFFFFFFF) != client_info->ctx.magic_keyword)
+     && (((last_double_word & 0xFFFFFFFF00000000) >> 32) != client_info->ctx.magic_keyword)){
+    APP_DBG("[OTA] Wrong magic keyword: invalid firmware.\n");
+    status = ZCL_STATUS_INVALID_IMAGE;
+    return status;
+  }
+
+  client_info->ctx.binary_calc_crc = APP_ZIGBEE_OTA_Client_Crc_Calc(client_info->ctx.base_address, client_info->write_info.flash_current_offset);
+  if((client_info->flags & OTA_CLIENT_CRC_RECEIVED_FLAG) && (client_info->ctx.binary_calc_crc != client_info->ctx.binary_srv_crc)){
+    APP_DBG("[OTA] Wrong CRC (0x%08X instead of 0x%08X): invalid firmware.\n", client_info->ctx.binary_calc_crc, client_info->ctx.binary_srv_crc);
+    status = ZCL_STATUS_INVALID_IMAGE;
+    return status;
+  }
+
+#if (OTA_SIGNATURE_ENABLE)
+  status = APP_ZIGBEE_OTA_Client_CheckSignature(client_info);
+  if(status != ZCL_STATUS_SUCCESS){
+    return status;
+  }
+  if((client_info->flags & OTA_CLIENT_IMAGE_VERIFIED_FLAG) == 0u){
+    /* Saved so that a reset before the reboot does not need the signature again */
+    client_info->flags |= OTA_CLIENT_IMAGE_VERIFIED_FLAG;
+    APP_ZIGBEE_OTA_ctx_save_nvm(client_info);
+  }
+#endif
+
+  APP_DBG("[OTA] The downloaded firmware is valid.\n");
+  client_info->download_time = (HAL_GetTick()- client_info->download_time)/1000;
+  l_transfer_throughput = (((double)client_info->requested_image_size/client_info->download_time) / 1000) * 8;
+  lTransfertThroughputInt = (uint32_t)l_transfer_throughput;
+  lTransfertThroughputDec = (uint32_t)( ( l_transfer_throughput - lTransfertThroughputInt ) * 100 );
+
+  APP_DBG("**************************************************************");
+  APP_DBG(" FUOTA : END OF TRANSFER COMPLETED");
+
+  if(client_info->image_type == IMAGE_TYPE_FW_COPRO_WIRELESS){
+    APP_DBG("  - M0 wireless coprocessor firmware.");
+  } else {
+    APP_DBG("  - M4 application firmware.");
+  }
+
+  APP_DBG("  - %d bytes downloaded in %d seconds.",  client_info->requested_image_size, client_info->download_time);
+  if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_LZSS){
+    APP_DBG("  - %d bytes written to flash after decompression.", client_info->write_info.flash_current_offset);
+  }
+  else if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_DELTA){
+    APP_DBG("  - %d bytes rebuilt from delta, copied over the application on reboot.", client_info->write_info.flash_current_offset);
+  }
+  else if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_ENCRYPTED){
+    APP_DBG("  - %d bytes decrypted.", client_info->write_info.flash_current_offset);
+  }
+  APP_DBG("  - Average throughput = %d.%d kbit/s.", lTransfertThroughputInt, lTransfertThroughputDec );
+  APP_DBG("**************************************************************");
+
+  BSP_LED_On(LED_GREEN);
+  APP_DBG("LED_GREEN ON");
+
+  return status;
+}
+
+/**
+ * @brief  OTA client Reboot callback
+ * @param  clusterPtr: ZCL Cluster pointer
+ * @param  arg: Passed arg
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Client_Reboot_cb(struct ZbZclClusterT *clusterPtr, void *arg){
+#if (OTA_BUNDLE_ENABLE)
+  if(APP_ZIGBEE_OTA_Client_BundleNext((struct Zigbee_OTA_client_info*) arg))
+  {
+    return;
+  }
+#else
+  UNUSED(arg);
+#endif
+
+  APP_DBG("**************************************************************");
+  APP_DBG("[OTA] Rebooting.");
+
+  APP_DBG("LED_BLUE OFF");
+  BSP_LED_Off(LED_BLUE);
+  APP_DBG("LED_GREEN OFF");
+  BSP_LED_Off(LED_GREEN);
+  APP_DBG("**************************************************************\n");
+  
+  HAL_Delay(100);
+  APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_FUOTA_RESET, CFG_SCH_CLASS_OTA);
+}
+
+#if (OTA_BUNDLE_ENABLE)
+/**
+ * @brief  Chaining the download of the M0 image after a validated M4 image
+ *         The M0 image is written in the pages following the M4 one. On reboot
+ *         the M0 image is installed by the FUS first, then the OTA loader jumps
+ *         to the new M4 application as it does after any wireless stack update.
+ *         The bundle offset is saved with the OTA ctx so that the M0 download
+ *         is resumed after a reset.
+ * @param  client_info: OTA client internal structure
+ * @retval true if the reboot is deferred until the M0 image is downloaded
+ */
+static bool APP_ZIGBEE_OTA_Client_BundleNext(struct Zigbee_OTA_client_info* client_info)
+{
+  if((client_info->image_type != fileType_APP) || (client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_DELTA)
+     || (client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_MULTICAST) || (CFG_APP_AB_SLOTS))
+  {
+    /* A delta image (or any M4 image with A/B slots) is only moved to its place on reboot, the pages after it are still in use */
+    return false;
+  }
+
+  client_info->ctx.bundle_offset = (client_info->write_info.flash_current_offset + FLASH_PAGE_SIZE - 1u) & ~(FLASH_PAGE_SIZE - 1u);
+  client_info->write_info.flash_current_offset = 0;
+  client_info->flags &= ~(OTA_CLIENT_CTX_FOUND_FLAG | OTA_CLIENT_RESUME_DOWNLOAD_FLAG | OTA_CLIENT_IMAGE_VERIFIED_FLAG);
+  client_info->flags |= OTA_CLIENT_ERASE_PENDING_FLAG;
+  (void)APP_ZIGBEE_OTA_Client_SetImageType(client_info, fileType_COPRO_WIRELESS);
+  client_info->ctx.file_version = 0;
+  client_info->ctx.image_encoding = OTA_IMAGE_ENCODING_RAW;
+  client_info->OTA_state = QUERYING_NEXT_IMAGE;
+  APP_ZIGBEE_OTA_ctx_save_nvm(client_info);
+
+  APP_DBG("[OTA] M4 application kept at 0x%08X, looking for an M0 image to bundle (written at 0x%08X).",
+          FUOTA_APP_FW_BINARY_ADDRESS, client_info->ctx.base_address);
+  client_info->current_file_version = OTA_currentFileVersionTab[APP_ZIGBEE_FindImageType(fileType_COPRO_WIRELESS)].fileVersion;
+  APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_REQUEST_UPGRADE, CFG_SCH_CLASS_OTA);
+
+  return true;
+}
+#endif /* OTA_BUNDLE_ENABLE */
+
+/**
+ * @brief  OTA client Abort callback
+ * @param  clusterPtr: ZCL Cluster pointer
+ * @param  commandId: ZCL OTA command ID associated to the block transfer abortion
+ * @param  arg: Passed arg
+ * @retval ZCL status code
+ */
+static enum ZclStatusCodeT APP_ZIGBEE_OTA_Client_AbortDownload_cb(struct ZbZclClusterT *clusterPtr, enum ZbZclOtaCommandId commandId, void *arg){
+ 
+  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+  APP_DBG("[OTA] Server aborted download.");
+  HW_TS_Stop(TS_ID_LED);
+  BSP_LED_Off(LED_GREEN);
+  BSP_LED_On(LED_RED);
+
+//  if(commandId == ZCL_OTA_COMMAND_IMAGE_BLOCK_RESPONSE)
+//  {
+  #if (OTA_SCHEDULE_ENABLE)
+    if(!OTA_schedule.in_window)
+    {
+      /* Transfer goes on from the saved offset when the next window opens */
+      APP_DBG("[OTA] Outside of the download window, resuming at the next window");
+      OTA_schedule.paused = true;
+      return ZCL_STATUS_ABORT;
+    }
+  #endif
+  #ifdef OTA_ABORT_RETRY_ENABLE
+    client_info->OTA_abort_retries++;
+    if(client_info->OTA_abort_retries < OTA_CLIENT_ABORT_MAX_RETRIES )
+    {
+      APP_DBG("[OTA] retrying resume download in 500ms");
+      HW_TS_Start(TS_DOWNLOAD_RESUME, (uint32_t)OTA_DOWNLOAD_RETRY_DELAY);
+    }
+    else
+    {
+      
+      APP_DBG("[OTA] FATAL ERROR :resuming download failled after %d attempts",client_info->OTA_abort_retries);
+      client_info->OTA_abort_retries=0;
+      return ZCL_STATUS_SUCCESS;
+    }
+  #endif
+ //}
+
+  return ZCL_STATUS_ABORT;
+}
+
+/**
+ * @brief  OTA client request upgrade
+ * @param  None
+ * @retval None
+ */
+static inline void APP_ZIGBEE_OTA_Client_Request_Upgrade(void){
+  enum ZclStatusCodeT status;
+  struct ZbZclOtaImageDefinition image_definition;
+
+  APP_DBG("[OTA] Requesting an update.");
+  APP_DBG("[OTA] Image type: 0x%04x.", OTA_client_info.image_type);
+  APP_DBG("[OTA] Current file version: 0x%08x.\n", OTA_client_info.current_file_version);
+
+  /* Image definition configuration */
+  memset(&image_definition, 0, sizeof(image_definition));
+  image_definition.manufacturer_code = ST_ZIGBEE_MANUFACTURER_CODE;
+  image_definition.image_type = OTA_client_info.image_type;
+  image_definition.file_version = OTA_client_info.current_file_version;
+
+  OTA_client_info.OTA_state = QUERYING_NEXT_IMAGE;
+  /* Sending Discovery request to server */
+  APP_DBG("[OTA] Sending Query Next Image request.");
+  /* HW version is provided as additional info in Query Next Image request */
+  status = ZbZclOtaClientQueryNextImageReq(zigbee_app_info.ota_client, &image_definition,
+                                           ZCL_OTA_QUERY_FIELD_CONTROL_HW_VERSION, CURRENT_HARDWARE_VERSION);
+  if(status != ZCL_STATUS_SUCCESS){
+    APP_DBG("ZbZclOtaClientDiscover failed.\n");
+  }
+}
+
+/**
+ * @brief  OTA client start download
+ * @param  None
+ * @retval None
+ */
+static inline void APP_ZIGBEE_OTA_Client_StartDownload(void){
+  HW_TS_Start(TS_ID_LED, (uint32_t)LED_TOGGLE_TIMING);
+  OTA_client_info.download_time = HAL_GetTick();
+  ZbZclOtaClientImageTransferStart(zigbee_app_info.ota_client);
+}
+
+/**
+ * @brief  OTA client pause download
+ * @param  None
+ * @retval None
+ */
+static inline void APP_ZIGBEE_OTA_Client_PauseDownload(void){
+  /* Request download pause */
+  OTA_client_info.flags |= OTA_CLIENT_PAUSE_DOWNLOAD_FLAG ;
+}
+
+
+/**
+ * @brief  OTA client resume download
+ * @param  None
+ * @retval None
+ */
+static inline void APP_ZIGBEE_OTA_Client_ResumeDownload(void){
+  /* Resume download */
+  ZbZclOtaClientImageTransferResume(zigbee_app_info.ota_client);
+}
+
+/**
+ * @brief  OTA client check for previous ota data vs server image_definition
+ * @param  struct ZbZclOtaImageDefinition *image_definition : image type header received 
+ * @retval bool : True : Resume download, False : erase sectors and start a new download
+ */
+static bool APP_ZIGBEE_OTA_Client_CheckPriviousDownload(struct ZbZclOtaImageDefinition *image_definition){
+  /* Check previous downloaded image type & version */
+  bool status = true;
+  if(image_definition->file_version != OTA_client_info.zigbee_ota_ctx_nvm.file_version)
+  {
+    status = false;
+  }
+
+  if(image_definition->image_type != OTA_client_info.zigbee_ota_ctx_nvm.previous_image_type)
+  {
+    status = false;
+  }
+
+  return status;
+}
+
+
+/**
+ * @brief  OTA Server find image type helper
+ * @param  fileType: requested file type
+ * @retval index value
+ */
+static inline int APP_ZIGBEE_FindImageType(unsigned int fileType)
+{
+    /* Table is indexed by image type */
+    if((fileType <= IMAGE_TYPE_MAX) && (OTA_currentFileVersionTab[fileType].fileType == fileType) && (fileType != 0u))
+    {
+        return (int)fileType;
+    }
+    return -1;
+}
+
+/**
+ * @brief  Filling the version registry from the installed images
+ *         M4 : image info block found before the magic keyword of the application
+ *         installed at FUOTA_APP_FW_BINARY_ADDRESS, version 0 if there is no valid
+ *         application. M0 : running wireless stack version.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_VersionRegistry_Init(void)
+{
+  WirelessFwInfo_t wireless_info;
+  uint32_t magic_keyword_address;
+  uint32_t last_address = FLASH_BASE + (GetFirstSecureSector() * FLASH_PAGE_SIZE) - 4u;
+
+  magic_keyword_address = *(uint32_t *)(FUOTA_APP_FW_BINARY_ADDRESS + FUOTA_MAGIC_KEYWORD_POINTER_OFFSET);
+  if((magic_keyword_address < (FUOTA_APP_FW_BINARY_ADDRESS + FUOTA_IMAGE_INFO_SIZE)) || (magic_keyword_address > last_address)
+     || (*(uint32_t *)magic_keyword_address != FUOTA_MAGIC_KEYWORD_APP))
+  {
+    /* No application installed : any version can be downloaded */
+    OTA_currentFileVersionTab[fileType_APP].fileVersion = 0;
+  }
+  else if(*(uint32_t *)(magic_keyword_address - FUOTA_IMAGE_INFO_SIZE) == FUOTA_IMAGE_INFO_TAG)
+  {
+    OTA_currentFileVersionTab[fileType_APP].fileVersion = *(uint32_t *)(magic_keyword_address - 4u);
+  }
+  else
+  {
+    /* Application without image info block : keep the default version */
+  }
+
+  if(SHCI_GetWirelessFwInfo(&wireless_info) == SHCI_Success)
+  {
+    OTA_currentFileVersionTab[fileType_COPRO_WIRELESS].fileVersion = OTA_COPRO_FILE_VERSION(wireless_info.VersionMajor,
+                                                                                            wireless_info.VersionMinor,
+                                                                                            wireless_info.VersionSub);
+  }
+
+  APP_DBG("[OTA] Installed versions : M4 application 0x%08x, M0 wireless stack 0x%08x.",
+          OTA_currentFileVersionTab[fileType_APP].fileVersion, OTA_currentFileVersionTab[fileType_COPRO_WIRELESS].fileVersion);
+}
+
+/**
+ * @brief  Selecting the download area and magic keyword of an image type
+ * @param  client_info: OTA client internal structure
+ * @param  image_type: ZCL OTA image type
+ * @retval false if the image type is unknown
+ */
+static bool APP_ZIGBEE_OTA_Client_SetImageType(struct Zigbee_OTA_client_info* client_info, uint16_t image_type)
+{
+  switch(image_type){
+    case fileType_COPRO_WIRELESS:
+      client_info->ctx.base_address = FUOTA_COPRO_FW_BINARY_ADDRESS + client_info->ctx.bundle_offset;
+      client_info->ctx.magic_keyword = FUOTA_MAGIC_KEYWORD_COPRO_WIRELESS;
+      client_info->ctx.file_type = fileType_COPRO_WIRELESS;
+      break;
+
+    case fileType_APP:
+#if (CFG_APP_AB_SLOTS)
+      if(!slotLayoutValid){
+        APP_DBG("[OTA] Error, the slots overlap the secure flash, no M4 image.\n");
+        return false;
+      }
+      /* Slot B, the running application stays in slot A */
+      client_info->ctx.base_address = FUOTA_APP_DELTA_STAGING_ADDRESS;
+#else
+      client_info->ctx.base_address = FUOTA_APP_FW_BINARY_ADDRESS;
+#endif
+      client_info->ctx.magic_keyword = FUOTA_MAGIC_KEYWORD_APP;
+      client_info->ctx.file_type = fileType_APP;
+      break;
+
+    default:
+      APP_DBG("[OTA] Error, unknown image type.\n");
+      return false;
+  }
+  client_info->image_type = image_type;
+
+  return true;
+}
+
+/**
+ * @brief  Reading a little endian 32 bits field helper
+ * @param  p_data: field address
+ * @retval field value
+ */
+static inline uint32_t APP_ZIGBEE_GetLE32(const uint8_t *p_data)
+{
+  return (uint32_t)p_data[0] | ((uint32_t)p_data[1] << 8) | ((uint32_t)p_data[2] << 16) | ((uint32_t)p_data[3] << 24);
+}
+
+/**
+ * @brief  OTA client writing firmware data from internal RAM cache to flash
+ * @param  client_info: OTA client internal structure
+ * @retval Application status code
+ */
+static inline APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_WriteFirmwareData(struct Zigbee_OTA_client_info* client_info){
+  uint32_t size = client_info->write_info.firmware_buffer_current_offset;
+
+#if (CFG_APP_AB_SLOTS)
+  if((client_info->ctx.file_type == fileType_APP)
+     && ((client_info->write_info.flash_current_offset + size) > (CFG_APP_SLOT_NB_SECTORS * FLASH_PAGE_SIZE)))
+  {
+    APP_DBG("[OTA] Image larger than slot B.");
+    return APP_ZIGBEE_ERROR;
+  }
+#endif
+
+#if (OTA_SIGNATURE_ENABLE)
+  if(client_info->write_info.flash_current_offset == 0u)
+  {
+    APP_OTA_SHA256_Init(&client_info->image_hash);
+  }
+  APP_OTA_SHA256_Update(&client_info->image_hash, client_info->write_info.firmware_buffer, size);
+#endif
+
+  /* Write to Flash Memory */
+  if(APP_ZIGBEE_OTA_Client_FlashProgram(client_info->ctx.base_address + client_info->write_info.flash_current_offset,
+                                        client_info->write_info.firmware_buffer, size) != APP_ZIGBEE_OK)
+  {
+    return APP_ZIGBEE_ERROR;
+  }
+  client_info->write_info.flash_current_offset += (size + 7u) & ~7u;
+
+  /* Save client.info ctx to NVM */
+  if(APP_ZIGBEE_OTA_ctx_save_nvm(client_info))
+  {
+    APP_DBG("[OTA] ctx save : flash offset =0x%04X pushed to NVM",client_info->write_info.flash_current_offset);
+  }
+
+  return APP_ZIGBEE_OK;
+}
+
+/**
+ * @brief  Programming a RAM buffer to flash, by double words with read back verification
+ * @param  address: flash destination address (double word aligned)
+ * @param  p_data: data to program, a last incomplete double word is completed with the following RAM bytes
+ * @param  size: data length
+ * @retval Application status code
+ */
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_FlashProgram(uint32_t address, const uint8_t *p_data, uint32_t size){
+  APP_ZIGBEE_StatusTypeDef status = APP_ZIGBEE_OK;
+  uint64_t l_read64 = 0;
+  uint64_t l_data64 = 0;
+
+  for(unsigned int flash_index = 0; (flash_index < size) && (status == APP_ZIGBEE_OK); flash_index+=8){
+    while( LL_HSEM_1StepLock( HSEM, CFG_HW_FLASH_SEMID ) );
+    HAL_FLASH_Unlock();
+    while(LL_FLASH_IsActiveFlag_OperationSuspended());
+
+    memcpy(&l_data64, &p_data[flash_index], 8);
+    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, address + flash_index, l_data64) == HAL_OK)
+    {
+      /* Read back value for verification */
+      l_read64 = *(uint64_t*)(address + flash_index);
+      if(l_read64 != l_data64)
+      {
+        APP_DBG("FLASH: Comparison failed l_read64 = 0x%jx / ram_array = 0x%jx", l_read64, l_data64);
+        status = APP_ZIGBEE_ERROR;
+      }
+    }
+    else
+    {
+      APP_DBG("HAL_FLASH_Program FAILED at flash address = 0x%08X", address + flash_index);
+      status = APP_ZIGBEE_ERROR;
+    }
+  }
+
+  HAL_FLASH_Lock();
+  LL_HSEM_ReleaseLock( HSEM, CFG_HW_FLASH_SEMID, 0 );
+
+  return status;
+}
+
+/**
+ * @brief  Erasing flash pages, clipped to the first secure sector
+ * @param  first_page: first page index
+ * @param  nb_pages: number of pages
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Client_ErasePages(uint32_t first_page, uint32_t nb_pages){
+  uint32_t page_error;
+  FLASH_EraseInitTypeDef p_erase_init;
+  uint32_t first_secure_sector_idx;
+
+  first_secure_sector_idx = GetFirstSecureSector();
+  if ((first_page + nb_pages) > first_secure_sector_idx)
+  {
+    nb_pages = first_secure_sector_idx - first_page;
+  }
+
+  p_erase_init.TypeErase = FLASH_TYPEERASE_PAGES;
+  p_erase_init.Page = first_page;
+  p_erase_init.NbPages = nb_pages;
+
+  APP_DBG("Erase FLASH Memory from sector %d (0x080%x) to sector %d (0x080%x)", first_page, first_page*4096, first_page+nb_pages, (first_page+nb_pages)*4096);
+
+  while( LL_HSEM_1StepLock( HSEM, CFG_HW_FLASH_SEMID ) );
+  HAL_FLASH_Unlock();
+  HAL_FLASHEx_Erase(&p_erase_init, &page_error);
+  HAL_FLASH_Lock();
+  LL_HSEM_ReleaseLock( HSEM, CFG_HW_FLASH_SEMID, 0 );
+}
+
+/**
+ * @brief  Erasing the area the image is going to be written to, if not done yet
+ *         For a delta image only the staging area is erased as the running
+ *         application is the patch source.
+ * @param  client_info: OTA client internal structure
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Client_PrepareFlash(struct Zigbee_OTA_client_info* client_info){
+  if((client_info->flags & OTA_CLIENT_ERASE_PENDING_FLAG) == 0)
+  {
+    return;
+  }
+  client_info->flags &= ~OTA_CLIENT_ERASE_PENDING_FLAG;
+
+  if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_DELTA)
+  {
+    APP_ZIGBEE_OTA_Client_ErasePages(CFG_APP_DELTA_STAGING_SECTOR_INDEX,
+                                     (client_info->ctx.binary_size + FLASH_PAGE_SIZE - 1u) / FLASH_PAGE_SIZE);
+  }
+#if (CFG_APP_AB_SLOTS)
+  else if(client_info->ctx.file_type == fileType_APP)
+  {
+    APP_ZIGBEE_OTA_Client_ErasePages(CFG_APP_DELTA_STAGING_SECTOR_INDEX, CFG_APP_SLOT_NB_SECTORS);
+  }
+#endif
+  else if(client_info->ctx.bundle_offset != 0u)
+  {
+    /* Keep the M4 image of the bundle */
+    APP_ZIGBEE_OTA_Client_ErasePages((client_info->ctx.base_address - FLASH_BASE) / FLASH_PAGE_SIZE,
+                                     GetFirstSecureSector() - ((client_info->ctx.base_address - FLASH_BASE) / FLASH_PAGE_SIZE));
+  }
+  else
+  {
+    /* With A/B slots, a M0 image also erases slot B and the slot state page */
+    APP_DBG("Delete_Sectors");
+    Delete_Sectors();
+  }
+
+#if (CFG_APP_AB_SLOTS)
+  if(client_info->ctx.file_type == fileType_APP)
+  {
+    APP_ZIGBEE_OTA_Slot_SetState(CFG_APP_SLOT_RECORD(CFG_APP_SLOT_DOWNLOADING, 0u, 0u), client_info->ctx.file_version);
+  }
+#endif
+}
+
+#if !(CFG_APP_AB_SLOTS)
+/**
+ * @brief  Copying a delta image rebuilt in the staging area over the running application
+ *         The first page (vector table and magic keyword pointer) is copied last so
+ *         that an interrupted copy is never seen as a valid application. The copy
+ *         is restarted from APP_ZIGBEE_OTA_Client_Init after a reset.
+ * @param  client_info: OTA client internal structure
+ * @retval Application status code
+ */
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_CommitImage(struct Zigbee_OTA_client_info* client_info){
+  uint32_t size = client_info->write_info.flash_current_offset;
+  uint32_t nb_pages = (size + FLASH_PAGE_SIZE - 1u) / FLASH_PAGE_SIZE;
+  uint32_t index, page, page_size;
+
+  client_info->OTA_state = COMMITTING_IMAGE;
+  APP_ZIGBEE_OTA_ctx_save_nvm(client_info);
+
+  APP_DBG("[OTA] Copying rebuilt image (%d bytes) over the application.", size);
+  APP_ZIGBEE_OTA_Client_ErasePages(CFG_APP_START_SECTOR_INDEX, nb_pages);
+
+  for(index = 1; index <= nb_pages; index++)
+  {
+    page = index % nb_pages;
+    page_size = ((size - page * FLASH_PAGE_SIZE) < FLASH_PAGE_SIZE) ? (size - page * FLASH_PAGE_SIZE) : FLASH_PAGE_SIZE;
+    if(APP_ZIGBEE_OTA_Client_FlashProgram(FUOTA_APP_FW_BINARY_ADDRESS + page * FLASH_PAGE_SIZE,
+                                          (const uint8_t *)(FUOTA_APP_DELTA_STAGING_ADDRESS + page * FLASH_PAGE_SIZE),
+                                          page_size) != APP_ZIGBEE_OK)
+    {
+      return APP_ZIGBEE_ERROR;
+    }
+  }
+
+  client_info->OTA_state = REBOOTING;
+  APP_ZIGBEE_OTA_ctx_save_nvm(client_info);
+
+  return APP_ZIGBEE_OK;
+}
+#endif
+
+#if (CFG_APP_AB_SLOTS)
+/**
+ * @brief  Appending a record to the slot state page
+ * @param  record: record first word, see CFG_APP_SLOT_RECORD
+ * @param  file_version: file version of the image in the record
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Slot_SetState(uint32_t record, uint32_t file_version)
+{
+  const uint32_t *p_record = (const uint32_t *)FUOTA_SLOT_STATE_ADDRESS;
+  uint32_t data[2] = { record, file_version };
+  uint32_t index = 0;
+
+  while((index < (FLASH_PAGE_SIZE / 4u)) && (p_record[index] != 0xFFFFFFFFu))
+  {
+    index += 2u;
+  }
+  if(index == (FLASH_PAGE_SIZE / 4u))
+  {
+    APP_ZIGBEE_OTA_Client_ErasePages(CFG_APP_SLOT_STATE_SECTOR_INDEX, 1u);
+    index = 0;
+  }
+  (void)APP_ZIGBEE_OTA_Client_FlashProgram(FUOTA_SLOT_STATE_ADDRESS + (4u * index), (const uint8_t *)data, sizeof(data));
+}
+
+/**
+ * @brief  Erasing the slot state page before a swap if it cannot hold all its records
+ *         The caller writes the current state again right after.
+ * @param  nb_records: records to be written
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Slot_Reserve(uint32_t nb_records)
+{
+  const uint32_t *p_record = (const uint32_t *)FUOTA_SLOT_STATE_ADDRESS;
+  uint32_t index = 0;
+
+  while((index < (FLASH_PAGE_SIZE / 4u)) && (p_record[index] != 0xFFFFFFFFu))
+  {
+    index += 2u;
+  }
+  if(((FLASH_PAGE_SIZE / 4u) - index) < (2u * nb_records))
+  {
+    APP_ZIGBEE_OTA_Client_ErasePages(CFG_APP_SLOT_STATE_SECTOR_INDEX, 1u);
+  }
+}
+
+/**
+ * @brief  Number of pages of the application in a slot
+ *         Both slots hold images linked at FUOTA_APP_FW_BINARY_ADDRESS.
+ * @param  slot_address: slot start address
+ * @retval pages up to the magic keyword, the whole slot if there is no valid image
+ */
+static uint32_t APP_ZIGBEE_OTA_Slot_ImagePages(uint32_t slot_address)
+{
+  uint32_t magic_keyword_address = *(uint32_t *)(slot_address + FUOTA_MAGIC_KEYWORD_POINTER_OFFSET);
+  uint32_t size;
+
+  if((magic_keyword_address < FUOTA_APP_FW_BINARY_ADDRESS)
+     || (magic_keyword_address >= (FUOTA_APP_FW_BINARY_ADDRESS + (CFG_APP_SLOT_NB_SECTORS * FLASH_PAGE_SIZE) - 4u)))
+  {
+    return CFG_APP_SLOT_NB_SECTORS;
+  }
+  size = magic_keyword_address + 4u - FUOTA_APP_FW_BINARY_ADDRESS;
+  if(*(uint32_t *)(slot_address + size - 4u) != FUOTA_MAGIC_KEYWORD_APP)
+  {
+    return CFG_APP_SLOT_NB_SECTORS;
+  }
+
+  return (size + FLASH_PAGE_SIZE - 1u) / FLASH_PAGE_SIZE;
+}
+
+/**
+ * @brief  Swapping the first pages of slots A and B through the scratch page
+ *         Each page takes three steps, each recorded in the slot state page
+ *         once done, so that the swap is resumed after a reset : copy A[i] to
+ *         the scratch page, B[i] to A[i], then the scratch page to B[i]. A step
+ *         only erases its destination, its source is kept until the step is
+ *         recorded : an interrupted step is run again from the same source.
+ * @param  state: CFG_APP_SLOT_INSTALLING or CFG_APP_SLOT_REVERTING
+ * @param  pages: number of pages to swap
+ * @param  progress: steps already done
+ * @param  file_version: file version of the new image
+ * @retval Application status code
+ */
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Slot_Swap(uint32_t state, uint32_t pages, uint32_t progress, uint32_t file_version)
+{
+  uint32_t page;
+
+  uint32_t dst_sector, src_address;
+
+  APP_DBG("[OTA] Swapping %d pages of slots A and B (step %d).", pages, progress);
+  for(; progress < (CFG_APP_SLOT_SWAP_STEPS * pages); progress++)
+  {
+    page = progress / CFG_APP_SLOT_SWAP_STEPS;
+    switch(progress % CFG_APP_SLOT_SWAP_STEPS)
+    {
+      case 0u:
+        /* scratch <- A[i] */
+        dst_sector = CFG_APP_SWAP_SCRATCH_SECTOR_INDEX;
+        src_address = FUOTA_APP_FW_BINARY_ADDRESS + page * FLASH_PAGE_SIZE;
+        break;
+
+      case 1u:
+        /* A[i] <- B[i] */
+        dst_sector = CFG_APP_START_SECTOR_INDEX + page;
+        src_address = FUOTA_APP_DELTA_STAGING_ADDRESS + page * FLASH_PAGE_SIZE;
+        break;
+
+      default:
+        /* B[i] <- scratch */
+        dst_sector = CFG_APP_DELTA_STAGING_SECTOR_INDEX + page;
+        src_address = FUOTA_SWAP_SCRATCH_ADDRESS;
+        break;
+    }
+    APP_ZIGBEE_OTA_Client_ErasePages(dst_sector, 1u);
+    if(APP_ZIGBEE_OTA_Client_FlashProgram(FLASH_BASE + dst_sector * FLASH_PAGE_SIZE, (const uint8_t *)src_address,
+                                          FLASH_PAGE_SIZE) != APP_ZIGBEE_OK)
+    {
+      return APP_ZIGBEE_ERROR;
+    }
+    APP_ZIGBEE_OTA_Slot_SetState(CFG_APP_SLOT_RECORD(state, progress + 1u, pages), file_version);
+  }
+
+  return APP_ZIGBEE_OK;
+}
+
+/**
+ * @brief  Installing a validated image of slot B : the slots are swapped and
+ *         the new application is started on trial
+ * @param  file_version: file version of the new image
+ * @retval None, only returns on error
+ */
+static void APP_ZIGBEE_OTA_Slot_Install(uint32_t file_version)
+{
+  uint32_t pages = MAX(APP_ZIGBEE_OTA_Slot_ImagePages(FUOTA_APP_FW_BINARY_ADDRESS),
+                       APP_ZIGBEE_OTA_Slot_ImagePages(FUOTA_APP_DELTA_STAGING_ADDRESS));
+
+  APP_ZIGBEE_OTA_Slot_Reserve((CFG_APP_SLOT_SWAP_STEPS * pages) + 4u);
+  APP_ZIGBEE_OTA_Slot_SetState(CFG_APP_SLOT_RECORD(CFG_APP_SLOT_PENDING, 0u, pages), file_version);
+  if(APP_ZIGBEE_OTA_Slot_Swap(CFG_APP_SLOT_INSTALLING, pages, 0u, file_version) != APP_ZIGBEE_OK)
+  {
+    return;
+  }
+  APP_ZIGBEE_OTA_Slot_SetState(CFG_APP_SLOT_RECORD(CFG_APP_SLOT_TRIAL, 0u, pages), file_version);
+
+  APP_DBG("[OTA] Starting application 0x%08x on trial.", file_version);
+  *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_TRIAL_FW;
+  HAL_Delay(100);
+  NVIC_SystemReset();
+}
+
+/**
+ * @brief  Completing the slots swap found at startup
+ *         The boot code only keeps the OTA loader running in these states. A
+ *         trial application which reset before being confirmed is rolled back.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Slot_Init(void)
+{
+  uint32_t file_version;
+  uint32_t record;
+  uint32_t pages;
+  uint32_t progress;
+
+  /* The wireless stack installed may have moved the secure flash down over the slots */
+  slotLayoutValid = (GetFirstSecureSector() > CFG_APP_SLOT_STATE_SECTOR_INDEX);
+  if(!slotLayoutValid)
+  {
+    APP_DBG("[OTA] Slot state page 0x%x in the secure flash, A/B slots disabled.", CFG_APP_SLOT_STATE_SECTOR_INDEX);
+    return;
+  }
+
+  record = APP_SLOT_GetState(&file_version);
+  pages = CFG_APP_SLOT_RECORD_PAGES(record);
+  progress = CFG_APP_SLOT_RECORD_PROGRESS(record);
+
+  switch(CFG_APP_SLOT_RECORD_STATE(record))
+  {
+    case CFG_APP_SLOT_PENDING:
+      progress = 0;
+      /* fall through */
+    case CFG_APP_SLOT_INSTALLING:
+      APP_DBG("[OTA] Resuming the installation of application 0x%08x.", file_version);
+      if(APP_ZIGBEE_OTA_Slot_Swap(CFG_APP_SLOT_INSTALLING, pages, progress, file_version) != APP_ZIGBEE_OK)
+      {
+        return;
+      }
+      APP_ZIGBEE_OTA_Slot_SetState(CFG_APP_SLOT_RECORD(CFG_APP_SLOT_TRIAL, 0u, pages), file_version);
+      *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_TRIAL_FW;
+      break;
+
+    case CFG_APP_SLOT_TRIAL:
+      APP_DBG("[OTA] Application 0x%08x not confirmed, rolling back.", file_version);
+      APP_ZIGBEE_OTA_Slot_Reserve((CFG_APP_SLOT_SWAP_STEPS * pages) + 2u);
+      APP_ZIGBEE_OTA_Slot_SetState(CFG_APP_SLOT_RECORD(CFG_APP_SLOT_REVERTING, 0u, pages), file_version);
+      progress = 0;
+      /* fall through */
+    case CFG_APP_SLOT_REVERTING:
+      if(APP_ZIGBEE_OTA_Slot_Swap(CFG_APP_SLOT_REVERTING, pages, progress, file_version) != APP_ZIGBEE_OK)
+      {
+        return;
+      }
+      APP_ZIGBEE_OTA_Slot_SetState(CFG_APP_SLOT_RECORD(CFG_APP_SLOT_ROLLED_BACK, 0u, pages), file_version);
+      *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_DOWNLOADED_FW;
+      break;
+
+    default:
+      return;
+  }
+
+  HAL_Delay(100);
+  NVIC_SystemReset();
+}
+#endif /* CFG_APP_AB_SLOTS */
+
+/**
+ * @brief  OTA client flushing a full RAM staging buffer to flash
+ * @param  client_info: OTA client internal structure
+ * @retval Application status code
+ */
+static APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_OTA_Client_FlushBuffer(struct Zigbee_OTA_client_info* client_info){
+  if ( APP_ZIGBEE_OTA_Client_WriteFirmwareData(client_info) != APP_ZIGBEE_OK ){
+    return APP_ZIGBEE_ERROR;
+  }
+  APP_DBG("[OTA] FUOTA Transfer (tag offset = 0x%04X, flash offset = 0x%04X)",
+          client_info->ctx.tag_offset, client_info->write_info.flash_current_offset);
+
+  memset(client_info->write_info.firmware_buffer, 0, RAM_FIRMWARE_BUFFER_SIZE);
+  client_info->write_info.firmware_buffer_current_offset = 0;
+  client_info->write_info.buffer_full = false;
+
+  return APP_ZIGBEE_OK;
+}
+
+/**
+ * @brief  Getting flash first secure sector helper
+ * @param  None
+ * @retval First flash secure sector
+ */
+static inline uint32_t GetFirstSecureSector(void)
+{
+  uint32_t first_secure_sector_idx, sfsa_field, sbrv_field, sbrv_field_sector;
+
+  /* Read SFSA */
+  sfsa_field = (READ_BIT(FLASH->SFR, FLASH_SFR_SFSA) >> FLASH_SFR_SFSA_Pos);
+  APP_DBG("SFSA OB = 0x%x", sfsa_field);
+  APP_DBG("SFSA Option Bytes set to sector = 0x%x (0x080%x)", sfsa_field, sfsa_field*4096);
+
+  /* Read SBRV */
+  /* Contains the word aligned CPU2 boot reset start address offset within the selected memory area by C2OPT. */
+  sbrv_field = (READ_BIT(FLASH->SRRVR, FLASH_SRRVR_SBRV) >> FLASH_SRRVR_SBRV_Pos);
+  APP_DBG("SBRV OB = 0x%x", sbrv_field);
+  /* Divide sbrv_field by 1024 to be compared to SFSA value */
+  sbrv_field_sector = sbrv_field / 1024;
+  APP_DBG("SBRV Option Bytes set to sector = 0x%x (0x080%x)", sbrv_field_sector, sbrv_field*4);
+
+  /* If SBRV is below SFSA then set first_secure_sector_idx to SBRV */
+  if (sbrv_field_sector < sfsa_field)
+  {
+    first_secure_sector_idx = sbrv_field_sector;
+  }
+  else
+  {
+    first_secure_sector_idx = sfsa_field;
+  }
+
+  APP_DBG("first_secure_sector_idx = 0x%x", first_secure_sector_idx);
+
+  return first_secure_sector_idx;
+}
+
+/**
+ * @brief  Deleting non secure sectors helper
+ * @param  None
+ * @retval None
+ */
+static inline void Delete_Sectors( void )
+{
+  /**
+   * The number of sectors to erase is read from SRAM1.
+   * It shall be checked whether the number of sectors to erase does not overlap on the secured Flash
+   * The limit can be read from the SFSA option byte which provides the first secured sector address.
+   */
+
+  uint32_t page_error;
+  FLASH_EraseInitTypeDef p_erase_init;
+  uint32_t first_secure_sector_idx;
+
+  first_secure_sector_idx = GetFirstSecureSector();
+
+  p_erase_init.TypeErase = FLASH_TYPEERASE_PAGES;
+  p_erase_init.Page = *((uint8_t*) SRAM1_BASE + 1);
+  if(p_erase_init.Page < (CFG_APP_START_SECTOR_INDEX - 1))
+  {
+    /**
+     * Something has been wrong as there is no case we should delete the OTA application
+     * Reboot on the firmware application
+     */
+    *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_DOWNLOADED_FW;
+    NVIC_SystemReset();
+  }
+  p_erase_init.NbPages = *((uint8_t*) SRAM1_BASE + 2);
+
+  if ((p_erase_init.Page + p_erase_init.NbPages) > first_secure_sector_idx)
+  {
+    p_erase_init.NbPages = first_secure_sector_idx - p_erase_init.Page;
+  }
+
+  APP_DBG("Erase FLASH Memory from sector %d (0x080%x) to sector %d (0x080%x)", p_erase_init.Page, p_erase_init.Page*4096, p_erase_init.NbPages+p_erase_init.Page, (p_erase_init.NbPages+p_erase_init.Page)*4096);
+
+  HAL_FLASH_Unlock();
+
+  HAL_FLASHEx_Erase(&p_erase_init, &page_error);
+
+  HAL_FLASH_Lock();
+
+  return;
+}
+
+/**
+ * @brief  Getting available internal flash space size
+ * @param  required_size: number of bytes to be written in flash
+ * @retval Application status code
+ */
+static inline APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_CheckDeviceCapabilities(uint32_t required_size)
+{
+  APP_ZIGBEE_StatusTypeDef status = APP_ZIGBEE_OK;
+
+  /* Get Flash memory size available to copy binary from Server */
+  uint32_t first_sector_idx;
+  uint32_t first_secure_sector_idx;
+  uint32_t free_sectors;
+  uint32_t free_size;
+
+  APP_DBG("Check Device capabilities");
+
+  first_secure_sector_idx = GetFirstSecureSector();
+
+  first_sector_idx = *((uint8_t*) SRAM1_BASE + 1);
+  if (first_sector_idx == 0)
+  {
+    APP_DBG("ERROR : SRAM1_BASE + 1 == 0");
+    first_sector_idx = CFG_APP_START_SECTOR_INDEX;
+  }
+  APP_DBG("First available sector = %d (0x080%x)", first_sector_idx, first_sector_idx*4096);
+
+  free_sectors = first_secure_sector_idx - first_sector_idx;
+  free_size = free_sectors*4096;
+
+  APP_DBG("free_sectors = %d , -> %d bytes of FLASH Free", free_sectors, free_size);
+
+  APP_DBG("Server requests    : %d bytes", required_size);
+  APP_DBG("Client Free memory : %d bytes", free_size);
+
+  if (free_size < required_size)
+  {
+    status = APP_ZIGBEE_ERROR;
+    APP_DBG("WARNING: Not enough Free Flash Memory available to download binary from Server!");
+  }
+  else
+  {
+    APP_DBG("Device contains enough Flash Memory to download binary");
+  }
+
+  return status;
+}
+
+/**
+ * @brief Task responsible for the reset at the end of OTA transfer.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_PerformReset(void)
+{
+  /* Do not lose the last network changes */
+  APP_ZIGBEE_persist_flush();
+
+  OTA_client_info.OTA_state = REBOOTING;
+  APP_DBG("*******************************************************");
+  APP_DBG(" FUOTA_CLIENT : END OF TRANSFER COMPLETED");
+
+  if (OTA_client_info.image_type == fileType_APP)
+  {
+#if (CFG_APP_AB_SLOTS)
+    /* Only returns if the slots could not be swapped */
+    APP_ZIGBEE_OTA_Slot_Install(OTA_client_info.ctx.file_version);
+    APP_DBG("  --> Slots swap failed, staying on OTA loader");
+    return;
+#else
+    if (OTA_client_info.ctx.image_encoding == OTA_IMAGE_ENCODING_DELTA)
+    {
+      if (APP_ZIGBEE_OTA_Client_CommitImage(&OTA_client_info) != APP_ZIGBEE_OK)
+      {
+        APP_DBG("  --> Copy of the rebuilt image failed, staying on OTA loader");
+        return;
+      }
+    }
+    APP_DBG("  --> Request to reboot on FW Application");
+    APP_DBG("*******************************************************");
+
+    /* Reboot on Downloaded FW Application */
+    *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_DOWNLOADED_FW;
+
+    HAL_Delay(100);
+    NVIC_SystemReset();
+#endif
+  }
+  else
+  {
+    if (OTA_client_info.image_type == fileType_COPRO_WIRELESS)
+    {
+#if (OTA_BUNDLE_ENABLE)
+      if (OTA_client_info.ctx.bundle_offset != 0u)
+      {
+        /* The OTA loader jumps to the M4 image once the wireless stack is updated */
+        APP_DBG("  --> M4 application started after the M0 update");
+        APP_ZIGBEE_OTA_ctx_save_nvm(&OTA_client_info);
+      }
+#endif
+      APP_DBG("  --> Request to reboot on FUS");
+      APP_DBG("*******************************************************");
+      HAL_Delay(100);
+
+      /**
+       * Wireless firmware update is requested
+       * Request CPU2 to reboot on FUS by sending two FUS command
+       */
+      SHCI_C2_FUS_GetState( NULL );
+      SHCI_C2_FUS_GetState( NULL );
+      while(1)
+      {
+        HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
+      }
+    }
+    else
+    {
+      APP_DBG("APP_ZIGBEE_PerformReset: OtaContext.file_type not recognized");
+      return;
+    }
+  }
+}
+
+/**
+ * @brief  Application timer server callback (led toggling)
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_LEDToggle(void)
+{
+  BSP_LED_Toggle(LED_GREEN);
+}
+
+#if (OTA_MCAST_ENABLE)
+/*************************************************************
+ *
+ * MULTICAST DISTRIBUTION
+ *
+ *************************************************************/
+/**
+ * @brief  Reading a little endian 16 bits field helper
+ * @param  p_data: field address
+ * @retval field value
+ */
+static inline uint16_t APP_ZIGBEE_GetLE16(const uint8_t *p_data)
+{
+  return (uint16_t)((uint16_t)p_data[0] | ((uint16_t)p_data[1] << 8));
+}
+
+/**
+ * @brief  Joining the OTA multicast group and restoring an interrupted session
+ *         Blocks already programmed are found back by reading the download area.
+ *         A block received with the erased value (all 0xFF) cannot be told from
+ *         a missing one, its bitmap word is saved in the EE when it is received
+ *         and merged here. The session parameters are kept in the OTA ctx.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_Init(void)
+{
+  struct APP_ZIGBEE_OtaMcastSession_t *p_mcast = &OTA_client_info.mcast;
+  struct ZbApsmeAddGroupReqT group_req;
+  struct ZbApsmeAddGroupConfT group_conf;
+  const uint8_t *p_block;
+  uint32_t block_len;
+  uint32_t word;
+  uint16_t index;
+
+  memset(&group_req, 0, sizeof(group_req));
+  group_req.groupAddr = OTA_MCAST_GROUP_ADDR;
+  group_req.endpoint = SW1_ENDPOINT;
+  ZbApsmeAddGroupReq(zigbee_app_info.zb, &group_req, &group_conf);
+  if(group_conf.status != ZB_STATUS_SUCCESS)
+  {
+    APP_DBG("[OTA] Multicast group join failed (0x%02x).", group_conf.status);
+    return;
+  }
+
+  if(zigbee_app_info.ota_mcast_filter == NULL)
+  {
+    zigbee_app_info.ota_mcast_filter = ZbApsFilterEndpointAdd(zigbee_app_info.zb, SW1_ENDPOINT, ZCL_PROFILE_HOME_AUTOMATION,
+                                                              APP_ZIGBEE_OTA_Mcast_Filter_cb, &OTA_client_info);
+  }
+
+  if(((OTA_client_info.flags & OTA_CLIENT_CTX_FOUND_FLAG) == 0)
+     || (OTA_client_info.zigbee_ota_ctx_nvm.image_encoding != OTA_IMAGE_ENCODING_MULTICAST)
+     || (OTA_client_info.zigbee_ota_ctx_nvm.OtaCurrentState != DOWNLOADING_IMAGE))
+  {
+    return;
+  }
+
+  if(!APP_ZIGBEE_OTA_Client_SetImageType(&OTA_client_info, (uint16_t)OTA_client_info.zigbee_ota_ctx_nvm.previous_image_type))
+  {
+    return;
+  }
+  OTA_client_info.ctx.file_version = OTA_client_info.zigbee_ota_ctx_nvm.file_version;
+  OTA_client_info.ctx.image_encoding = OTA_IMAGE_ENCODING_MULTICAST;
+  p_mcast->session_id = (uint8_t)(OTA_client_info.zigbee_ota_ctx_nvm.decoder_ctx[0] & 0xFFu);
+  p_mcast->block_size = (uint8_t)((OTA_client_info.zigbee_ota_ctx_nvm.decoder_ctx[0] >> 8) & 0xFFu);
+  p_mcast->server_endpoint = (uint8_t)((OTA_client_info.zigbee_ota_ctx_nvm.decoder_ctx[0] >> 16) & 0xFFu);
+  p_mcast->image_size = OTA_client_info.zigbee_ota_ctx_nvm.decoder_ctx[1];
+  p_mcast->image_crc = OTA_client_info.zigbee_ota_ctx_nvm.decoder_ctx[2];
+  p_mcast->server_addr = (uint16_t)OTA_client_info.zigbee_ota_ctx_nvm.decoder_ctx[3];
+  if((p_mcast->block_size == 0u) || (p_mcast->block_size > OTA_MCAST_MAX_BLOCK_SIZE))
+  {
+    return;
+  }
+  p_mcast->nb_blocks = (uint16_t)((p_mcast->image_size + p_mcast->block_size - 1u) / p_mcast->block_size);
+
+  /* Blocks received with the erased value */
+  for(index = 0; index < ((p_mcast->nb_blocks + 31u) / 32u); index++)
+  {
+    if(EE_Read(0, OTA_MCAST_BITMAP_EE_ADDR + index, &word) == EE_OK)
+    {
+      p_mcast->bitmap[4u * index] = (uint8_t)word;
+      p_mcast->bitmap[4u * index + 1u] = (uint8_t)(word >> 8);
+      p_mcast->bitmap[4u * index + 2u] = (uint8_t)(word >> 16);
+      p_mcast->bitmap[4u * index + 3u] = (uint8_t)(word >> 24);
+    }
+  }
+
+  /* Any other block is received once anything else than the erased value is found in it */
+  for(index = 0; index < p_mcast->nb_blocks; index++)
+  {
+    if((p_mcast->bitmap[index / 8u] & (1u << (index % 8u))) == 0u)
+    {
+      p_block = (const uint8_t *)(OTA_client_info.ctx.base_address + (uint32_t)index * p_mcast->block_size);
+      block_len = ((index + 1u) == p_mcast->nb_blocks) ? (p_mcast->image_size - (uint32_t)index * p_mcast->block_size) : p_mcast->block_size;
+      if(APP_ZIGBEE_OTA_Mcast_IsErased(p_block, block_len))
+      {
+        continue;
+      }
+      p_mcast->bitmap[index / 8u] |= (uint8_t)(1u << (index % 8u));
+    }
+    p_mcast->nb_received++;
+  }
+
+  p_mcast->active = true;
+  OTA_client_info.OTA_state = DOWNLOADING_IMAGE;
+  OTA_client_info.requested_image_size = p_mcast->image_size;
+  OTA_client_info.download_time = HAL_GetTick();
+  APP_DBG("[OTA] Multicast session %d restored : %d/%d blocks already received.",
+          p_mcast->session_id, p_mcast->nb_received, p_mcast->nb_blocks);
+
+  /* Ask the server for what is missing if the stream does not come back */
+  APP_ZIGBEE_OTA_Mcast_ArmNack(OTA_MCAST_NACK_DELAY);
+}
+
+/**
+ * @brief  APS filter receiving the multicast distribution frames on SW1_ENDPOINT
+ * @param  data_ind: APS data indication
+ * @param  arg: OTA client internal structure
+ * @retval ZB_APS_FILTER_DISCARD when the frame has been consumed
+ */
+static int APP_ZIGBEE_OTA_Mcast_Filter_cb(struct ZbApsdeDataIndT *data_ind, void *arg)
+{
+  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+
+  if((data_ind->clusterId != OTA_MCAST_CLUSTER_ID) || (data_ind->asduLength < 2u))
+  {
+    return ZB_APS_FILTER_CONTINUE;
+  }
+
+  switch(data_ind->asdu[0])
+  {
+    case OTA_MCAST_CMD_SESSION_START:
+      APP_ZIGBEE_OTA_Mcast_SessionStart(client_info, data_ind);
+      break;
+
+    case OTA_MCAST_CMD_BLOCK:
+      APP_ZIGBEE_OTA_Mcast_Block(client_info, data_ind);
+      break;
+
+#if (OTA_SIGNATURE_ENABLE)
+    case OTA_MCAST_CMD_SIGNATURE:
+      APP_ZIGBEE_OTA_Mcast_Signature(client_info, data_ind);
+      break;
+#endif
+
+    case OTA_MCAST_CMD_SESSION_END:
+      if(client_info->mcast.active && (data_ind->asdu[1] == client_info->mcast.session_id))
+      {
+        APP_DBG("[OTA] Multicast session end : %d/%d blocks received.", client_info->mcast.nb_received, client_info->mcast.nb_blocks);
+        client_info->mcast.end_received = true;
+        /* Repair request is spread over the clients according to their short address */
+        if(!APP_ZIGBEE_CmdPost(APP_ZIGBEE_OTA_Mcast_ArmRepairCmd, NULL, NULL))
+        {
+          APP_ZIGBEE_OTA_Mcast_ArmNack(OTA_MCAST_NACK_DELAY);
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return ZB_APS_FILTER_DISCARD;
+}
+
+/**
+ * @brief  Handling a multicast session announce
+ *         The image is checked as for an Image Notify, then the download area is
+ *         erased in the background (APP_ZIGBEE_OTA_Mcast_Prepare). A session in
+ *         progress is only repeated or superseded by its own server.
+ * @param  client_info: OTA client internal structure
+ * @param  data_ind: APS data indication
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_SessionStart(struct Zigbee_OTA_client_info* client_info, struct ZbApsdeDataIndT *data_ind)
+{
+  struct APP_ZIGBEE_OtaMcastSession_t *p_mcast = &client_info->mcast;
+  const uint8_t *p_frame = data_ind->asdu;
+  uint16_t manufacturer_code, image_type;
+  uint32_t file_version, image_size, image_crc;
+  uint8_t session_id, block_size;
+  int pos;
+
+  if(data_ind->asduLength < OTA_MCAST_SESSION_START_SIZE)
+  {
+    return;
+  }
+  session_id = p_frame[1];
+  manufacturer_code = APP_ZIGBEE_GetLE16(&p_frame[2]);
+  image_type = APP_ZIGBEE_GetLE16(&p_frame[4]);
+  file_version = APP_ZIGBEE_GetLE32(&p_frame[6]);
+  image_size = APP_ZIGBEE_GetLE32(&p_frame[10]);
+  image_crc = APP_ZIGBEE_GetLE32(&p_frame[14]);
+  block_size = p_frame[18];
+
+  /* Only the server of the session in progress may repeat or supersede it */
+  if(p_mcast->active && (data_ind->src.nwkAddr != p_mcast->server_addr))
+  {
+    APP_DBG("[OTA] Multicast session %d of 0x%04x in progress, session %d of 0x%04x ignored.",
+            p_mcast->session_id, p_mcast->server_addr, session_id, data_ind->src.nwkAddr);
+    return;
+  }
+
+  /* Announce repeated by the server : keep what was already received */
+  if(p_mcast->active && (p_mcast->session_id == session_id)
+     && (client_info->ctx.file_version == file_version) && (p_mcast->image_size == image_size))
+  {
+    p_mcast->server_endpoint = data_ind->src.endpoint;
+    if(p_mcast->preparing)
+    {
+      return;
+    }
+    APP_ZIGBEE_OTA_Mcast_ArmNack(OTA_MCAST_NACK_DELAY);
+    return;
+  }
+
+  if(!p_mcast->active && (client_info->OTA_state >= QUERYING_NEXT_IMAGE))
+  {
+    APP_DBG("[OTA] Unicast upgrade in progress, multicast session %d ignored.", session_id);
+    return;
+  }
+
+  APP_DBG("[OTA] Multicast session %d : image type 0x%04x, file version 0x%08x, %d bytes.", session_id, image_type, file_version, image_size);
+  if(manufacturer_code != ST_ZIGBEE_MANUFACTURER_CODE)
+  {
+    APP_DBG("[OTA] Unauthorized OTA upgrade manufacturer.\n");
+    return;
+  }
+  pos = APP_ZIGBEE_FindImageType(image_type);
+  if((pos < 0) || (OTA_currentFileVersionTab[pos].fileVersion == file_version))
+  {
+    APP_DBG("[OTA] Unknown file type or already up-to-date.\n");
+    return;
+  }
+#if (OTA_PREVENT_DOWNGRADE)
+  if(OTA_currentFileVersionTab[pos].fileVersion > file_version)
+  {
+    APP_DBG("[OTA] Can't downgrade firmeware version.\n");
+    return;
+  }
+#endif
+  if((block_size == 0u) || ((block_size % 8u) != 0u) || (block_size > OTA_MCAST_MAX_BLOCK_SIZE)
+     || (image_size == 0u) || (image_size > (uint32_t)block_size * OTA_MCAST_MAX_BLOCKS))
+  {
+    APP_DBG("[OTA] Unsupported multicast block size %d.\n", block_size);
+    return;
+  }
+  if(APP_ZIGBEE_CheckDeviceCapabilities(image_size) != APP_ZIGBEE_OK)
+  {
+    APP_DBG("[OTA] Not enough space. No download.\n");
+    return;
+  }
+  if(!APP_ZIGBEE_OTA_Client_SetImageType(client_info, image_type))
+  {
+    return;
+  }
+
+  /* A previous session, if any, is superseded */
+  HW_TS_Stop(TS_MCAST_NACK);
+  memset(p_mcast, 0, sizeof(*p_mcast));
+  p_mcast->session_id = session_id;
+  p_mcast->block_size = block_size;
+  p_mcast->server_addr = data_ind->src.nwkAddr;
+  p_mcast->server_endpoint = data_ind->src.endpoint;
+  p_mcast->image_size = image_size;
+  p_mcast->image_crc = image_crc;
+  p_mcast->nb_blocks = (uint16_t)((image_size + block_size - 1u) / block_size);
+
+  client_info->ctx.file_version = file_version;
+  client_info->ctx.image_encoding = OTA_IMAGE_ENCODING_MULTICAST;
+  client_info->ctx.tag_offset = 0;
+  client_info->write_info.flash_current_offset = 0;
+  client_info->write_info.firmware_buffer_current_offset = 0;
+  client_info->requested_image_size = image_size;
+  client_info->flags &= ~(OTA_CLIENT_ERASE_PENDING_FLAG | OTA_CLIENT_RESUME_DOWNLOAD_FLAG | OTA_CLIENT_CTX_FOUND_FLAG
+                          | OTA_CLIENT_SIGNATURE_RECEIVED_FLAG | OTA_CLIENT_MANIFEST_VALID_FLAG | OTA_CLIENT_IMAGE_VERIFIED_FLAG);
+
+  /* The download area is erased by APP_ZIGBEE_OTA_Mcast_Prepare, not in the APS filter : blocks are ignored until then */
+  p_mcast->active = true;
+  p_mcast->preparing = true;
+  client_info->OTA_state = NONE;
+  APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_MCAST_PREPARE, CFG_SCH_CLASS_BACKGROUND);
+}
+
+/**
+ * @brief  Erasing the download area of a new multicast session, background task
+ *         A few pages per run, then the EE bitmap words of the previous session.
+ *         The session is saved once done : after a reset before that, the
+ *         previous session (if any) is found back with the blocks still in flash.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_Prepare(void)
+{
+  struct APP_ZIGBEE_OtaMcastSession_t *p_mcast = &OTA_client_info.mcast;
+  uint32_t first_page = (OTA_client_info.ctx.base_address - FLASH_BASE) / FLASH_PAGE_SIZE;
+  uint32_t nb_pages = (p_mcast->image_size + FLASH_PAGE_SIZE - 1u) / FLASH_PAGE_SIZE;
+  uint32_t count;
+
+  if(!p_mcast->active || !p_mcast->preparing)
+  {
+    return;
+  }
+
+  if(p_mcast->prepare_step < nb_pages)
+  {
+    count = MIN(OTA_MCAST_ERASE_PAGES_PER_RUN, nb_pages - p_mcast->prepare_step);
+    APP_ZIGBEE_OTA_Client_ErasePages(first_page + p_mcast->prepare_step, count);
+    p_mcast->prepare_step += (uint16_t)count;
+  }
+  else if(p_mcast->prepare_step < (nb_pages + OTA_MCAST_BITMAP_EE_WORDS))
+  {
+    count = MIN(OTA_MCAST_CLEAR_WORDS_PER_RUN, (nb_pages + OTA_MCAST_BITMAP_EE_WORDS) - p_mcast->prepare_step);
+    APP_ZIGBEE_OTA_Mcast_ClearSavedBitmap((uint16_t)(p_mcast->prepare_step - nb_pages), (uint16_t)count);
+    p_mcast->prepare_step += (uint16_t)count;
+  }
+  else
+  {
+    p_mcast->preparing = false;
+    OTA_client_info.OTA_state = DOWNLOADING_IMAGE;
+    APP_ZIGBEE_OTA_ctx_save_nvm(&OTA_client_info);
+    APP_DBG("[OTA] Multicast session %d : download area erased, %d blocks expected.", p_mcast->session_id, p_mcast->nb_blocks);
+
+    HW_TS_Start(TS_ID_LED, (uint32_t)LED_TOGGLE_TIMING);
+    OTA_client_info.download_time = HAL_GetTick();
+    APP_ZIGBEE_OTA_Mcast_ArmNack(OTA_MCAST_NACK_DELAY);
+    return;
+  }
+
+  APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_MCAST_PREPARE, CFG_SCH_CLASS_BACKGROUND);
+}
+
+/**
+ * @brief  Handling a multicast (or repair) block : programmed at its place in the download area
+ * @param  client_info: OTA client internal structure
+ * @param  data_ind: APS data indication
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_Block(struct Zigbee_OTA_client_info* client_info, struct ZbApsdeDataIndT *data_ind)
+{
+  struct APP_ZIGBEE_OtaMcastSession_t *p_mcast = &client_info->mcast;
+  uint8_t block[OTA_MCAST_MAX_BLOCK_SIZE];
+  uint32_t block_len;
+  uint16_t index;
+
+  if(!p_mcast->active || p_mcast->preparing || (data_ind->asduLength < OTA_MCAST_BLOCK_HEADER_SIZE)
+     || (data_ind->asdu[1] != p_mcast->session_id))
+  {
+    return;
+  }
+  index = APP_ZIGBEE_GetLE16(&data_ind->asdu[2]);
+  if(index >= p_mcast->nb_blocks)
+  {
+    return;
+  }
+  APP_ZIGBEE_OTA_Mcast_ArmNack(p_mcast->end_received ? OTA_MCAST_NACK_RETRY_DELAY : OTA_MCAST_NACK_DELAY);
+  if((p_mcast->bitmap[index / 8u] & (1u << (index % 8u))) != 0u)
+  {
+    /* Repair of a block missed by another client */
+    return;
+  }
+
+  block_len = ((index + 1u) == p_mcast->nb_blocks) ? (p_mcast->image_size - (uint32_t)index * p_mcast->block_size) : p_mcast->block_size;
+  if((uint32_t)(data_ind->asduLength - OTA_MCAST_BLOCK_HEADER_SIZE) != block_len)
+  {
+    return;
+  }
+
+  /* Last block is completed with 0, as done for the RAM staging buffer */
+  memset(block, 0, sizeof(block));
+  memcpy(block, &data_ind->asdu[OTA_MCAST_BLOCK_HEADER_SIZE], block_len);
+  if(APP_ZIGBEE_OTA_Client_FlashProgram(client_info->ctx.base_address + (uint32_t)index * p_mcast->block_size,
+                                        block, block_len) != APP_ZIGBEE_OK)
+  {
+    return;
+  }
+  p_mcast->bitmap[index / 8u] |= (uint8_t)(1u << (index % 8u));
+  p_mcast->nb_received++;
+  if(APP_ZIGBEE_OTA_Mcast_IsErased(block, block_len))
+  {
+    /* Not found back in flash after a reset */
+    APP_ZIGBEE_OTA_Mcast_SaveBitmapWord(index);
+  }
+
+  if(p_mcast->nb_received == p_mcast->nb_blocks)
+  {
+    APP_ZIGBEE_OTA_Mcast_Complete(client_info);
+  }
+}
+
+#if (OTA_SIGNATURE_ENABLE)
+/**
+ * @brief  Handling the image signature of a multicast session
+ *         Sent by the server with the session, and again when a client
+ *         reports no missing block (NACK without range) : the signature is
+ *         not kept over a reset.
+ * @param  client_info: OTA client internal structure
+ * @param  data_ind: APS data indication
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_Signature(struct Zigbee_OTA_client_info* client_info, struct ZbApsdeDataIndT *data_ind)
+{
+  struct APP_ZIGBEE_OtaMcastSession_t *p_mcast = &client_info->mcast;
+
+  if(!p_mcast->active || (data_ind->asduLength != OTA_MCAST_SIGNATURE_FRAME_SIZE) || (data_ind->asdu[1] != p_mcast->session_id)
+     || (client_info->flags & OTA_CLIENT_SIGNATURE_RECEIVED_FLAG))
+  {
+    return;
+  }
+  memcpy(client_info->signature, &data_ind->asdu[2], OTA_ECDSA_SIGNATURE_SIZE);
+  client_info->flags |= OTA_CLIENT_SIGNATURE_RECEIVED_FLAG;
+  APP_DBG("[OTA] Multicast session %d : get image signature.", p_mcast->session_id);
+
+  if(p_mcast->nb_received == p_mcast->nb_blocks)
+  {
+    APP_ZIGBEE_OTA_Mcast_Complete(client_info);
+  }
+}
+#endif /* OTA_SIGNATURE_ENABLE */
+
+/**
+ * @brief  Validating an image once all its blocks are received, and reporting to the server
+ *         With OTA_SIGNATURE_REQUIRED, the image waits for its signature : the
+ *         client reports no missing block until it is received.
+ * @param  client_info: OTA client internal structure
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_Complete(struct Zigbee_OTA_client_info* client_info)
+{
+  struct APP_ZIGBEE_OtaMcastSession_t *p_mcast = &client_info->mcast;
+
+#if (OTA_SIGNATURE_REQUIRED)
+  if((client_info->flags & OTA_CLIENT_SIGNATURE_RECEIVED_FLAG) == 0)
+  {
+    APP_DBG("[OTA] Multicast session %d : all blocks received, waiting for the signature.", p_mcast->session_id);
+    APP_ZIGBEE_OTA_Mcast_SendReport(client_info, OTA_MCAST_STATUS_MISSING);
+    APP_ZIGBEE_OTA_Mcast_ArmNack(OTA_MCAST_NACK_RETRY_DELAY);
+    return;
+  }
+#endif
+
+  HW_TS_Stop(TS_MCAST_NACK);
+  p_mcast->active = false;
+
+#if (OTA_SIGNATURE_ENABLE)
+  /* Blocks are written out of order : the image is hashed once complete */
+  APP_OTA_SHA256_Init(&client_info->image_hash);
+  APP_OTA_SHA256_Update(&client_info->image_hash, (const uint8_t *)client_info->ctx.base_address, p_mcast->image_size);
+#endif
+
+  /* Validation is the one of a unicast download */
+  client_info->write_info.flash_current_offset = (p_mcast->image_size + 7u) & ~7u;
+  client_info->ctx.binary_srv_crc = p_mcast->image_crc;
+  client_info->flags |= OTA_CLIENT_CRC_RECEIVED_FLAG;
+  if(APP_ZIGBEE_OTA_Client_ImageValidate_cb(NULL, NULL, client_info) != ZCL_STATUS_SUCCESS)
+  {
+    /* Next session starts from an erased area */
+    client_info->OTA_state = NONE;
+    client_info->write_info.flash_current_offset = 0;
+    client_info->flags |= OTA_CLIENT_ERASE_PENDING_FLAG;
+    APP_ZIGBEE_OTA_ctx_save_nvm(client_info);
+    APP_ZIGBEE_OTA_Mcast_SendReport(client_info, OTA_MCAST_STATUS_INVALID);
+    return;
+  }
+
+  client_info->OTA_state = REBOOTING;
+  APP_ZIGBEE_OTA_ctx_save_nvm(client_info);
+  APP_ZIGBEE_OTA_Mcast_SendReport(client_info, OTA_MCAST_STATUS_COMPLETE);
+}
+
+/**
+ * @brief  Saving in the EE the bitmap word of a block
+ * @param  index: block index
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_SaveBitmapWord(uint16_t index)
+{
+  const uint8_t *p_word = &OTA_client_info.mcast.bitmap[4u * (index / 32u)];
+
+  if(APP_ZIGBEE_NVM_EeWrite(OTA_MCAST_BITMAP_EE_ADDR + (index / 32u), APP_ZIGBEE_GetLE32(p_word)) != EE_OK)
+  {
+    APP_DBG("[OTA] Multicast bitmap save failed, block %d requested again after a reset.", index);
+  }
+}
+
+/**
+ * @brief  Clearing the bitmap words saved by a previous session
+ *         Only the words not already cleared are written.
+ * @param  first: first bitmap word
+ * @param  count: number of bitmap words
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_ClearSavedBitmap(uint16_t first, uint16_t count)
+{
+  uint32_t word;
+  uint16_t index;
+
+  for(index = first; index < (first + count); index++)
+  {
+    if((EE_Read(0, OTA_MCAST_BITMAP_EE_ADDR + index, &word) == EE_OK) && (word != 0u))
+    {
+      (void)APP_ZIGBEE_NVM_EeWrite(OTA_MCAST_BITMAP_EE_ADDR + index, 0u);
+    }
+  }
+}
+
+/**
+ * @brief  Checking if data only holds the flash erased value
+ * @param  p_data: data
+ * @param  size: data size
+ * @retval true if all bytes are 0xFF
+ */
+static bool APP_ZIGBEE_OTA_Mcast_IsErased(const uint8_t *p_data, uint32_t size)
+{
+  while(size != 0u)
+  {
+    size--;
+    if(p_data[size] != 0xFFu)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief  (Re)starting the NACK timer
+ * @param  delay: timer server ticks
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_ArmNack(uint32_t delay)
+{
+  HW_TS_Stop(TS_MCAST_NACK);
+  HW_TS_Start(TS_MCAST_NACK, delay);
+}
+
+/**
+ * @brief  Arming the NACK timer in the slot of the client after the session end (posted command)
+ * @param  arg: unused
+ * @retval ZB_STATUS_SUCCESS
+ */
+static uint32_t APP_ZIGBEE_OTA_Mcast_ArmRepairCmd(void *arg)
+{
+  UNUSED(arg);
+
+  if(OTA_client_info.mcast.active)
+  {
+    APP_ZIGBEE_OTA_Mcast_ArmNack(OTA_MCAST_NACK_SLOT * (1u + (ZbShortAddress(zigbee_app_info.zb) % OTA_MCAST_NACK_SLOTS)));
+  }
+  return (uint32_t)ZB_STATUS_SUCCESS;
+}
+
+/**
+ * @brief  NACK timer callback (timer server ISR context)
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_NackTimer_cb(void)
+{
+  APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_MCAST_NACK, CFG_SCH_CLASS_OTA);
+}
+
+/**
+ * @brief  Task sending the ranges of missing blocks to the server
+ *         Rescheduled until the session completes, so that a lost NACK or a
+ *         lost repair block is requested again.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_SendNack(void)
+{
+  if(!OTA_client_info.mcast.active || OTA_client_info.mcast.preparing)
+  {
+    return;
+  }
+  if(OTA_client_info.mcast.nb_received == OTA_client_info.mcast.nb_blocks)
+  {
+    /* Session restored with all its blocks, or signature still missing */
+    APP_ZIGBEE_OTA_Mcast_Complete(&OTA_client_info);
+    return;
+  }
+  APP_DBG("[OTA] Multicast session %d : %d block(s) missing, sending NACK.",
+          OTA_client_info.mcast.session_id, OTA_client_info.mcast.nb_blocks - OTA_client_info.mcast.nb_received);
+  APP_ZIGBEE_OTA_Mcast_SendReport(&OTA_client_info, OTA_MCAST_STATUS_MISSING);
+  APP_ZIGBEE_OTA_Mcast_ArmNack(OTA_MCAST_NACK_RETRY_DELAY);
+}
+
+/**
+ * @brief  Sending a NACK frame to the multicast server
+ *         The frame is sent by a posted command : when called from a M0
+ *         notification (last block received), the notification is acknowledged
+ *         first. Only the last status is sent if several reports are pending.
+ * @param  client_info: OTA client internal structure
+ * @param  status: OTA_MCAST_STATUS_xxx
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_SendReport(struct Zigbee_OTA_client_info* client_info, uint8_t status)
+{
+  struct APP_ZIGBEE_OtaMcastSession_t *p_mcast = &client_info->mcast;
+
+  p_mcast->report_status = status;
+  if(p_mcast->report_pending)
+  {
+    return;
+  }
+  p_mcast->report_pending = true;
+  if(!APP_ZIGBEE_CmdPost(APP_ZIGBEE_OTA_Mcast_ReportCmd, APP_ZIGBEE_OTA_Mcast_ReportDone, client_info))
+  {
+    APP_ZIGBEE_OTA_Mcast_ReportDone(APP_ZIGBEE_OTA_Mcast_ReportCmd(client_info), client_info);
+  }
+}
+
+/**
+ * @brief  Report command completion
+ * @param  status: ZbApsdeDataReqCallback status
+ * @param  arg: OTA client internal structure
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_ReportDone(uint32_t status, void *arg)
+{
+  if(status != (uint32_t)ZB_STATUS_SUCCESS)
+  {
+    APP_DBG("[OTA] Multicast report send failed.");
+    APP_ZIGBEE_OTA_Mcast_ReportSent((struct Zigbee_OTA_client_info*) arg);
+  }
+}
+
+/**
+ * @brief  Building and sending the report frame (posted command)
+ *         Frame : command, session, status, range count, ranges (first block, nb blocks).
+ *         Only the first OTA_MCAST_MAX_NACK_RANGES ranges are reported, the
+ *         others are requested by the next NACK. The frame is built in a
+ *         McastReportPool block, freed by the APS confirm.
+ * @param  arg: OTA client internal structure
+ * @retval ZbApsdeDataReqCallback status
+ */
+static uint32_t APP_ZIGBEE_OTA_Mcast_ReportCmd(void *arg)
+{
+  struct Zigbee_OTA_client_info* client_info = (struct Zigbee_OTA_client_info*) arg;
+  struct APP_ZIGBEE_OtaMcastSession_t *p_mcast = &client_info->mcast;
+  struct APP_ZIGBEE_OtaMcastReport_t *p_report;
+  struct ZbApsdeDataReqT req;
+  enum ZbStatusCodeT req_status;
+  uint8_t *frame;
+  uint16_t length = 4u;
+  uint8_t nb_ranges = 0;
+  uint8_t status = p_mcast->report_status;
+  uint32_t index, first;
+
+  p_mcast->report_pending = false;
+  p_report = APP_POOL_Alloc(&McastReportPool);
+  if(p_report == NULL)
+  {
+    return (uint32_t)ZB_STATUS_ALLOC_FAIL;
+  }
+  p_report->client_info = client_info;
+  frame = p_report->frame;
+
+  if(status == OTA_MCAST_STATUS_MISSING)
+  {
+    index = 0;
+    while((index < p_mcast->nb_blocks) && (nb_ranges < OTA_MCAST_MAX_NACK_RANGES))
+    {
+      if((p_mcast->bitmap[index / 8u] & (1u << (index % 8u))) != 0u)
+      {
+        index++;
+        continue;
+      }
+      first = index;
+      while((index < p_mcast->nb_blocks) && ((p_mcast->bitmap[index / 8u] & (1u << (index % 8u))) == 0u))
+      {
+        index++;
+      }
+      frame[length++] = (uint8_t)(first & 0xFFu);
+      frame[length++] = (uint8_t)(first >> 8);
+      frame[length++] = (uint8_t)((index - first) & 0xFFu);
+      frame[length++] = (uint8_t)((index - first) >> 8);
+      nb_ranges++;
+    }
+  }
+  frame[0] = OTA_MCAST_CMD_NACK;
+  frame[1] = p_mcast->session_id;
+  frame[2] = status;
+  frame[3] = nb_ranges;
+
+  memset(&req, 0, sizeof(req));
+  req.dst.mode = ZB_APSDE_ADDRMODE_SHORT;
+  req.dst.nwkAddr = p_mcast->server_addr;
+  req.dst.endpoint = p_mcast->server_endpoint;
+  req.profileId = ZCL_PROFILE_HOME_AUTOMATION;
+  req.clusterId = OTA_MCAST_CLUSTER_ID;
+  req.srcEndpt = SW1_ENDPOINT;
+  req.asdu = frame;
+  req.asduLength = length;
+  req.txOptions = ZB_APSDE_DATAREQ_TXOPTIONS_ACK | ZB_APSDE_DATAREQ_TXOPTIONS_SECURITY | ZB_APSDE_DATAREQ_TXOPTIONS_NWKKEY;
+  req.discoverRoute = true;
+  req.radius = ZB_APS_DEF_RADIUS;
+  req_status = ZbApsdeDataReqCallback(zigbee_app_info.zb, &req, APP_ZIGBEE_OTA_Mcast_ReportConf_cb, p_report);
+  if(req_status != ZB_STATUS_SUCCESS)
+  {
+    APP_POOL_Free(&McastReportPool, p_report);
+  }
+  return (uint32_t)req_status;
+}
+
+/**
+ * @brief  Multicast report confirm
+ * @param  conf: APS data confirm
+ * @param  arg: report, from McastReportPool
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_ReportConf_cb(struct ZbApsdeDataConfT *conf, void *arg)
+{
+  struct APP_ZIGBEE_OtaMcastReport_t *p_report = (struct APP_ZIGBEE_OtaMcastReport_t *) arg;
+  struct Zigbee_OTA_client_info* client_info = p_report->client_info;
+  UNUSED(conf);
+
+  APP_POOL_Free(&McastReportPool, p_report);
+  APP_ZIGBEE_OTA_Mcast_ReportSent(client_info);
+}
+
+/**
+ * @brief  Multicast report sent or failed : a validated image is applied once the server knows about it
+ * @param  client_info: OTA client internal structure
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Mcast_ReportSent(struct Zigbee_OTA_client_info* client_info)
+{
+  if(client_info->OTA_state == REBOOTING)
+  {
+    APP_DBG("**************************************************************");
+    APP_DBG("[OTA] Rebooting.");
+    APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_FUOTA_RESET, CFG_SCH_CLASS_OTA);
+  }
+}
+#endif /* OTA_MCAST_ENABLE */
+
+#if (OTA_SCHEDULE_ENABLE)
+/*************************************************************
+ *
+ * DOWNLOAD WINDOW
+ *
+ *************************************************************/
+/**
+ * @brief  Download window initialization
+ *         The start offset in the window is derived from the extended address so
+ *         that the clients of a network do not all start downloading together.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Schedule_Init(void)
+{
+  uint64_t ext_addr = ZbExtendedAddress(zigbee_app_info.zb);
+  uint32_t hash = 2166136261u;
+  uint8_t index;
+
+  /* FNV-1a over the EUI64 */
+  for(index = 0; index < 8u; index++)
+  {
+    hash ^= (uint32_t)((ext_addr >> (8u * index)) & 0xFFu);
+    hash *= 16777619u;
+  }
+  OTA_schedule.start_offset = hash % OTA_SCHEDULE_SPREAD;
+  OTA_schedule.in_window = APP_ZIGBEE_OTA_Schedule_IsInWindow();
+  APP_DBG("[OTA] Download window : %d s after %d s of day, for %d s (local time %d s).",
+          OTA_schedule.start_offset, OTA_SCHEDULE_WINDOW_START, OTA_SCHEDULE_WINDOW_LENGTH, OTA_schedule.local_time);
+
+  HW_TS_Create(CFG_TIM_PROC_ID_ISR, &TS_OTA_SCHEDULE, hw_ts_Repeated, APP_ZIGBEE_OTA_Schedule_Tick_cb);
+  HW_TS_Start(TS_OTA_SCHEDULE, (uint32_t)HW_TS_SERVER_1S_NB_TICKS);
+}
+
+/**
+ * @brief  Checking whether this device is allowed to download at local time
+ * @param  None
+ * @retval true between the device start offset and the end of the window
+ */
+static bool APP_ZIGBEE_OTA_Schedule_IsInWindow(void)
+{
+  uint32_t elapsed = (OTA_schedule.local_time + OTA_SCHEDULE_PERIOD - OTA_SCHEDULE_WINDOW_START) % OTA_SCHEDULE_PERIOD;
+
+  return (elapsed >= OTA_schedule.start_offset) && (elapsed < OTA_SCHEDULE_WINDOW_LENGTH);
+}
+
+/**
+ * @brief  Local clock timer callback (timer server ISR context)
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Schedule_Tick_cb(void)
+{
+  bool in_window;
+
+  OTA_schedule.local_time = (OTA_schedule.local_time + 1u) % OTA_SCHEDULE_PERIOD;
+  in_window = APP_ZIGBEE_OTA_Schedule_IsInWindow();
+  if(in_window != OTA_schedule.in_window)
+  {
+    OTA_schedule.in_window = in_window;
+    APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_SCHEDULE, CFG_SCH_CLASS_OTA);
+  }
+}
+
+/**
+ * @brief  Starting an accepted image download now or at the next window
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Schedule_Download(void)
+{
+  uint32_t wait;
+
+  if(OTA_schedule.in_window)
+  {
+    APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_START_DOWNLOAD, CFG_SCH_CLASS_OTA);
+    APP_DBG("[OTA] Starting download.\n");
+    return;
+  }
+
+  OTA_schedule.offer_pending = true;
+  wait = (OTA_SCHEDULE_WINDOW_START + OTA_schedule.start_offset + OTA_SCHEDULE_PERIOD - OTA_schedule.local_time) % OTA_SCHEDULE_PERIOD;
+  APP_DBG("[OTA] Download deferred to the next window, in %d s.\n", wait);
+}
+
+/**
+ * @brief  Task run on window boundaries : starts or resumes the download when the
+ *         window opens, pauses it when the window closes. The data received so far
+ *         is kept and the transfer goes on from there at the next window.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Schedule_Process(void)
+{
+  if(OTA_schedule.in_window)
+  {
+    APP_DBG("[OTA] Download window opened.");
+    if(OTA_schedule.offer_pending)
+    {
+      OTA_schedule.offer_pending = false;
+      APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_START_DOWNLOAD, CFG_SCH_CLASS_OTA);
+      APP_DBG("[OTA] Starting download.\n");
+    }
+    else if(OTA_schedule.paused)
+    {
+      OTA_schedule.paused = false;
+      APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_RESUME_DOWNLOAD, CFG_SCH_CLASS_OTA);
+      APP_DBG("[OTA] Resuming download.\n");
+    }
+  }
+  else
+  {
+    APP_DBG("[OTA] Download window closed.");
+    if((OTA_client_info.OTA_state == DOWNLOADING_IMAGE) && !OTA_client_info.mcast.active)
+    {
+      OTA_schedule.paused = true;
+      APP_ZIGBEE_OTA_Client_PauseDownload();
+      APP_DBG("[OTA] Download paused until the next window.\n");
+    }
+  }
+}
+#endif /* OTA_SCHEDULE_ENABLE */
+
+/**
+ * @brief  Setting the local time of day used for the download window
+ * @param  seconds: seconds elapsed since the beginning of the day
+ * @retval None
+ */
+void APP_ZIGBEE_OTA_SetLocalTime(uint32_t seconds)
+{
+#if (OTA_SCHEDULE_ENABLE)
+  OTA_schedule.local_time = seconds % OTA_SCHEDULE_PERIOD;
+#else
+  UNUSED(seconds);
+#endif
+}
+
+/*************************************************************
+ *
+ * NVM FUNCTIONS
+ *
+ *************************************************************/
+/**
+ * @brief  notify to save persistent data callback
+ *         The data is saved by CFG_TASK_ZIGBEE_PERSIST_SAVE once no notification came
+ *         for PERSIST_SAVE_DELAY, or PERSIST_SAVE_MAX_LATENCY after the first one.
+ * @param  zb: Zigbee device object pointer, cbarg: callback arg pointer
+ * @retval None
+ */
+static void APP_ZIGBEE_persist_notify_cb(struct ZigBeeT *zb, void *cbarg)
+{
+  APP_DBG("Notification to save persistent data requested from stack.");
+  if(!persistDirty)
+  {
+    persistDirty = true;
+    persistDirtyTime = HAL_GetTick();
+  }
+
+  HW_TS_Stop(TS_PERSIST_SAVE);
+  if((HAL_GetTick() - persistDirtyTime) >= PERSIST_SAVE_MAX_LATENCY)
+  {
+    APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_PERSIST_SAVE, CFG_SCH_CLASS_BACKGROUND);
+  }
+  else
+  {
+    HW_TS_Start(TS_PERSIST_SAVE, (uint32_t)PERSIST_SAVE_DELAY);
+  }
+}
+
+/**
+ * @brief  Persistence save timer callback (interrupt context)
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_persist_timer_cb(void)
+{
+  APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_PERSIST_SAVE, CFG_SCH_CLASS_BACKGROUND);
+}
+
+/**
+ * @brief  Saving the persistent data if notifications are pending
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_persist_flush(void)
+{
+#ifdef OTA_DISPLAY_TIMING
+  static uint32_t lPersistentStartTime = 0;
+  uint32_t  lTime1, lTime2;
+
+  lTime1 = ( HAL_GetTick() - lPersistentStartTime );
+  lPersistentStartTime = HAL_GetTick();
+#endif // OTA_DISPLAY_TIMING
+
+  HW_TS_Stop(TS_PERSIST_SAVE);
+  if(!persistDirty)
+  {
+    return;
+  }
+  persistDirty = false;
+
+  /* Save the persistent data */
+  APP_DBG("Saving persistent data (%d ms after the first notification).", HAL_GetTick() - persistDirtyTime);
+  APP_ZIGBEE_persist_save();
+
+#ifdef OTA_DISPLAY_TIMING
+  lTime2 = ( HAL_GetTick() - lPersistentStartTime );
+  lPersistentStartTime = HAL_GetTick();
+  APP_DBG("Persistent Data: Interval Time : %d ms and Save Time : %d ms", lTime1, lTime2);
+#endif // OTA_DISPLAY_TIMING
+}
+
+/**
+ * @brief  Start Zigbee Network from persistent data
+ * @param  zb: Zigbee device object pointer
+ * @retval Zigbee stack Status code
+ */
+static enum ZbStatusCodeT APP_ZIGBEE_ZbStartupPersist(struct ZigBeeT* zb)
+{
+   bool read_status;
+   enum ZbStatusCodeT status = ZB_STATUS_SUCCESS;
+
+   /* Restore persistence */
+   read_status = APP_ZIGBEE_persist_load();
+
+   if (read_status)
+   {
+       /* Make sure the EPID is cleared, before we are allowed to restore persistence */
+       uint64_t epid = 0U;
+       ZbNwkSet(zb, ZB_NWK_NIB_ID_ExtendedPanId, &epid, sizeof(uint64_t));
+
+       /* Start-up from persistence */
+       APP_DBG("APP_ZIGBEE_ZbStartupPersist: restoring stack persistence");
+       status = ZbStartupPersist(zb, &cache_persistent_data.U8_data[ST_PERSIST_FLASH_DATA_OFFSET], cache_persistent_data.U32_data[0],NULL, NULL, NULL);
+       if (status == ZB_STATUS_SUCCESS)
+       {
+         bPersistDataUsed = TRUE;
+       }
+   }
+   else
+   {
+       /* Failed to restart from persistence */
+       APP_DBG("APP_ZIGBEE_ZbStartupPersist: no persistence data to restore");
+       status = ZB_STATUS_ALLOC_FAIL;
+   }
+
+   /* Only for debug purpose, depending of persistent data, following traces
+      could display bytes that are irrelevants to on off cluster */
+   if (status == ZB_STATUS_SUCCESS)
+   {
+      /* read the last bytes of data where the ZCL on off persistent data shall be*/
+      uint32_t len = cache_persistent_data.U32_data[0] + 4 ;
+      APP_DBG("ClusterID %02x %02x",cache_persistent_data.U8_data[len-9],cache_persistent_data.U8_data[len-10]);
+      APP_DBG("Endpoint %02x %02x",cache_persistent_data.U8_data[len-7],cache_persistent_data.U8_data[len-8]);
+      APP_DBG("Direction %02x",cache_persistent_data.U8_data[len-6]);
+      APP_DBG("AttrID %02x %02x",cache_persistent_data.U8_data[len-4],cache_persistent_data.U8_data[len-5]);
+      APP_DBG("Len %02x %02x",cache_persistent_data.U8_data[len-2],cache_persistent_data.U8_data[len-3]);
+      APP_DBG("Value %02x",cache_persistent_data.U8_data[len-1]);
+   }
+
+   return status;
+}/* APP_ZIGBEE_ZbStartupPersist */
+
+/**
+ * @brief  timer callback to wait end of restore cluster persistence form M0
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_PersistCompleted_callback(void)
+{
+  /* No cluster attributes to restore */
+}/* APP_ZIGBEE_PersistCompleted_callback */
+
+
+/**
+ * @brief  save OTA ctx persistent data
+ * @param  None
+ * @retval true if success, false if fail
+ */
+static bool APP_ZIGBEE_OTA_ctx_save_nvm (struct Zigbee_OTA_client_info* client_info) {
+
+  int ee_status = 0;
+  uint32_t*  p_data;
+  /* Populate data struct */
+  client_info->zigbee_ota_ctx_nvm.flash_offset = client_info->write_info.flash_current_offset;
+  client_info->zigbee_ota_ctx_nvm.previous_image_type = client_info->ctx.file_type;
+  client_info->zigbee_ota_ctx_nvm.file_version = client_info->ctx.file_version;
+  client_info->zigbee_ota_ctx_nvm.OtaCurrentState= client_info->OTA_state;
+  client_info->zigbee_ota_ctx_nvm.image_encoding = client_info->ctx.image_encoding;
+  client_info->zigbee_ota_ctx_nvm.bundle_offset = client_info->ctx.bundle_offset;
+  client_info->zigbee_ota_ctx_nvm.image_verified = ((client_info->flags & OTA_CLIENT_IMAGE_VERIFIED_FLAG) != 0u) ? 1u : 0u;
+  if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_LZSS)
+  {
+    /* Called right after a flush : decoder output matches the flash offset */
+    client_info->zigbee_ota_ctx_nvm.tag_offset = client_info->ctx.tag_offset;
+    APP_OTA_LZSS_Save(&client_info->decoder.lzss, client_info->zigbee_ota_ctx_nvm.decoder_ctx);
+  }
+  else if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_DELTA)
+  {
+    client_info->zigbee_ota_ctx_nvm.tag_offset = client_info->ctx.tag_offset;
+    APP_OTA_DELTA_Save(&client_info->decoder.delta, client_info->zigbee_ota_ctx_nvm.decoder_ctx);
+  }
+  else if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_ENCRYPTED)
+  {
+    /* Stream position is the flash offset, only the initial counter block is saved */
+    client_info->zigbee_ota_ctx_nvm.tag_offset = client_info->ctx.tag_offset;
+    memcpy(client_info->zigbee_ota_ctx_nvm.decoder_ctx, client_info->ctx.sub_header, OTA_AES_HEADER_SIZE);
+  }
+  else if(client_info->ctx.image_encoding == OTA_IMAGE_ENCODING_MULTICAST)
+  {
+    /* Received blocks are found back in flash and in the EE bitmap words, only the session is saved */
+    client_info->zigbee_ota_ctx_nvm.tag_offset = 0;
+    client_info->zigbee_ota_ctx_nvm.decoder_ctx[0] = (uint32_t)client_info->mcast.session_id
+                                                     | ((uint32_t)client_info->mcast.block_size << 8)
+                                                     | ((uint32_t)client_info->mcast.server_endpoint << 16);
+    client_info->zigbee_ota_ctx_nvm.decoder_ctx[1] = client_info->mcast.image_size;
+    client_info->zigbee_ota_ctx_nvm.decoder_ctx[2] = client_info->mcast.image_crc;
+    client_info->zigbee_ota_ctx_nvm.decoder_ctx[3] = client_info->mcast.server_addr;
+  }
+  else
+  {
+    client_info->zigbee_ota_ctx_nvm.tag_offset = client_info->write_info.flash_current_offset;
+  }
+
+  p_data = (uint32_t *)&client_info->zigbee_ota_ctx_nvm.flash_offset;
+ /* loop i = number of uint32_t in zigbee_ota_ctx_nvm*/ 
+  for(uint8_t i =0; i< (sizeof(client_info->zigbee_ota_ctx_nvm)/sizeof(uint32_t));i++)
+  {
+    ee_status = APP_ZIGBEE_NVM_EeWrite(USER_DB_START_ADDR+i, *(p_data+i));
+    if (ee_status != EE_OK)
+    {
+      /* Failed to write , an Erase shall be done */
+      APP_DBG("APP_ZIGBEE_NVM_Write failed @ %d status %d", i, ee_status);
+      return false;
+    }
+  }
+
+
+  return true;
+
+}
+
+/**
+ * @brief  load OTA ctx persistent data
+ * @param  None
+ * @retval true if success, false if fail
+ */
+static bool APP_ZIGBEE_OTA_ctx_load_nvm () {
+  bool status = true;
+  int ee_status = 0;
+  uint32_t*  p_data;
+
+  HAL_FLASH_Unlock();
+  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_PGSERR | FLASH_FLAG_WRPERR | FLASH_FLAG_OPTVERR);
+
+  /* Searching for previous OTA CTX */
+  p_data = (uint32_t *)&OTA_client_info.zigbee_ota_ctx_nvm.flash_offset;
+  for(uint8_t i =0; i< (sizeof(OTA_client_info.zigbee_ota_ctx_nvm)/sizeof(uint32_t));i++)
+  {
+    ee_status = EE_Read(0, USER_DB_START_ADDR+i, p_data+i);
+    if (ee_status != EE_OK )
+    {
+      APP_DBG("[OTA] ctx_load : Can't find previous OTA ctx file version in NVM !");
+      HAL_FLASH_Lock();
+      status = false;
+      return status;
+    }
+  }
+  APP_DBG("[OTA] ctx_load : successfully loaded previous OTA ctx from NVM");
+  OTA_client_info.flags |= OTA_CLIENT_CTX_FOUND_FLAG;
+  OTA_client_info.write_info.flash_current_offset = OTA_client_info.zigbee_ota_ctx_nvm.flash_offset;
+  HAL_FLASH_Lock();
+  return status;
+
+}
+
+/**
+ * @brief  Load persistent data
+ * @param  None
+ * @retval true if success, false if fail
+ */
+static bool APP_ZIGBEE_persist_load(void)
+{
+#ifdef CFG_NVM
+    APP_DBG("Retrieving persistent data from FLASH");
+    if ( APP_ZIGBEE_NVM_Read() == false )
+    {
+      return false;
+    }
+#else /* CFG_NVM */
+    /* Check length range */
+    if ((cache_persistent_data.U32_data[0] == 0) ||
+        (cache_persistent_data.U32_data[0] > ST_PERSIST_MAX_ALLOC_SZ))
+    {
+        APP_DBG("No data or too large length : %d",cache_persistent_data.U32_data[0]);
+        return false;
+    }
+#endif /* CFG_NVM */
+
+    /* Verify Tag */
+    if ( cache_persistent_data.U32_data[1] != ST_PERSIST_TAG )
+    {
+      APP_DBG("Bad Verification TAG in RAM : 0x%04X",cache_persistent_data.U32_data[1]);
+      return false;
+    }
+
+    return true;
+} /* APP_ZIGBEE_persist_load */
+
+
+/**
+ * @brief  Save persistent data
+ * @param  None
+ * @retval true if success , false if fail
+ */
+static bool APP_ZIGBEE_persist_save(void)
+{
+    uint32_t len;
+#ifdef OTA_DISPLAY_TIMING
+    static union cache  szPersistentDataTemp = { 0, };
+#endif // OTA_DISPLAY_TIMING
+
+#ifdef CFG_NVM
+    /* The cache no longer matches the NVM until written */
+    APP_ZIGBEE_NVM_Unseal();
+#endif /* CFG_NVM */
+
+    /* Clear the RAM cache before saving */
+    memset(cache_persistent_data.U8_data, 0x00, ST_PERSIST_MAX_ALLOC_BUFFER_SZ);
+
+    /* Call the satck API t get current persistent data */
+    len = ZbPersistGet(zigbee_app_info.zb, 0, 0);
+
+    /* Check Length range */
+    if (len == 0U)
+    {
+        /* If the persistence length was zero then no data available. */
+        APP_DBG("APP_ZIGBEE_persist_save: no persistence data to save !");
+        return false;
+    }
+
+    if (len > ST_PERSIST_MAX_ALLOC_SZ)
+    {
+        /* if persistence length to big to store */
+        APP_DBG("APP_ZIGBEE_persist_save: persist size too large for storage (%d)", len);
+        return false;
+    }
+
+    /* Store in cache the persistent data */
+    len = ZbPersistGet(zigbee_app_info.zb, &cache_persistent_data.U8_data[ST_PERSIST_FLASH_DATA_OFFSET], len);
+
+    /* Store in cache the persistent data length */
+    cache_persistent_data.U32_data[0] = len;
+
+    /* Store in cache the persistent verification Tag */
+    cache_persistent_data.U32_data[1] = ST_PERSIST_TAG;
+
+#ifdef OTA_DISPLAY_TIMING
+    // -- Compare with previous --
+    if ( memcmp( szPersistentDataTemp.U8_data, cache_persistent_data.U8_data, ( len + 8 ) ) == 0 )
+      { APP_DBG("APP_ZIGBEE_persist_save: This Persistence is same as previous"); }
+    memcpy( szPersistentDataTemp.U8_data, cache_persistent_data.U8_data, (len + 8 ) );
+#endif // OTA_DISPLAY_TIMING
+
+    zigbee_app_info.persistNumWrites++;
+    APP_DBG("APP_ZIGBEE_persist_save: Persistence written in cache RAM (num writes = %d) len=%d",
+             zigbee_app_info.persistNumWrites, cache_persistent_data.U32_data[0]);
+
+#ifdef CFG_NVM
+    if(!APP_ZIGBEE_NVM_Write())
+    {
+      return false;
+    }
+    APP_DBG("APP_ZIGBEE_persist_save: Persistent data FLASHED");
+#endif /* CFG_NVM */
+
+    return true;
+} /* APP_ZIGBEE_persist_save */
+
+
+/**
+ * @brief  Delete persistent data
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_persist_delete(void)
+{
+  /* Clear RAM cache */
+  memset(cache_persistent_data.U8_data, 0x00, ST_PERSIST_MAX_ALLOC_BUFFER_SZ);
+  APP_DBG("Persistent Data RAM cache cleared");
+#ifdef CFG_NVM
+  APP_DBG("FLASH ERASED");
+  APP_ZIGBEE_NVM_Erase();
+#endif /* CFG_NVM */
+
+  // -- Reset Chip --
+  *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_OTA_FW;
+  NVIC_SystemReset();
+} /* APP_ZIGBEE_persist_delete */
+
+
+#ifdef CFG_NVM
+
+/**
+ * @brief  Init the NVM
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_NVM_Init(void)
+{
+  int eeprom_init_status;
+
+  APP_DBG("Flash starting address = %x",HW_FLASH_ADDRESS  + CFG_NVM_BASE_ADDRESS);
+  eeprom_init_status = EE_Init( 0 , HW_FLASH_ADDRESS + CFG_NVM_BASE_ADDRESS );
+
+  if (eeprom_init_status != EE_OK)
+  {
+    /* format NVM since init failed, e.g. first startup after the EE emulation
+       shrank to CFG_NB_OF_PAGE pages : the OTA resume context is lost */
+    APP_DBG("EE_init failed (%d) : formatting, OTA resume context lost", eeprom_init_status);
+    eeprom_init_status= EE_Init( 1, HW_FLASH_ADDRESS + CFG_NVM_BASE_ADDRESS );
+  }
+  APP_DBG("EE_init status = %d",eeprom_init_status);
+
+  /* Warm reset : the store index is taken from the RAM cache seal */
+  persistRamSealed = APP_ZIGBEE_NVM_SealCheck();
+  if ( !persistRamSealed )
+  {
+    APP_ZIGBEE_NVM_Scan();
+  }
+} /* APP_ZIGBEE_NVM_Init */
+
+/**
+ * @brief  Sealing the persistent data RAM cache once it matches the NVM
+ * @param  num_words: cache size in words
+ * @retval None
+ */
+static void APP_ZIGBEE_NVM_Seal(uint32_t num_words)
+{
+  persistRamSeal.magic = PERSIST_RAM_SEAL_MAGIC;
+  persistRamSeal.sequence = persistStoreSequence;
+  persistRamSeal.snapshot = persistStoreSnapshot;
+  persistRamSeal.record = persistStoreRecord;
+  persistRamSeal.deltas = persistStoreDeltas;
+  persistRamSeal.free = persistStoreFree;
+  persistRamSeal.num_words = num_words;
+  persistRamSeal.data_crc = APP_ZIGBEE_NVM_Crc32(0, cache_persistent_data.U8_data, num_words * 4u);
+  persistRamSeal.crc = APP_ZIGBEE_NVM_Crc32(0, (const uint8_t *)&persistRamSeal, offsetof(APP_ZIGBEE_PersistSeal_t, crc));
+} /* APP_ZIGBEE_NVM_Seal */
+
+/**
+ * @brief  Breaking the seal of the persistent data RAM cache
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_NVM_Unseal(void)
+{
+  persistRamSeal.magic = 0u;
+  persistRamSealed = false;
+} /* APP_ZIGBEE_NVM_Unseal */
+
+/**
+ * @brief  Checking the seal of the persistent data RAM cache after a reset : the seal
+ *         is intact and its generation is still the last record of the persistence store
+ *         (no record appended after it nor in the next page). The store index is then
+ *         taken from the seal, the cache itself is checked by APP_ZIGBEE_NVM_Read.
+ * @param  None
+ * @retval true if the seal is valid
+ */
+static bool APP_ZIGBEE_NVM_SealCheck(void)
+{
+  const APP_ZIGBEE_PersistRecord_t *p_record = (const APP_ZIGBEE_PersistRecord_t *)persistRamSeal.record;
+  const APP_ZIGBEE_PersistRecord_t *p_next;
+  uint32_t end;
+
+  if ( ( persistRamSeal.magic != PERSIST_RAM_SEAL_MAGIC )
+       || ( APP_ZIGBEE_NVM_Crc32(0, (const uint8_t *)&persistRamSeal, offsetof(APP_ZIGBEE_PersistSeal_t, crc)) != persistRamSeal.crc )
+       || ( persistRamSeal.record < PERSIST_STORE_ADDRESS )
+       || ( persistRamSeal.record >= ( PERSIST_STORE_ADDRESS + CFG_PERSIST_STORE_NB_PAGES * FLASH_PAGE_SIZE ) ) )
+  {
+    return false;
+  }
 
+  end = PERSIST_STORE_PAGE_END(persistRamSeal.record);
+  p_next = (const APP_ZIGBEE_PersistRecord_t *)( PERSIST_STORE_ADDRESS
+                                                 + ( ( PERSIST_STORE_PAGE(persistRamSeal.record) + 1u ) % CFG_PERSIST_STORE_NB_PAGES ) * FLASH_PAGE_SIZE );
+  if ( ( APP_ZIGBEE_NVM_RecordSize(persistRamSeal.record, end) == 0u ) || ( p_record->sequence != persistRamSeal.sequence )
+       || ( ( persistRamSeal.free != 0u ) && ( *(const uint32_t *)persistRamSeal.free != 0xFFFFFFFFu ) )
+       || ( ( ( p_next->magic == ST_PERSIST_RECORD_MAGIC ) || ( p_next->magic == ST_PERSIST_DELTA_MAGIC ) )
+            && ( p_next->sequence > persistRamSeal.sequence ) ) )
+  {
+    return false;
+  }
 
-  return APP_ZIGBEE_OK;
-}
+  persistStoreSequence = persistRamSeal.sequence;
+  persistStoreSnapshot = persistRamSeal.snapshot;
+  persistStoreRecord = persistRamSeal.record;
+  persistStoreDeltas = persistRamSeal.deltas;
+  persistStoreFree = persistRamSeal.free;
+  persistShadowWords = 0;
+  APP_DBG("Persistence store : RAM cache sealed at sequence %d", persistStoreSequence);
+  return true;
+} /* APP_ZIGBEE_NVM_SealCheck */
 
 /**
- * @brief  Getting flash first secure sector helper
+ * @brief  Scanning the persistence store pages once for the last valid snapshot,
+ *         the delta records following it and the address the next record is appended at
  * @param  None
- * @retval First flash secure sector
+ * @retval None
  */
-static inline uint32_t GetFirstSecureSector(void)
+static void APP_ZIGBEE_NVM_Scan(void)
 {
-  uint32_t first_secure_sector_idx, sfsa_field, sbrv_field, sbrv_field_sector;
-
-  /* Read SFSA */
-  sfsa_field = (READ_BIT(FLASH->SFR, FLASH_SFR_SFSA) >> FLASH_SFR_SFSA_Pos);
-  APP_DBG("SFSA OB = 0x%x", sfsa_field);
-  APP_DBG("SFSA Option Bytes set to sector = 0x%x (0x080%x)", sfsa_field, sfsa_field*4096);
+  const APP_ZIGBEE_PersistRecord_t *p_record;
+  uint32_t  page;
+  uint32_t  address;
+  uint32_t  end;
+  uint32_t  size;
+  uint32_t  free_address[CFG_PERSIST_STORE_NB_PAGES];
+#ifdef OTA_DISPLAY_TIMING
+  uint32_t  lStartTime = HAL_GetTick();
+#endif // OTA_DISPLAY_TIMING
 
-  /* Read SBRV */
-  /* Contains the word aligned CPU2 boot reset start address offset within the selected memory area by C2OPT. */
-  sbrv_field = (READ_BIT(FLASH->SRRVR, FLASH_SRRVR_SBRV) >> FLASH_SRRVR_SBRV_Pos);
-  APP_DBG("SBRV OB = 0x%x", sbrv_field);
-  /* Divide sbrv_field by 1024 to be compared to SFSA value */
-  sbrv_field_sector = sbrv_field / 1024;
-  APP_DBG("SBRV Option Bytes set to sector = 0x%x (0x080%x)", sbrv_field_sector, sbrv_field*4);
+  persistStoreSnapshot = 0;
+  persistStoreRecord = 0;
+  persistStoreDeltas = 0;
+  persistStoreSequence = 0;
+  persistStoreFree = 0;
+  persistShadowWords = 0;
 
-  /* If SBRV is below SFSA then set first_secure_sector_idx to SBRV */
-  if (sbrv_field_sector < sfsa_field)
+  for ( page = 0; page < CFG_PERSIST_STORE_NB_PAGES; page++ )
   {
-    first_secure_sector_idx = sbrv_field_sector;
+    address = PERSIST_STORE_ADDRESS + page * FLASH_PAGE_SIZE;
+    end = address + FLASH_PAGE_SIZE;
+    while ( ( size = APP_ZIGBEE_NVM_RecordSize(address, end) ) != 0u )
+    {
+      /* A record torn by a reset has a bad CRC and is skipped */
+      p_record = (const APP_ZIGBEE_PersistRecord_t *)address;
+      if ( ( p_record->magic == ST_PERSIST_RECORD_MAGIC )
+           && ( ( persistStoreSnapshot == 0u ) || ( p_record->sequence > persistStoreSequence ) )
+           && ( APP_ZIGBEE_NVM_Crc32(0, (const uint8_t *)( address + sizeof(APP_ZIGBEE_PersistRecord_t) ), p_record->size) == p_record->crc ) )
+      {
+        persistStoreSnapshot = address;
+        persistStoreSequence = p_record->sequence;
+      }
+      address += size;
+    }
+    /* Appending is only possible on erased flash */
+    free_address[page] = ( ( address < end ) && ( *(const uint32_t *)address == 0xFFFFFFFFu ) ) ? address : 0u;
   }
-  else
+
+  if ( persistStoreSnapshot != 0u )
   {
-    first_secure_sector_idx = sfsa_field;
+    /* Delta records of the snapshot, always in the same page */
+    end = PERSIST_STORE_PAGE_END(persistStoreSnapshot);
+    persistStoreRecord = persistStoreSnapshot;
+    while ( ( address = APP_ZIGBEE_NVM_NextDelta(persistStoreRecord + APP_ZIGBEE_NVM_RecordSize(persistStoreRecord, end),
+                                                 end, persistStoreSequence + 1u) ) != 0u )
+    {
+      persistStoreRecord = address;
+      persistStoreSequence++;
+      persistStoreDeltas++;
+    }
+    persistStoreFree = free_address[PERSIST_STORE_PAGE(persistStoreSnapshot)];
   }
 
-  APP_DBG("first_secure_sector_idx = 0x%x", first_secure_sector_idx);
-
-  return first_secure_sector_idx;
-}
+#ifdef OTA_DISPLAY_TIMING
+  APP_DBG("Persistence store scanned in %d ms", HAL_GetTick() - lStartTime);
+#endif // OTA_DISPLAY_TIMING
+  APP_DBG("Persistence store : snapshot 0x%08X + %d deltas (sequence %d)", persistStoreSnapshot, persistStoreDeltas, persistStoreSequence);
+} /* APP_ZIGBEE_NVM_Scan */
 
 /**
- * @brief  Deleting non secure sectors helper
+ * @brief  NVM maintenance, background task, one flash step per run, postponed while an image transfer is running :
+ *         - the EE is cleaned when EE_Write asked for it or when much of it was written since
+ *           the last cleanup, rather than inside a write
+ *         - the persistence store page following the one in use only holds stale records,
+ *           it is erased ahead so that the next snapshot does not wait for an erase
  * @param  None
  * @retval None
  */
-static inline void Delete_Sectors( void )
+static void APP_ZIGBEE_NVM_Gc(void)
 {
-  /**
-   * The number of sectors to erase is read from SRAM1.
-   * It shall be checked whether the number of sectors to erase does not overlap on the secured Flash
-   * The limit can be read from the SFSA option byte which provides the first secured sector address.
-   */
-
-  uint32_t page_error;
-  FLASH_EraseInitTypeDef p_erase_init;
-  uint32_t first_secure_sector_idx;
-
-  first_secure_sector_idx = GetFirstSecureSector();
+  uint32_t page;
 
-  p_erase_init.TypeErase = FLASH_TYPEERASE_PAGES;
-  p_erase_init.Page = *((uint8_t*) SRAM1_BASE + 1);
-  if(p_erase_init.Page < (CFG_APP_START_SECTOR_INDEX - 1))
+  if ( ( OTA_client_info.OTA_state == DOWNLOADING_IMAGE ) && ( ( OTA_client_info.flags & OTA_CLIENT_PAUSE_DOWNLOAD_FLAG ) == 0u ) )
   {
-    /**
-     * Something has been wrong as there is no case we should delete the OTA application
-     * Reboot on the firmware application
-     */
-    *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_DOWNLOADED_FW;
-    NVIC_SystemReset();
+    nvmStats.ee_cleanups_deferred++;
+    HW_TS_Start(TS_PERSIST_GC, (uint32_t)NVM_GC_RETRY_DELAY);
+    return;
   }
-  p_erase_init.NbPages = *((uint8_t*) SRAM1_BASE + 2);
 
-  if ((p_erase_init.Page + p_erase_init.NbPages) > first_secure_sector_idx)
+  nvmStats.ee_fill = ( eeWritesSinceClean * 8u * 100u ) / CFG_EE_BANK0_SIZE;
+  if ( eeCleanPending || ( nvmStats.ee_fill >= NVM_EE_CLEAN_FILL ) )
   {
-    p_erase_init.NbPages = first_secure_sector_idx - p_erase_init.Page;
+    APP_DBG("EE cleanup (%s, %d%% written)", eeCleanPending ? "requested" : "preemptive", nvmStats.ee_fill);
+    EE_Clean(eeCleanPending ? 0 : 1, 0);
+    eeCleanPending = false;
+    eeWritesSinceClean = 0;
+    nvmStats.ee_fill = 0;
+    nvmStats.ee_cleanups++;
+
+    /* One flash step per run : the store page is checked next time */
+    if ( persistStoreRecord != 0u )
+    {
+      APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_PERSIST_GC, CFG_SCH_CLASS_BACKGROUND);
+    }
+    return;
   }
 
-  APP_DBG("Erase FLASH Memory from sector %d (0x080%x) to sector %d (0x080%x)", p_erase_init.Page, p_erase_init.Page*4096, p_erase_init.NbPages+p_erase_init.Page, (p_erase_init.NbPages+p_erase_init.Page)*4096);
-
-  HAL_FLASH_Unlock();
-
-  HAL_FLASHEx_Erase(&p_erase_init, &page_error);
-
-  HAL_FLASH_Lock();
+  if ( persistStoreRecord == 0u )
+  {
+    return;
+  }
 
-  return;
-}
+  page = ( PERSIST_STORE_PAGE(persistStoreRecord) + 1u ) % CFG_PERSIST_STORE_NB_PAGES;
+  if ( !APP_ZIGBEE_NVM_PageErased(page) )
+  {
+    APP_DBG("Persistence store : erasing stale page %d", page);
+    APP_ZIGBEE_OTA_Client_ErasePages(CFG_PERSIST_STORE_SECTOR_INDEX + page, 1);
+    nvmStats.store_erases++;
+  }
+} /* APP_ZIGBEE_NVM_Gc */
 
 /**
- * @brief  Getting available internal flash space size
+ * @brief  NVM maintenance retry timer callback (interrupt context)
  * @param  None
- * @retval Application status code
+ * @retval None
  */
-static inline APP_ZIGBEE_StatusTypeDef APP_ZIGBEE_CheckDeviceCapabilities(void)
+static void APP_ZIGBEE_NVM_GcTimer_cb(void)
 {
-  APP_ZIGBEE_StatusTypeDef status = APP_ZIGBEE_OK;
-
-  /* Get Flash memory size available to copy binary from Server */
-  uint32_t first_sector_idx;
-  uint32_t first_secure_sector_idx;
-  uint32_t free_sectors;
-  uint32_t free_size;
-
-  APP_DBG("Check Device capabilities");
+  APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_PERSIST_GC, CFG_SCH_CLASS_BACKGROUND);
+} /* APP_ZIGBEE_NVM_GcTimer_cb */
 
-  first_secure_sector_idx = GetFirstSecureSector();
+/**
+ * @brief  Writing an EE variable, the cleanup it may ask for is left to APP_ZIGBEE_NVM_Gc
+ * @param  address: EE variable address
+ * @param  data: value
+ * @retval EE status
+ */
+static int APP_ZIGBEE_NVM_EeWrite(uint16_t address, uint32_t data)
+{
+  int ee_status;
 
-  first_sector_idx = *((uint8_t*) SRAM1_BASE + 1);
-  if (first_sector_idx == 0)
+  ee_status = EE_Write(0, address, data);
+  if ( ( ee_status != EE_OK ) && ( ee_status != EE_CLEAN_NEEDED ) )
   {
-    APP_DBG("ERROR : SRAM1_BASE + 1 == 0");
-    first_sector_idx = CFG_APP_START_SECTOR_INDEX;
+    /* No room left : last resort cleanup, even during a transfer */
+    APP_DBG("EE write failed (%d), CLEANING", ee_status);
+    EE_Clean(1, 0);
+    eeCleanPending = false;
+    eeWritesSinceClean = 0;
+    nvmStats.ee_cleanups++;
+    ee_status = EE_Write(0, address, data);
   }
-  APP_DBG("First available sector = %d (0x080%x)", first_sector_idx, first_sector_idx*4096);
-
-  free_sectors = first_secure_sector_idx - first_sector_idx;
-  free_size = free_sectors*4096;
-
-  APP_DBG("free_sectors = %d , -> %d bytes of FLASH Free", free_sectors, free_size);
-
-  APP_DBG("Server requests    : %d bytes", OTA_client_info.requested_image_size);
-  APP_DBG("Client Free memory : %d bytes", free_size);
 
-  if (free_size < OTA_client_info.requested_image_size)
+  if ( ee_status == EE_CLEAN_NEEDED )
   {
-    status = APP_ZIGBEE_ERROR;
-    APP_DBG("WARNING: Not enough Free Flash Memory available to download binary from Server!");
+    /* The value itself was written */
+    eeCleanPending = true;
+    APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_PERSIST_GC, CFG_SCH_CLASS_BACKGROUND);
+    ee_status = EE_OK;
   }
-  else
+  if ( ee_status == EE_OK )
   {
-    APP_DBG("Device contains enough Flash Memory to download binary");
+    nvmStats.ee_writes++;
+    eeWritesSinceClean++;
   }
 
-  return status;
-}
+  return ee_status;
+} /* APP_ZIGBEE_NVM_EeWrite */
 
 /**
- * @brief Task responsible for the reset at the end of OTA transfer.
- * @param  None
+ * @brief  NVM statistics
+ * @param  p_stats: statistics
  * @retval None
  */
-static void APP_ZIGBEE_PerformReset(void)
+void APP_ZIGBEE_NVM_GetStats(APP_ZIGBEE_NvmStats_t *p_stats)
 {
-  OTA_client_info.OTA_state = REBOOTING;
-  APP_DBG("*******************************************************");
-  APP_DBG(" FUOTA_CLIENT : END OF TRANSFER COMPLETED");
-
-  if (OTA_client_info.image_type == fileType_APP)
-  {
-    APP_DBG("  --> Request to reboot on FW Application");
-    APP_DBG("*******************************************************");
+  nvmStats.ee_fill = ( eeWritesSinceClean * 8u * 100u ) / CFG_EE_BANK0_SIZE;
+  nvmStats.store_sequence = persistStoreSequence;
+  *p_stats = nvmStats;
+} /* APP_ZIGBEE_NVM_GetStats */
 
-    /* Reboot on Downloaded FW Application */
-    *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_DOWNLOADED_FW;
+/**
+ * @brief  Checking if a persistence store page is erased
+ * @param  page: page index in the store
+ * @retval true if erased
+ */
+static bool APP_ZIGBEE_NVM_PageErased(uint32_t page)
+{
+  const uint32_t *p_word = (const uint32_t *)( PERSIST_STORE_ADDRESS + page * FLASH_PAGE_SIZE );
+  uint32_t index;
 
-    HAL_Delay(100);
-    NVIC_SystemReset();
-  }
-  else
+  for ( index = 0; index < ( FLASH_PAGE_SIZE / 4u ); index++ )
   {
-    if (OTA_client_info.image_type == fileType_COPRO_WIRELESS)
-    {
-      APP_DBG("  --> Request to reboot on FUS");
-      APP_DBG("*******************************************************");
-      HAL_Delay(100);
-
-      /**
-       * Wireless firmware update is requested
-       * Request CPU2 to reboot on FUS by sending two FUS command
-       */
-      SHCI_C2_FUS_GetState( NULL );
-      SHCI_C2_FUS_GetState( NULL );
-      while(1)
-      {
-        HAL_PWR_EnterSLEEPMode(PWR_MAINREGULATOR_ON, PWR_SLEEPENTRY_WFI);
-      }
-    }
-    else
+    if ( p_word[index] != 0xFFFFFFFFu )
     {
-      APP_DBG("APP_ZIGBEE_PerformReset: OtaContext.file_type not recognized");
-      return;
+      return false;
     }
   }
-}
+
+  return true;
+} /* APP_ZIGBEE_NVM_PageErased */
 
 /**
- * @brief  Application timer server callback (led toggling)
- * @param  None
- * @retval None
+ * @brief  Checking the header of a persistence store record
+ * @param  address: record address
+ * @param  end: end of the page
+ * @retval record size with its header, 0 if there is no record (end of the records of the page)
  */
-static void APP_ZIGBEE_LEDToggle(void)
+static uint32_t APP_ZIGBEE_NVM_RecordSize(uint32_t address, uint32_t end)
 {
-  BSP_LED_Toggle(LED_GREEN);
-}
+  const APP_ZIGBEE_PersistRecord_t *p_record = (const APP_ZIGBEE_PersistRecord_t *)address;
+
+  if ( ( ( address + sizeof(APP_ZIGBEE_PersistRecord_t) ) > end )
+       || ( ( p_record->magic != ST_PERSIST_RECORD_MAGIC ) && ( p_record->magic != ST_PERSIST_DELTA_MAGIC ) )
+       || ( p_record->size == 0u ) || ( ( p_record->size % 8u ) != 0u ) || ( p_record->size > ST_PERSIST_MAX_ALLOC_BUFFER_SZ )
+       || ( p_record->size > ( end - address - sizeof(APP_ZIGBEE_PersistRecord_t) ) ) )
+  {
+    return 0u;
+  }
+
+  return sizeof(APP_ZIGBEE_PersistRecord_t) + p_record->size;
+} /* APP_ZIGBEE_NVM_RecordSize */
 
-/*************************************************************
- *
- * NVM FUNCTIONS
- *
- *************************************************************/
 /**
- * @brief  notify to save persistent data callback
- * @param  zb: Zigbee device object pointer, cbarg: callback arg pointer
- * @retval None
+ * @brief  Following a chain of records : next valid record, records torn by a reset
+ *         are skipped
+ * @param  address: address following the last record of the chain
+ * @param  end: end of the page
+ * @param  sequence: sequence number expected
+ * @retval address of the delta record with this sequence number, 0 at the end of the chain
  */
-static void APP_ZIGBEE_persist_notify_cb(struct ZigBeeT *zb, void *cbarg)
+static uint32_t APP_ZIGBEE_NVM_NextDelta(uint32_t address, uint32_t end, uint32_t sequence)
 {
-#ifdef OTA_DISPLAY_TIMING
-  static uint32_t lPersistentStartTime = 0;
-  uint32_t  lTime1, lTime2;
-
-  lTime1 = ( HAL_GetTick() - lPersistentStartTime );
-  lPersistentStartTime = HAL_GetTick();
-#endif // OTA_DISPLAY_TIMING
+  const APP_ZIGBEE_PersistRecord_t *p_record;
+  uint32_t size;
 
-  /* Save the persistent data */
-  APP_DBG("Notification to save persistent data requested from stack.");
-  APP_ZIGBEE_persist_save();
+  while ( ( size = APP_ZIGBEE_NVM_RecordSize(address, end) ) != 0u )
+  {
+    p_record = (const APP_ZIGBEE_PersistRecord_t *)address;
+    if ( APP_ZIGBEE_NVM_Crc32(0, (const uint8_t *)( address + sizeof(APP_ZIGBEE_PersistRecord_t) ), p_record->size) == p_record->crc )
+    {
+      return ( ( p_record->magic == ST_PERSIST_DELTA_MAGIC ) && ( p_record->sequence == sequence ) ) ? address : 0u;
+    }
+    address += size;
+  }
 
-#ifdef OTA_DISPLAY_TIMING
-  lTime2 = ( HAL_GetTick() - lPersistentStartTime );
-  lPersistentStartTime = HAL_GetTick();
-  APP_DBG("Persistent Data: Interval Time : %d ms and Save Time : %d ms", lTime1, lTime2);
-#endif // OTA_DISPLAY_TIMING
-}
+  return 0u;
+} /* APP_ZIGBEE_NVM_NextDelta */
 
 /**
- * @brief  Start Zigbee Network from persistent data
- * @param  zb: Zigbee device object pointer
- * @retval Zigbee stack Status code
- */
-static enum ZbStatusCodeT APP_ZIGBEE_ZbStartupPersist(struct ZigBeeT* zb)
+*@brief  Read the persistent data from NVM
+*        The snapshot found by APP_ZIGBEE_NVM_Scan is copied at once, packed data
+*        (ST_PERSIST_TAG_PACKED) is unpacked and checked against its CRC, then the
+*        delta records following it are applied.
+* @param  None
+* @retval true if success , false if failed
+*/
+static bool APP_ZIGBEE_NVM_Read(void)
 {
-   bool read_status;
-   enum ZbStatusCodeT status = ZB_STATUS_SUCCESS;
+  const APP_ZIGBEE_PersistRecord_t *p_record = (const APP_ZIGBEE_PersistRecord_t *)persistStoreSnapshot;
+  uint32_t  num_bytes;
+  uint32_t  num_words = 0;
+  uint32_t  address;
+  uint32_t  end;
+  uint32_t  index;
+  bool      status = true;
+  uint32_t  *p_image = cache_nvm_image.U32_data;
 
-   /* Restore persistence */
-   read_status = APP_ZIGBEE_persist_load();
+  persistShadowWords = 0;
+  if ( persistRamSealed )
+  {
+    persistRamSealed = false;
+    num_words = persistRamSeal.num_words;
+    if ( ( ( num_words * 4u ) <= ST_PERSIST_MAX_ALLOC_BUFFER_SZ )
+         && ( APP_ZIGBEE_NVM_Crc32(0, cache_persistent_data.U8_data, num_words * 4u) == persistRamSeal.data_crc ) )
+    {
+      memcpy(cache_diag_reference.U32_data, cache_persistent_data.U32_data, num_words * 4u);
+      persistShadowWords = num_words;
+      APP_DBG("READ PERSISTENT DATA LEN = %d (RAM cache, sequence %d)", cache_persistent_data.U32_data[0], persistStoreSequence);
+      return true;
+    }
+    /* Cache altered : back to the NVM */
+    APP_DBG("Persistent data RAM cache corrupted, reading NVM");
+    APP_ZIGBEE_NVM_Unseal();
+    APP_ZIGBEE_NVM_Scan();
+    p_record = (const APP_ZIGBEE_PersistRecord_t *)persistStoreSnapshot;
+  }
 
-   if (read_status)
-   {
-       /* Make sure the EPID is cleared, before we are allowed to restore persistence */
-       uint64_t epid = 0U;
-       ZbNwkSet(zb, ZB_NWK_NIB_ID_ExtendedPanId, &epid, sizeof(uint64_t));
+  if ( p_record == NULL )
+  {
+    APP_DBG("Read -> no persistent data record in FLASH - Read Stopped");
+    return false;
+  }
 
-       /* Start-up from persistence */
-       APP_DBG("APP_ZIGBEE_ZbStartupPersist: restoring stack persistence");
-       status = ZbStartupPersist(zb, &cache_persistent_data.U8_data[ST_PERSIST_FLASH_DATA_OFFSET], cache_persistent_data.U32_data[0],NULL, NULL, NULL);
-       if (status == ZB_STATUS_SUCCESS)
-       {
-         bPersistDataUsed = TRUE;
-       }
-   }
-   else
-   {
-       /* Failed to restart from persistence */
-       APP_DBG("APP_ZIGBEE_ZbStartupPersist: no persistence data to restore");
-       status = ZB_STATUS_ALLOC_FAIL;
-   }
+  /* Length, Verification Tag then data, packed or not, U32 aligned */
+  memcpy(p_image, (const uint8_t *)( persistStoreSnapshot + sizeof(APP_ZIGBEE_PersistRecord_t) ), p_record->size);
+
+  /* Check length is not too big nor zero */
+  num_bytes = p_image[0];
+  if ( ( num_bytes == 0 ) || ( num_bytes > ST_PERSIST_MAX_ALLOC_SZ ) )
+  {
+    APP_DBG("No data or too large length : %d", num_bytes);
+    status = false;
+  }
+  else if ( p_image[1] == ST_PERSIST_TAG_PACKED )
+  {
+    if ( ( p_image[2] >= num_bytes ) || ( ( 16u + p_image[2] ) > p_record->size )
+         || ( APP_ZIGBEE_NVM_Unpack(&cache_nvm_image.U8_data[16], p_image[2], &cache_persistent_data.U8_data[ST_PERSIST_FLASH_DATA_OFFSET], num_bytes) != num_bytes )
+         || ( APP_ZIGBEE_NVM_Crc32(0, &cache_persistent_data.U8_data[ST_PERSIST_FLASH_DATA_OFFSET], num_bytes) != p_image[3] ) )
+    {
+      APP_DBG("Corrupted packed persistent data");
+      status = false;
+    }
+    cache_persistent_data.U32_data[0] = num_bytes;
+    cache_persistent_data.U32_data[1] = ST_PERSIST_TAG;
+  }
+  else if ( ( ST_PERSIST_FLASH_DATA_OFFSET + num_bytes ) > p_record->size )
+  {
+    APP_DBG("Truncated persistent data : %d", num_bytes);
+    status = false;
+  }
+  else
+  {
+    memcpy(cache_persistent_data.U32_data, p_image, p_record->size);
+  }
 
-   /* Only for debug purpose, depending of persistent data, following traces
-      could display bytes that are irrelevants to on off cluster */
-   if (status == ZB_STATUS_SUCCESS)
-   {
-      /* read the last bytes of data where the ZCL on off persistent data shall be*/
-      uint32_t len = cache_persistent_data.U32_data[0] + 4 ;
-      APP_DBG("ClusterID %02x %02x",cache_persistent_data.U8_data[len-9],cache_persistent_data.U8_data[len-10]);
-      APP_DBG("Endpoint %02x %02x",cache_persistent_data.U8_data[len-7],cache_persistent_data.U8_data[len-8]);
-      APP_DBG("Direction %02x",cache_persistent_data.U8_data[len-6]);
-      APP_DBG("AttrID %02x %02x",cache_persistent_data.U8_data[len-4],cache_persistent_data.U8_data[len-5]);
-      APP_DBG("Len %02x %02x",cache_persistent_data.U8_data[len-2],cache_persistent_data.U8_data[len-3]);
-      APP_DBG("Value %02x",cache_persistent_data.U8_data[len-1]);
-   }
+  if (status)
+  {
+    /* Length, Tag and data, U32 aligned and completed to double words with zeros as when saved */
+    num_words = ( ( ( ST_PERSIST_FLASH_DATA_OFFSET + num_bytes ) + 7u ) / 8u ) * 2u;
+    memset(&cache_persistent_data.U8_data[ST_PERSIST_FLASH_DATA_OFFSET + num_bytes], 0, ( num_words * 4u ) - ST_PERSIST_FLASH_DATA_OFFSET - num_bytes);
 
-   return status;
-}/* APP_ZIGBEE_ZbStartupPersist */
+    address = persistStoreSnapshot;
+    end = PERSIST_STORE_PAGE_END(persistStoreSnapshot);
+    for ( index = 1; ( index <= persistStoreDeltas ) && status; index++ )
+    {
+      address = APP_ZIGBEE_NVM_NextDelta(address + APP_ZIGBEE_NVM_RecordSize(address, end), end, p_record->sequence + index);
+      status = APP_ZIGBEE_NVM_ApplyDelta(address, &num_words);
+    }
+  }
 
-/**
- * @brief  timer callback to wait end of restore cluster persistence form M0
- * @param  None
- * @retval None
- */
-static void APP_ZIGBEE_PersistCompleted_callback(void)
-{
-  /* No cluster attributes to restore */
-}/* APP_ZIGBEE_PersistCompleted_callback */
+  if(status)
+  {
+    /* Reference for the next delta records */
+    memcpy(cache_diag_reference.U32_data, cache_persistent_data.U32_data, num_words * 4u);
+    persistShadowWords = num_words;
+    APP_ZIGBEE_NVM_Seal(num_words);
+    APP_DBG("READ PERSISTENT DATA LEN = %d (snapshot %d + %d deltas)", cache_persistent_data.U32_data[0], p_record->sequence, persistStoreDeltas);
+  }
 
+  return status;
+} /* APP_ZIGBEE_NVM_Read */
 
 /**
- * @brief  save OTA ctx persistent data
- * @param  None
- * @retval true if success, false if fail
+ * @brief  Applying a delta record to the persistent data cache
+ * @param  address: delta record address
+ * @param  p_num_words: persistent data size in words, updated
+ * @retval true if success , false if the record is corrupted
  */
-static bool APP_ZIGBEE_OTA_ctx_save_nvm (struct Zigbee_OTA_client_info* client_info) {
+static bool APP_ZIGBEE_NVM_ApplyDelta(uint32_t address, uint32_t *p_num_words)
+{
+  const APP_ZIGBEE_PersistRecord_t *p_record = (const APP_ZIGBEE_PersistRecord_t *)address;
+  const uint32_t *p_data = (const uint32_t *)( address + sizeof(APP_ZIGBEE_PersistRecord_t) );
+  uint32_t size_words;
+  uint32_t num_words;
+  uint32_t pos = 2u;
+  uint32_t index;
+  uint32_t count;
+
+  if ( p_record == NULL )
+  {
+    APP_DBG("Missing persistent data delta");
+    return false;
+  }
 
-  int ee_status = 0;
-  uint32_t*  p_data;
-  /* Populate data struct */
-  client_info->zigbee_ota_ctx_nvm.flash_offset = client_info->write_info.flash_current_offset;
-  client_info->zigbee_ota_ctx_nvm.previous_image_type = client_info->ctx.file_type;
-  client_info->zigbee_ota_ctx_nvm.file_version = client_info->ctx.file_version;
-  client_info->zigbee_ota_ctx_nvm.OtaCurrentState= client_info->OTA_state;
+  size_words = p_record->size / 4u;
+  num_words = p_data[0];
+  if ( ( ( num_words % 2u ) != 0u ) || ( ( num_words * 4u ) > ST_PERSIST_MAX_ALLOC_BUFFER_SZ ) )
+  {
+    APP_DBG("Bad persistent data delta size : %d", num_words);
+    return false;
+  }
 
-  p_data = (uint32_t *)&client_info->zigbee_ota_ctx_nvm.flash_offset;
- /* loop i = number of uint32_t in zigbee_ota_ctx_nvm*/ 
-  for(uint8_t i =0; i< (sizeof(client_info->zigbee_ota_ctx_nvm)/sizeof(uint32_t));i++)
+  while ( pos < size_words )
   {
-    ee_status = EE_Write(0, USER_DB_START_ADDR+i, *(p_data+i));
-    if (ee_status != EE_OK)
+    /* Run of changed double words : index, count, then the double words */
+    index = p_data[pos];
+    count = p_data[pos + 1u];
+    pos += 2u;
+    if ( ( ( ( index + count ) * 2u ) > num_words ) || ( ( pos + ( count * 2u ) ) > size_words ) )
     {
-      if (ee_status == EE_CLEAN_NEEDED) /* Shall not be there if CFG_EE_AUTO_CLEAN = 1*/
-      {
-        APP_DBG("CLEAN NEEDED, CLEANING");
-        EE_Clean(0,0);
-      }
-      else
-      {
-        /* Failed to write , an Erase shall be done */
-        APP_DBG("APP_ZIGBEE_NVM_Write failed @ %d status %d", i, ee_status);
-        return false;
-      }
+      APP_DBG("Corrupted persistent data delta");
+      return false;
     }
+    memcpy(&cache_persistent_data.U32_data[index * 2u], &p_data[pos], count * 8u);
+    pos += count * 2u;
   }
 
-
+  *p_num_words = num_words;
   return true;
+} /* APP_ZIGBEE_NVM_ApplyDelta */
 
-}
 
 /**
- * @brief  load OTA ctx persistent data
+ * @brief  Write the persistent data in NVM
+ *         A delta record against the last stored data is appended when it is small
+ *         enough and fits in the page, a snapshot record otherwise.
  * @param  None
- * @retval true if success, false if fail
+ * @retval None
  */
-static bool APP_ZIGBEE_OTA_ctx_load_nvm () {
-  bool status = true;
-  int ee_status = 0;
-  uint32_t*  p_data;
+static bool APP_ZIGBEE_NVM_Write(void)
+{
+  uint32_t len = cache_persistent_data.U32_data[0];
+  uint32_t num_words;
+  uint32_t size;
+  uint32_t crc;
 
-  HAL_FLASH_Unlock();
-  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_PGSERR | FLASH_FLAG_WRPERR | FLASH_FLAG_OPTVERR);
+  /* Length, Tag and data, completed to double words (the cache is cleared before saving) */
+  num_words = ( ( ( ST_PERSIST_FLASH_DATA_OFFSET + len ) + 7u ) / 8u ) * 2u;
 
-  /* Searching for previous OTA CTX */
-  p_data = (uint32_t *)&OTA_client_info.zigbee_ota_ctx_nvm.flash_offset;
-  for(uint8_t i =0; i< (sizeof(OTA_client_info.zigbee_ota_ctx_nvm)/sizeof(uint32_t));i++)
+  if ( ( num_words == persistShadowWords ) && ( memcmp(cache_diag_reference.U32_data, cache_persistent_data.U32_data, num_words * 4u) == 0 ) )
   {
-    ee_status = EE_Read(0, USER_DB_START_ADDR+i, p_data+i);
-    if (ee_status != EE_OK )
+    APP_DBG("PERSISTENT DATA UNCHANGED, not written");
+    APP_ZIGBEE_NVM_Seal(num_words);
+    return true;
+  }
+
+  if ( ( persistShadowWords != 0u ) && ( persistStoreFree != 0u ) && ( persistStoreDeltas < PERSIST_STORE_MAX_DELTAS ) )
+  {
+    size = APP_ZIGBEE_NVM_Delta(num_words, 0u, &crc);
+    if ( ( size <= ( ( num_words * 4u ) / 2u ) )
+         && ( ( persistStoreFree + sizeof(APP_ZIGBEE_PersistRecord_t) + size ) <= PERSIST_STORE_PAGE_END(persistStoreRecord) ) )
     {
-      APP_DBG("[OTA] ctx_load : Can't find previous OTA ctx file version in NVM !");
-      status = false;
-      return status;
+      return APP_ZIGBEE_NVM_WriteDelta(num_words, size, crc);
     }
   }
-  APP_DBG("[OTA] ctx_load : successfully loaded previous OTA ctx from NVM");
-  OTA_client_info.flags |= OTA_CLIENT_CTX_FOUND_FLAG;
-  OTA_client_info.write_info.flash_current_offset = OTA_client_info.zigbee_ota_ctx_nvm.flash_offset;
-  HAL_FLASH_Lock();
-  return status;
 
-}
+  return APP_ZIGBEE_NVM_WriteSnapshot(num_words);
+} /* APP_ZIGBEE_NVM_Write */
 
 /**
- * @brief  Load persistent data
- * @param  None
- * @retval true if success, false if fail
+ * @brief  Delta of the persistent data against the shadow of the NVM : the new size
+ *         in words, then each run of changed double words as its index and its length
+ *         (in double words) followed by the double words
+ * @param  num_words: persistent data size in words, even
+ * @param  address: flash address the delta is programmed at, 0 to only get its size and CRC
+ * @param  p_crc: CRC-32 of the delta
+ * @retval delta size in bytes, 0 if programming failed
  */
-static bool APP_ZIGBEE_persist_load(void)
+static uint32_t APP_ZIGBEE_NVM_Delta(uint32_t num_words, uint32_t address, uint32_t *p_crc)
 {
-#ifdef CFG_NVM
-    APP_DBG("Retrieving persistent data from FLASH");
-    if ( APP_ZIGBEE_NVM_Read() == false )
+  const uint32_t *p_new = cache_persistent_data.U32_data;
+  uint32_t nb_dw = num_words / 2u;
+  uint32_t header[2];
+  uint32_t size;
+  uint32_t crc;
+  uint32_t index = 0;
+  uint32_t count;
+
+  header[0] = num_words;
+  header[1] = 0u;
+  crc = APP_ZIGBEE_NVM_Crc32(0, (const uint8_t *)header, sizeof(header));
+  if ( ( address != 0u ) && ( APP_ZIGBEE_OTA_Client_FlashProgram(address, (const uint8_t *)header, sizeof(header)) != APP_ZIGBEE_OK ) )
+  {
+    return 0u;
+  }
+  size = sizeof(header);
+
+  while ( index < nb_dw )
+  {
+    if ( !APP_ZIGBEE_NVM_DwChanged(index) )
     {
-      return false;
+      index++;
+      continue;
     }
-#else /* CFG_NVM */
-    /* Check length range */
-    if ((cache_persistent_data.U32_data[0] == 0) ||
-        (cache_persistent_data.U32_data[0] > ST_PERSIST_MAX_ALLOC_SZ))
+    count = 1;
+    while ( ( ( index + count ) < nb_dw ) && APP_ZIGBEE_NVM_DwChanged(index + count) )
     {
-        APP_DBG("No data or too large length : %d",cache_persistent_data.U32_data[0]);
-        return false;
+      count++;
     }
-#endif /* CFG_NVM */
 
-    /* Verify Tag */
-    if ( cache_persistent_data.U32_data[1] != ST_PERSIST_TAG )
+    header[0] = index;
+    header[1] = count;
+    crc = APP_ZIGBEE_NVM_Crc32(crc, (const uint8_t *)header, sizeof(header));
+    crc = APP_ZIGBEE_NVM_Crc32(crc, (const uint8_t *)&p_new[2u * index], count * 8u);
+    if ( ( address != 0u )
+         && ( ( APP_ZIGBEE_OTA_Client_FlashProgram(address + size, (const uint8_t *)header, sizeof(header)) != APP_ZIGBEE_OK )
+              || ( APP_ZIGBEE_OTA_Client_FlashProgram(address + size + sizeof(header), (const uint8_t *)&p_new[2u * index], count * 8u) != APP_ZIGBEE_OK ) ) )
     {
-      APP_DBG("Bad Verification TAG in RAM : 0x%04X",cache_persistent_data.U32_data[1]);
-      return false;
+      return 0u;
     }
+    size += sizeof(header) + ( count * 8u );
+    index += count;
+  }
 
-    return true;
-} /* APP_ZIGBEE_persist_load */
-
+  *p_crc = crc;
+  return size;
+} /* APP_ZIGBEE_NVM_Delta */
 
 /**
- * @brief  Save persistent data
- * @param  None
- * @retval true if success , false if fail
+ * @brief  Comparing a double word of the persistent data with the shadow of the NVM
+ * @param  index: double word index
+ * @retval true if changed or beyond the shadow
  */
-static bool APP_ZIGBEE_persist_save(void)
+static bool APP_ZIGBEE_NVM_DwChanged(uint32_t index)
 {
-    uint32_t len;
-#ifdef OTA_DISPLAY_TIMING
-    static union cache  szPersistentDataTemp = { 0, };
-#endif // OTA_DISPLAY_TIMING
-
-    /* Clear the RAM cache before saving */
-    memset(cache_persistent_data.U8_data, 0x00, ST_PERSIST_MAX_ALLOC_BUFFER_SZ);
-
-    /* Call the satck API t get current persistent data */
-    len = ZbPersistGet(zigbee_app_info.zb, 0, 0);
-
-    /* Check Length range */
-    if (len == 0U)
-    {
-        /* If the persistence length was zero then no data available. */
-        APP_DBG("APP_ZIGBEE_persist_save: no persistence data to save !");
-        return false;
-    }
+  return ( ( 2u * index ) >= persistShadowWords )
+         || ( cache_persistent_data.U32_data[2u * index] != cache_diag_reference.U32_data[2u * index] )
+         || ( cache_persistent_data.U32_data[2u * index + 1u] != cache_diag_reference.U32_data[2u * index + 1u] );
+} /* APP_ZIGBEE_NVM_DwChanged */
 
-    if (len > ST_PERSIST_MAX_ALLOC_SZ)
-    {
-        /* if persistence length to big to store */
-        APP_DBG("APP_ZIGBEE_persist_save: persist size too large for storage (%d)", len);
-        return false;
-    }
+/**
+ * @brief  Appending a delta record after the last record
+ * @param  num_words: persistent data size in words, even
+ * @param  size: delta size in bytes
+ * @param  crc: delta CRC-32
+ * @retval true if success , false if failed
+ */
+static bool APP_ZIGBEE_NVM_WriteDelta(uint32_t num_words, uint32_t size, uint32_t crc)
+{
+  APP_ZIGBEE_PersistRecord_t record;
+  uint32_t address = persistStoreFree;
 
-    /* Store in cache the persistent data */
-    len = ZbPersistGet(zigbee_app_info.zb, &cache_persistent_data.U8_data[ST_PERSIST_FLASH_DATA_OFFSET], len);
+  record.magic = ST_PERSIST_DELTA_MAGIC;
+  record.size = size;
+  record.sequence = persistStoreSequence + 1u;
+  record.crc = crc;
 
-    /* Store in cache the persistent data length */
-    cache_persistent_data.U32_data[0] = len;
+  /* Header first : a record torn by a reset is skipped thanks to its size */
+  if ( ( APP_ZIGBEE_OTA_Client_FlashProgram(address, (const uint8_t *)&record, sizeof(record)) != APP_ZIGBEE_OK )
+       || ( APP_ZIGBEE_NVM_Delta(num_words, address + sizeof(record), &crc) != size ) )
+  {
+    /* Next write is a snapshot in the next page */
+    persistStoreFree = 0u;
+    APP_DBG("WRITE STOPPED, need a FLASH ERASE");
+    return false;
+  }
 
-    /* Store in cache the persistent verification Tag */
-    cache_persistent_data.U32_data[1] = ST_PERSIST_TAG;
+  persistStoreRecord = address;
+  persistStoreSequence = record.sequence;
+  persistStoreDeltas++;
+  persistStoreFree = address + sizeof(record) + size;
+  memcpy(cache_diag_reference.U32_data, cache_persistent_data.U32_data, num_words * 4u);
+  persistShadowWords = num_words;
+  APP_ZIGBEE_NVM_Seal(num_words);
 
-#ifdef OTA_DISPLAY_TIMING
-    // -- Compare with previous --
-    if ( memcmp( szPersistentDataTemp.U8_data, cache_persistent_data.U8_data, ( len + 8 ) ) == 0 )
-      { APP_DBG("APP_ZIGBEE_persist_save: This Persistence is same as previous"); }
-    memcpy( szPersistentDataTemp.U8_data, cache_persistent_data.U8_data, (len + 8 ) );
-#endif // OTA_DISPLAY_TIMING
+  APP_DBG("WRITTEN PERSISTENT DATA LEN = %d (delta %d at 0x%08X, %d bytes)", cache_persistent_data.U32_data[0], record.sequence, address, size);
+  return true;
+} /* APP_ZIGBEE_NVM_WriteDelta */
 
-    zigbee_app_info.persistNumWrites++;
-    APP_DBG("APP_ZIGBEE_persist_save: Persistence written in cache RAM (num writes = %d) len=%d",
-             zigbee_app_info.persistNumWrites, cache_persistent_data.U32_data[0]);
+/**
+ * @brief  Appending a snapshot record after the last record, or at the start of the
+ *         next page when it does not fit
+ * @param  num_words: persistent data size in words, even
+ * @retval true if success , false if failed
+ */
+static bool APP_ZIGBEE_NVM_WriteSnapshot(uint32_t num_words)
+{
+  APP_ZIGBEE_PersistRecord_t record;
+  uint32_t len = cache_persistent_data.U32_data[0];
+  uint32_t packed_size = 0;
+  uint32_t *p_words = cache_persistent_data.U32_data;
+  uint32_t stored_words = num_words;
+  uint32_t address;
+  uint32_t page;
+  bool     next_page = false;
+
+  /* Packed when it saves words : Length + Tag + packed size + CRC, then packed data */
+  if ( len > ( 16u - ST_PERSIST_FLASH_DATA_OFFSET ) )
+  {
+    packed_size = APP_ZIGBEE_NVM_Pack(&cache_persistent_data.U8_data[ST_PERSIST_FLASH_DATA_OFFSET], len, &cache_nvm_image.U8_data[16],
+                                      len - ( 16u - ST_PERSIST_FLASH_DATA_OFFSET ) - 1u);
+  }
+  if ( packed_size != 0u )
+  {
+    cache_nvm_image.U32_data[0] = len;
+    cache_nvm_image.U32_data[1] = ST_PERSIST_TAG_PACKED;
+    cache_nvm_image.U32_data[2] = packed_size;
+    cache_nvm_image.U32_data[3] = APP_ZIGBEE_NVM_Crc32(0, &cache_persistent_data.U8_data[ST_PERSIST_FLASH_DATA_OFFSET], len);
+    /* Flash is programmed by double words */
+    stored_words = ( ( 16u + packed_size + 7u ) / 8u ) * 2u;
+    memset(&cache_nvm_image.U8_data[16u + packed_size], 0, ( stored_words * 4u ) - 16u - packed_size);
+    p_words = cache_nvm_image.U32_data;
+  }
 
-#ifdef CFG_NVM
-    if(!APP_ZIGBEE_NVM_Write())
+  address = persistStoreFree;
+  if ( ( address == 0u ) || ( persistStoreRecord == 0u )
+       || ( ( address + sizeof(APP_ZIGBEE_PersistRecord_t) + ( stored_words * 4u ) ) > PERSIST_STORE_PAGE_END(persistStoreRecord) ) )
+  {
+    /* Next page, normally erased ahead by APP_ZIGBEE_NVM_Gc : the last record is kept until the new one is written */
+    page = ( persistStoreRecord == 0u ) ? 0u : ( PERSIST_STORE_PAGE(persistStoreRecord) + 1u ) % CFG_PERSIST_STORE_NB_PAGES;
+    if ( !APP_ZIGBEE_NVM_PageErased(page) )
     {
-      return false;
+      APP_ZIGBEE_OTA_Client_ErasePages(CFG_PERSIST_STORE_SECTOR_INDEX + page, 1);
+      nvmStats.store_erases++;
     }
-    APP_DBG("APP_ZIGBEE_persist_save: Persistent data FLASHED");
-#endif /* CFG_NVM */
+    address = PERSIST_STORE_ADDRESS + page * FLASH_PAGE_SIZE;
+    next_page = true;
+  }
 
-    return true;
-} /* APP_ZIGBEE_persist_save */
+  record.magic = ST_PERSIST_RECORD_MAGIC;
+  record.size = stored_words * 4u;
+  record.sequence = persistStoreSequence + 1u;
+  record.crc = APP_ZIGBEE_NVM_Crc32(0, (const uint8_t *)p_words, record.size);
 
+  /* Header first : a record torn by a reset is skipped thanks to its size */
+  if ( ( APP_ZIGBEE_OTA_Client_FlashProgram(address, (const uint8_t *)&record, sizeof(record)) != APP_ZIGBEE_OK )
+       || ( APP_ZIGBEE_OTA_Client_FlashProgram(address + sizeof(record), (const uint8_t *)p_words, record.size) != APP_ZIGBEE_OK ) )
+  {
+    /* Next write goes to the next page */
+    persistStoreFree = 0u;
+    APP_DBG("WRITE STOPPED, need a FLASH ERASE");
+    return false;
+  }
 
-/**
- * @brief  Delete persistent data
- * @param  None
- * @retval None
- */
-static void APP_ZIGBEE_persist_delete(void)
-{
-  /* Clear RAM cache */
-  memset(cache_persistent_data.U8_data, 0x00, ST_PERSIST_MAX_ALLOC_BUFFER_SZ);
-  APP_DBG("Persistent Data RAM cache cleared");
-#ifdef CFG_NVM
-  APP_DBG("FLASH ERASED");
-  APP_ZIGBEE_NVM_Erase();
-#endif /* CFG_NVM */
+  persistStoreSnapshot = address;
+  persistStoreRecord = address;
+  persistStoreSequence = record.sequence;
+  persistStoreDeltas = 0;
+  persistStoreFree = address + sizeof(record) + record.size;
+  memcpy(cache_diag_reference.U32_data, cache_persistent_data.U32_data, num_words * 4u);
+  persistShadowWords = num_words;
+  APP_ZIGBEE_NVM_Seal(num_words);
 
-  // -- Reset Chip --
-  *(uint8_t*)SRAM1_BASE = CFG_REBOOT_ON_OTA_FW;
-  NVIC_SystemReset();
-} /* APP_ZIGBEE_persist_delete */
+  if ( next_page )
+  {
+    /* Erase the following page while idle */
+    APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_PERSIST_GC, CFG_SCH_CLASS_BACKGROUND);
+  }
 
+  APP_DBG("WRITTEN PERSISTENT DATA LEN = %d (%s snapshot %d at 0x%08X, %d bytes)", len, (packed_size != 0u) ? "packed" : "raw",
+          record.sequence, address, record.size);
+  return true;
+} /* APP_ZIGBEE_NVM_WriteSnapshot */
 
-#ifdef CFG_NVM
 
 /**
- * @brief  Init the NVM
+ * @brief  Erase the NVM
  * @param  None
  * @retval None
  */
-static void APP_ZIGBEE_NVM_Init(void)
+static void APP_ZIGBEE_NVM_Erase(void)
 {
-  int eeprom_init_status;
-
-  APP_DBG("Flash starting address = %x",HW_FLASH_ADDRESS  + CFG_NVM_BASE_ADDRESS);
-  eeprom_init_status = EE_Init( 0 , HW_FLASH_ADDRESS + CFG_NVM_BASE_ADDRESS );
-
-  if (eeprom_init_status != EE_OK)
-  {
-    /* format NVM since init failed */
-    eeprom_init_status= EE_Init( 1, HW_FLASH_ADDRESS + CFG_NVM_BASE_ADDRESS );
-  }
-  APP_DBG("EE_init status = %d",eeprom_init_status);
-
-} /* APP_ZIGBEE_NVM_Init */
+   /* The EE emulation, holding the OTA context, is kept */
+   APP_ZIGBEE_OTA_Client_ErasePages(CFG_PERSIST_STORE_SECTOR_INDEX, CFG_PERSIST_STORE_NB_PAGES);
+   APP_ZIGBEE_NVM_Unseal();
+   persistStoreSnapshot = 0;
+   persistStoreRecord = 0;
+   persistStoreDeltas = 0;
+   persistStoreFree = 0;
+   persistStoreSequence = 0;
+   persistShadowWords = 0;
+} /* APP_ZIGBEE_NVM_Erase */
 
 /**
-*@brief  Read the persistent data from NVM
-* @param  None
-* @retval true if success , false if failed
-*/
-static bool APP_ZIGBEE_NVM_Read(void)
+ * @brief  Packing the persistent data : runs of 3 to 130 identical bytes
+ *         (0x80 + length - 3, value) and 1 to 128 literals (length - 1, bytes)
+ * @param  p_in: data to pack
+ * @param  size: data length
+ * @param  p_out: packed data
+ * @param  max_size: packed data max length
+ * @retval packed data length, 0 if larger than max_size
+ */
+static uint32_t APP_ZIGBEE_NVM_Pack(const uint8_t *p_in, uint32_t size, uint8_t *p_out, uint32_t max_size)
 {
-  uint16_t  num_words;
-  uint16_t  num_bytes;
-  uint16_t  iIndex;
-  bool      status = true;
-  int       ee_status = 0;
-
-  HAL_FLASH_Unlock();
-  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_PGSERR | FLASH_FLAG_WRPERR | FLASH_FLAG_OPTVERR);
+  uint32_t in = 0;
+  uint32_t out = 0;
+  uint32_t count;
+  uint32_t start;
 
-  /* Read the data length from cache */
-  ee_status = EE_Read(0, ZIGBEE_DB_START_ADDR, &cache_persistent_data.U32_data[0]);
-  if (ee_status != EE_OK)
-  {
-    APP_DBG("Read -> persistent data length not found ERASE to be done - Read Stopped");
-    status = false;
-  }
-  else
+  while ( in < size )
   {
-    /* Check length is not too big nor zero */
-    num_bytes = cache_persistent_data.U32_data[0];
-    if ( ( num_bytes == 0 ) || ( num_bytes > ST_PERSIST_MAX_ALLOC_SZ ) )
+    count = 1;
+    while ( ( ( in + count ) < size ) && ( count < 130u ) && ( p_in[in + count] == p_in[in] ) )
     {
-      APP_DBG("No data or too large length : %d", num_bytes);
-      status = false;
+      count++;
     }
-    else
+    if ( count >= 3u )
     {
-      /* Length is within range. Adjust the length to be U32 aligned */
-      num_words = (uint16_t) ( num_bytes / 4 ) ;
-      if ( cache_persistent_data.U32_data[0] % 4 != 0 )
+      if ( ( out + 2u ) > max_size )
       {
-        num_words++;
+        return 0;
       }
-      // -- Add the Verification Tag  --
-      num_words++;
-
-      /* copy the read data from Flash to cache including length */
-      for ( iIndex = 1; iIndex <= num_words; iIndex++)
+      p_out[out++] = (uint8_t)( 0x80u + count - 3u );
+      p_out[out++] = p_in[in];
+      in += count;
+    }
+    else
+    {
+      /* Literals up to the next run */
+      start = in;
+      while ( ( in < size ) && ( ( in - start ) < 128u )
+              && !( ( ( in + 2u ) < size ) && ( p_in[in + 1u] == p_in[in] ) && ( p_in[in + 2u] == p_in[in] ) ) )
       {
-        /* read data from first data in U32 unit */
-        ee_status = EE_Read(0, iIndex + ZIGBEE_DB_START_ADDR, &cache_persistent_data.U32_data[iIndex] );
-        if (ee_status != EE_OK)
-        {
-          APP_DBG("Read not found leaving");
-          status = false;
-          break;
-        }
+        in++;
       }
-    }
-  }
-
-  HAL_FLASH_Lock();
-  if(status)
-  {
-    APP_DBG("READ PERSISTENT DATA LEN = %d", num_bytes);
+      count = in - start;
+      if ( ( out + 1u + count ) > max_size )
+      {
+        return 0;
+      }
+      p_out[out++] = (uint8_t)( count - 1u );
+      memcpy(&p_out[out], &p_in[start], count);
+      out += count;
+    }
   }
 
-  return status;
-} /* APP_ZIGBEE_NVM_Read */
-
+  return out;
+}
 
 /**
- * @brief  Write the persistent data in NVM
- * @param  None
- * @retval None
+ * @brief  Unpacking the persistent data, see APP_ZIGBEE_NVM_Pack
+ * @param  p_in: packed data
+ * @param  size: packed data length
+ * @param  p_out: data
+ * @param  max_size: data max length
+ * @retval data length, 0 if the packed data is corrupted
  */
-static bool APP_ZIGBEE_NVM_Write(void)
+static uint32_t APP_ZIGBEE_NVM_Unpack(const uint8_t *p_in, uint32_t size, uint8_t *p_out, uint32_t max_size)
 {
-  int ee_status = 0;
-  uint16_t num_words;
-  uint16_t iIndex;
-
-  // -- Offset in Word for Length + Tag */
-  num_words = ( ST_PERSIST_FLASH_DATA_OFFSET / 4u );
-  num_words += (uint16_t) ( cache_persistent_data.U32_data[0] / 4u );
+  uint32_t in = 0;
+  uint32_t out = 0;
+  uint32_t count;
 
-  /* Adjust the length to be U32 aligned */
-  if ( cache_persistent_data.U32_data[0] % 4 != 0 )
+  while ( in < size )
   {
-    num_words++;
-  }
-
-  // -- Save data in flash --
-  for ( iIndex = 0; iIndex < num_words; iIndex++ )
-  {
-    ee_status = EE_Write(0, (uint16_t)iIndex + ZIGBEE_DB_START_ADDR, cache_persistent_data.U32_data[iIndex]);
-    if (ee_status != EE_OK)
+    if ( p_in[in] < 0x80u )
     {
-      if (ee_status == EE_CLEAN_NEEDED) /* Shall not be there if CFG_EE_AUTO_CLEAN = 1*/
+      count = p_in[in++] + 1u;
+      if ( ( ( in + count ) > size ) || ( ( out + count ) > max_size ) )
       {
-        APP_DBG("CLEAN NEEDED, CLEANING");
-        EE_Clean(0,0);
+        return 0;
       }
-      else
+      memcpy(&p_out[out], &p_in[in], count);
+      in += count;
+    }
+    else
+    {
+      count = p_in[in++] - 0x80u + 3u;
+      if ( ( in >= size ) || ( ( out + count ) > max_size ) )
       {
-        /* Failed to write , an Erase shall be done */
-        APP_DBG("APP_ZIGBEE_NVM_Write failed @ %d status %d", iIndex, ee_status);
-        break;
+        return 0;
       }
+      memset(&p_out[out], p_in[in++], count);
     }
+    out += count;
   }
 
-  if(ee_status != EE_OK)
-  {
-     APP_DBG("WRITE STOPPED, need a FLASH ERASE");
-     return false;
-  }
-
-  APP_DBG("WRITTEN PERSISTENT DATA LEN = %d", cache_persistent_data.U32_data[0]);
-  return true;
-} /* APP_ZIGBEE_NVM_Write */
-
+  return out;
+}
 
 /**
- * @brief  Erase the NVM
- * @param  None
- * @retval None
+ * @brief  CRC-32 (IEEE 802.3) of the persistent data records
+ * @param  crc: CRC of the previous data, 0 to start
+ * @param  p_data: data
+ * @param  size: data length
+ * @retval CRC
  */
-static void APP_ZIGBEE_NVM_Erase(void)
+static uint32_t APP_ZIGBEE_NVM_Crc32(uint32_t crc, const uint8_t *p_data, uint32_t size)
 {
-   EE_Init(1, HW_FLASH_ADDRESS + CFG_NVM_BASE_ADDRESS + ZIGBEE_DB_START_ADDR); /* Erase Flash except user data */
-} /* APP_ZIGBEE_NVM_Erase */
+  /* Reflected polynomial 0xEDB88320, 4 bits at a time */
+  static const uint32_t crc_table[16] =
+  {
+    0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu, 0x76DC4190u, 0x6B6B51F4u, 0x4DB26158u, 0x5005713Cu,
+    0xEDB88320u, 0xF00F9344u, 0xD6D6A3E8u, 0xCB61B38Cu, 0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u, 0xBDBDF21Cu
+  };
+  uint32_t index;
+
+  crc = ~crc;
+  for ( index = 0; index < size; index++ )
+  {
+    crc ^= p_data[index];
+    crc = ( crc >> 4 ) ^ crc_table[crc & 0x0Fu];
+    crc = ( crc >> 4 ) ^ crc_table[crc & 0x0Fu];
+  }
+
+  return ~crc;
+}
 
 #endif /* CFG_NVM */
 
@@ -1476,12 +4627,39 @@ static void APP_ZIGBEE_NVM_Erase(void)
  * @retval None
  */
 static void APP_ZIGBEE_App_Init(void){
+  if(zigbee_app_info.has_init)
+  {
+    if(zigbee_app_info.startup_state != STARTUP_SERVER_DISCOVERY)
+    {
+      return;
+    }
+    if(zigbee_app_info.startup_timeout)
+    {
+      /* Discovery callback lost : searching again */
+      zigbee_app_info.startup_timeout = false;
+      APP_DBG("OTA Server discovery timeout, retrying");
+      APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_SERVER_DISCOVERY, CFG_SCH_CLASS_OTA);
+      return;
+    }
+    /* Server found */
+    APP_ZIGBEE_OTA_Client_Start();
+    return;
+  }
+  zigbee_app_info.has_init = true;
+
   /* Tasks associated to OTA upgrade process */
-  UTIL_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_REQUEST_UPGRADE, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Client_Request_Upgrade);
-  UTIL_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_START_DOWNLOAD, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Client_StartDownload);
-  UTIL_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_RESUME_DOWNLOAD, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Client_ResumeDownload);
-  UTIL_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_SERVER_DISCOVERY, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Client_ServerDiscovery);
-  UTIL_SEQ_RegTask(1U << (uint32_t)CFG_TASK_FUOTA_RESET, UTIL_SEQ_RFU, APP_ZIGBEE_PerformReset);
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_REQUEST_UPGRADE, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Client_Request_Upgrade);
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_START_DOWNLOAD, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Client_StartDownload);
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_RESUME_DOWNLOAD, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Client_ResumeDownload);
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_SERVER_DISCOVERY, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Client_ServerDiscovery);
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_FUOTA_RESET, UTIL_SEQ_RFU, APP_ZIGBEE_PerformReset);
+#if (OTA_MCAST_ENABLE)
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_MCAST_NACK, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Mcast_SendNack);
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_MCAST_PREPARE, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Mcast_Prepare);
+#endif
+#if (OTA_SCHEDULE_ENABLE)
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_OTA_SCHEDULE, UTIL_SEQ_RFU, APP_ZIGBEE_OTA_Schedule_Process);
+#endif
 
   /* Timer associated to GREEN LED toggling */
   HW_TS_Create(CFG_TIM_PROC_ID_ISR, &TS_ID_LED, hw_ts_Repeated, APP_ZIGBEE_LEDToggle);
@@ -1489,10 +4667,78 @@ static void APP_ZIGBEE_App_Init(void){
   /* Timer associated to OTA download resume */
   HW_TS_Create(CFG_TIM_PROC_ID_ISR, &TS_DOWNLOAD_RESUME, hw_ts_SingleShot, APP_ZIGBEE_OTA_Client_ResumeDownload);
 
+  /* Deferred saving of the persistent data */
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_PERSIST_SAVE, UTIL_SEQ_RFU, APP_ZIGBEE_persist_flush);
+  HW_TS_Create(CFG_TIM_PROC_ID_ISR, &TS_PERSIST_SAVE, hw_ts_SingleShot, APP_ZIGBEE_persist_timer_cb);
+#ifdef CFG_NVM
+  /* NVM maintenance (EE cleanup, persistence store garbage collection), at low priority */
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_PERSIST_GC, UTIL_SEQ_RFU, APP_ZIGBEE_NVM_Gc);
+  HW_TS_Create(CFG_TIM_PROC_ID_ISR, &TS_PERSIST_GC, hw_ts_SingleShot, APP_ZIGBEE_NVM_GcTimer_cb);
+  APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_PERSIST_GC, CFG_SCH_CLASS_BACKGROUND);
+#endif /* CFG_NVM */
+
+#if (OTA_MCAST_ENABLE)
+  /* Timer associated to multicast repair requests */
+  HW_TS_Create(CFG_TIM_PROC_ID_ISR, &TS_MCAST_NACK, hw_ts_SingleShot, APP_ZIGBEE_OTA_Mcast_NackTimer_cb);
+#endif
+
+#if (OTA_SCHEDULE_ENABLE)
+  /* Local clock of the download window */
+  APP_ZIGBEE_OTA_Schedule_Init();
+#endif
+
   /* Initialize Zigbee OTA Client parameters */
+  APP_ZIGBEE_Startup_SetState(STARTUP_CTX_LOAD);
   APP_ZIGBEE_OTA_Client_Init();
 } /* APP_ZIGBEE_App_Init */
 
+/**
+ * @brief  Moving the start-up sequence to a new state
+ *         The time spent in the previous state is traced, a timeout is armed
+ *         for the states waiting for the M0.
+ * @param  state: new state
+ * @retval None
+ */
+static void APP_ZIGBEE_Startup_SetState(enum APP_ZIGBEE_StartupState_t state)
+{
+  static const char * const state_name[STARTUP_STATE_NB] = { "persist restore", "join", "context load", "server discovery", "ready" };
+  uint32_t now = HAL_GetTick();
+  uint32_t elapsed = now - zigbee_app_info.startup_state_tick;
+
+  zigbee_app_info.startup_time[zigbee_app_info.startup_state] += elapsed;
+  APP_DBG("Startup : %s done in %d ms, %s", state_name[zigbee_app_info.startup_state], elapsed, state_name[state]);
+  zigbee_app_info.startup_state = state;
+  zigbee_app_info.startup_state_tick = now;
+  zigbee_app_info.startup_timeout = false;
+
+  /* The join timeout is armed per ZbStartup call, the discovery one per discovery */
+  HW_TS_Stop(TS_STARTUP);
+  if(state == STARTUP_READY)
+  {
+    APP_DBG("Startup : persist restore %d ms, join %d ms, context load %d ms, server discovery %d ms",
+            zigbee_app_info.startup_time[STARTUP_PERSIST_RESTORE], zigbee_app_info.startup_time[STARTUP_JOINING],
+            zigbee_app_info.startup_time[STARTUP_CTX_LOAD], zigbee_app_info.startup_time[STARTUP_SERVER_DISCOVERY]);
+  }
+} /* APP_ZIGBEE_Startup_SetState */
+
+/**
+ * @brief  Start-up state timeout (timer server ISR context)
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_Startup_Timer_cb(void)
+{
+  zigbee_app_info.startup_timeout = true;
+  if(zigbee_app_info.startup_state == STARTUP_JOINING)
+  {
+    APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_NETWORK_FORM, CFG_SCH_CLASS_OTA);
+  }
+  else
+  {
+    APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_APP_START, CFG_SCH_CLASS_OTA);
+  }
+} /* APP_ZIGBEE_Startup_Timer_cb */
+
 
 static void APP_ZIGBEE_OTA_Client_ServerDiscovery( void )
 {
@@ -1505,6 +4751,12 @@ static void APP_ZIGBEE_OTA_Client_ServerDiscovery( void )
   dst.endpoint = SW1_ENDPOINT;
   dst.nwkAddr = 0x0;
   OTA_client_info.OTA_state = DISCOVERING_OTA_SERVER;
+  if(zigbee_app_info.startup_state == STARTUP_SERVER_DISCOVERY)
+  {
+    /* Timeout of this attempt */
+    HW_TS_Stop(TS_STARTUP);
+    HW_TS_Start(TS_STARTUP, (uint32_t)STARTUP_DISCOVERY_TIMEOUT);
+  }
   status = ZbZclOtaClientDiscover(zigbee_app_info.ota_client, &dst);
   if(status != ZCL_STATUS_SUCCESS)
   {
@@ -1520,19 +4772,60 @@ static void APP_ZIGBEE_OTA_Client_ServerDiscovery( void )
  */
 static void APP_ZIGBEE_OTA_Client_Init(void)
 {
-  uint16_t  iShortAddress;
-
   /* Client info fields set to 0 */
   memset(&OTA_client_info, 0, sizeof(OTA_client_info));
 
+  if(APP_ZIGBEE_OTA_ctx_load_nvm())
+  {
+    APP_DBG("[OTA] ctx_load : OTA NVM flash offset restored succesfuly \n");
+    if(OTA_client_info.zigbee_ota_ctx_nvm.OtaCurrentState == COMMITTING_IMAGE)
+    {
+      /* Reset while copying a rebuilt delta image : staging area is intact, copy it again */
+      OTA_client_info.ctx.file_type = (enum APP_ZIGBEE_OtaFileTypeDef_t)OTA_client_info.zigbee_ota_ctx_nvm.previous_image_type;
+      OTA_client_info.ctx.file_version = OTA_client_info.zigbee_ota_ctx_nvm.file_version;
+      OTA_client_info.ctx.image_encoding = OTA_IMAGE_ENCODING_DELTA;
+      OTA_client_info.image_type = fileType_APP;
+      APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_FUOTA_RESET, CFG_SCH_CLASS_OTA);
+      return;
+    }
+#if (OTA_BUNDLE_ENABLE)
+    if((OTA_client_info.zigbee_ota_ctx_nvm.bundle_offset != 0u)
+       && (OTA_client_info.zigbee_ota_ctx_nvm.OtaCurrentState >= QUERYING_NEXT_IMAGE)
+       && (OTA_client_info.zigbee_ota_ctx_nvm.OtaCurrentState <= VERIFYING_IMAGE))
+    {
+      /* M4 image of a bundle already validated, the M0 image is still to be downloaded */
+      OTA_client_info.ctx.bundle_offset = OTA_client_info.zigbee_ota_ctx_nvm.bundle_offset;
+    }
+#endif
+  }
+  else{
+    /* Erase is done on first block, once the image encoding is known */
+    OTA_client_info.flags |= OTA_CLIENT_ERASE_PENDING_FLAG;
+  }
+
+#if (OTA_MCAST_ENABLE)
+  /* Multicast blocks may be received while the OTA server is searched for */
+  APP_ZIGBEE_OTA_Mcast_Init();
+#endif
+
   APP_DBG("Searching for OTA server.");
   BSP_LED_On(LED_GREEN);
 
-  /* Requesting a discovery for any available OTA server */
-  UTIL_SEQ_SetTask( 1U << CFG_TASK_ZIGBEE_OTA_SERVER_DISCOVERY, CFG_SCH_PRIO_0 );
+  /* Requesting a discovery for any available OTA server, APP_ZIGBEE_OTA_Client_Start once found */
+  APP_ZIGBEE_Startup_SetState(STARTUP_SERVER_DISCOVERY);
+  APP_SEQ_SetTask( 1U << CFG_TASK_ZIGBEE_OTA_SERVER_DISCOVERY, CFG_SCH_CLASS_OTA );
+} /* APP_ZIGBEE_OTA_Client_Init */
+
+/**
+ * @brief  OTA client start, once the OTA server is found
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_OTA_Client_Start(void)
+{
+  uint16_t  iShortAddress;
 
-  /* Wait a Discovery */
-  UTIL_SEQ_WaitEvt(EVENT_ZIGBEE_OTA_SERVER_FOUND);
+  APP_ZIGBEE_Startup_SetState(STARTUP_READY);
   BSP_LED_Off(LED_GREEN);
 
   /**
@@ -1548,19 +4841,21 @@ static void APP_ZIGBEE_OTA_Client_Init(void)
   {
     BSP_LED_On(LED_GREEN);
   }
-  if(APP_ZIGBEE_OTA_ctx_load_nvm())
-  {
-    APP_DBG("[OTA] ctx_load : OTA NVM flash offset restored succesfuly \n");
-  }
-  else{
-    APP_DBG("Delete_Sectors");
-    Delete_Sectors();
-  }
   iShortAddress = ZbShortAddress( zigbee_app_info.zb );
   APP_DBG("OTA Client with Short Address 0x%04X.", iShortAddress );
   APP_DBG("OTA Client init done!\n");
 
-} /* APP_ZIGBEE_OTA_Client_Init */
+#if (OTA_BUNDLE_ENABLE)
+  if(OTA_client_info.ctx.bundle_offset != 0u)
+  {
+    APP_DBG("[OTA] Resuming bundle : requesting the M0 image.");
+    OTA_client_info.image_type = fileType_COPRO_WIRELESS;
+    OTA_client_info.current_file_version = OTA_currentFileVersionTab[APP_ZIGBEE_FindImageType(fileType_COPRO_WIRELESS)].fileVersion;
+    APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_REQUEST_UPGRADE, CFG_SCH_CLASS_OTA);
+  }
+#endif
+
+} /* APP_ZIGBEE_OTA_Client_Start */
 
 /**
  * @brief  Zigbee application initialization
@@ -1576,31 +4871,46 @@ void APP_ZIGBEE_Init(void)
   /* Check the compatibility with the Coprocessor Wireless Firmware loaded */
   APP_ZIGBEE_CheckWirelessFirmwareInfo();
 
+#if (CFG_APP_AB_SLOTS)
+  /* Complete or revert a slots swap before anything else */
+  APP_ZIGBEE_OTA_Slot_Init();
+#endif
+
+  /* Versions reported to the OTA server */
+  APP_ZIGBEE_OTA_VersionRegistry_Init();
+
   /* Register cmdbuffer */
   APP_ZIGBEE_RegisterCmdBuffer(&ZigbeeOtCmdBuffer);
 
+  /* Posted commands and stack callback contexts */
+  APP_POOL_Init(&CmdPool);
+#if (OTA_MCAST_ENABLE)
+  APP_POOL_Init(&McastReportPool);
+#endif /* OTA_MCAST_ENABLE */
+
   /* Init config buffer and call TL_ZIGBEE_Init */
   APP_ZIGBEE_TL_INIT();
 
   /* Register task */
   /* Create the different tasks */
-  UTIL_SEQ_RegTask(1U << (uint32_t)CFG_TASK_NOTIFY_FROM_M0_TO_M4, UTIL_SEQ_RFU, APP_ZIGBEE_ProcessNotifyM0ToM4);
-  UTIL_SEQ_RegTask(1U << (uint32_t)CFG_TASK_REQUEST_FROM_M0_TO_M4, UTIL_SEQ_RFU, APP_ZIGBEE_ProcessRequestM0ToM4);
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_NOTIFY_FROM_M0_TO_M4, UTIL_SEQ_RFU, APP_ZIGBEE_ProcessNotifyM0ToM4);
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_REQUEST_FROM_M0_TO_M4, UTIL_SEQ_RFU, APP_ZIGBEE_ProcessRequestM0ToM4);
+  APP_SEQ_RegTask(1U << (uint32_t)CFG_TASK_ZIGBEE_CMD, UTIL_SEQ_RFU, APP_ZIGBEE_CmdProcess);
 
   /* Task associated with network creation process */
-  UTIL_SEQ_RegTask(1U << CFG_TASK_ZIGBEE_NETWORK_FORM, UTIL_SEQ_RFU, APP_ZIGBEE_NwkForm);
+  APP_SEQ_RegTask(1U << CFG_TASK_ZIGBEE_NETWORK_FORM, UTIL_SEQ_RFU, APP_ZIGBEE_NwkForm);
 
   /* Task associated with push button SW1 */
-  UTIL_SEQ_RegTask(1U << CFG_TASK_BUTTON_SW1, UTIL_SEQ_RFU, APP_ZIGBEE_SW1_Process); /* request download pause */
+  APP_SEQ_RegTask(1U << CFG_TASK_BUTTON_SW1, UTIL_SEQ_RFU, APP_ZIGBEE_SW1_Process); /* request download pause */
 
   /* Task associated with push button SW2 */
-  UTIL_SEQ_RegTask(1U << CFG_TASK_BUTTON_SW2, UTIL_SEQ_RFU, APP_ZIGBEE_SW2_Process); /* clear persistence */
+  APP_SEQ_RegTask(1U << CFG_TASK_BUTTON_SW2, UTIL_SEQ_RFU, APP_ZIGBEE_SW2_Process); /* clear persistence */
 
   /* Task associated with push button SW3 */
-  UTIL_SEQ_RegTask(1U << CFG_TASK_BUTTON_SW3, UTIL_SEQ_RFU, APP_ZIGBEE_SW3_Process); /* request download resume */
+  APP_SEQ_RegTask(1U << CFG_TASK_BUTTON_SW3, UTIL_SEQ_RFU, APP_ZIGBEE_SW3_Process); /* request download resume */
 
   /* Task associated with application init */
-  UTIL_SEQ_RegTask(1U << CFG_TASK_ZIGBEE_APP_START, UTIL_SEQ_RFU, APP_ZIGBEE_App_Init);
+  APP_SEQ_RegTask(1U << CFG_TASK_ZIGBEE_APP_START, UTIL_SEQ_RFU, APP_ZIGBEE_App_Init);
 
   /* Start the Zigbee on the CPU2 side */
   ZigbeeInitStatus = SHCI_C2_ZIGBEE_Init();
@@ -1638,7 +4948,14 @@ static void APP_ZIGBEE_StackLayersInit(void)
 
   /* Configure the joining parameters */
   zigbee_app_info.join_status = (enum ZbStatusCodeT) 0x01; /* init to error status */
-  zigbee_app_info.join_delay = HAL_GetTick(); /* now */
+  zigbee_app_info.join_retry_nb = 0U;
+  zigbee_app_info.join_rand = (uint32_t)ZbExtendedAddress(zigbee_app_info.zb) ^ (uint32_t)(ZbExtendedAddress(zigbee_app_info.zb) >> 32);
+  HW_TS_Create(CFG_TIM_PROC_ID_ISR, &TS_JOIN_RETRY, hw_ts_SingleShot, APP_ZIGBEE_JoinRetry_Timer_cb);
+
+  /* Timeout of the start-up states waiting for the M0 */
+  HW_TS_Create(CFG_TIM_PROC_ID_ISR, &TS_STARTUP, hw_ts_SingleShot, APP_ZIGBEE_Startup_Timer_cb);
+  zigbee_app_info.startup_state = STARTUP_PERSIST_RESTORE;
+  zigbee_app_info.startup_state_tick = HAL_GetTick();
 
   /* STEP 1 - TRY to START FROM PERSISTENCE */
 
@@ -1670,7 +4987,7 @@ static void APP_ZIGBEE_StackLayersInit(void)
      APP_ZIGBEE_persist_notify_cb(zigbee_app_info.zb,NULL);
 
      /* Call the ZIGBEE app init */
-     UTIL_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_APP_START, CFG_SCH_PRIO_0);
+     APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_APP_START, CFG_SCH_CLASS_OTA);
   }
   else
   {
@@ -1681,7 +4998,8 @@ static void APP_ZIGBEE_StackLayersInit(void)
   if(zigbee_app_info.fresh_startup)
   {
     /* Go for fresh start */
-    UTIL_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_NETWORK_FORM, CFG_SCH_PRIO_0);
+    APP_ZIGBEE_Startup_SetState(STARTUP_JOINING);
+    APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_NETWORK_FORM, CFG_SCH_CLASS_OTA);
   }
 } /* APP_ZIGBEE_StackLayersInit */
 
@@ -1710,8 +5028,19 @@ static void APP_ZIGBEE_ConfigEndpoints(void)
   client_config.callbacks.image_notify = APP_ZIGBEE_OTA_Client_ImageNotify_cb;
   client_config.callbacks.query_next = APP_ZIGBEE_OTA_Client_QueryNextImage_cb;
 //  .callbacks.update_raw = APP_ZIGBEE_OTA_Client_UpdateRaw_cb;
-#ifdef USE_TAG_WRITE_CB
+#if (USE_TAG_WRITE_CB)
   client_config.callbacks.write_tag = APP_ZIGBEE_OTA_Client_WriteTag_cb;
+  APP_ZIGBEE_OTA_Client_RegisterTagHandler(ZCL_OTA_SUB_TAG_UPGRADE_IMAGE, APP_ZIGBEE_OTA_Client_WriteImage_cb);
+  APP_ZIGBEE_OTA_Client_RegisterTagHandler(OTA_SUB_TAG_LZSS_IMAGE, APP_ZIGBEE_OTA_Client_WriteCompressedImage);
+  APP_ZIGBEE_OTA_Client_RegisterTagHandler(OTA_SUB_TAG_DELTA_IMAGE, APP_ZIGBEE_OTA_Client_WriteDeltaImage);
+  APP_ZIGBEE_OTA_Client_RegisterTagHandler(ZCL_OTA_SUB_TAG_IMAGE_INTEGRITY_CODE, APP_ZIGBEE_OTA_Client_WriteIntegrityCode);
+#if (OTA_SIGNATURE_ENABLE)
+  APP_ZIGBEE_OTA_Client_RegisterTagHandler(OTA_SUB_TAG_SIGNATURE, APP_ZIGBEE_OTA_Client_WriteSignature);
+  APP_ZIGBEE_OTA_Client_RegisterTagHandler(OTA_SUB_TAG_MANIFEST, APP_ZIGBEE_OTA_Client_WriteManifest);
+#endif
+#if (OTA_ENCRYPTION_ENABLE)
+  APP_ZIGBEE_OTA_Client_RegisterTagHandler(OTA_SUB_TAG_ENCRYPTED_IMAGE, APP_ZIGBEE_OTA_Client_WriteEncryptedImage);
+#endif
 #endif
   client_config.callbacks.write_image = APP_ZIGBEE_OTA_Client_WriteImage_cb;
   client_config.callbacks.image_validate = APP_ZIGBEE_OTA_Client_ImageValidate_cb;
@@ -1733,35 +5062,39 @@ static void APP_ZIGBEE_ConfigEndpoints(void)
  */
 static void APP_ZIGBEE_NwkForm(void)
 {
-  if ((zigbee_app_info.join_status != ZB_STATUS_SUCCESS) && (HAL_GetTick() >= zigbee_app_info.join_delay))
-  {
-    struct ZbStartupT config;
-    enum ZbStatusCodeT status;
-
-    /* Configure Zigbee Logging (only need to do this once, but this is a good place to put it) */
-    ZbSetLogging(zigbee_app_info.zb, ZB_LOG_MASK_LEVEL_5, NULL);
-
-    /* Attempt to join a zigbee network */
-    ZbStartupConfigGetProDefaults(&config);
-
-    APP_DBG("Network config : APP_STARTUP_CENTRALIZED_ROUTER");
-    config.startupControl = ZbStartTypeJoin;
-
-    /* Using the default HA preconfigured Link Key */
-    memcpy(config.security.preconfiguredLinkKey, sec_key_ha, ZB_SEC_KEYSIZE);
-    config.channelList.count = 1;
-    config.channelList.list[0].page = 0;
-    config.channelList.list[0].channelMask = 1 << CHANNEL; /* Channel in use*/
+  enum ZbStatusCodeT status;
 
-    /* Using ZbStartupWait (blocking) here instead of ZbStartup, in order to demonstrate how to do
-     * a blocking call on the M4. */
-    status = ZbStartupWait(zigbee_app_info.zb, &config);
+  if (zigbee_app_info.join_retry_pending)
+  {
+    /* Set again by APP_ZIGBEE_JoinRetry_Timer_cb */
+    return;
+  }
 
+  if (zigbee_app_info.join_in_progress)
+  {
+    if (!zigbee_app_info.startup_timeout)
+    {
+      /* Set again by APP_ZIGBEE_Join_cb */
+      return;
+    }
+    /* The callback of this attempt is ignored if it ever comes */
+    APP_DBG("ZbStartup timeout, resetting the stack");
+    zigbee_app_info.startup_timeout = false;
+    zigbee_app_info.join_in_progress = false;
+    zigbee_app_info.join_attempt++;
+    ZbReset( zigbee_app_info.zb );
+    APP_ZIGBEE_JoinRetrySchedule();
+    return;
+  }
+  else if (zigbee_app_info.join_done)
+  {
+    /* ZbStartup completed */
+    zigbee_app_info.join_done = false;
+    HW_TS_Stop(TS_STARTUP);
+    status = zigbee_app_info.join_status;
     APP_DBG("ZbStartup Callback (status = 0x%02x)", status);
-    zigbee_app_info.join_status = status;
-
     if (status == ZB_STATUS_SUCCESS) {
-      zigbee_app_info.join_delay = 0U;
+      zigbee_app_info.join_retry_nb = 0U;
 
       ZbPersistNotifyRegister(zigbee_app_info.zb,APP_ZIGBEE_persist_notify_cb,NULL);
       /* Call the callback once here to save persistence data */
@@ -1769,73 +5102,146 @@ static void APP_ZIGBEE_NwkForm(void)
     }
     else
     {
-      APP_DBG("Startup failed, attempting again after a short delay (%d ms)", APP_ZIGBEE_STARTUP_FAIL_DELAY);
-
       // -- Reset Zigbee to be sure that we re-start with a good setting --
       if ( status == ZB_NWK_STATUS_INVALID_REQUEST ) {
         ZbReset( zigbee_app_info.zb );
       }
 
-      zigbee_app_info.join_delay = HAL_GetTick() + APP_ZIGBEE_STARTUP_FAIL_DELAY;
+      APP_ZIGBEE_JoinRetrySchedule();
+      return;
     }
   }
 
-  /* If Network forming/joining was not successful reschedule the current task to retry the process */
   if (zigbee_app_info.join_status != ZB_STATUS_SUCCESS)
   {
-    UTIL_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_NETWORK_FORM, CFG_SCH_PRIO_0);
-  }
-  else
-  {
+    struct ZbStartupT config;
+
+    /* Configure Zigbee Logging (only need to do this once, but this is a good place to put it) */
+    ZbSetLogging(zigbee_app_info.zb, ZB_LOG_MASK_LEVEL_5, NULL);
+
+    /* Attempt to join a zigbee network */
+    ZbStartupConfigGetProDefaults(&config);
 
-    /* Since we're using group addressing (broadcast), shorten the broadcast timeout */
-    uint32_t bcast_timeout = 3;
-    ZbNwkSet(zigbee_app_info.zb, ZB_NWK_NIB_ID_NetworkBroadcastDeliveryTime, &bcast_timeout, sizeof(bcast_timeout));
+    APP_DBG("Network config : APP_STARTUP_CENTRALIZED_ROUTER");
+    config.startupControl = ZbStartTypeJoin;
 
-    /* Starting application init task */
-    UTIL_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_APP_START, CFG_SCH_PRIO_0);
+    /* Using the default HA preconfigured Link Key */
+    memcpy(config.security.preconfiguredLinkKey, sec_key_ha, ZB_SEC_KEYSIZE);
+    config.channelList.count = 1;
+    config.channelList.list[0].page = 0;
+    config.channelList.list[0].channelMask = APP_ZIGBEE_JoinChannelMask();
+    APP_DBG("Join attempt on channel mask 0x%08x", config.channelList.list[0].channelMask);
+
+    /* Non blocking : the task is set again by APP_ZIGBEE_Join_cb, or by the timeout */
+    zigbee_app_info.join_attempt++;
+    zigbee_app_info.startup_timeout = false;
+    status = ZbStartup(zigbee_app_info.zb, &config, APP_ZIGBEE_Join_cb, (void *)(uintptr_t)zigbee_app_info.join_attempt);
+    if (status == ZB_STATUS_SUCCESS)
+    {
+      zigbee_app_info.join_in_progress = true;
+      HW_TS_Stop(TS_STARTUP);
+      HW_TS_Start(TS_STARTUP, (uint32_t)STARTUP_JOIN_TIMEOUT);
+      return;
+    }
+    APP_DBG("ZbStartup failed (status = 0x%02x)", status);
+    APP_ZIGBEE_JoinRetrySchedule();
+    return;
   }
-} /* APP_ZIGBEE_NwkForm */
 
-/*************************************************************
- * ZbStartupWait Blocking Call
- *************************************************************/
-struct ZbStartupWaitInfo {
-  bool active;
-  enum ZbStatusCodeT status;
-};
+  /* Since we're using group addressing (broadcast), shorten the broadcast timeout */
+  uint32_t bcast_timeout = 3;
+  ZbNwkSet(zigbee_app_info.zb, ZB_NWK_NIB_ID_NetworkBroadcastDeliveryTime, &bcast_timeout, sizeof(bcast_timeout));
+
+  /* Starting application init task */
+  APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_APP_START, CFG_SCH_CLASS_OTA);
+} /* APP_ZIGBEE_NwkForm */
 
-static void ZbStartupWaitCb(enum ZbStatusCodeT status, void *cb_arg)
+/**
+ * @brief  Arm the join retry timer after a failed attempt
+ *         The delay doubles with each consecutive failure up to
+ *         APP_ZIGBEE_STARTUP_FAIL_DELAY_MAX, plus a random part of up to half
+ *         of it, so that the nodes of a network restarting together do not
+ *         join again at the same time.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_JoinRetrySchedule(void)
 {
-  struct ZbStartupWaitInfo *info = cb_arg;
+  uint32_t backoff = zigbee_app_info.join_retry_nb;
+  uint32_t delay;
+
+  if (backoff > APP_ZIGBEE_STARTUP_FAIL_BACKOFF_MAX)
+  {
+    backoff = APP_ZIGBEE_STARTUP_FAIL_BACKOFF_MAX;
+  }
+  delay = APP_ZIGBEE_STARTUP_FAIL_DELAY << backoff;
+  if (delay > APP_ZIGBEE_STARTUP_FAIL_DELAY_MAX)
+  {
+    delay = APP_ZIGBEE_STARTUP_FAIL_DELAY_MAX;
+  }
+
+  /* xorshift32, the state is never 0 */
+  zigbee_app_info.join_rand ^= HAL_GetTick();
+  if (zigbee_app_info.join_rand == 0U)
+  {
+    zigbee_app_info.join_rand = 1U;
+  }
+  zigbee_app_info.join_rand ^= zigbee_app_info.join_rand << 13;
+  zigbee_app_info.join_rand ^= zigbee_app_info.join_rand >> 17;
+  zigbee_app_info.join_rand ^= zigbee_app_info.join_rand << 5;
+  delay += zigbee_app_info.join_rand % (delay / 2U + 1U);
+
+  zigbee_app_info.join_retry_nb++;
+  APP_DBG("Join attempt %d failed, attempting again in %d ms", zigbee_app_info.join_retry_nb, delay);
 
-  info->status = status;
-  info->active = false;
-  UTIL_SEQ_SetEvt(EVENT_ZIGBEE_STARTUP_ENDED);
-} /* ZbStartupWaitCb */
+  zigbee_app_info.join_retry_pending = true;
+  HW_TS_Stop(TS_JOIN_RETRY);
+  HW_TS_Start(TS_JOIN_RETRY, (uint32_t)(delay * 1000U / CFG_TS_TICK_VAL));
+} /* APP_ZIGBEE_JoinRetrySchedule */
 
-enum ZbStatusCodeT ZbStartupWait(struct ZigBeeT *zb, struct ZbStartupT *config)
+/**
+ * @brief  Join retry delay elapsed (timer server ISR context)
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_JoinRetry_Timer_cb(void)
 {
-  struct ZbStartupWaitInfo *info;
-  enum ZbStatusCodeT status;
+  zigbee_app_info.join_retry_pending = false;
+  APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_NETWORK_FORM, CFG_SCH_CLASS_OTA);
+} /* APP_ZIGBEE_JoinRetry_Timer_cb */
 
-  info = malloc(sizeof(struct ZbStartupWaitInfo));
-  if (info == NULL) {
-    return ZB_STATUS_ALLOC_FAIL;
-  }
-  memset(info, 0, sizeof(struct ZbStartupWaitInfo));
+/**
+ * @brief  Channel mask of the next join attempt
+ *         Two attempts on CHANNEL, then one scanning all the 2.4 GHz channels
+ *         in case the network was formed again on another one.
+ * @param  None
+ * @retval channel mask
+ */
+static uint32_t APP_ZIGBEE_JoinChannelMask(void)
+{
+  static const uint32_t channel_masks[] = { 1U << CHANNEL, 1U << CHANNEL, APP_ZIGBEE_CHANNELMASK_2400MHZ };
 
-  info->active = true;
-  status = ZbStartup(zb, config, ZbStartupWaitCb, info);
-  if (status != ZB_STATUS_SUCCESS) {
-    info->active = false;
-    return status;
+  return channel_masks[zigbee_app_info.join_retry_nb % (sizeof(channel_masks) / sizeof(channel_masks[0]))];
+} /* APP_ZIGBEE_JoinChannelMask */
+
+/**
+ * @brief  ZbStartup callback
+ * @param  status: join status
+ * @param  cb_arg: attempt number
+ * @retval None
+ */
+static void APP_ZIGBEE_Join_cb(enum ZbStatusCodeT status, void *cb_arg)
+{
+  if (!zigbee_app_info.join_in_progress || ((uintptr_t)cb_arg != zigbee_app_info.join_attempt))
+  {
+    /* Attempt given up after a timeout */
+    return;
   }
-  UTIL_SEQ_WaitEvt(EVENT_ZIGBEE_STARTUP_ENDED);
-  status = info->status;
-  free(info);
-  return status;
-} /* ZbStartupWait */
+  zigbee_app_info.join_in_progress = false;
+  zigbee_app_info.join_done = true;
+  zigbee_app_info.join_status = status;
+  APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_NETWORK_FORM, CFG_SCH_CLASS_OTA);
+} /* APP_ZIGBEE_Join_cb */
 
 /**
  * @brief  Trace the error or the warning reported.
@@ -1884,7 +5290,7 @@ static void APP_ZIGBEE_SW2_Process(void)
 static void APP_ZIGBEE_SW3_Process(void)
 {
   APP_DBG("SW3 PUSHED : Resuming OTA process");
-  UTIL_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_RESUME_DOWNLOAD, CFG_SCH_PRIO_0);
+  APP_SEQ_SetTask(1U << CFG_TASK_ZIGBEE_OTA_RESUME_DOWNLOAD, CFG_SCH_CLASS_OTA);
 }
 
 /*************************************************************
@@ -2031,6 +5437,78 @@ void ZIGBEE_CmdTransfer(void)
   Wait_Getting_Ack_From_M0();
 } /* ZIGBEE_CmdTransfer */
 
+/**
+ * @brief  Posting a command to the M0.
+ *         The command is a function calling the Zigbee API, run by the
+ *         CFG_TASK_ZIGBEE_CMD task with the other posted commands, back to back
+ *         on the OT command buffer. Used from M0 notification callbacks and from
+ *         tasks which do not need the result right away.
+ *         To be called from the sequencer tasks only.
+ * @param  cmd: command, returns the status given to done
+ * @param  done: completion callback, may be NULL
+ * @param  arg: argument of cmd and done
+ * @retval false if CmdPool is exhausted, the command is not posted
+ */
+bool APP_ZIGBEE_CmdPost(APP_ZIGBEE_CmdFunc_t cmd, APP_ZIGBEE_CmdDone_cb_t done, void *arg)
+{
+  APP_ZIGBEE_Cmd_t *p_cmd;
+
+  p_cmd = APP_POOL_Alloc(&CmdPool);
+  if ( p_cmd == NULL )
+  {
+    APP_DBG("Zigbee command pool exhausted");
+    return false;
+  }
+
+  p_cmd->cmd = cmd;
+  p_cmd->done = done;
+  p_cmd->arg = arg;
+  p_cmd->p_next = NULL;
+  if ( CmdQueueTail == NULL )
+  {
+    CmdQueueHead = p_cmd;
+  }
+  else
+  {
+    CmdQueueTail->p_next = p_cmd;
+  }
+  CmdQueueTail = p_cmd;
+
+  APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_ZIGBEE_CMD, CFG_SCH_CLASS_IPCC);
+  return true;
+} /* APP_ZIGBEE_CmdPost */
+
+/**
+ * @brief  Running the posted commands.
+ *         Commands posted by a command or by a completion callback are run
+ *         in the same pass. A command is given back to CmdPool before it
+ *         runs, so that it can post another one.
+ * @param  None
+ * @retval None
+ */
+static void APP_ZIGBEE_CmdProcess(void)
+{
+  APP_ZIGBEE_Cmd_t cmd;
+  uint32_t status;
+
+  while ( CmdQueueHead != NULL )
+  {
+    cmd = *CmdQueueHead;
+    APP_POOL_Free(&CmdPool, CmdQueueHead);
+    CmdQueueHead = cmd.p_next;
+    if ( CmdQueueHead == NULL )
+    {
+      CmdQueueTail = NULL;
+    }
+
+    status = cmd.cmd(cmd.arg);
+    if ( cmd.done != NULL )
+    {
+      cmd.done(status, cmd.arg);
+    }
+  }
+} /* APP_ZIGBEE_CmdProcess */
+
 /**
  * @brief  This function is called when the M0+ acknowledge  the fact that it has received a Cmd
  *
@@ -2056,6 +5534,21 @@ void TL_ZIGBEE_NotReceived(TL_EvtPacket_t *Notbuffer)
 {
   p_ZIGBEE_notif_M0_to_M4 = Notbuffer;
 
+  /* The M0 waits for the acknowledgment, sent once the notification is processed,
+   * before the next one : a second one means it is out of sync. Reported by the task. */
+  if ( CptReceiveNotifyFromM0 != 0u )
+  {
+    notifyStats.overflows++;
+    NotifyOverflowPending = 1u;
+  }
+  CptReceiveNotifyFromM0++;
+
+  notifyStats.received++;
+  if ( CptReceiveNotifyFromM0 > notifyStats.high_water )
+  {
+    notifyStats.high_water = CptReceiveNotifyFromM0;
+  }
+
   Receive_Notification_From_M0();
 } /* TL_ZIGBEE_NotReceived */
 
@@ -2103,8 +5596,7 @@ static void Receive_Ack_From_M0(void)
  */
 static void Receive_Notification_From_M0(void)
 {
-    CptReceiveNotifyFromM0++;
-    UTIL_SEQ_SetTask(1U << (uint32_t)CFG_TASK_NOTIFY_FROM_M0_TO_M4, CFG_SCH_PRIO_0);
+    APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_NOTIFY_FROM_M0_TO_M4, CFG_SCH_CLASS_IPCC);
 }
 
 /**
@@ -2118,7 +5610,7 @@ void TL_ZIGBEE_M0RequestReceived(TL_EvtPacket_t *Reqbuffer)
     p_ZIGBEE_request_M0_to_M4 = Reqbuffer;
 
     CptReceiveRequestFromM0++;
-    UTIL_SEQ_SetTask(1U << (uint32_t)CFG_TASK_REQUEST_FROM_M0_TO_M4, CFG_SCH_PRIO_0);
+    APP_SEQ_SetTask(1U << (uint32_t)CFG_TASK_REQUEST_FROM_M0_TO_M4, CFG_SCH_CLASS_IPCC);
 }
 
 /**
@@ -2141,19 +5633,31 @@ void APP_ZIGBEE_TL_INIT(void)
  */
 void APP_ZIGBEE_ProcessNotifyM0ToM4(void)
 {
+    if (NotifyOverflowPending != 0u) {
+        /* Reported here rather than under interrupt, APP_ZIGBEE_Error does not return */
+        APP_DBG("M0 notification received before the previous one was acknowledged (%d)", notifyStats.overflows);
+        APP_ZIGBEE_Error(ERR_REC_MULTI_MSG_FROM_M0, CptReceiveNotifyFromM0);
+    }
     if (CptReceiveNotifyFromM0 != 0) {
-        /* If CptReceiveNotifyFromM0 is > 1. it means that we did not serve all the events from the radio */
-        if (CptReceiveNotifyFromM0 > 1U) {
-            APP_ZIGBEE_Error(ERR_REC_MULTI_MSG_FROM_M0, 0);
-        }
-        else {
-            Zigbee_CallBackProcessing();
-        }
-        /* Reset counter */
+        /* Reset counter before the acknowledgment, which allows the next notification */
         CptReceiveNotifyFromM0 = 0;
+
+        /* Acknowledges the notification to the M0 */
+        Zigbee_CallBackProcessing();
     }
 }
 
+/**
+ * @brief  Get the M0 notification statistics
+ * @param  p_stats: statistics
+ * @retval None
+ */
+void APP_ZIGBEE_GetNotifyStats(APP_ZIGBEE_NotifyStats_t *p_stats)
+{
+    *p_stats = notifyStats;
+    p_stats->depth = CptReceiveNotifyFromM0;
+}
+
 /**
  * @brief Process the requests coming from the M0.
  * @param
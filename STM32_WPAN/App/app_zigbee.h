@@ -28,6 +28,11 @@ extern "C" {
 #include "tl.h"
 #include "tl_zigbee_hci.h"
 #include "stdbool.h"
+#include "app_ota_lzss.h"
+#include "app_ota_delta.h"
+#include "app_ota_sha256.h"
+#include "app_ota_ecdsa.h"
+#include "app_ota_aes.h"
   
 /* FUOTA specific defines ----------------------------------------------------*/
 
@@ -37,9 +42,23 @@ extern "C" {
 /* Keyword found at the end of encrypted Copro Wireless binaries */
 #define FUOTA_MAGIC_KEYWORD_COPRO_WIRELESS     0xD3A12C5E
 
+/* Offset in the application of the pointer to its magic keyword */
+#define FUOTA_MAGIC_KEYWORD_POINTER_OFFSET     0x140
+
+/* Tag of the image info block placed by an application just before its magic keyword : tag, file version */
+#define FUOTA_IMAGE_INFO_TAG                   0x4F544131  /* "OTA1" */
+#define FUOTA_IMAGE_INFO_SIZE                  8
+
 /* Define Address for Application FW Update */
 #define FUOTA_APP_FW_BINARY_ADDRESS            (FLASH_BASE + CFG_APP_START_SECTOR_INDEX*0x1000)
 
+/* Define Address where a delta image is rebuilt before being copied over the running application (slot B with CFG_APP_AB_SLOTS) */
+#define FUOTA_APP_DELTA_STAGING_ADDRESS        (FLASH_BASE + CFG_APP_DELTA_STAGING_SECTOR_INDEX*0x1000)
+
+/* Define Address of the A/B slots swap scratch page and state records */
+#define FUOTA_SWAP_SCRATCH_ADDRESS             (FLASH_BASE + CFG_APP_SWAP_SCRATCH_SECTOR_INDEX*0x1000)
+#define FUOTA_SLOT_STATE_ADDRESS               (FLASH_BASE + CFG_APP_SLOT_STATE_SECTOR_INDEX*0x1000)
+
 /* Define Address for Copro Wireless FW Update */
 #define FUOTA_COPRO_FW_BINARY_ADDRESS          (FLASH_BASE + CFG_APP_START_SECTOR_INDEX*0x1000)
 
@@ -49,16 +68,60 @@ extern "C" {
 /* ZCL OTA specific defines ------------------------------------------------------*/
 #define ST_ZIGBEE_MANUFACTURER_CODE            0x1041
 #define CURRENT_HARDWARE_VERSION               0x01
-#define CURRENT_FW_COPRO_WIRELESS_FILE_VERSION 0x01
-#define CURRENT_FW_APP_FILE_VERSION            0x01
+#define CURRENT_FW_COPRO_WIRELESS_FILE_VERSION 0x01 /* used if the wireless stack version can't be read */
+#define CURRENT_FW_APP_FILE_VERSION            0x01 /* used for an installed application without image info block */
 #define IMAGE_TYPE_FW_COPRO_WIRELESS           0x01 /* M0 binary  */
 #define IMAGE_TYPE_FW_APP                      0x02 /* M4 binary  */
+#define IMAGE_TYPE_MAX                         IMAGE_TYPE_FW_APP
+/* File version of a M0 image : wireless stack version major.minor.sub */
+#define OTA_COPRO_FILE_VERSION(major, minor, sub) (((uint32_t)(major) << 24) | ((uint32_t)(minor) << 16) | ((uint32_t)(sub) << 8))
 #define RAM_FIRMWARE_BUFFER_SIZE               1024
 #define OTA_CLIENT_PAUSE_DOWNLOAD_FLAG         (1 << 0) // 0001
 #define OTA_CLIENT_RESUME_DOWNLOAD_FLAG        (1 << 1) // 0010
 #define OTA_CLIENT_CTX_FOUND_FLAG              (1 << 2) // 0100
+#define OTA_CLIENT_ERASE_PENDING_FLAG          (1 << 3) // 1000 download area to be erased on first block
+#define OTA_CLIENT_CRC_RECEIVED_FLAG           (1 << 4) // integrity code tag received
+#define OTA_CLIENT_SIGNATURE_RECEIVED_FLAG     (1 << 5) // signature tag received
+#define OTA_CLIENT_MANIFEST_VALID_FLAG         (1 << 6) // manifest tag received and verified
+#define OTA_CLIENT_IMAGE_VERIFIED_FLAG         (1 << 7) // signature and/or manifest checked against the image in flash
 #define OTA_CLIENT_ABORT_MAX_RETRIES           5/*max retries when download is aborted*/
 #define OTA_HEADER_TAG_SIZE                    6u  /**< 6 bytes ( 2 bytes TAG ID + 4 bytes TAG length) */
+#define OTA_SUB_TAG_LZSS_IMAGE                 0xF000u /**< Manufacturer specific tag : LZSS compressed upgrade image */
+#define OTA_LZSS_HEADER_SIZE                   4u  /**< uncompressed image size (uint32 LE) in front of the LZSS stream */
+#define OTA_SUB_TAG_DELTA_IMAGE                0xF001u /**< Manufacturer specific tag : patch against the image installed at FUOTA_APP_FW_BINARY_ADDRESS */
+#define OTA_DELTA_HEADER_SIZE                  12u /**< source size, source CRC, target size (uint32 LE) in front of the patch */
+#define OTA_SUB_TAG_SIGNATURE                  0xF002u /**< Manufacturer specific tag : ECDSA P-256 signature of the image, after the image tag */
+/* manufacturer code, image type, file version (LE) of the OTA header, then SHA-256 of the image : the message signed in OTA_SUB_TAG_SIGNATURE */
+#define OTA_SIGNED_MESSAGE_SIZE                (8u + OTA_SHA256_DIGEST_SIZE)
+#define OTA_SUB_TAG_ENCRYPTED_IMAGE            0xF003u /**< Manufacturer specific tag : AES-128 CTR encrypted upgrade image */
+#define OTA_AES_HEADER_SIZE                    16u /**< initial counter block in front of the encrypted image */
+#define OTA_SUB_TAG_MANIFEST                   0xF004u /**< Manufacturer specific tag : signed image manifest, first sub-element */
+#define OTA_MANIFEST_MAGIC                     0x4D41544Fu /**< "OTAM" */
+#define OTA_MANIFEST_VERSION                   1u
+/* magic, version, image type, file version, hardware min/max, image size, SHA-256 of the image (LE), then signature of the above */
+#define OTA_MANIFEST_BODY_SIZE                 52u
+#define OTA_MANIFEST_SIZE                      (OTA_MANIFEST_BODY_SIZE + OTA_ECDSA_SIGNATURE_SIZE)
+#define OTA_SUB_HEADER_MAX_SIZE                OTA_AES_HEADER_SIZE
+#define OTA_DECODER_CTX_WORDS                  4u  /**< max of OTA_LZSS_CTX_WORDS, OTA_DELTA_CTX_WORDS and OTA_AES_HEADER_SIZE / 4 */
+#define OTA_TAG_HANDLER_NONE                   0xFFu /**< sub-element without handler, skipped */
+
+/* Multicast distribution : private cluster carried on SW1_ENDPOINT (frame formats in README) */
+#define OTA_MCAST_GROUP_ADDR                   0x0F7Au
+#define OTA_MCAST_CLUSTER_ID                   0xFC01u /**< manufacturer specific cluster range */
+#define OTA_MCAST_CMD_SESSION_START            0x00u
+#define OTA_MCAST_CMD_BLOCK                    0x01u
+#define OTA_MCAST_CMD_SESSION_END              0x02u
+#define OTA_MCAST_CMD_NACK                     0x03u   /**< client to server, unicast */
+#define OTA_MCAST_CMD_SIGNATURE                0x04u   /**< ECDSA P-256 signature of the image */
+#define OTA_MCAST_STATUS_MISSING               0x00u
+#define OTA_MCAST_STATUS_COMPLETE              0x01u
+#define OTA_MCAST_STATUS_INVALID               0x02u
+#define OTA_MCAST_SESSION_START_SIZE           19u
+#define OTA_MCAST_BLOCK_HEADER_SIZE            4u
+#define OTA_MCAST_SIGNATURE_FRAME_SIZE         66u     /**< command, session, r || s */
+#define OTA_MCAST_MAX_BLOCK_SIZE               64u     /**< multiple of 8, fits a single APS frame */
+#define OTA_MCAST_MAX_BLOCKS                   8192u   /**< 512 KB with 64 bytes blocks */
+#define OTA_MCAST_MAX_NACK_RANGES              16u
 /* Exported types ------------------------------------------------------------*/
 
 /*
@@ -81,10 +144,23 @@ enum APP_ZIGBEE_OtaCurrentState_t{
   QUERYING_NEXT_IMAGE,
   DOWNLOADING_IMAGE,
   VERIFYING_IMAGE ,
+  COMMITTING_IMAGE,
   REBOOTING,
 
 };
 
+/**
+  * @brief  Start-up sequence, see APP_ZIGBEE_Startup_SetState
+  */
+enum APP_ZIGBEE_StartupState_t{
+  STARTUP_PERSIST_RESTORE,   /**< restarting from the persistent data */
+  STARTUP_JOINING,           /**< no persistent data, joining the network */
+  STARTUP_CTX_LOAD,          /**< loading the OTA context */
+  STARTUP_SERVER_DISCOVERY,  /**< searching for the OTA server */
+  STARTUP_READY,
+  STARTUP_STATE_NB
+};
+
 /**
   * @brief  APP_ZIGBEE Status structures definition
   */
@@ -94,6 +170,17 @@ typedef enum
   APP_ZIGBEE_ERROR    = 0x01,
 } APP_ZIGBEE_StatusTypeDef;
 
+/**
+  * @brief  Encoding of the upgrade image sub-element being downloaded
+  */
+enum APP_ZIGBEE_OtaImageEncoding_t{
+  OTA_IMAGE_ENCODING_RAW,
+  OTA_IMAGE_ENCODING_LZSS,
+  OTA_IMAGE_ENCODING_DELTA,
+  OTA_IMAGE_ENCODING_MULTICAST, /**< raw image received as multicast blocks */
+  OTA_IMAGE_ENCODING_ENCRYPTED,
+};
+
 /*
  *  OTA structures definition
  */
@@ -104,17 +191,21 @@ enum APP_ZIGBEE_OtaFileTypeDef_t{
 
 struct OTA_currentFileVersion{
   enum APP_ZIGBEE_OtaFileTypeDef_t fileType;
-  uint8_t fileVersion;
+  uint32_t fileVersion;
 };
 
 struct APP_ZIGBEE_OtaContext_t{
   enum APP_ZIGBEE_OtaFileTypeDef_t  file_type;
-  uint8_t file_version;
+  uint32_t file_version;
   uint32_t binary_size;
   uint32_t binary_calc_crc;
   uint32_t binary_srv_crc;
   uint32_t base_address;
   uint32_t magic_keyword;
+  enum APP_ZIGBEE_OtaImageEncoding_t image_encoding;
+  uint32_t tag_offset;      /**< bytes of the image sub-element received so far */
+  uint8_t sub_header[OTA_SUB_HEADER_MAX_SIZE]; /**< encoding specific header of the image sub-element */
+  uint32_t bundle_offset;   /**< M0 image offset after the M4 image of a bundle, 0 if no bundle */
 };
 
 struct APP_ZIGBEE_OtaWriteInfo_t{
@@ -124,17 +215,114 @@ struct APP_ZIGBEE_OtaWriteInfo_t{
   bool buffer_full;
 };
 
+/**
+  * @brief  OTA file sub-element being received
+  */
+struct APP_ZIGBEE_OtaTagInfo_t{
+  uint16_t id;
+  uint8_t  handler_index;  /**< entry of the handlers table, OTA_TAG_HANDLER_NONE if skipped */
+  uint32_t length;         /**< sub-element length from its header */
+  uint32_t offset;         /**< bytes of the sub-element received before the current chunk */
+  uint32_t data_offset;    /**< file offset of the sub-element data */
+  uint32_t next_offset;    /**< file offset of the next sub-element */
+};
+
+/**
+  * @brief  Multicast session in progress, received blocks are tracked in a bitmap
+  */
+struct APP_ZIGBEE_OtaMcastSession_t{
+  bool     active;
+  bool     end_received;     /**< server announced the end of the stream */
+  bool     preparing;        /**< download area being erased, blocks ignored */
+  uint16_t prepare_step;     /**< pages erased, then EE bitmap words cleared */
+  uint8_t  session_id;
+  uint8_t  block_size;
+  uint8_t  server_endpoint;
+  uint16_t server_addr;      /**< NACK destination */
+  uint16_t nb_blocks;
+  uint16_t nb_received;
+  uint32_t image_size;
+  uint32_t image_crc;
+  bool     report_pending;   /**< report posted, not sent yet */
+  uint8_t  report_status;    /**< OTA_MCAST_STATUS_xxx of the pending report */
+  uint8_t  bitmap[OTA_MCAST_MAX_BLOCKS / 8u];
+};
+
+/**
+  * @brief  Download window state
+  */
+struct APP_ZIGBEE_OtaSchedule_t{
+  uint32_t local_time;     /**< seconds in the schedule period */
+  uint32_t start_offset;   /**< device specific start offset in the window (s) */
+  bool     in_window;
+  bool     offer_pending;  /**< image accepted, download not started yet */
+  bool     paused;         /**< download paused at the end of the window */
+};
+
+/**
+  * @brief  NVM statistics, see APP_ZIGBEE_NVM_GetStats
+  */
+typedef struct
+{
+  uint32_t ee_writes;             /**< EE words written since startup */
+  uint32_t ee_fill;               /**< EE bank written since the last cleanup (%), estimated */
+  uint32_t ee_cleanups;           /**< EE cleanups since startup */
+  uint32_t ee_cleanups_deferred;  /**< maintenance postponed because an image transfer was running */
+  uint32_t store_erases;          /**< persistence store page erases since startup */
+  uint32_t store_sequence;        /**< persistence store records written over the device life */
+} APP_ZIGBEE_NvmStats_t;
+
+/**
+  * @brief  M0 notification statistics, see APP_ZIGBEE_GetNotifyStats
+  */
+typedef struct
+{
+  uint32_t depth;       /**< notifications waiting for the sequencer, 1 at most when in sync */
+  uint32_t high_water;  /**< maximum depth since startup */
+  uint32_t received;    /**< notifications received since startup */
+  uint32_t overflows;   /**< notifications received before the previous one was acknowledged */
+} APP_ZIGBEE_NotifyStats_t;
+
+/**
+  * @brief  Command posted to the M0, see APP_ZIGBEE_CmdPost
+  */
+typedef uint32_t (*APP_ZIGBEE_CmdFunc_t)(void *arg);
+typedef void (*APP_ZIGBEE_CmdDone_cb_t)(uint32_t status, void *arg);
+
+typedef struct APP_ZIGBEE_Cmd
+{
+  APP_ZIGBEE_CmdFunc_t    cmd;     /**< calls the Zigbee API, returns its status */
+  APP_ZIGBEE_CmdDone_cb_t done;    /**< completion callback, may be NULL */
+  void                    *arg;
+  struct APP_ZIGBEE_Cmd   *p_next; /**< next posted command */
+} APP_ZIGBEE_Cmd_t;
+
 struct zigbee_ota_ctx_nvm_t {
   //all struct memebers should be of type uint32_t for NVM api comptatibility
     uint32_t flash_offset; /**< last saved flash offset */
     uint32_t previous_image_type; /**< Image type */
     uint32_t file_version; /**< File version */
     uint32_t OtaCurrentState; /**< ota process current step (downloading, verif, reboot ...) */
+    uint32_t image_encoding; /**< Image sub-element encoding (raw, LZSS) */
+    uint32_t tag_offset; /**< Image sub-element offset matching flash_offset (compressed domain for LZSS) */
+    uint32_t decoder_ctx[OTA_DECODER_CTX_WORDS]; /**< LZSS decoder or delta patcher state at flash_offset, multicast session, AES initial counter block */
+    uint32_t bundle_offset; /**< M0 image offset in a M4 + M0 bundle, 0 if no bundle */
+    uint32_t image_verified; /**< 1 once the signature and/or manifest matched the image in flash (VERIFYING_IMAGE) */
 };
 
 struct Zigbee_OTA_client_info {
   struct APP_ZIGBEE_OtaContext_t ctx;
   struct APP_ZIGBEE_OtaWriteInfo_t write_info;
+  union {
+    APP_OTA_LZSS_Decoder_t lzss;
+    APP_OTA_DELTA_Patcher_t delta;
+    APP_OTA_AES_Ctr_t aes;
+  } decoder;
+  struct APP_ZIGBEE_OtaMcastSession_t mcast;
+  struct APP_ZIGBEE_OtaTagInfo_t tag;
+  APP_OTA_SHA256_Ctx_t image_hash;   /**< digest of the image written so far */
+  uint8_t signature[OTA_ECDSA_SIGNATURE_SIZE];
+  uint8_t manifest[OTA_MANIFEST_SIZE];
   uint16_t image_type;
   uint32_t current_file_version;
   uint32_t requested_image_size;
@@ -157,6 +345,10 @@ void APP_ZIGBEE_ProcessNotifyM0ToM4(void);
 void APP_ZIGBEE_ProcessRequestM0ToM4(void);
 void APP_ZIGBEE_TL_INIT(void);
 void Pre_ZigbeeCmdProcessing(void);
+void APP_ZIGBEE_OTA_SetLocalTime(uint32_t seconds);
+void APP_ZIGBEE_NVM_GetStats(APP_ZIGBEE_NvmStats_t *p_stats);
+void APP_ZIGBEE_GetNotifyStats(APP_ZIGBEE_NotifyStats_t *p_stats);
+bool APP_ZIGBEE_CmdPost(APP_ZIGBEE_CmdFunc_t cmd, APP_ZIGBEE_CmdDone_cb_t done, void *arg);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,347 @@
+/**
+  ******************************************************************************
+  * File Name          : nvm_bench.c
+  * Description        : Host benchmark of the persistent data restore : one
+  *                      EE_Read per word (previous APP_ZIGBEE_NVM_Read)
+  *                      against APP_ZIGBEE_NVM_Scan + APP_ZIGBEE_NVM_Read on
+  *                      the persistence store pages.
+  ******************************************************************************
+  * @attention
+  *
+  * Copyright (c) 2019-2021 STMicroelectronics.
+  * All rights reserved.
+  *
+  * This software is licensed under terms that can be found in the LICENSE file
+  * in the root directory of this software component.
+  * If no LICENSE file comes with this software, it is provided AS-IS.
+  *
+  ******************************************************************************
+  *
+  * Build and run on the host :
+  *   gcc -O2 -o nvm_bench Tools/nvm_bench.c && ./nvm_bench [words]
+  *
+  * Both layouts are in RAM arrays standing for the flash :
+  *  - the EE emulation is modelled after ee.c : 8 bytes elements (data, address,
+  *    CRC) appended to the EE pages, EE_Read looking for the last element of an
+  *    address from the end of the written elements. The blob is written once,
+  *    then updated a few times as the persistence notifications do.
+  *  - the persistence store holds one snapshot record per page (a 1000 words
+  *    blob fills a page), the restore runs the code of app_zigbee.c : records
+  *    scanned once, CRC checked, last snapshot copied. Delta records are not
+  *    exercised here.
+  * The flash words read by each method are counted as well as the host time :
+  * on the device the flash accesses dominate.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Private defines -----------------------------------------------------------*/
+#define FLASH_PAGE_SIZE                 4096u
+#define CFG_PERSIST_STORE_NB_PAGES      4u
+#define CFG_NB_OF_PAGE                  (16u - CFG_PERSIST_STORE_NB_PAGES)
+#define CFG_EE_BANK0_MAX_NB             1000u
+#define ZIGBEE_DB_START_ADDR            100u
+#define ST_PERSIST_MAX_ALLOC_SZ         (4u * CFG_EE_BANK0_MAX_NB)
+#define ST_PERSIST_FLASH_DATA_OFFSET    8u
+#define ST_PERSIST_MAX_ALLOC_BUFFER_SZ  (ST_PERSIST_MAX_ALLOC_SZ + ST_PERSIST_FLASH_DATA_OFFSET)
+#define ST_PERSIST_TAG                  0xCAFEDECAu
+#define ST_PERSIST_RECORD_MAGIC         0x53524550u
+#define ST_PERSIST_DELTA_MAGIC          0x41544C44u
+
+#define EE_ELEMENTS                     ((CFG_NB_OF_PAGE * FLASH_PAGE_SIZE) / 8u)
+#define EE_UPDATES                      8u     /* saves of the blob after the first one */
+#define EE_UPDATE_WORDS                 40u    /* words changed by each save */
+#define BENCH_RUNS                      200u
+
+#define EE_OK                           0
+#define EE_NOT_FOUND                    1
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+  uint32_t data;
+  uint16_t address;
+  uint16_t crc;
+} EE_Element_t;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t size;
+  uint32_t sequence;
+  uint32_t crc;
+} APP_ZIGBEE_PersistRecord_t;
+
+/* Private variables ---------------------------------------------------------*/
+static EE_Element_t ee_flash[EE_ELEMENTS];
+static uint32_t     ee_count;
+static uint8_t      store_flash[CFG_PERSIST_STORE_NB_PAGES * FLASH_PAGE_SIZE];
+static uint32_t     cache_persistent_data[ST_PERSIST_MAX_ALLOC_BUFFER_SZ / 4u];
+static uint32_t     blob[ST_PERSIST_MAX_ALLOC_BUFFER_SZ / 4u];
+static uint64_t     flash_reads;        /* flash words read by the restore */
+static uint32_t     persistStoreSnapshot;
+static uint32_t     persistStoreSequence;
+
+/* Private functions ---------------------------------------------------------*/
+static uint16_t EE_Crc(uint32_t data, uint16_t address)
+{
+  uint32_t crc = data ^ ((uint32_t)address * 0x9E3779B1u);
+
+  return (uint16_t)((crc >> 16) ^ crc);
+}
+
+static void EE_Write(uint16_t address, uint32_t data)
+{
+  if(ee_count < EE_ELEMENTS)
+  {
+    ee_flash[ee_count].data = data;
+    ee_flash[ee_count].address = address;
+    ee_flash[ee_count].crc = EE_Crc(data, address);
+    ee_count++;
+  }
+}
+
+/* Last element of the address, searched from the end as ee.c does */
+static int EE_Read(uint16_t address, uint32_t *p_data)
+{
+  uint32_t index = ee_count;
+
+  while(index != 0u)
+  {
+    index--;
+    flash_reads += 2u;
+    if((ee_flash[index].address == address) && (ee_flash[index].crc == EE_Crc(ee_flash[index].data, address)))
+    {
+      *p_data = ee_flash[index].data;
+      return EE_OK;
+    }
+  }
+
+  return EE_NOT_FOUND;
+}
+
+/* Same as APP_ZIGBEE_NVM_Crc32 */
+static uint32_t APP_ZIGBEE_NVM_Crc32(uint32_t crc, const uint8_t *p_data, uint32_t size)
+{
+  static const uint32_t crc_table[16] =
+  {
+    0x00000000u, 0x1DB71064u, 0x3B6E20C8u, 0x26D930ACu, 0x76DC4190u, 0x6B6B51F4u, 0x4DB26158u, 0x5005713Cu,
+    0xEDB88320u, 0xF00F9344u, 0xD6D6A3E8u, 0xCB61B38Cu, 0x9B64C2B0u, 0x86D3D2D4u, 0xA00AE278u, 0xBDBDF21Cu
+  };
+  uint32_t index;
+
+  flash_reads += size / 4u;
+  crc = ~crc;
+  for(index = 0; index < size; index++)
+  {
+    crc ^= p_data[index];
+    crc = (crc >> 4) ^ crc_table[crc & 0x0Fu];
+    crc = (crc >> 4) ^ crc_table[crc & 0x0Fu];
+  }
+
+  return ~crc;
+}
+
+/* Previous restore : one EE_Read per word */
+static bool EE_Restore(void)
+{
+  uint32_t num_words;
+  uint32_t index;
+
+  if(EE_Read(ZIGBEE_DB_START_ADDR, &cache_persistent_data[0]) != EE_OK)
+  {
+    return false;
+  }
+  num_words = 2u + ((cache_persistent_data[0] + 3u) / 4u);
+  for(index = 1; index < num_words; index++)
+  {
+    if(EE_Read((uint16_t)(ZIGBEE_DB_START_ADDR + index), &cache_persistent_data[index]) != EE_OK)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* Same as APP_ZIGBEE_NVM_RecordSize */
+static uint32_t APP_ZIGBEE_NVM_RecordSize(uint32_t address, uint32_t end)
+{
+  const APP_ZIGBEE_PersistRecord_t *p_record = (const APP_ZIGBEE_PersistRecord_t *)&store_flash[address];
+
+  if((address + sizeof(APP_ZIGBEE_PersistRecord_t)) > end)
+  {
+    return 0u;
+  }
+  flash_reads += 2u;
+  if(((p_record->magic != ST_PERSIST_RECORD_MAGIC) && (p_record->magic != ST_PERSIST_DELTA_MAGIC))
+     || (p_record->size == 0u) || ((p_record->size % 8u) != 0u) || (p_record->size > ST_PERSIST_MAX_ALLOC_BUFFER_SZ)
+     || (p_record->size > (end - address - sizeof(APP_ZIGBEE_PersistRecord_t))))
+  {
+    return 0u;
+  }
+
+  return sizeof(APP_ZIGBEE_PersistRecord_t) + p_record->size;
+}
+
+/* APP_ZIGBEE_NVM_Scan, snapshot records only */
+static void APP_ZIGBEE_NVM_Scan(void)
+{
+  const APP_ZIGBEE_PersistRecord_t *p_record;
+  uint32_t page;
+  uint32_t address;
+  uint32_t end;
+  uint32_t size;
+
+  persistStoreSnapshot = UINT32_MAX;
+  persistStoreSequence = 0;
+  for(page = 0; page < CFG_PERSIST_STORE_NB_PAGES; page++)
+  {
+    address = page * FLASH_PAGE_SIZE;
+    end = address + FLASH_PAGE_SIZE;
+    while((size = APP_ZIGBEE_NVM_RecordSize(address, end)) != 0u)
+    {
+      p_record = (const APP_ZIGBEE_PersistRecord_t *)&store_flash[address];
+      flash_reads += 2u;
+      if((p_record->magic == ST_PERSIST_RECORD_MAGIC)
+         && ((persistStoreSnapshot == UINT32_MAX) || (p_record->sequence > persistStoreSequence))
+         && (APP_ZIGBEE_NVM_Crc32(0, &store_flash[address + sizeof(APP_ZIGBEE_PersistRecord_t)], p_record->size) == p_record->crc))
+      {
+        persistStoreSnapshot = address;
+        persistStoreSequence = p_record->sequence;
+      }
+      address += size;
+    }
+  }
+}
+
+/* APP_ZIGBEE_NVM_Read, unpacked snapshot */
+static bool APP_ZIGBEE_NVM_Read(void)
+{
+  const APP_ZIGBEE_PersistRecord_t *p_record;
+
+  if(persistStoreSnapshot == UINT32_MAX)
+  {
+    return false;
+  }
+  p_record = (const APP_ZIGBEE_PersistRecord_t *)&store_flash[persistStoreSnapshot];
+  memcpy(cache_persistent_data, &store_flash[persistStoreSnapshot + sizeof(APP_ZIGBEE_PersistRecord_t)], p_record->size);
+  flash_reads += p_record->size / 4u;
+
+  return (cache_persistent_data[0] != 0u) && (cache_persistent_data[0] <= ST_PERSIST_MAX_ALLOC_SZ);
+}
+
+static void Store_Write(uint32_t page, uint32_t sequence, uint32_t num_words)
+{
+  APP_ZIGBEE_PersistRecord_t record;
+  uint32_t address = page * FLASH_PAGE_SIZE;
+
+  record.magic = ST_PERSIST_RECORD_MAGIC;
+  record.size = ((num_words * 4u) + 7u) & ~7u;
+  record.sequence = sequence;
+  record.crc = 0;
+  memset(&store_flash[address + sizeof(record)], 0, record.size);
+  memcpy(&store_flash[address + sizeof(record)], blob, num_words * 4u);
+  record.crc = APP_ZIGBEE_NVM_Crc32(0, &store_flash[address + sizeof(record)], record.size);
+  memcpy(&store_flash[address], &record, sizeof(record));
+}
+
+static double Elapsed_us(const struct timespec *p_start, const struct timespec *p_stop)
+{
+  return ((double)(p_stop->tv_sec - p_start->tv_sec) * 1e6) + ((double)(p_stop->tv_nsec - p_start->tv_nsec) / 1e3);
+}
+
+/* Public functions ----------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+  struct timespec start, stop;
+  uint32_t data_words = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : (CFG_EE_BANK0_MAX_NB - 2u);
+  uint32_t num_words;
+  uint32_t index, update, run;
+  uint64_t ee_reads, store_reads;
+  double ee_us, store_us;
+  bool status = true;
+
+  /* Blob : length, tag and data, the store record has to fit a page */
+  if((data_words == 0u) || (((data_words + 2u) * 4u) > (FLASH_PAGE_SIZE - sizeof(APP_ZIGBEE_PersistRecord_t) - 8u)))
+  {
+    fprintf(stderr, "words shall be 1 to %u\n",
+            (unsigned)(((FLASH_PAGE_SIZE - sizeof(APP_ZIGBEE_PersistRecord_t) - 8u) / 4u) - 2u));
+    return 1;
+  }
+  num_words = data_words + 2u;
+  srand(1);
+  blob[0] = data_words * 4u;
+  blob[1] = ST_PERSIST_TAG;
+  for(index = 2; index < num_words; index++)
+  {
+    blob[index] = (uint32_t)rand();
+  }
+
+  /* EE : the OTA context words, the whole blob, then saves of a few changed words */
+  memset(store_flash, 0xFF, sizeof(store_flash));
+  for(index = 0; index < 32u; index++)
+  {
+    EE_Write((uint16_t)index, index);
+  }
+  for(index = 0; index < num_words; index++)
+  {
+    EE_Write((uint16_t)(ZIGBEE_DB_START_ADDR + index), blob[index]);
+  }
+  for(update = 0; update < EE_UPDATES; update++)
+  {
+    for(index = 0; index < EE_UPDATE_WORDS; index++)
+    {
+      uint32_t word = 2u + ((uint32_t)rand() % data_words);
+
+      blob[word] = (uint32_t)rand();
+      EE_Write((uint16_t)(ZIGBEE_DB_START_ADDR + word), blob[word]);
+    }
+    /* Store : one snapshot per save, in turn in the pages */
+    Store_Write(update % CFG_PERSIST_STORE_NB_PAGES, update + 1u, num_words);
+  }
+
+  flash_reads = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(run = 0; run < BENCH_RUNS; run++)
+  {
+    status &= EE_Restore();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  status &= (memcmp(cache_persistent_data, blob, num_words * 4u) == 0);
+  ee_us = Elapsed_us(&start, &stop) / BENCH_RUNS;
+  ee_reads = flash_reads / BENCH_RUNS;
+
+  memset(cache_persistent_data, 0, sizeof(cache_persistent_data));
+  flash_reads = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(run = 0; run < BENCH_RUNS; run++)
+  {
+    APP_ZIGBEE_NVM_Scan();
+    status &= APP_ZIGBEE_NVM_Read();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  status &= (memcmp(cache_persistent_data, blob, num_words * 4u) == 0);
+  store_us = Elapsed_us(&start, &stop) / BENCH_RUNS;
+  store_reads = flash_reads / BENCH_RUNS;
+
+  printf("Blob of %u words, %u EE elements written, %u store pages\n", (unsigned)num_words, (unsigned)ee_count,
+         (unsigned)CFG_PERSIST_STORE_NB_PAGES);
+  printf("  EE_Read per word        : %10.1f us %10llu flash words read\n", ee_us, (unsigned long long)ee_reads);
+  printf("  NVM_Scan + NVM_Read     : %10.1f us %10llu flash words read\n", store_us, (unsigned long long)store_reads);
+  printf("  ratio                   : %10.1f x  %10.1f x\n", ee_us / store_us, (double)ee_reads / (double)store_reads);
+  if(!status)
+  {
+    printf("Restored data differ from the blob\n");
+    return 1;
+  }
+
+  return 0;
+}
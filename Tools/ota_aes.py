@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""AES-128 CTR encryption of OTA images for the Zigbee_OTA_Client_Router example.
+
+The encrypted upgrade image sub-element (0xF003) is the 16 bytes initial
+counter block followed by the binary encrypted in counter mode (NIST SP
+800-38A, counter incremented as a 128 bits big endian number), which the
+client decrypts block by block while it writes the image to flash.
+
+  ota_aes.py genkey KEY      create a key file and print the key
+  ota_aes.py key KEY         print the key of an existing key file
+
+The firmware keys header is written by ota_keys.py.
+"""
+import argparse
+import os
+import sys
+
+KEY_SIZE = 16
+BLOCK_SIZE = 16
+
+
+def _sbox():
+    box = [0] * 256
+    p = q = 1
+    while True:
+        # p * 3, q / 3 in GF(2^8)
+        p = p ^ ((p << 1) & 0xFF) ^ (0x1B if p & 0x80 else 0)
+        q ^= q << 1
+        q ^= q << 2
+        q ^= q << 4
+        q &= 0xFF
+        if q & 0x80:
+            q ^= 0x09
+        x = q ^ ((q << 1 | q >> 7) & 0xFF) ^ ((q << 2 | q >> 6) & 0xFF) ^ ((q << 3 | q >> 5) & 0xFF) ^ ((q << 4 | q >> 4) & 0xFF)
+        box[p] = x ^ 0x63
+        if p == 1:
+            break
+    box[0] = 0x63
+    return box
+
+
+SBOX = _sbox()
+
+
+def _xtime(x):
+    return ((x << 1) ^ (0x1B if x & 0x80 else 0)) & 0xFF
+
+
+def expand_key(key):
+    rk = list(key)
+    rcon = 1
+    while len(rk) < 176:
+        t = rk[-4:]
+        if len(rk) % 16 == 0:
+            t = [SBOX[t[1]] ^ rcon, SBOX[t[2]], SBOX[t[3]], SBOX[t[0]]]
+            rcon = _xtime(rcon)
+        rk += [a ^ b for a, b in zip(rk[-16:-12], t)]
+    return rk
+
+
+def encrypt_block(rk, block):
+    s = [b ^ k for b, k in zip(block, rk[:16])]
+    for rnd in range(1, 11):
+        t = [SBOX[s[(i + 4 * (i % 4)) % 16]] for i in range(16)]
+        if rnd != 10:
+            for c in range(0, 16, 4):
+                a = t[c:c + 4]
+                x = a[0] ^ a[1] ^ a[2] ^ a[3]
+                t[c:c + 4] = [a[i] ^ x ^ _xtime(a[i] ^ a[(i + 1) % 4]) for i in range(4)]
+        s = [b ^ k for b, k in zip(t, rk[16 * rnd:16 * rnd + 16])]
+    return bytes(s)
+
+
+def ctr(key, iv, data):
+    rk = expand_key(key)
+    counter = int.from_bytes(iv, "big")
+    out = bytearray()
+    for i in range(0, len(data), BLOCK_SIZE):
+        stream = encrypt_block(rk, ((counter + i // BLOCK_SIZE) % (1 << 128)).to_bytes(BLOCK_SIZE, "big"))
+        out += bytes(a ^ b for a, b in zip(data[i:i + BLOCK_SIZE], stream))
+    return bytes(out)
+
+
+def load_key(path):
+    with open(path) as f:
+        key = bytes.fromhex(f.read().strip())
+    if len(key) != KEY_SIZE:
+        raise ValueError("%s: invalid key" % path)
+    return key
+
+
+def pack(key, data):
+    """Return the encrypted image sub-element payload : IV + ciphertext."""
+    iv = os.urandom(BLOCK_SIZE)
+    return iv + ctr(key, iv, data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("command", choices=("genkey", "key"))
+    parser.add_argument("key", help="key file (hexadecimal)")
+    args = parser.parse_args()
+
+    if args.command == "genkey":
+        if os.path.exists(args.key):
+            sys.exit("%s already exists" % args.key)
+        with open(args.key, "w") as f:
+            f.write(os.urandom(KEY_SIZE).hex() + "\n")
+    print("  " + ", ".join("0x%02X" % b for b in load_key(args.key)) + ",")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Delta patch generator for Zigbee OTA upgrade images.
+
+The patch format matches the applier in STM32_WPAN/App/app_ota_delta.c.
+The payload stored in the OTA sub-element (tag 0xF001) is:
+
+  * source size, source CRC, target size (3 x uint32, little endian)
+  * a list of operations:
+    0x01 COPY   : source offset (uint32) + length (uint16), from the installed image
+    0x02 INSERT : length (uint16) followed by the new bytes
+
+The CRC is the XOR of the 32 bit little endian words of the image, the last
+incomplete word being padded with 0, as computed by the client.
+"""
+import argparse
+import struct
+
+OP_COPY = 0x01
+OP_INSERT = 0x02
+MAX_LENGTH = 0xFFFF
+BLOCK = 8           # minimum match length worth a COPY (7 bytes of operation)
+MAX_CANDIDATES = 16
+
+
+def crc(data):
+    data = bytes(data) + b"\0" * (-len(data) % 4)
+    value = 0
+    for (word,) in struct.iter_unpack("<I", data):
+        value ^= word
+    return value
+
+
+def diff(source, target):
+    """Return the list of operations rebuilding target from source."""
+    index = {}
+    for pos in range(0, len(source) - BLOCK + 1):
+        positions = index.setdefault(source[pos:pos + BLOCK], [])
+        if len(positions) < MAX_CANDIDATES:
+            positions.append(pos)
+
+    ops = []
+    literal = bytearray()
+    pos = 0
+    last_src = None
+    while pos < len(target):
+        best_len, best_src = 0, 0
+        candidates = list(index.get(target[pos:pos + BLOCK], ()))
+        if last_src is not None:
+            candidates.insert(0, last_src)
+        for src in candidates:
+            length = 0
+            limit = min(MAX_LENGTH, len(source) - src, len(target) - pos)
+            while length < limit and source[src + length] == target[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_src = length, src
+        if best_len >= BLOCK:
+            if literal:
+                ops.append((OP_INSERT, bytes(literal)))
+                literal = bytearray()
+            ops.append((OP_COPY, best_src, best_len))
+            pos += best_len
+            last_src = best_src + best_len
+        else:
+            literal.append(target[pos])
+            pos += 1
+            if last_src is not None:
+                last_src += 1
+            if len(literal) == MAX_LENGTH:
+                ops.append((OP_INSERT, bytes(literal)))
+                literal = bytearray()
+    if literal:
+        ops.append((OP_INSERT, bytes(literal)))
+    return ops
+
+
+def apply(source, patch):
+    """Reference applier, used to self check the generated patch."""
+    source_size, source_crc, target_size = struct.unpack_from("<III", patch)
+    if source_size != len(source) or source_crc != crc(source):
+        raise ValueError("patch does not apply to this source")
+    out = bytearray()
+    pos = 12
+    while pos < len(patch):
+        op = patch[pos]
+        if op == OP_COPY:
+            src, length = struct.unpack_from("<IH", patch, pos + 1)
+            out += source[src:src + length]
+            pos += 7
+        else:
+            (length,) = struct.unpack_from("<H", patch, pos + 1)
+            out += patch[pos + 3:pos + 3 + length]
+            pos += 3 + length
+    if len(out) != target_size:
+        raise ValueError("bad target size")
+    return bytes(out)
+
+
+def pack(source, target):
+    """Return the OTA sub-element payload rebuilding target from source."""
+    out = bytearray(struct.pack("<III", len(source), crc(source), len(target)))
+    for op in diff(source, target):
+        if op[0] == OP_COPY:
+            out += struct.pack("<BIH", OP_COPY, op[1], op[2])
+        else:
+            out += struct.pack("<BH", OP_INSERT, len(op[1])) + op[1]
+    if apply(source, out) != target:
+        raise RuntimeError("delta self check failed")
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", help="application binary installed in slot A of the devices")
+    parser.add_argument("target", help="new application binary")
+    parser.add_argument("output", help="delta sub-element payload")
+    args = parser.parse_args()
+
+    with open(args.source, "rb") as f:
+        source = f.read()
+    with open(args.target, "rb") as f:
+        target = f.read()
+    payload = pack(source, target)
+    with open(args.output, "wb") as f:
+        f.write(payload)
+    print("%s: %d -> %d bytes (%.1f %%)" % (args.target, len(target), len(payload),
+                                           100.0 * len(payload) / max(len(target), 1)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Build a Zigbee OTA upgrade file for the Zigbee_OTA_Client_Router example.
+
+The file follows the Zigbee OTA file format (header + tagged sub-elements).
+The firmware binary is stored either as a standard upgrade image sub-element
+(tag 0x0000), LZSS compressed in the manufacturer specific sub-element 0xF000
+(--lzss) or as a patch against the image installed in the application area
+(slot A) of the devices in the sub-element 0xF001 (--delta), which is not the
+running one after a bundle or an A/B slots swap. The client expands both on
+the fly.
+With --encrypt, the binary is AES-128 CTR encrypted in the sub-element 0xF003
+(see ota_aes.py) and decrypted by the client as it is received.
+With --sign, the ECDSA P-256 signature of the binary and of the header
+manufacturer code, image type and file version is appended in the
+sub-element 0xF002 (see ota_sign.py).
+With --manifest, a signed manifest (target, size, SHA-256 of the binary,
+hardware versions) is put in front of the image in the sub-element 0xF004 :
+the client checks it before erasing its download area.
+"""
+import argparse
+import hashlib
+import struct
+
+import ota_aes
+import ota_delta
+import ota_lzss
+import ota_sign
+
+OTA_FILE_IDENTIFIER = 0x0BEEF11E
+OTA_HEADER_VERSION = 0x0100
+OTA_HEADER_LENGTH = 56
+OTA_ZIGBEE_STACK_PRO = 0x0002
+
+TAG_UPGRADE_IMAGE = 0x0000
+TAG_IMAGE_INTEGRITY_CODE = 0x0003
+TAG_LZSS_IMAGE = 0xF000
+TAG_DELTA_IMAGE = 0xF001
+TAG_SIGNATURE = 0xF002
+TAG_ENCRYPTED_IMAGE = 0xF003
+TAG_MANIFEST = 0xF004
+
+MANIFEST_MAGIC = 0x4D41544F
+MANIFEST_VERSION = 1
+
+ST_ZIGBEE_MANUFACTURER_CODE = 0x1041
+
+
+def sub_element(tag, payload):
+    return struct.pack("<HI", tag, len(payload)) + payload
+
+
+def manifest(key, data, image_type, file_version, hw_min, hw_max):
+    body = struct.pack("<IHHIHHI32s", MANIFEST_MAGIC, MANIFEST_VERSION, image_type, file_version,
+                       hw_min, hw_max, len(data), hashlib.sha256(data).digest())
+    return body + ota_sign.sign(key, body)
+
+
+def build(elements, manufacturer, image_type, file_version, header_string=b""):
+    body = b"".join(elements)
+    header = struct.pack("<IHHHHHIH32sI",
+                         OTA_FILE_IDENTIFIER, OTA_HEADER_VERSION, OTA_HEADER_LENGTH,
+                         0x0000, manufacturer, image_type, file_version,
+                         OTA_ZIGBEE_STACK_PRO, header_string[:32].ljust(32, b"\0"),
+                         OTA_HEADER_LENGTH + len(body))
+    return header + body
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="firmware binary")
+    parser.add_argument("output", help="Zigbee OTA file")
+    parser.add_argument("--image-type", type=lambda v: int(v, 0), default=0x0002,
+                        help="1 = M0 wireless stack, 2 = M4 application (default)")
+    parser.add_argument("--file-version", type=lambda v: int(v, 0), required=True)
+    parser.add_argument("--manufacturer", type=lambda v: int(v, 0), default=ST_ZIGBEE_MANUFACTURER_CODE)
+    encoding = parser.add_mutually_exclusive_group()
+    encoding.add_argument("--lzss", action="store_true", help="store the image LZSS compressed (tag 0xF000)")
+    encoding.add_argument("--delta", metavar="SOURCE", help="store a patch against the SOURCE binary (tag 0xF001)")
+    encoding.add_argument("--encrypt", metavar="KEY", help="store the image encrypted with the KEY file (tag 0xF003)")
+    parser.add_argument("--crc", action="store_true", help="append the image CRC checked by the client (tag 0x0003)")
+    parser.add_argument("--sign", metavar="KEY", help="append the image signature with the KEY private key (tag 0xF002)")
+    parser.add_argument("--manifest", metavar="KEY", help="prepend a manifest signed with the KEY private key (tag 0xF004)")
+    parser.add_argument("--hw-min", type=lambda v: int(v, 0), default=0x0000, help="lowest hardware version in the manifest")
+    parser.add_argument("--hw-max", type=lambda v: int(v, 0), default=0xFFFF, help="highest hardware version in the manifest")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    if args.lzss:
+        elements = [sub_element(TAG_LZSS_IMAGE, ota_lzss.pack(data))]
+    elif args.delta:
+        with open(args.delta, "rb") as f:
+            elements = [sub_element(TAG_DELTA_IMAGE, ota_delta.pack(f.read(), data))]
+    elif args.encrypt:
+        elements = [sub_element(TAG_ENCRYPTED_IMAGE, ota_aes.pack(ota_aes.load_key(args.encrypt), data))]
+    else:
+        elements = [sub_element(TAG_UPGRADE_IMAGE, data)]
+    # The manifest must come first : the client checks it before erasing its download area
+    if args.manifest:
+        elements.insert(0, sub_element(TAG_MANIFEST, manifest(ota_sign.load_key(args.manifest), data, args.image_type,
+                                                              args.file_version, args.hw_min, args.hw_max)))
+    if args.crc:
+        elements.append(sub_element(TAG_IMAGE_INTEGRITY_CODE, struct.pack("<I", ota_delta.crc(data))))
+    if args.sign:
+        elements.append(sub_element(TAG_SIGNATURE, ota_sign.sign_image(ota_sign.load_key(args.sign), args.manufacturer,
+                                                                       args.image_type, args.file_version, data)))
+    ota = build(elements, args.manufacturer, args.image_type, args.file_version,
+                b"ST " + args.input.encode()[-29:])
+    with open(args.output, "wb") as f:
+        f.write(ota)
+    print("%s: %d bytes" % (args.output, len(ota)))
+
+
+if __name__ == "__main__":
+    main()
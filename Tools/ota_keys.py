@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Generate the OTA keys header of the Zigbee_OTA_Client_Router example.
+
+The firmware reads the public key checking the image signatures and the key
+of the encrypted images from STM32_WPAN/App/app_ota_keys.h, which is not part
+of the sources : run this script once before the first build.
+
+  ota_keys.py SIGN_KEY AES_KEY HEADER
+
+The private signing key and the AES key files are created when they do not
+exist (see ota_sign.py and ota_aes.py). Keep them out of version control, they
+are needed to build the OTA files (ota_file.py --sign / --manifest / --encrypt).
+"""
+import argparse
+import os
+
+import ota_aes
+import ota_sign
+
+HEADER = """/* Generated by Tools/ota_keys.py, do not commit */
+#ifndef APP_OTA_KEYS_H
+#define APP_OTA_KEYS_H
+
+/* Public key (X || Y) of the image signer, private key %(sign)s */
+#define OTA_KEYS_SIGNATURE_PUBLIC_KEY {\\
+%(public)s\\
+}
+
+/* Key of the encrypted images, %(aes)s */
+#define OTA_KEYS_IMAGE_KEY {\\
+%(image)s\\
+}
+
+#endif /* APP_OTA_KEYS_H */
+"""
+
+
+def c_lines(data):
+    return "\\\n".join(line for line in ota_sign.c_array(data).splitlines())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("sign_key", help="private signing key file (hexadecimal), created if missing")
+    parser.add_argument("aes_key", help="AES key file (hexadecimal), created if missing")
+    parser.add_argument("header", help="header to write, STM32_WPAN/App/app_ota_keys.h")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.sign_key):
+        with open(args.sign_key, "w") as f:
+            f.write("%064x\n" % (int.from_bytes(os.urandom(32), "big") % (ota_sign.N - 1) + 1))
+    if not os.path.exists(args.aes_key):
+        with open(args.aes_key, "w") as f:
+            f.write(os.urandom(ota_aes.KEY_SIZE).hex() + "\n")
+
+    with open(args.header, "w") as f:
+        f.write(HEADER % {
+            "sign": os.path.basename(args.sign_key),
+            "public": c_lines(ota_sign.public_key(ota_sign.load_key(args.sign_key))),
+            "aes": os.path.basename(args.aes_key),
+            "image": c_lines(ota_aes.load_key(args.aes_key)),
+        })
+
+
+if __name__ == "__main__":
+    main()
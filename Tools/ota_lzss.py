@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""LZSS compressor for Zigbee OTA upgrade images.
+
+The stream format matches the decoder in STM32_WPAN/App/app_ota_lzss.c:
+
+  * one flag byte announces the next 8 items, LSB first (1 = literal, 0 = match)
+  * a literal is one raw byte
+  * a match is a 16 bit little endian token:
+    bits 0..10 = distance - 1, bits 11..15 = length - MIN_MATCH
+
+The payload stored in the OTA sub-element (tag 0xF000) is the uncompressed
+size as a 32 bit little endian word followed by the stream.
+"""
+import argparse
+import struct
+
+WINDOW_BITS = 11
+LENGTH_BITS = 5
+WINDOW_SIZE = 1 << WINDOW_BITS
+MIN_MATCH = 3
+MAX_MATCH = MIN_MATCH + (1 << LENGTH_BITS) - 1
+MAX_CHAIN = 256
+
+
+def compress(data):
+    """Return the LZSS stream (without size prefix) for data."""
+    out = bytearray()
+    heads = {}
+    prev = [0] * len(data)
+    items = []
+    pos = 0
+
+    def insert(i):
+        if i + MIN_MATCH <= len(data):
+            key = data[i:i + MIN_MATCH]
+            prev[i] = heads.get(key, -1)
+            heads[key] = i
+
+    while pos < len(data):
+        best_len, best_dist = 0, 0
+        if pos + MIN_MATCH <= len(data):
+            cand = heads.get(data[pos:pos + MIN_MATCH], -1)
+            chain = 0
+            limit = min(MAX_MATCH, len(data) - pos)
+            while cand >= 0 and pos - cand <= WINDOW_SIZE and chain < MAX_CHAIN:
+                length = 0
+                while length < limit and data[cand + length] == data[pos + length]:
+                    length += 1
+                if length > best_len:
+                    best_len, best_dist = length, pos - cand
+                    if length == limit:
+                        break
+                cand = prev[cand]
+                chain += 1
+        if best_len >= MIN_MATCH:
+            items.append(struct.pack("<H", (best_dist - 1) | ((best_len - MIN_MATCH) << WINDOW_BITS)))
+            for i in range(pos, pos + best_len):
+                insert(i)
+            pos += best_len
+        else:
+            items.append(data[pos:pos + 1])
+            insert(pos)
+            pos += 1
+
+    for group in range(0, len(items), 8):
+        chunk = items[group:group + 8]
+        flags = 0
+        for bit, item in enumerate(chunk):
+            if len(item) == 1:
+                flags |= 1 << bit
+        out.append(flags)
+        for item in chunk:
+            out += item
+    return bytes(out)
+
+
+def decompress(stream, size):
+    """Reference decoder, used to self check the compressor output."""
+    out = bytearray()
+    pos = 0
+    while len(out) < size:
+        flags = stream[pos]
+        pos += 1
+        for bit in range(8):
+            if len(out) >= size:
+                break
+            if flags & (1 << bit):
+                out.append(stream[pos])
+                pos += 1
+            else:
+                token = stream[pos] | (stream[pos + 1] << 8)
+                pos += 2
+                dist = (token & (WINDOW_SIZE - 1)) + 1
+                for _ in range((token >> WINDOW_BITS) + MIN_MATCH):
+                    out.append(out[-dist])
+    return bytes(out)
+
+
+def pack(data):
+    """Return the OTA sub-element payload: size prefix + LZSS stream."""
+    stream = compress(data)
+    if decompress(stream, len(data)) != data:
+        raise RuntimeError("LZSS self check failed")
+    return struct.pack("<I", len(data)) + stream
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="raw firmware binary")
+    parser.add_argument("output", help="compressed sub-element payload")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    payload = pack(data)
+    with open(args.output, "wb") as f:
+        f.write(payload)
+    print("%s: %d -> %d bytes (%.1f %%)" % (args.input, len(data), len(payload),
+                                           100.0 * len(payload) / max(len(data), 1)))
+
+
+if __name__ == "__main__":
+    main()
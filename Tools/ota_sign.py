@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""ECDSA P-256 signing of OTA images for the Zigbee_OTA_Client_Router example.
+
+The client hashes the firmware as it is written to flash (SHA-256 of the
+binary, after LZSS or delta decoding) and checks the signature carried in
+the manufacturer specific sub-element 0xF002 against its public key. The
+signed message is the manufacturer code, image type and file version of the
+OTA header followed by that digest (sign_image), so that a signed image can
+not be offered again under another file version.
+Signatures are deterministic (RFC 6979) so no random source is needed.
+
+  ota_sign.py genkey KEY      create a private key file and print the public
+                              key
+  ota_sign.py pubkey KEY      print the public key of an existing key file
+
+The firmware keys header is written by ota_keys.py.
+"""
+import argparse
+import hashlib
+import hmac
+import os
+import struct
+import sys
+
+P = 0xFFFFFFFF00000001000000000000000000000000FFFFFFFFFFFFFFFFFFFFFFFF
+N = 0xFFFFFFFF00000000FFFFFFFFFFFFFFFFBCE6FAADA7179E84F3B9CAC2FC632551
+A = P - 3
+G = (0x6B17D1F2E12C4247F8BCE6E563A440F277037D812DEB33A0F4A13945D898C296,
+     0x4FE342E2FE1A7F9B8EE7EB4A7C0F9E162BCE33576B315ECECBB6406837BF51F5)
+
+SIGNATURE_SIZE = 64
+
+
+def _add(p1, p2):
+    if p1 is None:
+        return p2
+    if p2 is None:
+        return p1
+    if p1[0] == p2[0]:
+        if (p1[1] + p2[1]) % P == 0:
+            return None
+        lam = (3 * p1[0] * p1[0] + A) * pow(2 * p1[1], -1, P) % P
+    else:
+        lam = (p2[1] - p1[1]) * pow(p2[0] - p1[0], -1, P) % P
+    x = (lam * lam - p1[0] - p2[0]) % P
+    return x, (lam * (p1[0] - x) - p1[1]) % P
+
+
+def _mul(k, point):
+    result = None
+    while k:
+        if k & 1:
+            result = _add(result, point)
+        point = _add(point, point)
+        k >>= 1
+    return result
+
+
+def _rfc6979_k(key, digest):
+    x = key.to_bytes(32, "big")
+    h = (int.from_bytes(digest, "big") % N).to_bytes(32, "big")
+    v = b"\x01" * 32
+    k = b"\x00" * 32
+    k = hmac.new(k, v + b"\x00" + x + h, hashlib.sha256).digest()
+    v = hmac.new(k, v, hashlib.sha256).digest()
+    k = hmac.new(k, v + b"\x01" + x + h, hashlib.sha256).digest()
+    v = hmac.new(k, v, hashlib.sha256).digest()
+    while True:
+        v = hmac.new(k, v, hashlib.sha256).digest()
+        candidate = int.from_bytes(v, "big")
+        if 1 <= candidate < N:
+            yield candidate
+        k = hmac.new(k, v + b"\x00", hashlib.sha256).digest()
+        v = hmac.new(k, v, hashlib.sha256).digest()
+
+
+def load_key(path):
+    with open(path) as f:
+        key = int(f.read().strip(), 16)
+    if not 1 <= key < N:
+        raise ValueError("%s: invalid private key" % path)
+    return key
+
+
+def public_key(key):
+    x, y = _mul(key, G)
+    return x.to_bytes(32, "big") + y.to_bytes(32, "big")
+
+
+def sign(key, data):
+    """Return r || s (64 bytes, big endian) for the SHA-256 digest of data."""
+    digest = hashlib.sha256(data).digest()
+    e = int.from_bytes(digest, "big") % N
+    for k in _rfc6979_k(key, digest):
+        r = _mul(k, G)[0] % N
+        s = pow(k, -1, N) * (e + r * key) % N
+        if r and s:
+            return r.to_bytes(32, "big") + s.to_bytes(32, "big")
+
+
+def sign_image(key, manufacturer, image_type, file_version, data):
+    """Return the signature of the image data offered with these OTA header fields."""
+    return sign(key, struct.pack("<HHI", manufacturer, image_type, file_version) + hashlib.sha256(data).digest())
+
+
+def c_array(data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append("  " + ", ".join("0x%02X" % b for b in data[i:i + 16]) + ",")
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("command", choices=("genkey", "pubkey"))
+    parser.add_argument("key", help="private key file (hexadecimal)")
+    args = parser.parse_args()
+
+    if args.command == "genkey":
+        if os.path.exists(args.key):
+            sys.exit("%s already exists" % args.key)
+        key = int.from_bytes(os.urandom(32), "big") % (N - 1) + 1
+        with open(args.key, "w") as f:
+            f.write("%064x\n" % key)
+    print(c_array(public_key(load_key(args.key))))
+
+
+if __name__ == "__main__":
+    main()